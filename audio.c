@@ -108,6 +108,10 @@ static struct sound_params req_sound_params = { 0, 0, 0 };
 static struct audio_conversion sound_conv;
 static int need_audio_conversion = 0;
 
+/* Parameters the device is kept open with if FixedOutput is set, chosen
+ * when the device is opened for the first time. */
+static struct sound_params fixed_sound_params = { 0, 0, 0 };
+
 /* URL of the last played stream. Used to fake pause/unpause of internet
  * streams. Protected by curr_playing_mtx. */
 static char *last_stream_url = NULL;
@@ -258,6 +262,47 @@ static long sfmt_best_matching (const long formats_with_endian,
 	return best;
 }
 
+/* Choose the format out of formats (SFMT_* bits) which is also in
+ * accepted, the most precise one if there are more.  If there is no such
+ * format, choose the most precise one of formats.  The result has native
+ * endianness. */
+long sfmt_preferred (const long formats, const long accepted)
+{
+	/* Most precise first. */
+	static const long by_precision[] = {
+		SFMT_S32, SFMT_U32, SFMT_FLOAT, SFMT_S16, SFMT_U16,
+		SFMT_S8, SFMT_U8
+	};
+	size_t ix;
+
+	assert (formats & SFMT_MASK_FORMAT);
+
+	for (ix = 0; ix < ARRAY_SIZE(by_precision); ix += 1) {
+		if (formats & accepted & by_precision[ix])
+			return by_precision[ix] | SFMT_NE;
+	}
+
+	for (ix = 0; ix < ARRAY_SIZE(by_precision); ix += 1) {
+		if (formats & by_precision[ix])
+			return by_precision[ix] | SFMT_NE;
+	}
+
+	return 0;
+}
+
+/* Get the sample formats (SFMT_* bits) in which the sound needs no extra
+ * conversion: those the device plays and float if the sound is going to
+ * be resampled, which is done on floats. */
+long audio_get_formats ()
+{
+	long formats = hw_caps.formats & SFMT_MASK_FORMAT;
+
+	if (options_get_int ("ForceSampleRate"))
+		formats |= SFMT_FLOAT;
+
+	return formats;
+}
+
 /* Return the number of bytes per sample for the given format. */
 int sfmt_Bps (const long format)
 {
@@ -666,12 +711,99 @@ static void reset_sound_params (struct sound_params *params)
 	params->fmt = 0;
 }
 
+/* Set up the conversion from req_sound_params to driver_sound_params
+ * replacing the previous one.  Return 0 on error. */
+static int setup_conversion ()
+{
+	char fmt_name[SFMT_STR_MAX] LOGIT_ONLY;
+
+	if (need_audio_conversion) {
+		audio_conv_destroy (&sound_conv);
+		need_audio_conversion = 0;
+	}
+
+	if (driver_sound_params.fmt != req_sound_params.fmt
+			|| driver_sound_params.channels
+			!= req_sound_params.channels
+			|| (!sample_rate_compat(
+					req_sound_params.rate,
+					driver_sound_params.rate))) {
+		logit ("Conversion of the sound is needed.");
+		if (!audio_conv_new (&sound_conv, &req_sound_params,
+				&driver_sound_params))
+			return 0;
+		need_audio_conversion = 1;
+	}
+
+	logit ("Requested sound parameters: %s, %d channels, %dHz",
+			sfmt_str(req_sound_params.fmt, fmt_name, sizeof(fmt_name)),
+			req_sound_params.channels,
+			req_sound_params.rate);
+	logit ("Driver sound parameters: %s, %d channels, %dHz",
+			sfmt_str(driver_sound_params.fmt, fmt_name, sizeof(fmt_name)),
+			driver_sound_params.channels,
+			driver_sound_params.rate);
+
+	return 1;
+}
+
+/* Choose the parameters the device is kept open with if FixedOutput is
+ * set: the most precise format and stereo if the device supports them,
+ * ForceSampleRate or the rate of the first file. */
+static void choose_fixed_sound_params ()
+{
+	long fmt = sfmt_preferred (hw_caps.formats, hw_caps.formats);
+
+	fixed_sound_params.fmt = sfmt_best_matching (hw_caps.formats, fmt);
+	fixed_sound_params.channels = CLAMP(hw_caps.min_channels, 2,
+	                                    hw_caps.max_channels);
+	if (options_get_int("ForceSampleRate"))
+		fixed_sound_params.rate = options_get_int("ForceSampleRate");
+	else
+		fixed_sound_params.rate = req_sound_params.rate;
+}
+
+/* Return the parameters to open the device with for sound of the given
+ * parameters if FixedOutput is set.  The conversion can only make stereo
+ * of mono, so other sound with a different number of channels from the
+ * fixed parameters is played with its own number. */
+static struct sound_params fixed_driver_params (
+		const struct sound_params *params)
+{
+	struct sound_params driver = fixed_sound_params;
+
+	if (params->channels != driver.channels
+			&& !(params->channels == 1 && driver.channels == 2))
+		driver.channels = CLAMP(hw_caps.min_channels,
+		                        params->channels,
+		                        hw_caps.max_channels);
+
+	return driver;
+}
+
+/* Return 1 if audio_open() would play sound of the given parameters
+ * without reopening the device, 0 otherwise. */
+int audio_open_reuses_device (const struct sound_params *sound_params)
+{
+	if (!audio_opened)
+		return 0;
+
+	if (sound_params_eq(req_sound_params, *sound_params))
+		return options_get_bool ("FixedOutput")
+			|| audio_get_bps() >= 88200;
+
+	return options_get_bool ("FixedOutput")
+		&& fixed_driver_params (sound_params).channels
+		== driver_sound_params.channels;
+}
+
 /* Return 0 on error. If sound params == NULL, open the device using
  * the previous parameters. */
 int audio_open (struct sound_params *sound_params)
 {
 	int res;
 	static struct sound_params last_params = { 0, 0, 0 };
+	bool fixed_output = options_get_bool ("FixedOutput");
 
 	if (!sound_params)
 		sound_params = &last_params;
@@ -682,7 +814,7 @@ int audio_open (struct sound_params *sound_params)
 
 	if (audio_opened) {
 		if (sound_params_eq(req_sound_params, *sound_params)) {
-			if (audio_get_bps() >= 88200) {
+			if (fixed_output || audio_get_bps() >= 88200) {
 				logit ("Audio device already opened with such parameters.");
 				return 1;
 			}
@@ -692,6 +824,17 @@ int audio_open (struct sound_params *sound_params)
 			 * and the user will hear old data, so close it. */
 			logit ("Reopening device due to low bps.");
 		}
+		else if (audio_open_reuses_device (sound_params)) {
+
+			/* The device plays the same format, only the
+			 * conversion to it changes. */
+			req_sound_params = *sound_params;
+			if (!setup_conversion ()) {
+				audio_close ();
+				return 0;
+			}
+			return 1;
+		}
 
 		audio_close ();
 	}
@@ -701,53 +844,47 @@ int audio_open (struct sound_params *sound_params)
 	/* Set driver_sound_params to parameters supported by the driver that
 	 * are nearly the requested parameters. */
 
-	if (options_get_int("ForceSampleRate")) {
-		driver_sound_params.rate = options_get_int("ForceSampleRate");
-		logit ("Setting forced driver sample rate to %dHz",
-				driver_sound_params.rate);
+	if (fixed_output) {
+		if (!fixed_sound_params.rate)
+			choose_fixed_sound_params ();
+		driver_sound_params = fixed_driver_params (&req_sound_params);
+		if (driver_sound_params.channels != fixed_sound_params.channels)
+			logit ("Can't convert %d channels to %d, using fixed "
+			       "driver sound parameters with %d channels",
+			       req_sound_params.channels,
+			       fixed_sound_params.channels,
+			       driver_sound_params.channels);
+		else
+			logit ("Using fixed driver sound parameters");
 	}
-	else
-		driver_sound_params.rate = req_sound_params.rate;
+	else {
+		if (options_get_int("ForceSampleRate")) {
+			driver_sound_params.rate = options_get_int("ForceSampleRate");
+			logit ("Setting forced driver sample rate to %dHz",
+					driver_sound_params.rate);
+		}
+		else
+			driver_sound_params.rate = req_sound_params.rate;
 
-	driver_sound_params.fmt = sfmt_best_matching (hw_caps.formats,
-			req_sound_params.fmt);
+		driver_sound_params.fmt = sfmt_best_matching (hw_caps.formats,
+				req_sound_params.fmt);
 
-	/* number of channels */
-	driver_sound_params.channels = CLAMP(hw_caps.min_channels,
-	                                     req_sound_params.channels,
-	                                     hw_caps.max_channels);
+		/* number of channels */
+		driver_sound_params.channels = CLAMP(hw_caps.min_channels,
+		                                     req_sound_params.channels,
+		                                     hw_caps.max_channels);
+	}
 
 	res = hw.open (&driver_sound_params);
 
 	if (res) {
-		char fmt_name[SFMT_STR_MAX] LOGIT_ONLY;
-
 		driver_sound_params.rate = hw.get_rate ();
-		if (driver_sound_params.fmt != req_sound_params.fmt
-				|| driver_sound_params.channels
-				!= req_sound_params.channels
-				|| (!sample_rate_compat(
-						req_sound_params.rate,
-						driver_sound_params.rate))) {
-			logit ("Conversion of the sound is needed.");
-			if (!audio_conv_new (&sound_conv, &req_sound_params,
-					&driver_sound_params)) {
-				hw.close ();
-				reset_sound_params (&req_sound_params);
-				return 0;
-			}
-			need_audio_conversion = 1;
+		if (!setup_conversion ()) {
+			hw.close ();
+			reset_sound_params (&req_sound_params);
+			return 0;
 		}
 		audio_opened = 1;
-
-		logit ("Requested sound parameters: %s, %d channels, %dHz",
-				sfmt_str(req_sound_params.fmt, fmt_name, sizeof(fmt_name)),
-				req_sound_params.channels,
-				req_sound_params.rate);
-		logit ("Driver sound parameters: %s, %d channels, %dHz",
-				sfmt_str(driver_sound_params.fmt, fmt_name, sizeof(fmt_name)),
-				driver_sound_params.channels,
-				driver_sound_params.rate);
 	}
 
 	return res;
@@ -219,6 +219,7 @@ struct hw_funcs
 char *sfmt_str (const long format, char *msg, const size_t buf_size);
 int sfmt_Bps (const long format);
 int sfmt_same_bps (const long fmt1, const long fmt2);
+long sfmt_preferred (const long formats, const long accepted);
 
 void audio_stop ();
 void audio_play (const char *fname);
@@ -232,11 +233,13 @@ void audio_seek (const int sec);
 void audio_jump_to (const int sec);
 
 int audio_open (struct sound_params *sound_params);
+int audio_open_reuses_device (const struct sound_params *sound_params);
 int audio_send_buf (const char *buf, const size_t size);
 int audio_send_pcm (const char *buf, const size_t size);
 void audio_reset ();
 int audio_get_bpf ();
 int audio_get_bps ();
+long audio_get_formats ();
 int audio_get_buf_fill ();
 void audio_close ();
 int audio_get_time ();
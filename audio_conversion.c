@@ -439,6 +439,34 @@ static void swap_endian (char *buf, const size_t size, const long fmt)
 	}
 }
 
+/* Should the built-in resampler be used rather than libsamplerate? */
+static bool use_builtin_resampler ()
+{
+#ifdef HAVE_SAMPLERATE
+	return !strncasecmp (options_get_symb ("ResampleMethod"),
+			"Polyphase", 9);
+#else
+	return true;
+#endif
+}
+
+/* Quality of the built-in resampler for the ResampleMethod option.  The
+ * libsamplerate methods are mapped to the nearest tier if there is no
+ * libsamplerate. */
+static enum resample_quality builtin_resample_quality ()
+{
+	char *method = options_get_symb ("ResampleMethod");
+
+	if (!strcasecmp(method, "PolyphaseBest")
+			|| !strcasecmp(method, "SincBestQuality"))
+		return RESAMPLE_BEST;
+	if (!strcasecmp(method, "PolyphaseMedium")
+			|| !strcasecmp(method, "SincMediumQuality"))
+		return RESAMPLE_MEDIUM;
+
+	return RESAMPLE_FAST;
+}
+
 /* Initialize the audio_conversion structure for conversion between parameters
  * from and to. Return 0 on error. */
 int audio_conv_new (struct audio_conversion *conv,
@@ -458,13 +486,38 @@ int audio_conv_new (struct audio_conversion *conv,
 		}
 	}
 
-	if (from->rate != to->rate) {
+	conv->resampler = NULL;
+	conv->resampled = NULL;
+	conv->resampled_size = 0;
+#ifdef HAVE_SAMPLERATE
+	conv->src_state = NULL;
+#endif
+
+	if (from->rate != to->rate && use_builtin_resampler ()) {
+		conv->resampler = resampler_new (from->rate, to->rate,
+				from->channels, builtin_resample_quality ());
+		if (!conv->resampler) {
+#ifdef HAVE_SAMPLERATE
+			logit ("Ratio %d/%d too complex for the built-in "
+					"resampler, using libsamplerate",
+					to->rate, from->rate);
+#else
+			error ("Can't resample from %dHz to %dHz!",
+					from->rate, to->rate);
+			return 0;
+#endif
+		}
+	}
+
+	if (from->rate != to->rate && !conv->resampler) {
 #ifdef HAVE_SAMPLERATE
 		int err;
 		int resample_type = -1;
 		char *method = options_get_symb ("ResampleMethod");
 
-		if (!strcasecmp(method, "SincBestQuality"))
+		if (!strncasecmp(method, "Polyphase", 9))
+			resample_type = SRC_SINC_MEDIUM_QUALITY;
+		else if (!strcasecmp(method, "SincBestQuality"))
 			resample_type = SRC_SINC_BEST_QUALITY;
 		else if (!strcasecmp(method, "SincMediumQuality"))
 			resample_type = SRC_SINC_MEDIUM_QUALITY;
@@ -483,15 +536,8 @@ int audio_conv_new (struct audio_conversion *conv,
 					from->rate, to->rate, src_strerror (err));
 			return 0;
 		}
-#else
-		error ("Resampling not supported!");
-		return 0;
 #endif
 	}
-#ifdef HAVE_SAMPLERATE
-	else
-		conv->src_state = NULL;
-#endif
 
 	conv->from = *from;
 	conv->to = *to;
@@ -582,6 +628,38 @@ static float *resample_sound (struct audio_conversion *conv, const float *buf,
 }
 #endif
 
+/* Resample with the built-in resampler, which keeps its own state.  The
+ * output goes to conv->resampled, which grows as needed. */
+static float *resample_builtin (struct audio_conversion *conv,
+		const float *buf, const size_t samples,
+		size_t *resampled_samples)
+{
+	int channels = conv->from.channels;
+	size_t needed;
+
+	needed = channels * resampler_max_output (conv->resampler,
+			samples / channels);
+	if (conv->resampled_size < needed) {
+		conv->resampled = (float *)xrealloc (conv->resampled,
+				sizeof(float) * needed);
+		conv->resampled_size = needed;
+	}
+
+	*resampled_samples = resampler_process (conv->resampler, buf,
+			samples / channels, conv->resampled) * channels;
+
+	return conv->resampled;
+}
+
+/* Free the sound of a finished conversion step unless it's the input or
+ * the resampler's buffer. */
+static void free_step (struct audio_conversion *conv, const char *buf,
+		char *sound)
+{
+	if (sound != buf && sound != (char *)conv->resampled)
+		free (sound);
+}
+
 /* Double the channels from */
 static char *mono_to_stereo (const char *mono, const size_t size,
 		const long format)
@@ -663,8 +741,7 @@ char *audio_conv (struct audio_conversion *conv, const char *buf,
 			curr_sfmt = sfmt_set_fmt (curr_sfmt, SFMT_U16);
 		}
 
-		if (curr_sound != buf)
-			free (curr_sound);
+		free_step (conv, buf, curr_sound);
 		curr_sound = new_sound;
 		*conv_len /= 2;
 
@@ -682,20 +759,26 @@ char *audio_conv (struct audio_conversion *conv, const char *buf,
 				curr_sfmt, conv_len);
 		curr_sfmt = sfmt_set_fmt (curr_sfmt, SFMT_FLOAT);
 
-		if (curr_sound != buf)
-			free (curr_sound);
+		free_step (conv, buf, curr_sound);
 		curr_sound = new_sound;
 	}
 
+	if (conv->resampler) {
+		char *new_sound = (char *)resample_builtin (conv,
+				(float *)curr_sound,
+				*conv_len / sizeof(float), conv_len);
+		*conv_len *= sizeof(float);
+		free_step (conv, buf, curr_sound);
+		curr_sound = new_sound;
+	}
 #ifdef HAVE_SAMPLERATE
-	if (conv->from.rate != conv->to.rate) {
+	else if (conv->from.rate != conv->to.rate) {
 		char *new_sound = (char *)resample_sound (conv,
 				(float *)curr_sound,
 				*conv_len / sizeof(float), conv->to.channels,
 				conv_len);
 		*conv_len *= sizeof(float);
-		if (curr_sound != buf)
-			free (curr_sound);
+		free_step (conv, buf, curr_sound);
 		curr_sound = new_sound;
 	}
 #endif
@@ -715,8 +798,7 @@ char *audio_conv (struct audio_conversion *conv, const char *buf,
 					conv->to.fmt, conv_len);
 			curr_sfmt = sfmt_set_fmt (curr_sfmt, conv->to.fmt);
 
-			if (curr_sound != buf)
-				free (curr_sound);
+			free_step (conv, buf, curr_sound);
 			curr_sound = new_sound;
 		}
 	}
@@ -734,18 +816,26 @@ char *audio_conv (struct audio_conversion *conv, const char *buf,
 		new_sound = mono_to_stereo (curr_sound, *conv_len, curr_sfmt);
 		*conv_len *= 2;
 
-		if (curr_sound != buf)
-			free (curr_sound);
+		free_step (conv, buf, curr_sound);
 		curr_sound = new_sound;
 	}
 
+	/* The caller frees the result. */
+	if (curr_sound == (char *)conv->resampled) {
+		conv->resampled = NULL;
+		conv->resampled_size = 0;
+	}
+
 	return curr_sound;
 }
 
-void audio_conv_destroy (struct audio_conversion *conv ASSERT_ONLY)
+void audio_conv_destroy (struct audio_conversion *conv)
 {
 	assert (conv != NULL);
 
+	resampler_free (conv->resampler);
+	free (conv->resampled);
+
 #ifdef HAVE_SAMPLERATE
 	if (conv->resample_buf)
 		free (conv->resample_buf);
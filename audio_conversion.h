@@ -12,6 +12,7 @@
 #endif
 
 #include "audio.h"
+#include "resample.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -22,6 +23,11 @@ struct audio_conversion
 	struct sound_params from;
 	struct sound_params to;
 
+	struct resampler *resampler; /* built-in resampler or NULL */
+	float *resampled;	/* output of the resampler reused between
+				   calls */
+	size_t resampled_size;	/* in samples */
+
 #ifdef HAVE_SAMPLERATE
 	SRC_STATE *src_state;
 	float *resample_buf;
@@ -19,7 +19,13 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <limits.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <ltdl.h>
 
 #include "common.h"
@@ -29,16 +35,39 @@
 #include "io.h"
 #include "options.h"
 
+/* Flags of a plugin remembered in the manifest. */
+#define PLUGIN_MIME		0x01	/* has our_format_mime() */
+#define PLUGIN_CAN_DECODE	0x02	/* has can_decode() */
+#define PLUGIN_GET_NAME		0x04	/* has get_name() */
+#define PLUGIN_TREMOR		0x08	/* Vorbis decoder using Tremor */
+
 static struct plugin {
 	char *name;
+	char *file;		/* file name as listed by lt_dlforeachfile() */
 	lt_dlhandle handle;
-	struct decoder *decoder;
+	struct decoder *decoder; /* NULL if not loaded yet */
+	lists_t_strs *extns;	/* extensions from get_extns(), NULL if the
+				   decoder must be asked */
+	lists_t_strs *type_names; /* get_name() for each of extns, "-" for
+				     none, NULL if it has no get_name() */
+	struct decoder_magic *magic; /* copy of the decoder's signatures */
+	int magic_num;
+	int flags;
+	bool failed;		/* don't try to load it again */
 } plugins[16];
 
 #define PLUGINS_NUM			(ARRAY_SIZE(plugins))
 
 static int plugins_num = 0;
 
+/* Plugins are loaded on demand from any thread. */
+static pthread_mutex_t plugins_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* The manifest remembers which plugins there are and what they decode,
+ * so they don't have to be loaded at startup. */
+#define MANIFEST_FILE		"decoders"
+#define MANIFEST_HEADER		"MOC decoder manifest 2"
+
 static bool have_tremor = false;
 
 /* This structure holds the user's decoder preferences for audio formats. */
@@ -72,51 +101,184 @@ static char *clean_mime_subtype (char *subtype)
 	return subtype;
 }
 
-/* Find a preference entry matching the given filename extension and/or
- * MIME media type, or NULL. */
-static decoder_t_preference *lookup_preference (const char *extn,
-                                                const char *file,
+/* The dispatch table maps case-folded extensions and MIME types (as
+ * "type/subtype") to their decoders.  It is built by decoder_init() from the
+ * plugins' extension lists and PreferredDecoders and read only afterwards,
+ * so it needs no locking. */
+struct dispatch {
+	char *key;		/* NULL for a free slot */
+	unsigned int hash;
+	int decoder;		/* decoder for the extension or -1 */
+	decoder_t_preference *pref; /* preference for the key or NULL */
+	int rank;		/* position of pref in the preferences */
+	bool mime_first;	/* a MIME type preference precedes pref */
+};
+static struct dispatch *dispatch = NULL;
+static unsigned int dispatch_size = 0; /* power of 2 */
+static bool have_mime_prefs = false;
+
+/* Plugins which must be asked if they decode an extension. */
+static int callback_list[PLUGINS_NUM];
+static int callback_num = 0;
+
+/* Return the key's hash using the djb2 algorithm. */
+static unsigned int dispatch_hash (const char *key)
+{
+	unsigned int hash = 5381;
+
+	while (*key)
+		hash = ((hash << 5) + hash) + tolower (*(key++));
+	return hash;
+}
+
+/* Return the entry for the extension or MIME type, or NULL. */
+static struct dispatch *dispatch_find (const char *key)
+{
+	unsigned int h, i;
+
+	assert (key);
+
+	if (!dispatch)
+		return NULL;
+
+	h = dispatch_hash (key);
+	for (i = h & (dispatch_size - 1); dispatch[i].key;
+	     i = (i + 1) & (dispatch_size - 1)) {
+		if (dispatch[i].hash == h && !strcasecmp (dispatch[i].key, key))
+			return &dispatch[i];
+	}
+
+	return NULL;
+}
+
+/* Add the key to the dispatch table.  Return the new entry or NULL if the
+ * key is already there. */
+static struct dispatch *dispatch_add (const char *key)
+{
+	unsigned int h, i;
+
+	assert (key && key[0]);
+	assert (dispatch);
+
+	if (dispatch_find (key))
+		return NULL;
+
+	h = dispatch_hash (key);
+	for (i = h & (dispatch_size - 1); dispatch[i].key;
+	     i = (i + 1) & (dispatch_size - 1))
+		;
+
+	dispatch[i].key = xstrdup (key);
+	dispatch[i].hash = h;
+	dispatch[i].decoder = -1;
+	dispatch[i].pref = NULL;
+	dispatch[i].rank = -1;
+	dispatch[i].mime_first = false;
+
+	return &dispatch[i];
+}
+
+/* Find the dispatch entry of a MIME type preference matching the file's
+ * (or stream's) MIME type, or NULL.  The MIME type of the file is found if
+ * it's not known yet. */
+static struct dispatch *lookup_mime_preference (const char *file,
                                                 char **mime)
 {
-	char *type, *subtype;
-	decoder_t_preference *result;
+	char *type, *subtype, *key;
+	struct dispatch *result;
 
-	assert ((extn && extn[0]) || (file && file[0])
-	                          || (mime && *mime && *mime[0]));
+	if (mime && *mime == NULL && file && file[0]) {
+		if (options_get_bool ("UseMimeMagic"))
+			*mime = file_mime_type (file);
+	}
+	if (!mime || !*mime || !strchr (*mime, '/'))
+		return NULL;
 
-	type = NULL;
-	subtype = NULL;
-	for (result = preferences; result; result = result->next) {
-		if (!result->subtype) {
-			if (extn && !strcasecmp (result->type, extn))
-				break;
-		}
-		else {
+	type = xstrdup (*mime);
+	subtype = strchr (type, '/');
+	*subtype++ = 0x00;
+	if (!subtype[0]) {
+		free (type);
+		return NULL;
+	}
+	subtype = clean_mime_subtype (subtype);
 
-			if (!type) {
-				if (mime && *mime == NULL && file && file[0]) {
-					if (options_get_bool ("UseMimeMagic"))
-						*mime = file_mime_type (file);
-				}
-				if (mime && *mime && strchr (*mime, '/'))
-					type = xstrdup (*mime);
-				if (type) {
-					subtype = strchr (type, '/');
-					*subtype++ = 0x00;
-					subtype = clean_mime_subtype (subtype);
-				}
-			}
+	key = format_msg ("%s/%s", type, subtype);
+	result = dispatch_find (key);
+	free (key);
+	free (type);
 
-			if (type) {
-				if (!strcasecmp (result->type, type) &&
-			    	!strcasecmp (result->subtype, subtype))
-					break;
-			}
+	return result;
+}
 
+/* Open the plugin's library and get its decoder.  Return NULL on success
+ * or the error message. */
+static const char *open_plugin (struct plugin *p)
+{
+	const char *err = NULL;
+	struct decoder *decoder = NULL;
+	union {
+		void *data;
+		plugin_init_func *func;
+	} init;
+
+	p->handle = lt_dlopenext (p->file);
+	if (!p->handle)
+		return lt_dlerror ();
+
+	/* If this call to init.func() fails with memory access or illegal
+	 * instruction errors then read the commit log message for r2831. */
+	init.data = lt_dlsym (p->handle, "plugin_init");
+	if (!init.data)
+		err = "No init function in the plugin!";
+	else if (!(decoder = init.func ()))
+		err = "NULL decoder!";
+	else if (decoder->api_version != DECODER_API_VERSION)
+		err = "Plugin uses different API version";
+	else if (!decoder->decode && !decoder->decode_frames)
+		err = "No decode function in the plugin!";
+	else if (decoder->decode_frames && !decoder->set_format)
+		err = "Plugin has decode_frames() without set_format()";
+
+	if (err) {
+		if (lt_dlclose (p->handle))
+			logit ("Error unloading plugin: %s", lt_dlerror ());
+		p->handle = NULL;
+		return err;
+	}
+
+	p->decoder = decoder;
+	return NULL;
+}
+
+/* Return the plugin's decoder loading the plugin if it's not loaded yet.
+ * Return NULL if it can't be loaded. */
+static struct decoder *plugin_decoder (const int ix)
+{
+	struct plugin *p;
+	struct decoder *result;
+
+	assert (LIMIT(ix, plugins_num));
+
+	p = &plugins[ix];
+
+	LOCK (plugins_mtx);
+	if (!p->decoder && !p->failed) {
+		const char *err = open_plugin (p);
+
+		if (err) {
+			logit ("Can't load the %s decoder: %s", p->name, err);
+			p->failed = true;
+		}
+		else {
+			debug ("Loaded %s decoder", p->name);
+			if (p->decoder->init)
+				p->decoder->init ();
 		}
 	}
+	result = p->decoder;
+	UNLOCK (plugins_mtx);
 
-	free (type);
 	return result;
 }
 
@@ -131,8 +293,17 @@ static int find_extn_decoder (int *decoder_list, int count, const char *extn)
 	assert (extn && extn[0]);
 
 	for (ix = 0; ix < count; ix += 1) {
-		if (plugins[decoder_list[ix]].decoder->our_format_ext &&
-		    plugins[decoder_list[ix]].decoder->our_format_ext (extn))
+		struct plugin *p = &plugins[decoder_list[ix]];
+		struct decoder *d;
+
+		if (p->extns) {
+			if (lists_strs_exists (p->extns, extn))
+				return decoder_list[ix];
+			continue;
+		}
+
+		d = plugin_decoder (decoder_list[ix]);
+		if (d && d->our_format_ext && d->our_format_ext (extn))
 			return decoder_list[ix];
 	}
 
@@ -150,8 +321,13 @@ static int find_mime_decoder (int *decoder_list, int count, const char *mime)
 	assert (mime && mime[0]);
 
 	for (ix = 0; ix < count; ix += 1) {
-		if (plugins[decoder_list[ix]].decoder->our_format_mime &&
-		    plugins[decoder_list[ix]].decoder->our_format_mime (mime))
+		struct decoder *d;
+
+		if (!(plugins[decoder_list[ix]].flags & PLUGIN_MIME))
+			continue;
+
+		d = plugin_decoder (decoder_list[ix]);
+		if (d && d->our_format_mime && d->our_format_mime (mime))
 			return decoder_list[ix];
 	}
 
@@ -163,23 +339,40 @@ static int find_mime_decoder (int *decoder_list, int count, const char *mime)
 static int find_decoder (const char *extn, const char *file, char **mime)
 {
 	int result;
-	decoder_t_preference *pref;
+	struct dispatch *ext_entry, *mime_entry;
 
 	assert ((extn && extn[0]) || (file && file[0]) || (mime && *mime));
 
-	pref = lookup_preference (extn, file, mime);
-	if (pref) {
-		if (pref->subtype)
-			return find_mime_decoder (pref->decoder_list, pref->decoders, *mime);
-		else
-			return find_extn_decoder (pref->decoder_list, pref->decoders, extn);
+	ext_entry = NULL;
+	if (extn && extn[0])
+		ext_entry = dispatch_find (extn);
+
+	/* The first matching preference applies, so a MIME type preference
+	 * is looked for only if it could precede the extension's one. */
+	mime_entry = NULL;
+	if (have_mime_prefs && !(ext_entry && ext_entry->pref
+	                                   && !ext_entry->mime_first)) {
+		mime_entry = lookup_mime_preference (file, mime);
+		if (mime_entry && ext_entry && ext_entry->pref
+		               && ext_entry->rank < mime_entry->rank)
+			mime_entry = NULL;
 	}
 
+	if (mime_entry)
+		return find_mime_decoder (mime_entry->pref->decoder_list,
+		                          mime_entry->pref->decoders, *mime);
+	if (ext_entry && ext_entry->pref)
+		return ext_entry->decoder;
+
 	result = -1;
 	if (mime && *mime)
 		result = find_mime_decoder (default_decoder_list, plugins_num, *mime);
-	if (result == -1 && extn && *extn)
-		result = find_extn_decoder (default_decoder_list, plugins_num, extn);
+	if (result == -1 && extn && *extn) {
+		if (ext_entry)
+			result = ext_entry->decoder;
+		else
+			result = find_extn_decoder (callback_list, callback_num, extn);
+	}
 
 	return result;
 }
@@ -205,6 +398,34 @@ int is_sound_file (const char *name)
 	return find_type(name) != -1 ? 1 : 0;
 }
 
+/* Get the type name of the file from the names the plugin gave for its
+ * extensions, so it doesn't have to be loaded just for this.  A plugin
+ * which tells no extensions is loaded at startup anyway and is asked. */
+static void plugin_type_name (const struct plugin *p, const char *file,
+                              char buf[4])
+{
+	const char *extn;
+	int ix;
+
+	if (!p->extns) {
+		if (p->decoder && p->decoder->get_name)
+			p->decoder->get_name (file, buf);
+		return;
+	}
+
+	extn = ext_pos (file);
+	if (!extn || !p->type_names)
+		return;
+
+	ix = lists_strs_find (p->extns, extn);
+	if (ix < lists_strs_size (p->type_names)) {
+		const char *name = lists_strs_at (p->type_names, ix);
+
+		if (strcmp (name, "-"))
+			strncpy (buf, name, 3);
+	}
+}
+
 /* Return short type name for the given file or NULL if not found.
  * Not thread safe! */
 char *file_type_name (const char *file)
@@ -212,7 +433,7 @@ char *file_type_name (const char *file)
 	int i;
 	static char buf[4];
 
-	if (file_type (file) == F_URL) {
+	if (is_url (file)) {
 		strcpy (buf, "NET");
 		return buf;
 	}
@@ -222,8 +443,8 @@ char *file_type_name (const char *file)
 		return NULL;
 
 	memset (buf, 0, sizeof (buf));
-	if (plugins[i].decoder->get_name)
-		plugins[i].decoder->get_name (file, buf);
+	if (plugins[i].flags & PLUGIN_GET_NAME)
+		plugin_type_name (&plugins[i], file, buf);
 
 	/* Attempt a default name if we have nothing else. */
 	if (!buf[0]) {
@@ -256,7 +477,7 @@ struct decoder *get_decoder (const char *file)
 
 	i = find_type (file);
 	if (i != -1)
-		return plugins[i].decoder;
+		return plugin_decoder (i);
 
 	return NULL;
 }
@@ -295,7 +516,7 @@ static struct decoder *get_decoder_by_mime_type (struct io_stream *stream)
 		i = find_decoder (NULL, NULL, &mime);
 		if (i != -1) {
 			logit ("Found decoder for MIME type %s: %s", mime, plugins[i].name);
-			result = plugins[i].decoder;
+			result = plugin_decoder (i);
 		}
 		free (mime);
 	}
@@ -305,41 +526,115 @@ static struct decoder *get_decoder_by_mime_type (struct io_stream *stream)
 	return result;
 }
 
+/* Does the chain of signatures starting at *ix match the start of the
+ * stream?  Leave *ix at the last signature of the chain. */
+static bool match_magic (const struct plugin *p, int *ix, const char *buf,
+                         const ssize_t len)
+{
+	bool result = true;
+
+	for (;; *ix += 1) {
+		const struct decoder_magic *m = &p->magic[*ix];
+
+		if (m->offset + m->len > len
+				|| memcmp (buf + m->offset, m->bytes, m->len))
+			result = false;
+		if (!(m->flags & DECODER_MAGIC_NEXT) || *ix == p->magic_num - 1)
+			break;
+	}
+
+	return result;
+}
+
+/* Find the decoder by the signatures matching the start of the stream.
+ * Decoders asked to confirm a match are marked in asked[]. */
+static struct decoder *get_decoder_by_magic (struct io_stream *stream,
+                                             const char *buf,
+                                             const ssize_t len, bool *asked)
+{
+	int i, ix;
+
+	for (i = 0; i < plugins_num; i++) {
+		struct plugin *p = &plugins[i];
+
+		for (ix = 0; ix < p->magic_num; ix++) {
+			struct decoder *d;
+
+			if (!match_magic (p, &ix, buf, len))
+				continue;
+
+			d = plugin_decoder (i);
+			if (!d)
+				break;
+
+			if (p->magic[ix].flags & DECODER_MAGIC_SURE) {
+				logit ("Found decoder for stream by signature: %s",
+				        p->name);
+				return d;
+			}
+
+			if (!asked[i]) {
+				asked[i] = true;
+				if (d->can_decode && d->can_decode (stream)) {
+					logit ("Found decoder for stream: %s", p->name);
+					return d;
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+
 /* Return the decoder for this stream. */
 struct decoder *get_decoder_by_content (struct io_stream *stream)
 {
-	char buf[8096];
+	char *buf;
 	ssize_t res;
 	int i;
-	struct decoder *decoder_by_mime_type;
+	bool asked[PLUGINS_NUM];
+	struct decoder *result;
 
 	assert (stream != NULL);
 
 	/* Peek at the start of the stream to check if sufficient data is
 	 * available.  If not, there is no sense in trying the decoders as
 	 * each of them would issue an error.  The data is also needed to
-	 * get the MIME type. */
+	 * get the MIME type.  This waits for all the data the decoders
+	 * look at, so their own peeks don't wait for the network again. */
 	logit ("Testing the stream...");
-	res = io_peek (stream, buf, sizeof (buf));
+	buf = (char *)xmalloc (DECODER_SNIFF_SIZE);
+	res = io_peek (stream, buf, DECODER_SNIFF_SIZE);
 	if (res < 0) {
 		error ("Stream error: %s", io_strerror (stream));
+		free (buf);
 		return NULL;
 	}
 
 	if (res < 512) {
 		logit ("Stream too short");
+		free (buf);
 		return NULL;
 	}
 
-	decoder_by_mime_type = get_decoder_by_mime_type (stream);
-	if (decoder_by_mime_type)
-		return decoder_by_mime_type;
+	memset (asked, 0, sizeof (asked));
+	result = get_decoder_by_mime_type (stream);
+	if (!result)
+		result = get_decoder_by_magic (stream, buf, res, asked);
+	free (buf);
+	if (result)
+		return result;
 
 	for (i = 0; i < plugins_num; i++) {
-		if (plugins[i].decoder->can_decode
-				&& plugins[i].decoder->can_decode (stream)) {
+		struct decoder *d;
+
+		if (!(plugins[i].flags & PLUGIN_CAN_DECODE) || asked[i])
+			continue;
+
+		d = plugin_decoder (i);
+		if (d && d->can_decode && d->can_decode (stream)) {
 			logit ("Found decoder for stream: %s", plugins[i].name);
-			return plugins[i].decoder;
+			return d;
 		}
 	}
 
@@ -436,14 +731,97 @@ static int present_handle (const lt_dlhandle h)
 	return 0;
 }
 
+/* Check if the extensions given by the plugin agree with its
+ * our_format_ext(). */
+static void check_extns (const struct plugin *p)
+{
+	int ix;
+
+	if (!p->decoder->our_format_ext)
+		return;
+
+	for (ix = 0; ix < lists_strs_size (p->extns); ix += 1) {
+		const char *extn = lists_strs_at (p->extns, ix);
+
+		if (!p->decoder->our_format_ext (extn))
+			logit ("The %s decoder lists extension %s it doesn't "
+			       "accept", p->name, extn);
+	}
+}
+
+/* Ask the loaded plugin for the type name of each of its extensions to
+ * have them without loading it later. */
+static void get_type_names (struct plugin *p)
+{
+	int ix;
+
+	p->type_names = lists_strs_new (lists_strs_size (p->extns));
+	for (ix = 0; ix < lists_strs_size (p->extns); ix += 1) {
+		char *file, buf[4] = "";
+
+		file = format_msg ("file.%s", lists_strs_at (p->extns, ix));
+		p->decoder->get_name (file, buf);
+		free (file);
+
+		buf[3] = 0;
+		lists_strs_append (p->type_names, buf[0] && !strchr (buf, ' ')
+		                                  ? buf : "-");
+	}
+}
+
+/* Add a signature to the plugin. */
+static void add_magic (struct plugin *p, const int offset, const int len,
+                       const char *bytes, const int flags)
+{
+	struct decoder_magic *m;
+	char *copy;
+
+	p->magic = (struct decoder_magic *)xrealloc (p->magic,
+	                       (p->magic_num + 1) * sizeof (struct decoder_magic));
+	copy = (char *)xmalloc (len);
+	memcpy (copy, bytes, len);
+
+	m = &p->magic[p->magic_num++];
+	m->offset = offset;
+	m->len = len;
+	m->bytes = copy;
+	m->flags = flags;
+}
+
+/* Copy the decoder's signatures to the plugin, so they are available
+ * without loading it. */
+static void copy_magic (struct plugin *p)
+{
+	const struct decoder_magic *m;
+
+	for (m = p->decoder->magic; m->len; m++) {
+		if (m->offset < 0 || m->len < 0
+				|| m->offset + m->len > DECODER_SNIFF_SIZE) {
+			logit ("The %s decoder has an invalid signature", p->name);
+			return;
+		}
+	}
+
+	for (m = p->decoder->magic; m->len; m++)
+		add_magic (p, m->offset, m->len, m->bytes, m->flags);
+}
+
+static void free_magic (struct plugin *p)
+{
+	int ix;
+
+	for (ix = 0; ix < p->magic_num; ix++)
+		free ((char *)p->magic[ix].bytes);
+	free (p->magic);
+	p->magic = NULL;
+	p->magic_num = 0;
+}
+
 static int lt_load_plugin (const char *file, lt_ptr debug_info_ptr)
 {
 	int debug_info;
-	const char *name;
-	union {
-		void *data;
-		plugin_init_func *func;
-	} init;
+	const char *name, *err;
+	struct plugin *p;
 
 	debug_info = *(int *)debug_info_ptr;
 	name = strrchr (file, '/');
@@ -457,60 +835,60 @@ static int lt_load_plugin (const char *file, lt_ptr debug_info_ptr)
 		return 0;
 	}
 
-	plugins[plugins_num].handle = lt_dlopenext (file);
-	if (!plugins[plugins_num].handle) {
-		fprintf (stderr, "Can't load plugin %s: %s\n", name, lt_dlerror ());
+	p = &plugins[plugins_num];
+	p->file = xstrdup (file);
+
+	err = open_plugin (p);
+	if (err) {
+		fprintf (stderr, "Can't load plugin %s: %s\n", name, err);
+		free (p->file);
 		return 0;
 	}
 
-	if (present_handle (plugins[plugins_num].handle)) {
+	if (present_handle (p->handle)) {
 		if (debug_info)
 			printf ("Already loaded\n");
-		if (lt_dlclose (plugins[plugins_num].handle))
+		if (lt_dlclose (p->handle))
 			fprintf (stderr, "Error unloading plugin: %s\n", lt_dlerror ());
+		free (p->file);
+		p->handle = NULL;
+		p->decoder = NULL;
 		return 0;
 	}
 
-	init.data = lt_dlsym (plugins[plugins_num].handle, "plugin_init");
-	if (!init.data) {
-		fprintf (stderr, "No init function in the plugin!\n");
-		if (lt_dlclose (plugins[plugins_num].handle))
-			fprintf (stderr, "Error unloading plugin: %s\n", lt_dlerror ());
-		return 0;
-	}
+	p->name = extract_decoder_name (name);
+	p->extns = NULL;
+	p->type_names = NULL;
+	p->failed = false;
+	p->flags = 0;
+	if (p->decoder->our_format_mime)
+		p->flags |= PLUGIN_MIME;
+	if (p->decoder->can_decode)
+		p->flags |= PLUGIN_CAN_DECODE;
+	if (p->decoder->get_name)
+		p->flags |= PLUGIN_GET_NAME;
 
-	/* If this call to init.func() fails with memory access or illegal
-	 * instruction errors then read the commit log message for r2831. */
-	plugins[plugins_num].decoder = init.func ();
-	if (!plugins[plugins_num].decoder) {
-		fprintf (stderr, "NULL decoder!\n");
-		if (lt_dlclose (plugins[plugins_num].handle))
-			fprintf (stderr, "Error unloading plugin: %s\n", lt_dlerror ());
-		return 0;
-	}
-
-	if (plugins[plugins_num].decoder->api_version != DECODER_API_VERSION) {
-		fprintf (stderr, "Plugin uses different API version\n");
-		if (lt_dlclose (plugins[plugins_num].handle))
-			fprintf (stderr, "Error unloading plugin: %s\n", lt_dlerror ());
-		return 0;
-	}
+	/* Is the Vorbis decoder using Tremor? */
+	if (!strcmp (p->name, "vorbis")
+			&& lt_dlsym (p->handle, "vorbis_has_tremor"))
+		p->flags |= PLUGIN_TREMOR;
 
-	plugins[plugins_num].name = extract_decoder_name (name);
+	debug ("Loaded %s decoder", p->name);
 
-	/* Is the Vorbis decoder using Tremor? */
-	if (!strcmp (plugins[plugins_num].name, "vorbis")) {
-		void *vorbis_has_tremor;
+	if (p->decoder->init)
+		p->decoder->init ();
 
-		vorbis_has_tremor = lt_dlsym (plugins[plugins_num].handle,
-		                              "vorbis_has_tremor");
-		have_tremor = vorbis_has_tremor != NULL;
+	if (p->decoder->get_extns) {
+		p->extns = lists_strs_new (8);
+		p->decoder->get_extns (p->extns);
+		check_extns (p);
+		if (p->decoder->get_name)
+			get_type_names (p);
 	}
 
-	debug ("Loaded %s decoder", plugins[plugins_num].name);
+	if (p->decoder->magic && p->decoder->open_stream)
+		copy_magic (p);
 
-	if (plugins[plugins_num].decoder->init)
-		plugins[plugins_num].decoder->init ();
 	plugins_num += 1;
 
 	if (debug_info)
@@ -519,6 +897,234 @@ static int lt_load_plugin (const char *file, lt_ptr debug_info_ptr)
 	return 0;
 }
 
+/* Add the plugin file to the list. */
+static int lt_list_plugin (const char *file, lt_ptr files_ptr)
+{
+	lists_strs_append ((lists_t_strs *)files_ptr, file);
+
+	return 0;
+}
+
+/* Unload all plugins and empty the table. */
+static void clear_plugins ()
+{
+	int ix;
+
+	for (ix = 0; ix < plugins_num; ix++) {
+		struct plugin *p = &plugins[ix];
+
+		if (p->decoder && p->decoder->destroy)
+			p->decoder->destroy ();
+		if (p->handle)
+			lt_dlclose (p->handle);
+		if (p->extns)
+			lists_strs_free (p->extns);
+		if (p->type_names)
+			lists_strs_free (p->type_names);
+		free_magic (p);
+		free (p->name);
+		free (p->file);
+		memset (p, 0, sizeof (struct plugin));
+	}
+
+	plugins_num = 0;
+}
+
+/* Read the next line of the manifest in place of the previous one. */
+static char *next_line (FILE *file, char **line)
+{
+	free (*line);
+	*line = read_line (file);
+
+	return *line;
+}
+
+/* Add the signature from a "magic <flags> <offset> <hex bytes>" line of the
+ * manifest to the plugin.  Return false if the line is malformed. */
+static bool load_magic (struct plugin *p, const char *line)
+{
+	int flags, offset, len, ix, pos = 0;
+	char bytes[DECODER_SNIFF_SIZE];
+	const char *hex;
+
+	if (sscanf (line, "magic %d %d %n", &flags, &offset, &pos) != 2 || !pos)
+		return false;
+
+	hex = line + pos;
+	len = strlen (hex) / 2;
+	if (len == 0 || offset < 0 || offset + len > DECODER_SNIFF_SIZE)
+		return false;
+
+	for (ix = 0; ix < len; ix++) {
+		unsigned int byte;
+
+		if (sscanf (hex + ix * 2, "%2x", &byte) != 1)
+			return false;
+		bytes[ix] = byte;
+	}
+
+	add_magic (p, offset, len, bytes, flags);
+	return true;
+}
+
+/* Fill the plugins table from the manifest without loading the plugins.
+ * Return false if the manifest is missing or doesn't describe the plugin
+ * files we have. */
+static bool load_manifest (const char *fname, lists_t_strs *files,
+                           const time_t dir_mtime)
+{
+	FILE *file;
+	char *line = NULL;
+	int ix, count, api;
+	long mtime;
+	bool result = false;
+
+	file = fopen (fname, "r");
+	if (!file)
+		return false;
+
+	if (!next_line (file, &line) || strcmp (line, MANIFEST_HEADER))
+		goto end;
+	if (!next_line (file, &line) || sscanf (line, "api %d", &api) != 1
+			|| api != DECODER_API_VERSION)
+		goto end;
+	if (!next_line (file, &line) || sscanf (line, "dir %ld", &mtime) != 1
+			|| mtime != (long)dir_mtime)
+		goto end;
+	if (!next_line (file, &line) || sscanf (line, "files %d", &count) != 1
+			|| count != lists_strs_size (files))
+		goto end;
+
+	for (ix = 0; ix < count; ix += 1) {
+		if (!next_line (file, &line) || !lists_strs_exists (files, line))
+			goto end;
+	}
+
+	while (next_line (file, &line)) {
+		struct plugin *p = &plugins[plugins_num];
+		int flags, name_pos = 0;
+
+		if (!strncmp (line, "magic ", 6) && plugins_num > 0) {
+			if (!load_magic (&plugins[plugins_num - 1], line))
+				goto end;
+			continue;
+		}
+
+		if (!strncmp (line, "names ", 6) && plugins_num > 0) {
+			struct plugin *prev = &plugins[plugins_num - 1];
+
+			if (!prev->extns || prev->type_names)
+				goto end;
+			prev->type_names = lists_strs_new (8);
+			lists_strs_split (prev->type_names, line + 5, " ");
+			if (lists_strs_size (prev->type_names)
+					!= lists_strs_size (prev->extns))
+				goto end;
+			continue;
+		}
+
+		if (plugins_num == PLUGINS_NUM
+				|| sscanf (line, "plugin %d %n", &flags, &name_pos) != 1
+				|| !name_pos || !line[name_pos])
+			goto end;
+
+		memset (p, 0, sizeof (struct plugin));
+		p->name = xstrdup (line + name_pos);
+		p->flags = flags;
+		plugins_num += 1;
+
+		if (!next_line (file, &line) || !line[0])
+			goto end;
+		p->file = xstrdup (line);
+
+		if (!next_line (file, &line))
+			goto end;
+		if (!strncmp (line, "extns", 5)) {
+			p->extns = lists_strs_new (8);
+			lists_strs_split (p->extns, line + 5, " ");
+		}
+		else if (strcmp (line, "load"))
+			goto end;
+	}
+
+	result = plugins_num > 0;
+
+end:
+	free (line);
+	fclose (file);
+	if (!result) {
+		logit ("Decoder manifest is missing or out of date");
+		clear_plugins ();
+	}
+
+	return result;
+}
+
+/* Remember the loaded plugins for the next startup. */
+static void save_manifest (const char *fname, lists_t_strs *files,
+                           const time_t dir_mtime)
+{
+	FILE *file;
+	char *tmp;
+	int ix, jx;
+
+	tmp = format_msg ("%s.tmp", fname);
+	file = fopen (tmp, "w");
+	if (!file) {
+		log_errno ("Can't write the decoder manifest", errno);
+		free (tmp);
+		return;
+	}
+
+	fprintf (file, "%s\n", MANIFEST_HEADER);
+	fprintf (file, "api %d\n", DECODER_API_VERSION);
+	fprintf (file, "dir %ld\n", (long)dir_mtime);
+	fprintf (file, "files %d\n", lists_strs_size (files));
+	for (ix = 0; ix < lists_strs_size (files); ix += 1)
+		fprintf (file, "%s\n", lists_strs_at (files, ix));
+
+	for (ix = 0; ix < plugins_num; ix += 1) {
+		fprintf (file, "plugin %d %s\n%s\n", plugins[ix].flags,
+		               plugins[ix].name, plugins[ix].file);
+		/* An empty list would be formatted as NULL. */
+		if (plugins[ix].extns
+		                && !lists_strs_empty (plugins[ix].extns)) {
+			char *extns = lists_strs_fmt (plugins[ix].extns, " %s");
+
+			fprintf (file, "extns%s\n", extns);
+			free (extns);
+		}
+		else
+			fprintf (file, "load\n");
+
+		if (plugins[ix].type_names
+		                && !lists_strs_empty (plugins[ix].type_names)) {
+			char *names = lists_strs_fmt (plugins[ix].type_names,
+			                              " %s");
+
+			fprintf (file, "names%s\n", names);
+			free (names);
+		}
+
+		for (jx = 0; jx < plugins[ix].magic_num; jx += 1) {
+			const struct decoder_magic *m = &plugins[ix].magic[jx];
+			int kx;
+
+			fprintf (file, "magic %d %d ", m->flags, m->offset);
+			for (kx = 0; kx < m->len; kx += 1)
+				fprintf (file, "%02x", (unsigned char)m->bytes[kx]);
+			fprintf (file, "\n");
+		}
+	}
+
+	if (fclose (file) || rename (tmp, fname)) {
+		log_errno ("Can't write the decoder manifest", errno);
+		unlink (tmp);
+	}
+
+	free (tmp);
+}
+
 /* Create a new preferences entry and initialise it. */
 static decoder_t_preference *make_preference (const char *prefix)
 {
@@ -680,44 +1286,160 @@ static void load_preferences ()
 static void load_plugins (int debug_info)
 {
 	int ix;
-	char *names;
+	char *names, *manifest;
+	lists_t_strs *files;
+	struct stat st;
+	time_t dir_mtime = 0;
 
-	if (debug_info)
-		printf ("Loading plugins from %s...\n", PLUGIN_DIR);
 	if (lt_dlinit ())
 		fatal ("lt_dlinit() failed: %s", lt_dlerror ());
 
-	if (lt_dlforeachfile (PLUGIN_DIR, &lt_load_plugin, &debug_info))
+	/* Listing the directory doesn't load the plugins. */
+	files = lists_strs_new (PLUGINS_NUM);
+	if (lt_dlforeachfile (PLUGIN_DIR, &lt_list_plugin, files))
 		fatal ("Can't load plugins: %s", lt_dlerror ());
+	if (stat (PLUGIN_DIR, &st) == 0)
+		dir_mtime = st.st_mtime;
+
+	manifest = xstrdup (create_file_name (MANIFEST_FILE));
+	if (load_manifest (manifest, files, dir_mtime)) {
+		if (debug_info)
+			printf ("Using decoder manifest %s\n", manifest);
+
+		/* Plugins which can't tell their extensions are always
+		 * needed. */
+		for (ix = 0; ix < plugins_num; ix += 1) {
+			if (!plugins[ix].extns)
+				plugin_decoder (ix);
+		}
+	}
+	else {
+		if (debug_info)
+			printf ("Loading plugins from %s...\n", PLUGIN_DIR);
+
+		if (lt_dlforeachfile (PLUGIN_DIR, &lt_load_plugin, &debug_info))
+			fatal ("Can't load plugins: %s", lt_dlerror ());
+
+		if (plugins_num > 0)
+			save_manifest (manifest, files, dir_mtime);
+	}
+	free (manifest);
+	lists_strs_free (files);
 
 	if (plugins_num == 0)
 		fatal ("No decoder plugins have been loaded!");
 
-	for (ix = 0; ix < plugins_num; ix += 1)
+	for (ix = 0; ix < plugins_num; ix += 1) {
 		default_decoder_list[ix] = ix;
+		if (plugins[ix].flags & PLUGIN_TREMOR)
+			have_tremor = true;
+	}
 
 	names = list_decoder_names (default_decoder_list, plugins_num);
-	logit ("Loaded %d decoders:%s", plugins_num, names);
+	logit ("Found %d decoders:%s", plugins_num, names);
 	free (names);
 }
 
+/* Fill the dispatch table with the plugins' extensions and the
+ * preferences. */
+static void load_dispatch ()
+{
+	int ix, rank, count;
+	bool seen_mime;
+	decoder_t_preference *pref;
+
+	count = 0;
+	for (ix = 0; ix < plugins_num; ix += 1) {
+		if (plugins[ix].extns)
+			count += lists_strs_size (plugins[ix].extns);
+		else
+			callback_list[callback_num++] = ix;
+	}
+	for (pref = preferences; pref; pref = pref->next)
+		count += 1;
+
+	/* Keep the table at most half full. */
+	dispatch_size = 16;
+	while (dispatch_size < (unsigned int)count * 2)
+		dispatch_size *= 2;
+	dispatch = (struct dispatch *)xcalloc (dispatch_size,
+	                                       sizeof (struct dispatch));
+
+	/* Preferences first, the first one for a key wins. */
+	seen_mime = false;
+	for (pref = preferences, rank = 0; pref; pref = pref->next, rank += 1) {
+		struct dispatch *entry;
+
+		if (pref->subtype) {
+			char *key;
+
+			key = format_msg ("%s/%s", pref->type, pref->subtype);
+			entry = dispatch_add (key);
+			free (key);
+			seen_mime = true;
+			have_mime_prefs = true;
+		}
+		else {
+			entry = dispatch_add (pref->type);
+			if (entry)
+				entry->decoder = find_extn_decoder (pref->decoder_list,
+				                                    pref->decoders,
+				                                    pref->type);
+		}
+
+		if (entry) {
+			entry->pref = pref;
+			entry->rank = rank;
+			entry->mime_first = seen_mime && !pref->subtype;
+		}
+	}
+
+	for (ix = 0; ix < plugins_num; ix += 1) {
+		int jx;
+
+		if (!plugins[ix].extns)
+			continue;
+
+		for (jx = 0; jx < lists_strs_size (plugins[ix].extns); jx += 1) {
+			const char *extn = lists_strs_at (plugins[ix].extns, jx);
+			struct dispatch *entry;
+
+			entry = dispatch_add (extn);
+			if (entry)
+				entry->decoder = find_extn_decoder (default_decoder_list,
+				                                    plugins_num, extn);
+		}
+	}
+
+	debug ("Dispatch table: %d keys in %u slots", count, dispatch_size);
+}
+
+static void cleanup_dispatch ()
+{
+	unsigned int ix;
+
+	if (!dispatch)
+		return;
+
+	for (ix = 0; ix < dispatch_size; ix += 1)
+		free (dispatch[ix].key);
+	free (dispatch);
+	dispatch = NULL;
+	dispatch_size = 0;
+	callback_num = 0;
+	have_mime_prefs = false;
+}
+
 void decoder_init (int debug_info)
 {
 	load_plugins (debug_info);
 	load_preferences ();
+	load_dispatch ();
 }
 
 static void cleanup_decoders ()
 {
-	int ix;
-
-	for (ix = 0; ix < plugins_num; ix++) {
-		if (plugins[ix].decoder->destroy)
-			plugins[ix].decoder->destroy ();
-		free (plugins[ix].name);
-		if (plugins[ix].handle)
-			lt_dlclose (plugins[ix].handle);
-	}
+	clear_plugins ();
 
 	if (lt_dlexit ())
 		logit ("lt_exit() failed: %s", lt_dlerror ());
@@ -738,10 +1460,59 @@ static void cleanup_preferences ()
 
 void decoder_cleanup ()
 {
+	cleanup_dispatch ();
 	cleanup_decoders ();
 	cleanup_preferences ();
 }
 
+/* Let the decoder of a newly opened resource choose the output format
+ * for decoder_decode() out of the formats the device plays. */
+void decoder_set_format (const struct decoder *f, void *data)
+{
+	long fmt LOGIT_ONLY;
+	char fmt_name[SFMT_STR_MAX] LOGIT_ONLY;
+
+	assert (f != NULL);
+
+	if (!f->decode_frames)
+		return;
+
+	fmt = f->set_format (data, audio_get_formats ());
+
+	logit ("Decoder chose %s", sfmt_str (fmt, fmt_name, sizeof (fmt_name)));
+}
+
+/* Decode interleaved sound into the buffer using decode_frames() if the
+ * decoder provides it, decode() otherwise.  Set pos to the position of
+ * the decoded sound in frames or to -1 if it's unknown.  Return the
+ * number of bytes decoded or 0 on EOF. */
+int decoder_decode (const struct decoder *f, void *data, char *buf,
+		const int buf_len, struct sound_params *sound_params,
+		int64_t *pos)
+{
+	struct decoder_buf dbuf;
+	int frames;
+
+	assert (f != NULL);
+	assert (buf != NULL);
+	assert (pos != NULL);
+
+	*pos = -1;
+
+	if (!f->decode_frames)
+		return f->decode (data, buf, buf_len, sound_params);
+
+	/* The channels aren't known before decoding, so only the size of
+	 * the buffer limits what's written. */
+	dbuf.frames = INT_MAX;
+	dbuf.size = buf_len;
+	dbuf.data = buf;
+
+	frames = f->decode_frames (data, &dbuf, sound_params, pos);
+
+	return frames * sfmt_Bps (sound_params->fmt) * sound_params->channels;
+}
+
 /* Fill the error structure with an error of a given type and message.
  * strerror(add_errno) is appended at the end of the message if add_errno != 0.
  * The old error message is free()ed.
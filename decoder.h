@@ -4,6 +4,7 @@
 #include "audio.h"
 #include "playlist.h"
 #include "io.h"
+#include "lists.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,7 +14,7 @@ extern "C" {
  *
  * On every change in the decoder API this number will be changed, so
  * MOC will not load plugins compiled with older/newer decoder.h. */
-#define DECODER_API_VERSION	7
+#define DECODER_API_VERSION	11
 
 /** Type of the decoder error. */
 enum decoder_error_type
@@ -34,6 +35,40 @@ struct decoder_error
 	char *err;	/*!< malloc()ed error string or NULL. */
 };
 
+/** Number of bytes at the start of a stream which MOC reads to find the
+ * stream's format. */
+#define DECODER_SNIFF_SIZE	(16 * 1024)
+
+/** Flags of a magic signature. */
+enum decoder_magic_flags
+{
+	DECODER_MAGIC_NEXT = 0x01, /*!< The next signature must match too. */
+	DECODER_MAGIC_SURE = 0x02 /*!< The match needs no confirmation by
+				    can_decode(). */
+};
+
+/** Magic signature of a stream format.
+ *
+ * The bytes must be found at the offset from the start of the stream.
+ * Signatures can be chained with DECODER_MAGIC_NEXT, the flags of the last
+ * one in the chain tell if the decoder must confirm the match. */
+struct decoder_magic
+{
+	int offset; /*!< Offset of the bytes, offset + len must not exceed
+		      DECODER_SNIFF_SIZE. */
+	int len; /*!< Number of bytes, 0 ends an array of signatures. */
+	const char *bytes; /*!< The bytes. */
+	int flags; /*!< Flags from decoder_magic_flags. */
+};
+
+/** Buffer passed to decode_frames(), samples are interleaved. */
+struct decoder_buf
+{
+	int frames; /*!< Maximum number of frames to decode. */
+	size_t size; /*!< Size of the buffer in bytes. */
+	char *data; /*!< The buffer. */
+};
+
 /** @struct decoder
  * Functions provided by the decoder plugin.
  *
@@ -51,8 +86,8 @@ struct decoder
 
 	/** Initialize the plugin.
 	 *
-	 * This function is called once at MOC startup (once for the client and
-	 * once for the server). Optional. */
+	 * This function is called once when the plugin is loaded, which is
+	 * when MOC first needs it unless it lacks get_extns(). Optional. */
 	void (*init) ();
 
 	/** Cleanup the plugin.
@@ -121,7 +156,8 @@ struct decoder
 	 * \param buf Buffer to put data in.
 	 * \param buf_len Size of the buffer in bytes.
 	 * \param sound_params Parameters of the decoded sound. This must be
-	 * always filled.
+	 * always filled. A decoder which can produce several sample formats
+	 * should provide set_format() and decode_frames() instead.
 	 *
 	 * \return Number of bytes written or 0 on EOF.
 	 */
@@ -254,6 +290,63 @@ struct decoder
 	 * \return Average bitrate in kbps or -1 if not available.
 	 */
 	int (*get_avg_bitrate)(void *data);
+
+	/** Get the file name extensions supported by this decoder.
+	 *
+	 * Append all extensions for which our_format_ext() returns true to
+	 * the list. MOC remembers them, so the plugin is loaded only when a
+	 * file is to be decoded. Plugins without this function are loaded
+	 * at every startup. This function is optional.
+	 *
+	 * \param extns List to which the extensions are added.
+	 */
+	void (*get_extns)(lists_t_strs *extns);
+
+	/** Magic signatures of the streams this decoder can decode.
+	 *
+	 * Array ended by a signature with zero length, or NULL. MOC reads
+	 * the start of a stream once and matches it against the signatures
+	 * of all decoders, can_decode() is called only for an uncertain
+	 * match or if no signature matches. The array is read after init()
+	 * and remembered with the extensions. This field is optional and
+	 * used only if open_stream() is provided.
+	 */
+	const struct decoder_magic *magic;
+
+	/** Choose the output format.
+	 *
+	 * Called once after the resource is opened and before the first
+	 * decode_frames(). The decoder should choose the format it can
+	 * produce with the least work out of the offered formats. If it
+	 * can't produce any of them, it chooses its own and MOC converts
+	 * the sound. Required if decode_frames() is provided.
+	 *
+	 * \param data Decoder's private data.
+	 * \param formats Offered sample formats (SFMT_* bits).
+	 *
+	 * \return The chosen format including endianness.
+	 */
+	long (*set_format)(void *data, const long formats);
+
+	/** Decode frames into the caller's buffer.
+	 *
+	 * Like decode(), but the sound is written in the format chosen by
+	 * set_format() and only in whole frames (a sample for every
+	 * channel). At most buf->frames frames are decoded and no more
+	 * than buf->size bytes are written. If this function is provided,
+	 * decode() is optional.
+	 *
+	 * \param data Decoder's private data.
+	 * \param buf Buffer to put data in.
+	 * \param sound_params Parameters of the decoded sound. This must be
+	 * always filled.
+	 * \param pos Set to the number of frames in the stream before the
+	 * first decoded frame or to -1 if it's unknown.
+	 *
+	 * \return Number of frames written or 0 on EOF.
+	 */
+	int (*decode_frames)(void *data, struct decoder_buf *buf,
+			struct sound_params *sound_params, int64_t *pos);
 };
 
 /** Initialize decoder plugin.
@@ -269,6 +362,10 @@ struct decoder *get_decoder (const char *file);
 struct decoder *get_decoder_by_content (struct io_stream *stream);
 const char *get_decoder_name (const struct decoder *decoder);
 void decoder_init (int debug_info);
+void decoder_set_format (const struct decoder *f, void *data);
+int decoder_decode (const struct decoder *f, void *data, char *buf,
+		const int buf_len, struct sound_params *sound_params,
+		int64_t *pos);
 void decoder_cleanup ();
 char *file_type_name (const char *file);
 
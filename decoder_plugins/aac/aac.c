@@ -604,6 +604,11 @@ static int aac_our_mime (const char *mime)
 		|| !strncasecmp (mime, "audio/aacp;", 11);
 }
 
+static void aac_get_extns (lists_t_strs *extns)
+{
+	lists_strs_append (extns, "aac");
+}
+
 static struct decoder aac_decoder = {
 	DECODER_API_VERSION,
 	NULL,
@@ -623,7 +628,11 @@ static struct decoder aac_decoder = {
 	aac_get_name,
 	NULL,
 	NULL,
-	aac_get_avg_bitrate
+	aac_get_avg_bitrate,
+	aac_get_extns,
+	NULL,
+	NULL,
+	NULL
 };
 
 struct decoder *plugin_init ()
@@ -31,6 +31,9 @@
 #include <assert.h>
 #include <stdint.h>
 #include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <libavformat/avformat.h>
 #include <libavutil/mathematics.h>
@@ -67,7 +70,7 @@
 #endif
 
 /* Set SEEK_IN_DECODER to 1 if you'd prefer seeking to be delay until
- * the next time ffmpeg_decode() is called.  This will provide seeking
+ * the next time ffmpeg_decode_frames() is called.  This will provide seeking
  * in formats for which FFmpeg falsely reports seek errors, but could
  * result erroneous current time values. */
 #define SEEK_IN_DECODER 0
@@ -80,8 +83,14 @@ struct ffmpeg_data
 	AVCodecContext *enc;
 	AVCodec *codec;
 
-	char *remain_buf;
-	int remain_buf_len;
+	/* The last decoded frame is handed out from frame_pos (in samples)
+	 * before anything else is decoded, so its data stay valid. */
+	AVFrame *frame;
+	int frame_pos;
+
+	/* Packet being decoded or NULL. */
+	AVPacket *pkt;
+	uint8_t *pkt_data;      /* pkt->data before decoding */
 
 	bool delay;             /* FFmpeg may buffer samples */
 	bool eof;               /* end of file seen */
@@ -113,6 +122,9 @@ struct extn_list {
 
 static lists_t_strs *supported_extns = NULL;
 
+/* Signatures of the formats FFmpeg has demuxers for, filled in init(). */
+static struct decoder_magic supported_magic[32];
+
 static void ffmpeg_log_repeats (char *msg LOGIT_ONLY)
 {
 #ifndef NDEBUG
@@ -310,6 +322,44 @@ static void load_video_extns (lists_t_strs *list)
 	}
 }
 
+static void load_magic ()
+{
+	int ix, count = 0;
+	const struct {
+		const char *format;
+		struct decoder_magic magic[2];
+	} format_magic[] = {
+		{"aiff", {{0, 4, "FORM", DECODER_MAGIC_NEXT},
+		          {8, 4, "AIFF", DECODER_MAGIC_SURE}}},
+		{"ape", {{0, 4, "MAC ", DECODER_MAGIC_SURE}}},
+		{"asf", {{0, 8, "\x30\x26\xb2\x75\x8e\x66\xcf\x11",
+		          DECODER_MAGIC_SURE}}},
+		{"au", {{0, 4, ".snd", DECODER_MAGIC_SURE}}},
+		{"flac", {{0, 4, "fLaC", DECODER_MAGIC_SURE}}},
+		{"matroska", {{0, 4, "\x1a\x45\xdf\xa3", DECODER_MAGIC_SURE}}},
+		{"mp4", {{4, 4, "ftyp", DECODER_MAGIC_SURE}}},
+		{"mpc", {{0, 3, "MP+", DECODER_MAGIC_SURE}}},
+		{"mpc8", {{0, 4, "MPCK", DECODER_MAGIC_SURE}}},
+		{"tta", {{0, 4, "TTA1", DECODER_MAGIC_SURE}}},
+		{"wav", {{0, 4, "RIFF", DECODER_MAGIC_NEXT},
+		         {8, 4, "WAVE", DECODER_MAGIC_SURE}}},
+		{"wv", {{0, 4, "wvpk", DECODER_MAGIC_SURE}}},
+		{NULL, {{0, 0, NULL, 0}}}
+	};
+
+	for (ix = 0; format_magic[ix].format; ix += 1) {
+		if (!av_find_input_format (format_magic[ix].format))
+			continue;
+
+		/* Leave room for the terminating entry. */
+		assert (count + 2 < (int)ARRAY_SIZE(supported_magic));
+
+		supported_magic[count++] = format_magic[ix].magic[0];
+		if (format_magic[ix].magic[0].flags & DECODER_MAGIC_NEXT)
+			supported_magic[count++] = format_magic[ix].magic[1];
+	}
+}
+
 /* Handle FFmpeg's locking requirements. */
 #if HAVE_LIBAV || LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58,9,100)
 static int locking_cb (void **mutex, enum AVLockOp op)
@@ -404,6 +454,7 @@ static void ffmpeg_init ()
 	supported_extns = lists_strs_new (16);
 	load_audio_extns (supported_extns);
 	load_video_extns (supported_extns);
+	load_magic ();
 
 #if HAVE_LIBAV || LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58,9,100)
 	int rc = av_lockmgr_register (locking_cb);
@@ -619,8 +670,10 @@ static struct ffmpeg_data *ffmpeg_make_data (void)
 	data->stream = NULL;
 	data->enc = NULL;
 	data->codec = NULL;
-	data->remain_buf = NULL;
-	data->remain_buf_len = 0;
+	data->frame = NULL;
+	data->frame_pos = 0;
+	data->pkt = NULL;
+	data->pkt_data = NULL;
 	data->delay = false;
 	data->eof = false;
 	data->eos = false;
@@ -792,6 +845,14 @@ static void *ffmpeg_open_internal (struct ffmpeg_data *data)
 		goto end;
 	}
 
+#ifdef HAVE_AV_FRAME_FNS
+	data->frame = av_frame_alloc ();
+#else
+	data->frame = avcodec_alloc_frame ();
+#endif
+	if (!data->frame)
+		fatal ("Can't allocate frame!");
+
 	data->okay = true;
 
 	if (!data->timing_broken && data->ic->duration >= AV_TIME_BASE)
@@ -868,81 +929,6 @@ static int ffmpeg_can_decode (struct io_stream *stream)
 	return fmt != NULL;
 }
 
-static void put_in_remain_buf (struct ffmpeg_data *data, const char *buf,
-		const int len)
-{
-	debug ("Remain: %dB", len);
-
-	data->remain_buf_len = len;
-	data->remain_buf = (char *)xmalloc (len);
-	memcpy (data->remain_buf, buf, len);
-}
-
-static void add_to_remain_buf (struct ffmpeg_data *data, const char *buf,
-		const int len)
-{
-	debug ("Adding %dB to remain_buf", len);
-
-	data->remain_buf = (char *)xrealloc (data->remain_buf,
-			data->remain_buf_len + len);
-	memcpy (data->remain_buf + data->remain_buf_len, buf, len);
-	data->remain_buf_len += len;
-
-	debug ("remain_buf is %dB long", data->remain_buf_len);
-}
-
-/* Free the remainder buffer. */
-static void free_remain_buf (struct ffmpeg_data *data)
-{
-	free (data->remain_buf);
-	data->remain_buf = NULL;
-	data->remain_buf_len = 0;
-}
-
-/* Satisfy the request from previously decoded samples. */
-static int take_from_remain_buf (struct ffmpeg_data *data, char *buf, int buf_len)
-{
-	int to_copy = MIN (buf_len, data->remain_buf_len);
-
-	debug ("Copying %d bytes from the remain buf", to_copy);
-
-	memcpy (buf, data->remain_buf, to_copy);
-
-	if (to_copy < data->remain_buf_len) {
-		memmove (data->remain_buf, data->remain_buf + to_copy,
-				data->remain_buf_len - to_copy);
-		data->remain_buf_len -= to_copy;
-	}
-	else {
-		debug ("Remain buf is now empty");
-		free_remain_buf (data);
-	}
-
-	return to_copy;
-}
-
-/* Copy samples to output or remain buffer. */
-static int copy_or_buffer (struct ffmpeg_data *data, char *in, int in_len,
-                                                     char *out, int out_len)
-{
-	if (in_len == 0)
-		return 0;
-
-	if (in_len <= out_len) {
-		memcpy (out, in, in_len);
-		return in_len;
-	}
-
-	if (out_len == 0) {
-		add_to_remain_buf (data, in, in_len);
-		return 0;
-	}
-
-	memcpy (out, in, out_len);
-	put_in_remain_buf (data, in + out_len, in_len - out_len);
-	return out_len;
-}
-
 /* Create a new packet ('cause FFmpeg doesn't provide one). */
 static inline AVPacket *new_packet (struct ffmpeg_data *data)
 {
@@ -1087,82 +1073,161 @@ static int decode_audio (AVCodecContext *ctx, AVFrame *frame,
 }
 #endif
 
-/* Decode samples from packet data. */
-static int decode_packet (struct ffmpeg_data *data, AVPacket *pkt,
-                          char *buf, int buf_len)
+/* Interleave count samples of each plane starting at sample pos. */
+static void interleave (char *out, uint8_t * const *planes, const int channels,
+                        const int width, const int pos, const int count)
 {
-	int filled = 0;
-	char *packed;
-	AVFrame *frame;
+	int sample = 0, ch;
+
+	if (channels == 2 && width == 2) {
+		const int16_t *l = (const int16_t *)planes[0] + pos;
+		const int16_t *r = (const int16_t *)planes[1] + pos;
+		int16_t *o = (int16_t *)out;
+
+#ifdef __SSE2__
+		for (; sample + 8 <= count; sample += 8) {
+			__m128i lv = _mm_loadu_si128 ((const __m128i *)(l + sample));
+			__m128i rv = _mm_loadu_si128 ((const __m128i *)(r + sample));
+
+			_mm_storeu_si128 ((__m128i *)(o + sample * 2),
+			                  _mm_unpacklo_epi16 (lv, rv));
+			_mm_storeu_si128 ((__m128i *)(o + sample * 2 + 8),
+			                  _mm_unpackhi_epi16 (lv, rv));
+		}
+#endif
+		for (; sample < count; sample += 1) {
+			o[sample * 2] = l[sample];
+			o[sample * 2 + 1] = r[sample];
+		}
+		return;
+	}
 
-#ifdef HAVE_AV_FRAME_FNS
-	frame = av_frame_alloc ();
-#else
-	frame = avcodec_alloc_frame ();
+	/* 32-bit integer and float samples are moved the same way. */
+	if (channels == 2 && width == 4) {
+		const int32_t *l = (const int32_t *)planes[0] + pos;
+		const int32_t *r = (const int32_t *)planes[1] + pos;
+		int32_t *o = (int32_t *)out;
+
+#ifdef __SSE2__
+		for (; sample + 4 <= count; sample += 4) {
+			__m128i lv = _mm_loadu_si128 ((const __m128i *)(l + sample));
+			__m128i rv = _mm_loadu_si128 ((const __m128i *)(r + sample));
+
+			_mm_storeu_si128 ((__m128i *)(o + sample * 2),
+			                  _mm_unpacklo_epi32 (lv, rv));
+			_mm_storeu_si128 ((__m128i *)(o + sample * 2 + 4),
+			                  _mm_unpackhi_epi32 (lv, rv));
+		}
 #endif
+		for (; sample < count; sample += 1) {
+			o[sample * 2] = l[sample];
+			o[sample * 2 + 1] = r[sample];
+		}
+		return;
+	}
 
-	do {
-		int len, got_frame, is_planar, packed_size, copied;
+	for (ch = 0; ch < channels; ch += 1) {
+		const char *in = (const char *)planes[ch] + pos * width;
+		char *o = out + ch * width;
 
-		len = decode_audio (data->enc, frame, &got_frame, pkt);
+		for (sample = 0; sample < count; sample += 1)
+			memcpy (o + sample * channels * width, in + sample * width, width);
+	}
+}
 
-		if (len < 0) {
-			/* skip frame */
-			decoder_error (&data->error, ERROR_STREAM, 0,
-			               "Error in the stream!");
-			break;
-		}
+/* Copy as many whole samples of the decoded frame as fit in the buffer
+ * after the first done frames.  Return the number of frames copied. */
+static int take_from_frame (struct ffmpeg_data *data, struct decoder_buf *buf,
+                            const int done)
+{
+	AVFrame *frame = data->frame;
+	int channels = data->enc->channels;
+	int width = data->sample_width;
+	int bytes_per_frame = width * channels;
+	int count;
+
+	count = frame->nb_samples - data->frame_pos;
+	count = MIN (count, buf->frames - done);
+	count = MIN (count, (int)(buf->size / bytes_per_frame) - done);
+	if (count <= 0)
+		return 0;
 
-		debug ("Decoded %dB", len);
+	if (av_sample_fmt_is_planar (data->enc->sample_fmt) && channels > 1)
+		interleave (buf->data + done * bytes_per_frame,
+		            frame->extended_data, channels, width,
+		            data->frame_pos, count);
+	else
+		memcpy (buf->data + done * bytes_per_frame,
+		        (char *)frame->extended_data[0]
+		                + data->frame_pos * bytes_per_frame,
+		        count * bytes_per_frame);
 
-		pkt->data += len;
-		pkt->size -= len;
+	data->frame_pos += count;
+	debug ("Copying %d samples from the frame", count);
 
-		if (!got_frame) {
-			data->eos = data->eof && (pkt->size == 0);
-			continue;
-		}
+	return count;
+}
 
-		if (frame->nb_samples == 0)
-			continue;
+/* Number of bytes of the decoded frame not handed out yet. */
+static int frame_bytes_left (const struct ffmpeg_data *data)
+{
+	if (!data->frame)
+		return 0;
 
-		is_planar = av_sample_fmt_is_planar (data->enc->sample_fmt);
-		packed = (char *)frame->extended_data[0];
-		packed_size = frame->nb_samples * data->sample_width
-		                                * data->enc->channels;
+	return (data->frame->nb_samples - data->frame_pos)
+	       * data->sample_width * data->enc->channels;
+}
 
-		if (is_planar && data->enc->channels > 1) {
-			int sample, ch;
+static void drop_packet (struct ffmpeg_data *data)
+{
+	if (data->pkt) {
+		/* FFmpeg will segfault if the data pointer is not restored. */
+		data->pkt->data = data->pkt_data;
+		free_packet (data->pkt);
+		data->pkt = NULL;
+	}
+}
 
-			packed = xmalloc (packed_size);
+/* Forget the decoded samples and the packet being decoded. */
+static void drop_decoded (struct ffmpeg_data *data)
+{
+	drop_packet (data);
+	if (data->frame)
+		data->frame->nb_samples = 0;
+	data->frame_pos = 0;
+}
 
-			for (sample = 0; sample < frame->nb_samples; sample += 1) {
-				for (ch = 0; ch < data->enc->channels; ch += 1)
-					memcpy (packed + (sample * data->enc->channels + ch)
-					                         * data->sample_width,
-					        (char *)frame->extended_data[ch] + sample * data->sample_width,
-					        data->sample_width);
-			}
-		}
+/* Decode the next frame from the current packet. */
+static void decode_frame (struct ffmpeg_data *data)
+{
+	int len, got_frame;
+	AVPacket *pkt = data->pkt;
 
-		copied = copy_or_buffer (data, packed, packed_size, buf, buf_len);
-		buf += copied;
-		filled += copied;
-		buf_len -= copied;
+	data->frame_pos = 0;
 
-		debug ("Copying %dB (%dB filled)", packed_size, filled);
+	len = decode_audio (data->enc, data->frame, &got_frame, pkt);
 
-		if (packed != (char *)frame->extended_data[0])
-			free (packed);
-	} while (pkt->size > 0);
+	if (len < 0) {
+		/* skip frame */
+		decoder_error (&data->error, ERROR_STREAM, 0,
+		               "Error in the stream!");
+		data->frame->nb_samples = 0;
+		drop_packet (data);
+		return;
+	}
 
-#ifdef HAVE_AV_FRAME_FNS
-	av_frame_free (&frame);
-#else
-	avcodec_free_frame (&frame);
-#endif
+	debug ("Decoded %dB", len);
+
+	pkt->data += len;
+	pkt->size -= len;
 
-	return filled;
+	if (!got_frame) {
+		data->frame->nb_samples = 0;
+		data->eos = data->eof && (pkt->size == 0);
+	}
+
+	if (pkt->size <= 0)
+		drop_packet (data);
 }
 
 #if SEEK_IN_DECODER
@@ -1226,73 +1291,92 @@ static inline int compute_bitrate (struct sound_params *sound_params,
 	return bitrate;
 }
 
-static int ffmpeg_decode (void *prv_data, char *buf, int buf_len,
-                          struct sound_params *sound_params)
+static long ffmpeg_set_format (void *prv_data, const long formats ATTR_UNUSED)
 {
 	struct ffmpeg_data *data = (struct ffmpeg_data *)prv_data;
-	int bytes_used = 0, bytes_produced = 0;
 
-	decoder_error_clear (&data->error);
+	/* Samples are handed out as FFmpeg decodes them, MOC converts them
+	 * if needed. */
+	return data->fmt | SFMT_NE;
+}
 
-	if (data->eos)
-		return 0;
+static int ffmpeg_decode_frames (void *prv_data, struct decoder_buf *buf,
+                                 struct sound_params *sound_params,
+                                 int64_t *pos)
+{
+	struct ffmpeg_data *data = (struct ffmpeg_data *)prv_data;
+	int bytes_used = 0, frames = 0;
+	bool decoded = false;
+
+	decoder_error_clear (&data->error);
 
 	/* FFmpeg claims to always return native endian. */
 	sound_params->channels = data->enc->channels;
 	sound_params->rate = data->enc->sample_rate;
 	sound_params->fmt = data->fmt | SFMT_NE;
 
+	*pos = -1;
+
 #if SEEK_IN_DECODER
 	if (data->seek_req) {
 		data->seek_req = false;
 		if (seek_in_stream (data))
-			free_remain_buf (data);
+			drop_decoded (data);
 	}
 #endif
 
-	if (data->remain_buf)
-		return take_from_remain_buf (data, buf, buf_len);
-
-	do {
-		uint8_t *saved_pkt_data_ptr;
-		AVPacket *pkt;
+	/* Hand out all frames of the packet, take the next packet only if
+	 * nothing has been produced yet. */
+	while (true) {
+		if (frame_bytes_left (data) > 0) {
+			int copied = take_from_frame (data, buf, frames);
 
-		pkt = get_packet (data);
-		if (!pkt)
-			break;
-
-		if (pkt->stream_index != data->stream->index) {
-			free_packet (pkt);
+			if (copied == 0)
+				break;
+			frames += copied;
 			continue;
 		}
 
+		if (!data->pkt) {
+			if (frames || data->eos)
+				break;
+
+			data->pkt = get_packet (data);
+			if (!data->pkt)
+				break;
+			data->pkt_data = data->pkt->data;
+
+			if (data->pkt->stream_index != data->stream->index) {
+				drop_packet (data);
+				continue;
+			}
+
 #ifdef AV_PKT_FLAG_CORRUPT
-		if (pkt->flags & AV_PKT_FLAG_CORRUPT) {
-			ffmpeg_log_repeats (NULL);
-			debug ("Dropped corrupt packet.");
-			free_packet (pkt);
-			continue;
-		}
+			if (data->pkt->flags & AV_PKT_FLAG_CORRUPT) {
+				ffmpeg_log_repeats (NULL);
+				debug ("Dropped corrupt packet.");
+				drop_packet (data);
+				continue;
+			}
 #endif
 
-		saved_pkt_data_ptr = pkt->data;
-		bytes_used += pkt->size;
+			bytes_used += data->pkt->size;
+			decoded = true;
+		}
 
-		bytes_produced = decode_packet (data, pkt, buf, buf_len);
-		buf += bytes_produced;
-		buf_len -= bytes_produced;
+		decode_frame (data);
+	}
 
-		/* FFmpeg will segfault if the data pointer is not restored. */
-		pkt->data = saved_pkt_data_ptr;
-		free_packet (pkt);
-	} while (!bytes_produced && !data->eos);
+	if (decoded && !data->timing_broken) {
+		int bytes_produced = frames * data->sample_width
+		                            * data->enc->channels;
 
-	if (!data->timing_broken)
 		data->bitrate = compute_bitrate (sound_params, bytes_used,
-		                                 bytes_produced + data->remain_buf_len,
+		                                 bytes_produced + frame_bytes_left (data),
 		                                 data->bitrate);
+	}
 
-	return bytes_produced;
+	return frames;
 }
 
 static int ffmpeg_seek (void *prv_data, int sec)
@@ -1317,7 +1401,7 @@ static int ffmpeg_seek (void *prv_data, int sec)
 	if (!seek_in_stream (data, sec))
 		return -1;
 
-	free_remain_buf (data);
+	drop_decoded (data);
 
 #endif
 
@@ -1337,6 +1421,12 @@ static void ffmpeg_close (void *prv_data)
 	}
 
 	if (data->okay) {
+		drop_packet (data);
+#ifdef HAVE_AV_FRAME_FNS
+		av_frame_free (&data->frame);
+#else
+		avcodec_free_frame (&data->frame);
+#endif
 #ifdef HAVE_AVCODEC_FREE_CONTEXT
 		avcodec_free_context (&data->enc);
 #else
@@ -1344,7 +1434,6 @@ static void ffmpeg_close (void *prv_data)
 		av_freep (&data->enc);
 #endif
 		avformat_close_input (&data->ic);
-		free_remain_buf (data);
 	}
 
 	ffmpeg_log_repeats (NULL);
@@ -1423,6 +1512,14 @@ static void ffmpeg_get_error (void *prv_data, struct decoder_error *error)
 	decoder_error_copy (error, &data->error);
 }
 
+static void ffmpeg_get_extns (lists_t_strs *extns)
+{
+	int ix;
+
+	for (ix = 0; ix < lists_strs_size (supported_extns); ix += 1)
+		lists_strs_append (extns, lists_strs_at (supported_extns, ix));
+}
+
 static struct decoder ffmpeg_decoder = {
 	DECODER_API_VERSION,
 	ffmpeg_init,
@@ -1431,7 +1528,7 @@ static struct decoder ffmpeg_decoder = {
 	ffmpeg_open_stream,
 	ffmpeg_can_decode,
 	ffmpeg_close,
-	ffmpeg_decode,
+	NULL,
 	ffmpeg_seek,
 	ffmpeg_info,
 	ffmpeg_get_bitrate,
@@ -1442,7 +1539,11 @@ static struct decoder ffmpeg_decoder = {
 	NULL,
 	NULL,
 	ffmpeg_get_iostream,
-	ffmpeg_get_avg_bitrate
+	ffmpeg_get_avg_bitrate,
+	ffmpeg_get_extns,
+	supported_magic,
+	ffmpeg_set_format,
+	ffmpeg_decode_frames
 };
 
 struct decoder *plugin_init ()
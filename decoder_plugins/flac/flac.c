@@ -18,7 +18,11 @@
 #include <string.h>
 #include <FLAC/all.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /*#define DEBUG*/
 
@@ -29,11 +33,6 @@
 #include "log.h"
 #include "io.h"
 
-#define MAX_SUPPORTED_CHANNELS		2
-
-#define SAMPLES_PER_WRITE		512
-#define SAMPLE_BUFFER_SIZE ((FLAC__MAX_BLOCK_SIZE + SAMPLES_PER_WRITE) * MAX_SUPPORTED_CHANNELS * (32/8))
-
 struct flac_data
 {
 	FLAC__StreamDecoder *decoder;
@@ -45,8 +44,17 @@ struct flac_data
 	unsigned int length;
 	FLAC__uint64 total_samples;
 
-	FLAC__byte sample_buffer[SAMPLE_BUFFER_SIZE];
-	unsigned int sample_buffer_fill;
+	/* Decoded frame which didn't fit in the caller's buffer, read from
+	 * sample_buffer_pos up to sample_buffer_fill. */
+	FLAC__byte *sample_buffer;
+	size_t sample_buffer_size;
+	size_t sample_buffer_pos;
+	size_t sample_buffer_fill;
+
+	/* The caller's buffer while decoding in flac_decode(). */
+	char *out_buf;
+	size_t out_size;
+	size_t out_fill;
 
 	/* sound parameters */
 	unsigned int bits_per_sample;
@@ -59,49 +67,141 @@ struct flac_data
 	struct decoder_error error;
 };
 
-/* Convert FLAC big-endian data into PCM little-endian. */
-static size_t pack_pcm_signed (FLAC__byte *data,
-		const FLAC__int32 * const input[], unsigned int wide_samples,
-		unsigned int channels, unsigned int bps)
+/* Size of a sample in the output format for the given bits per sample. */
+static unsigned int sample_bytes (const unsigned int bps)
+{
+	if (bps <= 8)
+		return 1;
+	if (bps <= 16)
+		return 2;
+	return 4;
+}
+
+static void pack_s8 (int8_t *out, const FLAC__int32 * const input[],
+		const unsigned int wide_samples, const unsigned int channels,
+		const unsigned int shift)
 {
-	FLAC__byte * const start = data;
-	FLAC__int32 sample;
-	const FLAC__int32 *input_;
-	unsigned int samples, channel;
-	unsigned int bytes_per_sample;
-	unsigned int incr;
-
-	if (bps == 24)
-		bps = 32; /* we encode to 32-bit words */
-	bytes_per_sample = bps / 8;
-	incr = bytes_per_sample * channels;
+	unsigned int i, channel;
 
 	for (channel = 0; channel < channels; channel++) {
-		samples = wide_samples;
-		data = start + bytes_per_sample * channel;
-		input_ = input[channel];
-
-		while(samples--) {
-			sample = *input_++;
-
-			switch(bps) {
-				case 8:
-					data[0] = sample;
-					break;
-				case 16:
-					data[1] = (FLAC__byte)(sample >> 8);
-					data[0] = (FLAC__byte)sample;
-					break;
-				case 32:
-					data[3] = (FLAC__byte)(sample >> 16);
-					data[2] = (FLAC__byte)(sample >> 8);
-					data[1] = (FLAC__byte)sample;
-					data[0] = 0;
-					break;
-			}
+		const FLAC__int32 *in = input[channel];
+
+		for (i = 0; i < wide_samples; i++)
+			out[i * channels + channel] = (FLAC__uint32)in[i] << shift;
+	}
+}
+
+static void pack_s16 (int16_t *out, const FLAC__int32 * const input[],
+		const unsigned int wide_samples, const unsigned int channels,
+		const unsigned int shift)
+{
+	unsigned int i = 0, channel;
+
+#ifdef __SSE2__
+	const __m128i count = _mm_cvtsi32_si128 (shift);
+
+	if (channels == 1) {
+		for (; i + 8 <= wide_samples; i += 8) {
+			__m128i a = _mm_loadu_si128 ((const __m128i *)(input[0] + i));
+			__m128i b = _mm_loadu_si128 ((const __m128i *)(input[0] + i + 4));
+
+			a = _mm_sll_epi32 (a, count);
+			b = _mm_sll_epi32 (b, count);
+			_mm_storeu_si128 ((__m128i *)(out + i), _mm_packs_epi32 (a, b));
+		}
+	}
+	else if (channels == 2) {
+		for (; i + 4 <= wide_samples; i += 4) {
+			__m128i l = _mm_loadu_si128 ((const __m128i *)(input[0] + i));
+			__m128i r = _mm_loadu_si128 ((const __m128i *)(input[1] + i));
+
+			l = _mm_sll_epi32 (l, count);
+			r = _mm_sll_epi32 (r, count);
+			_mm_storeu_si128 ((__m128i *)(out + i * 2),
+					_mm_packs_epi32 (_mm_unpacklo_epi32 (l, r),
+						_mm_unpackhi_epi32 (l, r)));
+		}
+	}
+#endif
+
+	if (channels == 2) {
+		for (; i < wide_samples; i++) {
+			out[i * 2] = (FLAC__uint32)input[0][i] << shift;
+			out[i * 2 + 1] = (FLAC__uint32)input[1][i] << shift;
+		}
+		return;
+	}
+
+	for (channel = 0; channel < channels; channel++) {
+		const FLAC__int32 *in = input[channel];
+		unsigned int j;
+
+		for (j = i; j < wide_samples; j++)
+			out[j * channels + channel] = (FLAC__uint32)in[j] << shift;
+	}
+}
+
+static void pack_s32 (int32_t *out, const FLAC__int32 * const input[],
+		const unsigned int wide_samples, const unsigned int channels,
+		const unsigned int shift)
+{
+	unsigned int i = 0, channel;
+
+#ifdef __SSE2__
+	const __m128i count = _mm_cvtsi32_si128 (shift);
+
+	if (channels == 2) {
+		for (; i + 4 <= wide_samples; i += 4) {
+			__m128i l = _mm_loadu_si128 ((const __m128i *)(input[0] + i));
+			__m128i r = _mm_loadu_si128 ((const __m128i *)(input[1] + i));
+
+			l = _mm_sll_epi32 (l, count);
+			r = _mm_sll_epi32 (r, count);
+			_mm_storeu_si128 ((__m128i *)(out + i * 2),
+					_mm_unpacklo_epi32 (l, r));
+			_mm_storeu_si128 ((__m128i *)(out + i * 2 + 4),
+					_mm_unpackhi_epi32 (l, r));
+		}
+	}
+#endif
 
-			data += incr;
+	if (channels == 2) {
+		for (; i < wide_samples; i++) {
+			out[i * 2] = (FLAC__uint32)input[0][i] << shift;
+			out[i * 2 + 1] = (FLAC__uint32)input[1][i] << shift;
 		}
+		return;
+	}
+
+	for (channel = 0; channel < channels; channel++) {
+		const FLAC__int32 *in = input[channel];
+		unsigned int j;
+
+		for (j = i; j < wide_samples; j++)
+			out[j * channels + channel] = (FLAC__uint32)in[j] << shift;
+	}
+}
+
+/* Interleave the channels into native endian samples of sample_bytes()
+ * size with the bits in the most significant part.  Return the number of
+ * bytes written. */
+static size_t pack_pcm_signed (FLAC__byte *data,
+		const FLAC__int32 * const input[], unsigned int wide_samples,
+		unsigned int channels, unsigned int bps)
+{
+	const unsigned int bytes_per_sample = sample_bytes (bps);
+	const unsigned int shift = bytes_per_sample * 8 - bps;
+
+	switch (bytes_per_sample) {
+		case 1:
+			pack_s8 ((int8_t *)data, input, wide_samples, channels, shift);
+			break;
+		case 2:
+			pack_s16 ((int16_t *)data, input, wide_samples, channels, shift);
+			break;
+		case 4:
+			pack_s32 ((int32_t *)data, input, wide_samples, channels, shift);
+			break;
 	}
 
 	debug ("Converted %u bytes", wide_samples * channels * bytes_per_sample);
@@ -116,10 +216,35 @@ static FLAC__StreamDecoderWriteStatus write_cb (
 {
 	struct flac_data *data = (struct flac_data *)client_data;
 	const unsigned int wide_samples = frame->header.blocksize;
+	size_t size;
 
 	if (data->abort)
 		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 
+	if (frame->header.channels != data->channels) {
+		decoder_error (&data->error, ERROR_FATAL, 0,
+				"FLAC: number of channels changed");
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+	}
+
+	size = (size_t)wide_samples * data->channels
+		* sample_bytes (data->bits_per_sample);
+
+	/* Avoid copying if the frame fits in the caller's buffer. */
+	if (data->out_buf && size <= data->out_size) {
+		data->out_fill = pack_pcm_signed ((FLAC__byte *)data->out_buf,
+				buffer, wide_samples, data->channels,
+				data->bits_per_sample);
+		return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+	}
+
+	if (size > data->sample_buffer_size) {
+		data->sample_buffer = (FLAC__byte *)xrealloc (data->sample_buffer,
+				size);
+		data->sample_buffer_size = size;
+	}
+
+	data->sample_buffer_pos = 0;
 	data->sample_buffer_fill = pack_pcm_signed (
 			data->sample_buffer, buffer, wide_samples,
 			data->channels, data->bits_per_sample);
@@ -242,7 +367,13 @@ static void *flac_open_internal (const char *file, const int buffered)
 	data->bitrate = -1;
 	data->avg_bitrate = -1;
 	data->abort = 0;
+	data->sample_buffer = NULL;
+	data->sample_buffer_size = 0;
+	data->sample_buffer_pos = 0;
 	data->sample_buffer_fill = 0;
+	data->out_buf = NULL;
+	data->out_size = 0;
+	data->out_fill = 0;
 	data->last_decode_position = 0;
 	data->length = -1;
 	data->ok = 0;
@@ -311,6 +442,7 @@ static void flac_close (void *void_data)
 
 	io_close (data->stream);
 	decoder_error_clear (&data->error);
+	free (data->sample_buffer);
 	free (data);
 }
 
@@ -445,17 +577,17 @@ static int flac_decode (void *void_data, char *buf, int buf_len,
 	int bytes_per_sample;
 	FLAC__uint64 decode_position;
 
-	bytes_per_sample = data->bits_per_sample / 8;
+	bytes_per_sample = sample_bytes (data->bits_per_sample);
 
 	switch (bytes_per_sample) {
 		case 1:
 			sound_params->fmt = SFMT_S8;
 			break;
 		case 2:
-			sound_params->fmt = SFMT_S16 | SFMT_LE;
+			sound_params->fmt = SFMT_S16 | SFMT_NE;
 			break;
-		case 3:
-			sound_params->fmt = SFMT_S32 | SFMT_LE;
+		case 4:
+			sound_params->fmt = SFMT_S32 | SFMT_NE;
 			break;
 	}
 
@@ -464,7 +596,9 @@ static int flac_decode (void *void_data, char *buf, int buf_len,
 
 	decoder_error_clear (&data->error);
 
-	if (!data->sample_buffer_fill) {
+	if (data->sample_buffer_pos == data->sample_buffer_fill) {
+		size_t decoded;
+
 		debug ("decoding...");
 
 		if (FLAC__stream_decoder_get_state(data->decoder) == FLAC__STREAM_DECODER_END_OF_STREAM) {
@@ -472,38 +606,52 @@ static int flac_decode (void *void_data, char *buf, int buf_len,
 			return 0;
 		}
 
+		data->sample_buffer_pos = 0;
+		data->sample_buffer_fill = 0;
+		data->out_buf = buf;
+		data->out_size = buf_len;
+		data->out_fill = 0;
+
 		if (!FLAC__stream_decoder_process_single(data->decoder)) {
+			data->out_buf = NULL;
 			decoder_error (&data->error, ERROR_FATAL, 0,
 					"Read error processing frame.");
 			return 0;
 		}
 
+		data->out_buf = NULL;
+		decoded = data->out_fill + data->sample_buffer_fill;
+
 		/* Count the bitrate */
 		if(!FLAC__stream_decoder_get_decode_position(data->decoder, &decode_position))
 			decode_position = 0;
-		if (decode_position > data->last_decode_position) {
+		if (decode_position > data->last_decode_position && decoded) {
 			int bytes_per_sec = bytes_per_sample * data->sample_rate
 				* data->channels;
 
 			data->bitrate = (decode_position
 				- data->last_decode_position) * 8.0
-				/ (data->sample_buffer_fill
-						/ (float)bytes_per_sec)
+				/ (decoded / (float)bytes_per_sec)
 				/ 1000;
 		}
 
 		data->last_decode_position = decode_position;
+
+		if (data->out_fill) {
+			debug ("Decoded %zu bytes", data->out_fill);
+			return data->out_fill;
+		}
 	}
 	else
 		debug ("Some date remain in the buffer.");
 
-	debug ("Decoded %d bytes", data->sample_buffer_fill);
+	debug ("Decoded %zu bytes",
+			data->sample_buffer_fill - data->sample_buffer_pos);
 
-	to_copy = MIN((unsigned int)buf_len, data->sample_buffer_fill);
-	memcpy (buf, data->sample_buffer, to_copy);
-	memmove (data->sample_buffer, data->sample_buffer + to_copy,
-			data->sample_buffer_fill - to_copy);
-	data->sample_buffer_fill -= to_copy;
+	to_copy = MIN((size_t)buf_len,
+			data->sample_buffer_fill - data->sample_buffer_pos);
+	memcpy (buf, data->sample_buffer + data->sample_buffer_pos, to_copy);
+	data->sample_buffer_pos += to_copy;
 
 	return to_copy;
 }
@@ -558,6 +706,12 @@ static void flac_get_error (void *prv_data, struct decoder_error *error)
 	decoder_error_copy (error, &data->error);
 }
 
+static void flac_get_extns (lists_t_strs *extns)
+{
+	lists_strs_append (extns, "flac");
+	lists_strs_append (extns, "fla");
+}
+
 static struct decoder flac_decoder = {
 	DECODER_API_VERSION,
 	NULL,
@@ -577,7 +731,11 @@ static struct decoder flac_decoder = {
 	flac_get_name,
 	NULL,
 	NULL,
-	flac_get_avg_bitrate
+	flac_get_avg_bitrate,
+	flac_get_extns,
+	NULL,
+	NULL,
+	NULL
 };
 
 struct decoder *plugin_init ()
@@ -285,6 +285,13 @@ static void modplug_get_error (void *prv_data, struct decoder_error *error)
   decoder_error_copy (error, &data->error);
 }
 
+static void modplug_get_extns (lists_t_strs *extns)
+{
+  lists_strs_tokenise (extns, "NONE MOD S3M XM MED MTM IT 669 ULT STM FAR "
+                              "AMF AMS DSM MDL OKT DMF PTM DBM MT2 AMF0 PSM "
+                              "J2B UMX");
+}
+
 static struct decoder modplug_decoder =
 {
   DECODER_API_VERSION,
@@ -305,6 +312,10 @@ static struct decoder modplug_decoder =
   NULL,
   NULL,
   NULL,
+  NULL,
+  modplug_get_extns,
+  NULL,
+  NULL,
   NULL
 };
 
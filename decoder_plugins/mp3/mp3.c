@@ -33,6 +33,9 @@
 #ifdef HAVE_ICONV
 # include <iconv.h>
 #endif
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
 
 #define DEBUG
 
@@ -62,6 +65,9 @@ struct mp3_data
 	signed long duration;	/* Total time of the file in seconds
 	                           (used for seeking). */
 	off_t size;				/* Size of the file */
+	long fmt;				/* Format of the output */
+	unsigned int pcm_left;	/* frames of the synthesized sound not
+				   written yet */
 
 	unsigned char in_buff[INPUT_BUFFER + MAD_BUFFER_GUARD];
 
@@ -184,7 +190,10 @@ static char *get_tag (struct id3_tag *tag, const char *what)
 	return comm;
 }
 
-static int count_time_internal (struct mp3_data *data)
+/* Return the duration of the file in seconds or -1 if it's unknown.  If
+ * count_frames is 0, the frames of a VBR file without a Xing header are
+ * not counted, because that would read the whole file. */
+static int count_time_internal (struct mp3_data *data, const int count_frames)
 {
 	struct xing xing;
 	unsigned long bitrate = 0;
@@ -269,6 +278,12 @@ static int count_time_internal (struct mp3_data *data)
 			break;
 		}
 
+		if (is_vbr && !count_frames) {
+			debug ("VBR file without the number of frames");
+			mad_header_finish (&header);
+			return -1;
+		}
+
 		mad_timer_add (&duration, header.duration);
 	}
 
@@ -322,6 +337,26 @@ static int count_time_internal (struct mp3_data *data)
 	return mad_timer_count (duration, MAD_UNITS_SECONDS);
 }
 
+/* Get the duration of the file and seek back to the beginning. */
+static void read_duration (struct mp3_data *data, const int count_frames)
+{
+	data->duration = count_time_internal (data, count_frames);
+	mad_frame_mute (&data->frame);
+	data->stream.next_frame = NULL;
+	data->stream.sync = 0;
+	data->stream.error = MAD_ERROR_NONE;
+
+	if (io_seek(data->io_stream, 0, SEEK_SET) == -1) {
+		decoder_error (&data->error, ERROR_FATAL, 0, "seek failed");
+		mad_stream_finish (&data->stream);
+		mad_frame_finish (&data->frame);
+		mad_synth_finish (&data->synth);
+		data->ok = 0;
+	}
+
+	data->stream.error = MAD_ERROR_BUFLEN;
+}
+
 static struct mp3_data *mp3_open_internal (const char *file,
 		const int buffered)
 {
@@ -337,6 +372,8 @@ static struct mp3_data *mp3_open_internal (const char *file,
 	data->skip_frames = 0;
 	data->bitrate = -1;
 	data->avg_bitrate = -1;
+	data->fmt = SFMT_S16 | SFMT_NE;
+	data->pcm_left = 0;
 
 	/* Open the file */
 	data->io_stream = io_open (file, buffered);
@@ -353,21 +390,7 @@ static struct mp3_data *mp3_open_internal (const char *file,
 				mad_stream_options (&data->stream,
 					MAD_OPTION_IGNORECRC);
 
-		data->duration = count_time_internal (data);
-		mad_frame_mute (&data->frame);
-		data->stream.next_frame = NULL;
-		data->stream.sync = 0;
-		data->stream.error = MAD_ERROR_NONE;
-
-		if (io_seek(data->io_stream, 0, SEEK_SET) == -1) {
-			decoder_error (&data->error, ERROR_FATAL, 0, "seek failed");
-			mad_stream_finish (&data->stream);
-			mad_frame_finish (&data->frame);
-			mad_synth_finish (&data->synth);
-			data->ok = 0;
-		}
-
-		data->stream.error = MAD_ERROR_BUFLEN;
+		read_duration (data, 1);
 	}
 	else {
 		decoder_error (&data->error, ERROR_FATAL, 0, "Can't open: %s",
@@ -395,9 +418,12 @@ static void *mp3_open_stream (struct io_stream *stream)
 	data->channels = 0;
 	data->skip_frames = 0;
 	data->bitrate = -1;
+	data->avg_bitrate = -1;
 	data->io_stream = stream;
 	data->duration = -1;
 	data->size = -1;
+	data->fmt = SFMT_S16 | SFMT_NE;
+	data->pcm_left = 0;
 
 	mad_stream_init (&data->stream);
 	mad_frame_init (&data->frame);
@@ -407,6 +433,13 @@ static void *mp3_open_stream (struct io_stream *stream)
 			mad_stream_options (&data->stream,
 				MAD_OPTION_IGNORECRC);
 
+	/* A file served over HTTP with range requests.  Only the first
+	 * frames are downloaded to get the duration. */
+	if (io_seekable (stream)) {
+		data->size = io_file_size (stream);
+		read_duration (data, 0);
+	}
+
 	return data;
 }
 
@@ -489,47 +522,186 @@ static inline int32_t round_sample (mad_fixed_t sample)
 	return sample >> (MAD_F_FRACBITS + 1 - 24);
 }
 
-static int put_output (char *buf, int buf_len, struct mad_pcm *pcm,
-		struct mad_header *header)
+static inline int16_t round_sample_s16 (mad_fixed_t sample)
 {
-	unsigned int nsamples;
-	mad_fixed_t const *left_ch, *right_ch;
-	int olen;
+	sample += 1L << (MAD_F_FRACBITS - 16);
 
-	nsamples = pcm->length;
-	left_ch = pcm->samples[0];
-	right_ch = pcm->samples[1];
-	olen = nsamples * MAD_NCHANNELS (header) * 4;
+	sample = CLAMP(-MAD_F_ONE, sample, MAD_F_ONE - 1);
 
-	if (olen > buf_len) {
-		logit ("PCM buffer to small!");
-		return 0;
+	return sample >> (MAD_F_FRACBITS + 1 - 16);
+}
+
+static inline float sample_to_float (mad_fixed_t sample)
+{
+	float f = sample * (1.0f / MAD_F_ONE);
+
+	return CLAMP(-1.0f, f, 1.0f);
+}
+
+#ifdef __SSE2__
+/* The rounding and clamping of round_sample_s16() is done by saturation
+ * when packing. */
+static inline __m128i round_4_s16 (const mad_fixed_t *in)
+{
+	const __m128i half = _mm_set1_epi32 (1L << (MAD_F_FRACBITS - 16));
+	__m128i v = _mm_loadu_si128 ((const __m128i *)in);
+
+	return _mm_srai_epi32 (_mm_add_epi32 (v, half), MAD_F_FRACBITS + 1 - 16);
+}
+
+/* Clamping is done on floats, which are exact in the 24-bit range. */
+static inline __m128i round_4_s32 (const mad_fixed_t *in)
+{
+	const __m128i half = _mm_set1_epi32 (1L << (MAD_F_FRACBITS - 24));
+	__m128i v = _mm_loadu_si128 ((const __m128i *)in);
+	__m128 f;
+
+	v = _mm_srai_epi32 (_mm_add_epi32 (v, half), MAD_F_FRACBITS + 1 - 24);
+	f = _mm_max_ps (_mm_cvtepi32_ps (v), _mm_set1_ps (-8388608.0f));
+	f = _mm_min_ps (f, _mm_set1_ps (8388607.0f));
+
+	return _mm_slli_epi32 (_mm_cvttps_epi32 (f), 8);
+}
+
+static inline __m128 round_4_float (const mad_fixed_t *in)
+{
+	const __m128 scale = _mm_set1_ps (1.0f / MAD_F_ONE);
+	__m128i v = _mm_loadu_si128 ((const __m128i *)in);
+	__m128 f = _mm_mul_ps (_mm_cvtepi32_ps (v), scale);
+
+	f = _mm_max_ps (f, _mm_set1_ps (-1.0f));
+
+	return _mm_min_ps (f, _mm_set1_ps (1.0f));
+}
+#endif
+
+/* Convert and interleave the samples, right is NULL for mono. */
+static void put_s16 (int16_t *out, const mad_fixed_t *left,
+		const mad_fixed_t *right, const unsigned int nsamples)
+{
+	unsigned int i = 0;
+
+#ifdef __SSE2__
+	if (right) {
+		for (; i + 4 <= nsamples; i += 4) {
+			__m128i l = round_4_s16 (left + i);
+			__m128i r = round_4_s16 (right + i);
+
+			_mm_storeu_si128 ((__m128i *)(out + i * 2),
+					_mm_packs_epi32 (_mm_unpacklo_epi32 (l, r),
+						_mm_unpackhi_epi32 (l, r)));
+		}
 	}
+	else {
+		for (; i + 8 <= nsamples; i += 8)
+			_mm_storeu_si128 ((__m128i *)(out + i),
+					_mm_packs_epi32 (round_4_s16 (left + i),
+						round_4_s16 (left + i + 4)));
+	}
+#endif
 
-	while (nsamples--) {
-		long sample0 = round_sample (*left_ch++);
+	for (; i < nsamples; i += 1) {
+		if (right) {
+			out[i * 2] = round_sample_s16 (left[i]);
+			out[i * 2 + 1] = round_sample_s16 (right[i]);
+		}
+		else
+			out[i] = round_sample_s16 (left[i]);
+	}
+}
 
-		buf[0] = 0;
-		buf[1] = sample0;
-		buf[2] = sample0 >> 8;
-		buf[3] = sample0 >> 16;
-		buf += 4;
+static void put_s32 (int32_t *out, const mad_fixed_t *left,
+		const mad_fixed_t *right, const unsigned int nsamples)
+{
+	unsigned int i = 0;
+
+#ifdef __SSE2__
+	if (right) {
+		for (; i + 4 <= nsamples; i += 4) {
+			__m128i l = round_4_s32 (left + i);
+			__m128i r = round_4_s32 (right + i);
+
+			_mm_storeu_si128 ((__m128i *)(out + i * 2),
+					_mm_unpacklo_epi32 (l, r));
+			_mm_storeu_si128 ((__m128i *)(out + i * 2 + 4),
+					_mm_unpackhi_epi32 (l, r));
+		}
+	}
+	else {
+		for (; i + 4 <= nsamples; i += 4)
+			_mm_storeu_si128 ((__m128i *)(out + i),
+					round_4_s32 (left + i));
+	}
+#endif
+
+	for (; i < nsamples; i += 1) {
+		if (right) {
+			out[i * 2] = round_sample (left[i]) * 256;
+			out[i * 2 + 1] = round_sample (right[i]) * 256;
+		}
+		else
+			out[i] = round_sample (left[i]) * 256;
+	}
+}
 
-		if (MAD_NCHANNELS(header) == 2) {
-			long sample1;
+static void put_float (float *out, const mad_fixed_t *left,
+		const mad_fixed_t *right, const unsigned int nsamples)
+{
+	unsigned int i = 0;
 
-			sample1 = round_sample (*right_ch++);
+#ifdef __SSE2__
+	if (right) {
+		for (; i + 4 <= nsamples; i += 4) {
+			__m128 l = round_4_float (left + i);
+			__m128 r = round_4_float (right + i);
 
-			buf[0] = 0;
-			buf[1] = sample1;
-			buf[2] = sample1 >> 8;
-			buf[3] = sample1 >> 16;
+			_mm_storeu_ps (out + i * 2, _mm_unpacklo_ps (l, r));
+			_mm_storeu_ps (out + i * 2 + 4, _mm_unpackhi_ps (l, r));
+		}
+	}
+	else {
+		for (; i + 4 <= nsamples; i += 4)
+			_mm_storeu_ps (out + i, round_4_float (left + i));
+	}
+#endif
 
-			buf += 4;
+	for (; i < nsamples; i += 1) {
+		if (right) {
+			out[i * 2] = sample_to_float (left[i]);
+			out[i * 2 + 1] = sample_to_float (right[i]);
 		}
+		else
+			out[i] = sample_to_float (left[i]);
+	}
+}
+
+/* Write the next 'frames' frames of the synthesized sound in data->fmt. */
+static void put_output (struct mp3_data *data, char *buf, const int frames)
+{
+	struct mad_pcm *pcm = &data->synth.pcm;
+	const mad_fixed_t *left_ch, *right_ch;
+	unsigned int pos;
+
+	pos = pcm->length - data->pcm_left;
+	left_ch = pcm->samples[0] + pos;
+	right_ch = MAD_NCHANNELS (&data->frame.header) == 2
+		? pcm->samples[1] + pos : NULL;
+
+	switch (data->fmt & SFMT_MASK_FORMAT) {
+		case SFMT_S16:
+			put_s16 ((int16_t *)buf, left_ch, right_ch, frames);
+			break;
+		case SFMT_S32:
+			put_s32 ((int32_t *)buf, left_ch, right_ch, frames);
+			break;
+		case SFMT_FLOAT:
+			put_float ((float *)buf, left_ch, right_ch, frames);
+			break;
+		default:
+			fatal ("Unexpected sample format!");
 	}
 
-	return olen;
+	data->pcm_left -= frames;
 }
 
 /* If the current frame in the stream is an ID3 tag, then swallow it. */
@@ -548,13 +720,10 @@ static ssize_t flush_id3_tag (struct mp3_data *data)
 	return tag_size;
 }
 
-static int mp3_decode (void *void_data, char *buf, int buf_len,
-		struct sound_params *sound_params)
+/* Decode and synthesize the next frame.  Return 0 on EOF or a fatal
+ * error. */
+static int decode_frame (struct mp3_data *data)
 {
-	struct mp3_data *data = (struct mp3_data *)void_data;
-
-	decoder_error_clear (&data->error);
-
 	while (1) {
 
 		/* Fill the input buffer if needed */
@@ -594,17 +763,13 @@ static int mp3_decode (void *void_data, char *buf, int buf_len,
 			continue;
 		}
 
-		/* Sound parameters. */
-		if (!(sound_params->rate = data->frame.header.samplerate)) {
+		if (!data->frame.header.samplerate) {
 			decoder_error (&data->error, ERROR_FATAL, 0,
 					"Broken file: information about the"
 					" frequency couldn't be read.");
 			return 0;
 		}
 
-		sound_params->channels = MAD_NCHANNELS(&data->frame.header);
-		sound_params->fmt = SFMT_S32 | SFMT_LE;
-
 		/* Change of the bitrate? */
 		if (data->frame.header.bitrate != data->bitrate) {
 			if ((data->bitrate = data->frame.header.bitrate) == 0) {
@@ -617,12 +782,60 @@ static int mp3_decode (void *void_data, char *buf, int buf_len,
 
 		mad_synth_frame (&data->synth, &data->frame);
 		mad_stream_sync (&data->stream);
+		data->pcm_left = data->synth.pcm.length;
 
-		return put_output (buf, buf_len, &data->synth.pcm,
-				&data->frame.header);
+		return 1;
 	}
 }
 
+/* libmad's fixed point samples have to be converted to any format.  Float
+ * holds all their 24 bits and is offered only if the device plays it or
+ * the sound is resampled, so it's taken first, then the most precise of
+ * the others. */
+static long mp3_set_format (void *void_data, const long formats)
+{
+	struct mp3_data *data = (struct mp3_data *)void_data;
+
+	if (formats & SFMT_FLOAT)
+		data->fmt = SFMT_FLOAT | SFMT_NE;
+	else
+		data->fmt = sfmt_preferred (SFMT_S16 | SFMT_S32, formats);
+
+	return data->fmt;
+}
+
+/* Write the sound of the current frame, decoding the next one if it's all
+ * written.  A frame which doesn't fit in the buffer is written in parts. */
+static int mp3_decode_frames (void *void_data, struct decoder_buf *buf,
+		struct sound_params *sound_params, int64_t *pos)
+{
+	struct mp3_data *data = (struct mp3_data *)void_data;
+	int channels, frames;
+
+	decoder_error_clear (&data->error);
+	*pos = -1;
+
+	if (!data->pcm_left && !decode_frame (data))
+		return 0;
+
+	channels = MAD_NCHANNELS (&data->frame.header);
+	sound_params->rate = data->frame.header.samplerate;
+	sound_params->channels = channels;
+	sound_params->fmt = data->fmt;
+
+	frames = buf->size / (sfmt_Bps (data->fmt) * channels);
+	frames = MIN(frames, buf->frames);
+	frames = MIN(frames, (int)data->pcm_left);
+	if (frames == 0) {
+		logit ("PCM buffer to small!");
+		return 0;
+	}
+
+	put_output (data, buf->data, frames);
+
+	return frames;
+}
+
 static int mp3_seek (void *void_data, int sec)
 {
 	struct mp3_data *data = (struct mp3_data *)void_data;
@@ -655,6 +868,7 @@ static int mp3_seek (void *void_data, int sec)
 
 	mad_frame_mute (&data->frame);
 	mad_synth_mute (&data->synth);
+	data->pcm_left = 0;
 
 	data->stream.sync = 0;
 	data->stream.next_frame = NULL;
@@ -774,6 +988,23 @@ static void mp3_destroy ()
 		log_errno ("iconv_close() failed", errno);
 }
 
+static void mp3_get_extns (lists_t_strs *extns)
+{
+	lists_strs_append (extns, "mp3");
+	lists_strs_append (extns, "mpga");
+	lists_strs_append (extns, "mp2");
+	lists_strs_append (extns, "mp1");
+}
+
+/* Streams may start in the middle of a frame, so the frame headers are
+ * left to mp3_can_decode(). */
+static const struct decoder_magic mp3_magic[] = {
+	{ 0, 3, "ID3", 0 },
+	{ 0, 2, "\xff\xfb", 0 },
+	{ 0, 2, "\xff\xf3", 0 },
+	{ 0, 0, NULL, 0 }
+};
+
 static struct decoder mp3_decoder = {
 	DECODER_API_VERSION,
 	mp3_init,
@@ -782,7 +1013,7 @@ static struct decoder mp3_decoder = {
 	mp3_open_stream,
 	mp3_can_decode,
 	mp3_close,
-	mp3_decode,
+	NULL,
 	mp3_seek,
 	mp3_info,
 	mp3_get_bitrate,
@@ -793,7 +1024,11 @@ static struct decoder mp3_decoder = {
 	mp3_get_name,
 	NULL,
 	mp3_get_stream,
-	mp3_get_avg_bitrate
+	mp3_get_avg_bitrate,
+	mp3_get_extns,
+	mp3_magic,
+	mp3_set_format,
+	mp3_decode_frames
 };
 
 struct decoder *plugin_init ()
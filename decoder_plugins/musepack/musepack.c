@@ -469,6 +469,11 @@ static void musepack_get_error (void *prv_data, struct decoder_error *error)
 	decoder_error_copy (error, &data->error);
 }
 
+static void musepack_get_extns (lists_t_strs *extns)
+{
+	lists_strs_append (extns, "mpc");
+}
+
 static struct decoder musepack_decoder = {
 	DECODER_API_VERSION,
 	NULL,
@@ -488,7 +493,11 @@ static struct decoder musepack_decoder = {
 	musepack_get_name,
 	NULL /* musepack_current_tags */,
 	musepack_get_stream,
-	musepack_get_avg_bitrate
+	musepack_get_avg_bitrate,
+	musepack_get_extns,
+	NULL,
+	NULL,
+	NULL
 };
 
 struct decoder *plugin_init ()
@@ -537,6 +537,12 @@ extern "C" void destroy()
   }
 }
 
+extern "C" void sidplay2_get_extns(lists_t_strs *extns)
+{
+  lists_strs_append(extns, "sid");
+  lists_strs_append(extns, "mus");
+}
+
 static struct decoder sidplay2_decoder =
 {
   DECODER_API_VERSION,
@@ -557,6 +563,10 @@ static struct decoder sidplay2_decoder =
   NULL,
   NULL,
   NULL,
+  NULL,
+  sidplay2_get_extns,
+  NULL,
+  NULL,
   NULL
 };
 
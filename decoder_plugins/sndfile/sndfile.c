@@ -44,6 +44,7 @@ struct sndfile_data
 	SF_INFO snd_info;
 	struct decoder_error error;
 	bool timing_broken;
+	long fmt;		/* format of the decoded sound */
 };
 
 static lists_t_strs *supported_extns = NULL;
@@ -148,6 +149,7 @@ static void *sndfile_open (const char *file)
 	memset (&data->snd_info, 0, sizeof(data->snd_info));
 	data->sndfile = NULL;
 	data->timing_broken = false;
+	data->fmt = SFMT_FLOAT | SFMT_NE;
 
 	fd = open (file, O_RDONLY);
 	if (fd == -1) {
@@ -223,18 +225,84 @@ static int sndfile_seek (void *void_data, int sec)
 	return res / data->snd_info.samplerate;
 }
 
+/* Return the format in which libsndfile reads the file without
+ * conversion or with the least loss. */
+static long native_sfmt (const struct sndfile_data *data)
+{
+	switch (data->snd_info.format & SF_FORMAT_SUBMASK) {
+		case SF_FORMAT_PCM_S8:
+		case SF_FORMAT_PCM_U8:
+		case SF_FORMAT_PCM_16:
+			return SFMT_S16;
+		case SF_FORMAT_PCM_24:
+		case SF_FORMAT_PCM_32:
+			return SFMT_S32;
+		default:
+			return SFMT_FLOAT;
+	}
+}
+
+static long sndfile_set_format (void *void_data, const long formats)
+{
+	struct sndfile_data *data = (struct sndfile_data *)void_data;
+	long native = native_sfmt (data);
+
+	if (formats & native)
+		data->fmt = native | SFMT_NE;
+	else
+		data->fmt = sfmt_preferred (SFMT_S16 | SFMT_S32 | SFMT_FLOAT,
+		                            formats);
+
+	return data->fmt;
+}
+
+/* Read at most frames frames in data->fmt, return the number of frames
+ * read. */
+static sf_count_t read_frames (struct sndfile_data *data, char *buf,
+		const sf_count_t frames)
+{
+	switch (data->fmt & SFMT_MASK_FORMAT) {
+		case SFMT_S16:
+			return sf_readf_short (data->sndfile, (short *)buf, frames);
+		case SFMT_S32:
+			return sf_readf_int (data->sndfile, (int *)buf, frames);
+		default:
+			return sf_readf_float (data->sndfile, (float *)buf, frames);
+	}
+}
+
+static int sndfile_decode_frames (void *void_data, struct decoder_buf *buf,
+		struct sound_params *sound_params, int64_t *pos)
+{
+	struct sndfile_data *data = (struct sndfile_data *)void_data;
+	sf_count_t frames;
+
+	sound_params->channels = data->snd_info.channels;
+	sound_params->rate = data->snd_info.samplerate;
+	sound_params->fmt = data->fmt;
+
+	frames = buf->size / sfmt_Bps (data->fmt) / data->snd_info.channels;
+	frames = MIN(frames, buf->frames);
+
+	*pos = sf_seek (data->sndfile, 0, SEEK_CUR);
+
+	return read_frames (data, buf->data, frames);
+}
+
 static int sndfile_decode (void *void_data, char *buf, int buf_len,
 		struct sound_params *sound_params)
 {
 	struct sndfile_data *data = (struct sndfile_data *)void_data;
+	int bytes_per_frame;
 
 	sound_params->channels = data->snd_info.channels;
 	sound_params->rate = data->snd_info.samplerate;
-	sound_params->fmt = SFMT_FLOAT;
+	sound_params->fmt = data->fmt;
 
-	return sf_readf_float (data->sndfile, (float *)buf,
-			buf_len / sizeof(float) / data->snd_info.channels)
-		* sizeof(float) * data->snd_info.channels;
+	bytes_per_frame = sfmt_Bps (data->fmt) * data->snd_info.channels;
+
+	return read_frames (data, buf, buf_len / bytes_per_frame)
+		* bytes_per_frame;
 }
 
 static int sndfile_get_bitrate (void *unused ATTR_UNUSED)
@@ -285,6 +353,14 @@ static void sndfile_get_error (void *prv_data, struct decoder_error *error)
 	decoder_error_copy (error, &data->error);
 }
 
+static void sndfile_get_extns (lists_t_strs *extns)
+{
+	int ix;
+
+	for (ix = 0; ix < lists_strs_size (supported_extns); ix += 1)
+		lists_strs_append (extns, lists_strs_at (supported_extns, ix));
+}
+
 static struct decoder sndfile_decoder = {
 	DECODER_API_VERSION,
 	sndfile_init,
@@ -304,7 +380,11 @@ static struct decoder sndfile_decoder = {
 	sndfile_get_name,
 	NULL,
 	NULL,
-	NULL
+	NULL,
+	sndfile_get_extns,
+	NULL,
+	sndfile_set_format,
+	sndfile_decode_frames
 };
 
 struct decoder *plugin_init ()
@@ -678,6 +678,17 @@ static int spx_our_mime (const char *mime)
 		|| !strncasecmp (mime, "audio/speex;", 12);
 }
 
+static void spx_get_extns (lists_t_strs *extns)
+{
+	lists_strs_append (extns, "spx");
+}
+
+static const struct decoder_magic spx_magic[] = {
+	{ 0, 4, "OggS", DECODER_MAGIC_NEXT },
+	{ 28, 8, "Speex   ", DECODER_MAGIC_SURE },
+	{ 0, 0, NULL, 0 }
+};
+
 static struct decoder spx_decoder = {
 	DECODER_API_VERSION,
 	NULL,
@@ -697,6 +708,10 @@ static struct decoder spx_decoder = {
 	spx_get_name,
 	NULL /*spx_current_tags*/,
 	spx_get_stream,
+	NULL,
+	spx_get_extns,
+	spx_magic,
+	NULL,
 	NULL
 };
 
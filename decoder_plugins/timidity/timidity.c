@@ -184,6 +184,11 @@ static void timidity_destroy()
   mid_exit();
 }
 
+static void timidity_get_extns (lists_t_strs *extns)
+{
+  lists_strs_append (extns, "mid");
+}
+
 static struct decoder timidity_decoder =
 {
   DECODER_API_VERSION,
@@ -204,6 +209,10 @@ static struct decoder timidity_decoder =
   timidity_get_name,
   NULL,
   NULL,
+  NULL,
+  timidity_get_extns,
+  NULL,
+  NULL,
   NULL
 };
 
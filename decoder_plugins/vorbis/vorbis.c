@@ -20,6 +20,9 @@
 #include <stdio.h>
 #include <errno.h>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #ifndef HAVE_TREMOR
 #include <vorbis/vorbisfile.h>
 #include <vorbis/codec.h>
@@ -64,6 +67,10 @@ struct vorbis_data
 	int duration;
 	struct decoder_error error;
 	int ok; /* was this stream successfully opened? */
+	long fmt; /* format of the decoded sound */
+	float **pcm; /* floats from ov_read_float() */
+	int pcm_offset; /* first frame in pcm not written yet */
+	int pcm_left; /* number of frames in pcm not written yet */
 
 	int tags_change; /* the tags were changed from the last call of
 	                    ogg_current_tags() */
@@ -220,6 +227,8 @@ static void vorbis_open_stream_internal (struct vorbis_data *data)
 	};
 
 	data->tags = tags_new ();
+	data->fmt = SFMT_S16 | SFMT_NE;
+	data->pcm_left = 0;
 
 	res = ov_open_callbacks (data->stream, &data->vf, NULL, 0, callbacks);
 	if (res < 0) {
@@ -320,11 +329,101 @@ static int vorbis_seek (void *prv_data, int sec)
 
 	assert (sec >= 0);
 
+	data->pcm_left = 0;
+
 	return ov_time_seek (&data->vf, sec * time_scaler) ? -1 : sec;
 }
 
-static int vorbis_decode (void *prv_data, char *buf, int buf_len,
-		struct sound_params *sound_params)
+static long vorbis_set_format (void *prv_data, const long formats)
+{
+	struct vorbis_data *data = (struct vorbis_data *)prv_data;
+
+#ifndef HAVE_TREMOR
+	/* The sound is decoded to planar floats, it's cheaper to take them
+	 * if they are converted to float later anyway. */
+	if (formats & SFMT_FLOAT) {
+		data->fmt = SFMT_FLOAT | SFMT_NE;
+		return data->fmt;
+	}
+#endif
+
+	data->fmt = SFMT_S16 | SFMT_NE;
+
+	return data->fmt;
+}
+
+#ifndef HAVE_TREMOR
+/* Interleave count samples of each channel starting at offset. */
+static void interleave_float (float *out, float **pcm, const int offset,
+		const int channels, const int count)
+{
+	int sample = 0, ch;
+
+	if (channels == 2) {
+		const float *left = pcm[0] + offset;
+		const float *right = pcm[1] + offset;
+
+#ifdef __SSE2__
+		for (; sample + 4 <= count; sample += 4) {
+			__m128 l = _mm_loadu_ps (left + sample);
+			__m128 r = _mm_loadu_ps (right + sample);
+
+			_mm_storeu_ps (out + sample * 2, _mm_unpacklo_ps (l, r));
+			_mm_storeu_ps (out + sample * 2 + 4, _mm_unpackhi_ps (l, r));
+		}
+#endif
+		for (out += sample * 2; sample < count; sample += 1) {
+			*out++ = left[sample];
+			*out++ = right[sample];
+		}
+		return;
+	}
+
+	for (ch = 0; ch < channels; ch += 1) {
+		for (sample = 0; sample < count; sample += 1)
+			out[sample * channels + ch] = pcm[ch][offset + sample];
+	}
+}
+
+/* Read floats to the buffer, return the number of frames read, 0 on EOF
+ * or fatal error or a negative error code.  Frames which were read but
+ * didn't fit are written on the next call. */
+static int read_float (struct vorbis_data *data, struct decoder_buf *buf,
+		int channels, int *section)
+{
+	int frames;
+
+	if (data->pcm_left)
+		*section = data->last_section;
+	else {
+		frames = ov_read_float (&data->vf, &data->pcm,
+		                        MIN((int)(buf->size / sizeof(float)
+		                                  / channels), buf->frames),
+		                        section);
+		if (frames <= 0)
+			return frames;
+
+		data->pcm_offset = 0;
+		data->pcm_left = frames;
+	}
+
+	/* A new logical bitstream may have more channels. */
+	channels = ov_info (&data->vf, -1)->channels;
+	frames = buf->size / sizeof(float) / channels;
+	frames = MIN(frames, buf->frames);
+	frames = MIN(frames, data->pcm_left);
+
+	interleave_float ((float *)buf->data, data->pcm, data->pcm_offset,
+	                  channels, frames);
+	data->pcm_offset += frames;
+	data->pcm_left -= frames;
+
+	return frames;
+}
+#endif
+
+static int vorbis_decode_frames (void *prv_data, struct decoder_buf *buf,
+		struct sound_params *sound_params, int64_t *pos)
 {
 	struct vorbis_data *data = (struct vorbis_data *)prv_data;
 	int ret;
@@ -335,12 +434,27 @@ static int vorbis_decode (void *prv_data, char *buf, int buf_len,
 	decoder_error_clear (&data->error);
 
 	while (1) {
+		info = ov_info (&data->vf, -1);
+		assert (info != NULL);
+		*pos = ov_pcm_tell (&data->vf);
+		if (*pos >= 0)
+			*pos -= data->pcm_left;
+
 #ifndef HAVE_TREMOR
-		ret = ov_read(&data->vf, buf, buf_len,
-		              (SFMT_NE == SFMT_LE ? 0 : 1),
-		              2, 1, &current_section);
+		if ((data->fmt & SFMT_MASK_FORMAT) == SFMT_FLOAT)
+			ret = read_float (data, buf, info->channels,
+			                  &current_section);
+		else
+			ret = ov_read(&data->vf, buf->data,
+			              MIN(buf->size, (size_t)buf->frames * 2
+			                             * info->channels),
+			              (SFMT_NE == SFMT_LE ? 0 : 1),
+			              2, 1, &current_section);
 #else
-		ret = ov_read(&data->vf, buf, buf_len, &current_section);
+		ret = ov_read(&data->vf, buf->data,
+		              MIN(buf->size, (size_t)buf->frames * 2
+		                             * info->channels),
+		              &current_section);
 #endif
 		if (ret == 0)
 			return 0;
@@ -364,7 +478,11 @@ static int vorbis_decode (void *prv_data, char *buf, int buf_len,
 		assert (info != NULL);
 		sound_params->channels = info->channels;
 		sound_params->rate = info->rate;
-		sound_params->fmt = SFMT_S16 | SFMT_NE;
+		sound_params->fmt = data->fmt;
+
+		/* ov_read() returns bytes. */
+		if ((data->fmt & SFMT_MASK_FORMAT) == SFMT_S16)
+			ret /= 2 * info->channels;
 
 		/* Update the bitrate information */
 		bitrate = ov_bitrate_instant (&data->vf);
@@ -445,6 +563,18 @@ static int vorbis_our_mime (const char *mime)
 		|| !strncasecmp (mime, "application/x-ogg;", 18);
 }
 
+static void vorbis_get_extns (lists_t_strs *extns)
+{
+	lists_strs_append (extns, "ogg");
+	lists_strs_append (extns, "oga");
+}
+
+static const struct decoder_magic vorbis_magic[] = {
+	{ 0, 4, "OggS", DECODER_MAGIC_NEXT },
+	{ 28, 7, "\01vorbis", DECODER_MAGIC_SURE },
+	{ 0, 0, NULL, 0 }
+};
+
 static struct decoder vorbis_decoder = {
 	DECODER_API_VERSION,
 	NULL,
@@ -453,7 +583,7 @@ static struct decoder vorbis_decoder = {
 	vorbis_open_stream,
 	vorbis_can_decode,
 	vorbis_close,
-	vorbis_decode,
+	NULL,
 	vorbis_seek,
 	vorbis_tags,
 	vorbis_get_bitrate,
@@ -464,7 +594,11 @@ static struct decoder vorbis_decoder = {
 	vorbis_get_name,
 	vorbis_current_tags,
 	vorbis_get_stream,
-	vorbis_get_avg_bitrate
+	vorbis_get_avg_bitrate,
+	vorbis_get_extns,
+	vorbis_magic,
+	vorbis_set_format,
+	vorbis_decode_frames
 };
 
 struct decoder *plugin_init ()
@@ -112,15 +112,28 @@ int can_read_file (const char *file)
 }
 
 enum file_type file_type (const char *file)
+{
+	time_t mtime;
+
+	return file_type_mtime (file, &mtime);
+}
+
+/* Like file_type(), but also get the modification time of the file from
+ * the same stat() call ((time_t)-1 on error or for URLs). */
+enum file_type file_type_mtime (const char *file, time_t *mtime)
 {
 	struct stat file_stat;
 
 	assert (file != NULL);
+	assert (mtime != NULL);
+
+	*mtime = (time_t)-1;
 
 	if (is_url(file))
 		return F_URL;
 	if (stat(file, &file_stat) == -1)
 		return F_OTHER; /* Ignore the file if stat() failed */
+	*mtime = file_stat.st_mtime;
 	if (S_ISDIR(file_stat.st_mode))
 		return F_DIR;
 	if (is_sound_file(file))
@@ -172,7 +185,7 @@ void make_file_title (struct plist *plist, const int num,
 	assert (LIMIT(num, plist->num));
 	assert (!plist_deleted (plist, num));
 
-	if (file_type (plist->items[num].file) != F_URL) {
+	if (!is_url (plist->items[num].file)) {
 		char *file = xstrdup (plist->items[num].file);
 
 		if (hide_extension) {
@@ -207,7 +220,7 @@ void make_tags_title (struct plist *plist, const int num)
 	assert (LIMIT(num, plist->num));
 	assert (!plist_deleted (plist, num));
 
-	if (file_type (plist->items[num].file) == F_URL) {
+	if (is_url (plist->items[num].file)) {
 		make_file_title (plist, num, false);
 		return;
 	}
@@ -366,54 +379,72 @@ struct file_tags *read_file_tags (const char *file,
 	return tags;
 }
 
-/* Read the content of the directory, make an array of absolute paths for
- * all recognized files. Put directories, playlists and sound files
- * in proper structures. Return 0 on error.*/
-int read_directory (const char *directory, lists_t_strs *dirs,
-		lists_t_strs *playlists, struct plist *plist)
+struct dir_reader
 {
 	DIR *dir;
-	struct dirent *entry;
-	bool show_hidden = options_get_bool ("ShowHiddenFiles");
-	int dir_is_root;
+	char *directory;
+	bool show_hidden;
+	bool is_root;
+};
+
+/* Open the directory for reading its content in parts with
+ * dir_reader_read().  Return NULL on error. */
+struct dir_reader *dir_reader_open (const char *directory)
+{
+	DIR *dir;
+	struct dir_reader *reader;
 
 	assert (directory != NULL);
 	assert (*directory == '/');
-	assert (dirs != NULL);
-	assert (playlists != NULL);
-	assert (plist != NULL);
 
 	if (!(dir = opendir(directory))) {
 		error_errno ("Can't read directory", errno);
-		return 0;
+		return NULL;
 	}
 
-	if (!strcmp(directory, "/"))
-		dir_is_root = 1;
-	else
-		dir_is_root = 0;
+	reader = (struct dir_reader *)xmalloc (sizeof(struct dir_reader));
+	reader->dir = dir;
+	reader->directory = xstrdup (directory);
+	reader->show_hidden = options_get_bool ("ShowHiddenFiles");
+	reader->is_root = !strcmp (directory, "/");
 
-	while ((entry = readdir(dir))) {
+	return reader;
+}
+
+/* Read at most max entries from the directory, putting absolute paths of
+ * directories, playlists and sound files in proper structures.  Return
+ * the number of entries read, 0 at the end of the directory or -1 on
+ * error. */
+int dir_reader_read (struct dir_reader *reader, lists_t_strs *dirs,
+		lists_t_strs *playlists, struct plist *plist, const int max)
+{
+	struct dirent *entry;
+	int count = 0;
+
+	assert (reader != NULL);
+	assert (dirs != NULL);
+	assert (playlists != NULL);
+	assert (plist != NULL);
+	assert (max > 0);
+
+	while (count < max && (entry = readdir(reader->dir))) {
 		int rc;
 		char file[PATH_MAX];
 		enum file_type type;
 
-		if (user_wants_interrupt()) {
-			error ("Interrupted! Not all files read!");
-			break;
-		}
+		count += 1;
 
 		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
 			continue;
-		if (!show_hidden && entry->d_name[0] == '.')
+		if (!reader->show_hidden && entry->d_name[0] == '.')
 			continue;
 
 		rc = snprintf(file, sizeof(file), "%s/%s",
-		              dir_is_root ? "" : directory, entry->d_name);
+		              reader->is_root ? "" : reader->directory,
+		              entry->d_name);
 		if (rc >= ssizeof(file)) {
 			error ("Path too long!");
-			closedir (dir);
-			return 0;
+			return -1;
 		}
 
 		type = file_type (file);
@@ -425,9 +456,16 @@ int read_directory (const char *directory, lists_t_strs *dirs,
 			lists_strs_append (playlists, file);
 	}
 
-	closedir (dir);
+	return count;
+}
 
-	return 1;
+void dir_reader_close (struct dir_reader *reader)
+{
+	assert (reader != NULL);
+
+	closedir (reader->dir);
+	free (reader->directory);
+	free (reader);
 }
 
 static int dir_symlink_loop (const ino_t inode_no, const ino_t *dir_stack,
@@ -11,14 +11,19 @@ extern "C" {
 
 #define FILES_LIST_INIT_SIZE	64
 
+struct dir_reader;
+
 void files_init ();
 void files_cleanup ();
-int read_directory (const char *directory, lists_t_strs *dirs,
-		lists_t_strs *playlists, struct plist *plist);
+struct dir_reader *dir_reader_open (const char *directory);
+int dir_reader_read (struct dir_reader *reader, lists_t_strs *dirs,
+		lists_t_strs *playlists, struct plist *plist, const int max);
+void dir_reader_close (struct dir_reader *reader);
 int read_directory_recurr (const char *directory, struct plist *plist);
 void resolve_path (char *buf, size_t size, const char *file);
 char *ext_pos (const char *file);
 enum file_type file_type (const char *file);
+enum file_type file_type_mtime (const char *file, time_t *mtime);
 char *file_mime_type (const char *file);
 int is_url (const char *str);
 char *read_line (FILE *file);
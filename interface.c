@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <dirent.h>
 #include <sys/select.h>
 
@@ -39,6 +40,7 @@
 #include "lists.h"
 #include "playlist.h"
 #include "playlist_file.h"
+#include "status_page.h"
 #include "protocol.h"
 #include "keys.h"
 #include "options.h"
@@ -50,9 +52,23 @@
 
 #define INTERFACE_LOG	"mocp_client_log"
 #define PLAYLIST_FILE	"playlist.m3u"
+#define PLAYLIST_SNAPSHOT_FILE	"playlist.snapshot"
+#define PLAYLIST_SNAPSHOT_DIR	"snapshots"
+#define PLAYLIST_SYNC_FILE	"playlist.sync"
 
 #define QUEUE_CLEAR_THRESH 128
 
+/* Number of directory entries read between checks of the time spent. */
+#define DIR_READ_CHUNK		64
+
+/* How long (in milliseconds) to read the directory before getting back to
+ * user input and server events. */
+#define DIR_READ_SLICE		40
+
+/* Number of items above and below the visible part of the directory menu
+ * for which tags are requested in advance. */
+#define DIR_TAGS_MARGIN		32
+
 /* Socket of the server connection. */
 static int srv_sock = -1;
 
@@ -60,6 +76,22 @@ static struct plist *playlist = NULL; /* our playlist */
 static struct plist *queue = NULL; /* our queue */
 static struct plist *dir_plist = NULL; /* contents of the current directory */
 
+/* Files from dir_plist for which the tags were already requested. */
+static struct plist *dir_tags_requested = NULL;
+
+/* The directory which is being read in parts. */
+static struct
+{
+	struct dir_reader *reader;	/* NULL if there is no such directory */
+	lists_t_strs *dirs;
+	lists_t_strs *playlists;
+	int sorted_dirs;		/* how many of dirs are in order */
+	int sorted_playlists;		/* how many of playlists are in order */
+	int shown;			/* number of entries in the menu */
+	bool finished;			/* was everything read? */
+	char *select_file;		/* file to select when it has been read */
+} dir_read;
+
 /* Queue for events coming from the server. */
 static struct event_queue events;
 
@@ -81,6 +113,13 @@ static volatile int want_resize = 0;
 /* Are we waiting for the playlist we have loaded and sent to the clients? */
 static int waiting_for_plist_load = 0;
 
+/* Version of the clients' playlist kept by the server which our playlist
+ * reflects.  The id is -1 if we don't know it. */
+static struct {
+	int id;
+	int version;
+} plist_sync = { -1, 0 };
+
 /* Information about the currently played file. */
 static struct file_info curr_file;
 
@@ -330,6 +369,8 @@ static void init_playlists ()
 {
 	dir_plist = (struct plist *)xmalloc (sizeof(struct plist));
 	plist_init (dir_plist);
+	dir_tags_requested = (struct plist *)xmalloc (sizeof(struct plist));
+	plist_init (dir_tags_requested);
 	playlist = (struct plist *)xmalloc (sizeof(struct plist));
 	plist_init (playlist);
 	queue = (struct plist *)xmalloc (sizeof(struct plist));
@@ -931,54 +972,80 @@ static void update_error (char *err)
 	error ("%s", err);
 }
 
-/* Send the playlist to the server to be forwarded to another client. */
-static void forward_playlist ()
+/* Receive a change of the clients' playlist and apply it to plist. */
+static void recv_plist_change (struct plist *plist)
 {
-	int i;
-
-	debug ("Forwarding the playlist...");
-
-	send_int_to_srv (CMD_SEND_PLIST);
-	send_int_to_srv (plist_get_serial(playlist));
+	int type = get_int_from_srv ();
+	void *data = get_event_data (type);
+	int num;
 
-	for (i = 0; i < playlist->num; i++)
-		if (!plist_deleted(playlist, i))
-			send_item_to_srv (&playlist->items[i]);
+	switch (type) {
+		case EV_PLIST_ADD:
+			if (plist_find_fname (plist,
+					((struct plist_item *)data)->file) == -1)
+				plist_add_from_item (plist, data);
+			break;
+		case EV_PLIST_DEL:
+			if ((num = plist_find_fname (plist, data)) != -1)
+				plist_delete (plist, num);
+			break;
+		case EV_PLIST_MOVE:
+			plist_swap_files (plist, ((struct move_ev_data *)data)->from,
+					((struct move_ev_data *)data)->to);
+			break;
+		case EV_PLIST_CLEAR:
+			plist_clear (plist);
+			break;
+		default:
+			fatal ("Bad playlist change from the server: 0x%02x", type);
+	}
 
-	send_item_to_srv (NULL);
+	free_event_data (type, data);
 }
 
-static int recv_server_plist (struct plist *plist)
+/* Get the clients' playlist from the server.  If known_version is set,
+ * plist is the copy of it at the version in plist_sync and only the changes
+ * since are transferred.  Return 0 if there is no playlist. */
+static int recv_server_plist (struct plist *plist, const bool known_version)
 {
-	int end_of_list = 0;
-	struct plist_item *item;
+	int mode, serial;
 
-	logit ("Asking server for the playlist from other client.");
+	logit ("Asking server for the playlist.");
 	send_int_to_srv (CMD_GET_PLIST);
+	send_int_to_srv (known_version ? plist_sync.id : -1);
+	send_int_to_srv (known_version ? plist_sync.version : -1);
 	logit ("Waiting for response");
 	wait_for_data ();
 
-	if (!get_int_from_srv()) {
+	/* Playlist events received so far are included in the response. */
+	event_queue_drop (&events, EV_CLASS_PLIST);
+
+	mode = get_int_from_srv ();
+	if (mode == PLIST_SYNC_NONE) {
 		debug ("There is no playlist");
-		return 0; /* there are no other clients with a playlist */
+		return 0;
 	}
 
-	logit ("There is a playlist, getting...");
-	wait_for_data ();
+	plist_sync.id = get_int_from_srv ();
+	plist_sync.version = get_int_from_srv ();
+	serial = get_int_from_srv ();
 
-	logit ("Transfer...");
+	if (mode == PLIST_SYNC_DELTA) {
+		int changes = get_int_from_srv ();
 
-	plist_set_serial (plist, get_int_from_srv());
+		logit ("Applying %d changes...", changes);
+		while (changes--)
+			recv_plist_change (plist);
+	}
+	else {
+		logit ("Transfer...");
+		plist_clear (plist);
+		if (!recv_plist(srv_sock, plist))
+			fatal ("Can't receive the playlist from the server!");
+	}
 
-	do {
-		item = recv_item_from_srv ();
-		if (item->file[0])
-			plist_add_from_item (plist, item);
-		else
-			end_of_list = 1;
-		plist_free_item_fields (item);
-		free (item);
-	} while (!end_of_list);
+	if (serial != -1)
+		plist_set_serial (plist, serial);
 
 	return 1;
 }
@@ -1114,6 +1181,9 @@ static void server_event (const int event, void *data)
 {
 	logit ("EVENT: 0x%02x", event);
 
+	if (is_plist_event (event))
+		plist_sync.version++;
+
 	switch (event) {
 		case EV_BUSY:
 			interface_fatal ("The server is busy; "
@@ -1143,9 +1213,6 @@ static void server_event (const int event, void *data)
 		case EV_OPTIONS:
 			get_server_options ();
 			break;
-		case EV_SEND_PLIST:
-			forward_playlist ();
-			break;
 		case EV_PLIST_ADD:
 			if (options_get_bool("SyncPlaylist"))
 				event_plist_add ((struct plist_item *)data);
@@ -1257,74 +1324,244 @@ static void fill_tags (struct plist *plist, const int tags_sel,
 	iface_set_status ("");
 }
 
+/* Request tags for the files in and around the visible part of the
+ * directory menu, the visible ones first. */
+static void request_visible_tags ()
+{
+	int ix, tags_sel;
+	lists_t_strs *files;
+
+	tags_sel = get_tags_setting ();
+	if (!tags_sel)
+		return;
+
+	files = lists_strs_new (FILES_LIST_INIT_SIZE);
+	iface_get_visible_files (IFACE_MENU_DIR, files, DIR_TAGS_MARGIN);
+
+	for (ix = 0; ix < lists_strs_size (files); ix += 1) {
+		const char *file = lists_strs_at (files, ix);
+		const struct file_tags *tags;
+		int n;
+
+		n = plist_find_fname (dir_plist, file);
+		if (n == -1 || plist_find_fname (dir_tags_requested, file) != -1)
+			continue;
+
+		tags = dir_plist->items[n].tags;
+		if (!tags || ~tags->filled & tags_sel) {
+			send_tags_request (file, tags_sel);
+			plist_add (dir_tags_requested, file);
+		}
+	}
+
+	lists_strs_free (files);
+}
+
+/* Forget about the requested tags, so they will be requested again for
+ * visible files which are missing some of them. */
+static void forget_requested_tags ()
+{
+	plist_clear (dir_tags_requested);
+}
+
+/* Number of entries of the directory read so far. */
+static int dir_read_count ()
+{
+	return plist_count (dir_plist) + lists_strs_size (dir_read.dirs)
+	                               + lists_strs_size (dir_read.playlists);
+}
+
+/* Put the sorted content of the directory read so far into the menu.
+ * If reload is not zero, keep the menu state. */
+static void dir_read_show (const int reload)
+{
+	struct plist *shown_plist = NULL;
+
+	/* The menu refers to the items of the shown list by their indexes,
+	 * so sort a copy and free the old list when the menu is replaced. */
+	if (dir_read.shown) {
+		shown_plist = dir_plist;
+		dir_plist = (struct plist *)xmalloc (sizeof(struct plist));
+		plist_init (dir_plist);
+		plist_cat (dir_plist, shown_plist);
+		plist_set_serial (dir_plist, plist_get_serial (shown_plist));
+	}
+
+	switch_titles_file (dir_plist);
+
+	plist_sort_fname (dir_plist);
+	lists_strs_sort_tail (dir_read.dirs, dir_read.sorted_dirs,
+	                      sort_dirs_func);
+	lists_strs_sort_tail (dir_read.playlists, dir_read.sorted_playlists,
+	                      sort_strcmp_func);
+	dir_read.sorted_dirs = lists_strs_size (dir_read.dirs);
+	dir_read.sorted_playlists = lists_strs_size (dir_read.playlists);
+
+	if (reload)
+		iface_update_dir_content (IFACE_MENU_DIR, dir_plist,
+		                          dir_read.dirs, dir_read.playlists);
+	else
+		iface_set_dir_content (IFACE_MENU_DIR, dir_plist,
+		                       dir_read.dirs, dir_read.playlists);
+	iface_update_queue_positions (queue, NULL, dir_plist, NULL);
+
+	if (dir_read.select_file && iface_in_dir_menu ())
+		iface_select_file (dir_read.select_file);
+
+	if (shown_plist) {
+		plist_free (shown_plist);
+		free (shown_plist);
+	}
+
+	dir_read.shown = dir_read_count ();
+}
+
+/* Stop reading the directory, leaving what was read in the menu. */
+static void dir_read_stop ()
+{
+	if (!dir_read.reader)
+		return;
+
+	dir_reader_close (dir_read.reader);
+	lists_strs_free (dir_read.dirs);
+	lists_strs_free (dir_read.playlists);
+	dir_read.reader = NULL;
+	dir_read.dirs = NULL;
+	dir_read.playlists = NULL;
+
+	if (dir_read.select_file) {
+		free (dir_read.select_file);
+		dir_read.select_file = NULL;
+	}
+
+	iface_set_status ("");
+}
+
+/* Read the directory for up to DIR_READ_SLICE milliseconds.  Return the
+ * result of the last dir_reader_read(): 0 if the whole directory has been
+ * read or -1 on error. */
+static int dir_read_slice ()
+{
+	struct timespec start, now;
+	long elapsed;
+	int rc;
+
+	get_realtime (&start);
+
+	do {
+		if (user_wants_interrupt ()) {
+			error ("Interrupted! Not all files read!");
+			return 0;
+		}
+
+		rc = dir_reader_read (dir_read.reader, dir_read.dirs,
+		                      dir_read.playlists, dir_plist,
+		                      DIR_READ_CHUNK);
+
+		get_realtime (&now);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000L
+		          + (now.tv_nsec - start.tv_nsec) / 1000000L;
+	} while (rc > 0 && elapsed < DIR_READ_SLICE);
+
+	return rc;
+}
+
+/* Continue reading the directory.  The menu is updated when the read is
+ * finished or the number of new entries reaches the number of entries
+ * already shown, so the cost of rebuilding the menu stays linear. */
+static void dir_read_continue ()
+{
+	assert (dir_read.reader != NULL);
+
+	if (!dir_read.finished && dir_read_slice () <= 0)
+		dir_read.finished = true;
+
+	/* Don't replace the menu under the user's search. */
+	if (iface_in_entry () && iface_get_entry_type () == ENTRY_SEARCH)
+		return;
+
+	if (dir_read.finished) {
+		dir_read_show (1);
+		dir_read_stop ();
+	}
+	else if (dir_read_count () - dir_read.shown
+	                               >= MAX(dir_read.shown, DIR_READ_CHUNK))
+		dir_read_show (1);
+}
+
 /* Load the directory content into dir_plist and switch the menu to it.
  * If dir is NULL, go to the cwd.  If reload is not zero, we are reloading
  * the current directory, so use iface_update_dir_content().
+ * Only the first part of the directory is read here, the rest is read
+ * by dir_read_continue() from the interface loop.
  * Return 1 on success, 0 on error. */
 static int go_to_dir (const char *dir, const int reload)
 {
 	struct plist *old_dir_plist;
-	char last_dir[PATH_MAX];
+	struct dir_reader *reader;
 	const char *new_dir = dir ? dir : cwd;
-	int going_up = 0;
-	lists_t_strs *dirs, *playlists;
+	char *select_file = NULL;
+	int rc;
 
 	iface_set_status ("Reading directory...");
 
-	if (dir && is_subdir(dir, cwd)) {
-		strcpy (last_dir, strrchr(cwd, '/') + 1);
-		strcat (last_dir, "/");
-		going_up = 1;
+	if (!(reader = dir_reader_open(new_dir))) {
+		iface_set_status ("");
+		return 0;
 	}
 
+	if (dir && is_subdir(dir, cwd))
+		select_file = xstrdup (cwd);
+	else if (reload && iface_in_dir_menu ())
+		select_file = iface_get_curr_file ();
+
+	dir_read_stop ();
+
+	/* TODO: use CMD_ABORT_TAGS_REQUESTS (what if we requested tags for the
+	 playlist?) */
+
 	old_dir_plist = dir_plist;
 	dir_plist = (struct plist *)xmalloc (sizeof(struct plist));
 	plist_init (dir_plist);
-	dirs = lists_strs_new (FILES_LIST_INIT_SIZE);
-	playlists = lists_strs_new (FILES_LIST_INIT_SIZE);
-
-	if (!read_directory(new_dir, dirs, playlists, dir_plist)) {
-		iface_set_status ("");
+	forget_requested_tags ();
+
+	dir_read.reader = reader;
+	dir_read.dirs = lists_strs_new (FILES_LIST_INIT_SIZE);
+	dir_read.playlists = lists_strs_new (FILES_LIST_INIT_SIZE);
+	dir_read.sorted_dirs = 0;
+	dir_read.sorted_playlists = 0;
+	dir_read.shown = 0;
+	dir_read.finished = false;
+	dir_read.select_file = select_file;
+
+	rc = dir_read_slice ();
+	if (rc < 0 && dir_read_count () == 0) {
+		dir_read_stop ();
 		plist_free (dir_plist);
-		lists_strs_free (dirs);
-		lists_strs_free (playlists);
 		free (dir_plist);
 		dir_plist = old_dir_plist;
 		return 0;
 	}
 
-	/* TODO: use CMD_ABORT_TAGS_REQUESTS (what if we requested tags for the
-	 playlist?) */
-
-	plist_free (old_dir_plist);
-	free (old_dir_plist);
-
 	if (dir) /* if dir is NULL, we went to cwd */
 		strcpy (cwd, dir);
 
-	switch_titles_file (dir_plist);
+	dir_read_show (reload);
 
-	plist_sort_fname (dir_plist);
-	lists_strs_sort (dirs, sort_dirs_func);
-	lists_strs_sort (playlists, sort_strcmp_func);
-
-	ask_for_tags (dir_plist, get_tags_setting());
-
-	if (reload)
-		iface_update_dir_content (IFACE_MENU_DIR, dir_plist, dirs, playlists);
-	else
-		iface_set_dir_content (IFACE_MENU_DIR, dir_plist, dirs, playlists);
-	lists_strs_free (dirs);
-	lists_strs_free (playlists);
-	if (going_up)
-		iface_set_curr_item_title (last_dir);
+	/* The menu referred to the old list until now. */
+	plist_free (old_dir_plist);
+	free (old_dir_plist);
 
 	iface_set_title (IFACE_MENU_DIR, cwd);
-	iface_update_queue_positions (queue, NULL, dir_plist, NULL);
 
 	if (iface_in_plist_menu())
 		iface_switch_to_dir ();
 
+	if (rc <= 0)
+		dir_read_stop ();
+
+	request_visible_tags ();
+
 	return 1;
 }
 
@@ -1363,10 +1600,39 @@ static void toggle_menu ()
 		error ("The playlist is empty.");
 }
 
+/* Return the name of the file with the snapshot of the playlist file.
+ * Snapshots of playlists other than the one kept in the MOC directory are
+ * in PLAYLIST_SNAPSHOT_DIR, named after the hash of the path.  The returned
+ * memory is malloc()ed. */
+static char *snapshot_file_name (const char *plist_file)
+{
+	char name[sizeof(PLAYLIST_SNAPSHOT_DIR) + 16];
+	unsigned int hash = 5381;
+	char *default_plist;
+	const char *c;
+	bool is_default;
+
+	for (c = plist_file; *c; c++)
+		hash = ((hash << 5) + hash) + (unsigned char)*c;
+
+	default_plist = xstrdup (create_file_name (PLAYLIST_FILE));
+	is_default = !strcmp (plist_file, default_plist);
+	free (default_plist);
+
+	if (is_default)
+		return xstrdup (create_file_name (PLAYLIST_SNAPSHOT_FILE));
+
+	snprintf (name, sizeof(name), PLAYLIST_SNAPSHOT_DIR "/%08x", hash);
+	return xstrdup (create_file_name (name));
+}
+
 /* Load the playlist file and switch the menu to it. Return 1 on success. */
 static int go_to_playlist (const char *file, const int load_serial,
                            bool default_playlist)
 {
+	char *plist_file, *snapshot_file;
+	int num;
+
 	if (plist_count(playlist)) {
 		error ("Please clear the playlist, because "
 				"I'm not sure you want to do this.");
@@ -1376,13 +1642,28 @@ static int go_to_playlist (const char *file, const int load_serial,
 	plist_clear (playlist);
 
 	iface_set_status ("Loading playlist...");
-	if (plist_load(playlist, file, cwd, load_serial)) {
+
+	/* The file may be in the buffer of create_file_name(). */
+	plist_file = xstrdup (file);
+
+	/* A playlist saved by MOC may have an up-to-date snapshot with tags
+	 * which is much faster to load. */
+	snapshot_file = snapshot_file_name (plist_file);
+	num = plist_load_snapshot (playlist, snapshot_file, plist_file,
+			load_serial);
+	free (snapshot_file);
+	if (num == -1)
+		num = plist_load (playlist, plist_file, cwd, load_serial);
+	free (plist_file);
+
+	if (num) {
 
 		if (options_get_bool("SyncPlaylist")) {
 			send_int_to_srv (CMD_LOCK);
 			if (!load_serial)
 				change_srv_plist_serial ();
 			send_int_to_srv (CMD_CLI_PLIST_CLEAR);
+			send_int_to_srv (plist_get_serial (playlist));
 			iface_set_status ("Notifying clients...");
 			send_items_to_clients (playlist);
 			iface_set_status ("");
@@ -1448,13 +1729,13 @@ static void enter_first_dir ()
 	first_run = 0;
 }
 
-/* Request the playlist from the server (given by another client).  Make
- * the titles.  Return 0 if such a list doesn't exist. */
-static int get_server_playlist (struct plist *plist)
+/* Request the clients' playlist from the server (see recv_server_plist()).
+ * Make the titles.  Return 0 if such a list doesn't exist. */
+static int get_server_playlist (struct plist *plist, const bool known_version)
 {
 	iface_set_status ("Getting the playlist...");
 	debug ("Getting the playlist...");
-	if (recv_server_plist(plist)) {
+	if (recv_server_plist(plist, known_version)) {
 		ask_for_tags (plist, get_tags_setting());
 		if (options_get_bool ("ReadTags"))
 			switch_titles_tags (plist);
@@ -1469,16 +1750,56 @@ static int get_server_playlist (struct plist *plist)
 	return 0;
 }
 
-/* Get the playlist from another client and use it as our playlist.
- * Return 0 if there is no client with a playlist. */
+/* Load the playlist saved in the MOC directory if we know which version
+ * of the clients' playlist it is.  Return 1 if loaded. */
+static int load_synced_playlist ()
+{
+	FILE *file;
+	char *plist_file;
+	int id, version, num;
+
+	file = fopen (create_file_name (PLAYLIST_SYNC_FILE), "r");
+	if (!file)
+		return 0;
+	num = fscanf (file, "%d %d", &id, &version);
+	fclose (file);
+	if (num != 2)
+		return 0;
+
+	plist_file = xstrdup (create_file_name (PLAYLIST_FILE));
+	num = plist_load_snapshot (playlist,
+			create_file_name (PLAYLIST_SNAPSHOT_FILE), plist_file, 1);
+	free (plist_file);
+
+	if (num == -1) {
+		plist_clear (playlist);
+		return 0;
+	}
+
+	plist_sync.id = id;
+	plist_sync.version = version;
+
+	return 1;
+}
+
+/* Get the clients' playlist from the server and use it as our playlist.
+ * If we have saved it before, only the changes since are transferred.
+ * Return 0 if there is no such playlist. */
 static int use_server_playlist ()
 {
-	if (get_server_playlist(playlist)) {
+	bool known_version;
+
+	known_version = options_get_bool ("SavePlaylist")
+		&& load_synced_playlist ();
+
+	if (get_server_playlist(playlist, known_version)) {
 		iface_set_dir_content (IFACE_MENU_PLIST, playlist, NULL, NULL);
 		iface_update_queue_positions (queue, playlist, NULL, NULL);
 		return 1;
 	}
 
+	plist_clear (playlist);
+
 	return 0;
 }
 
@@ -1835,15 +2156,18 @@ static void add_dir_plist ()
 		iface_set_status ("");
 	}
 	else {
-		int i;
+		int i, first;
 
 		switch_titles_file (&plist);
 		ask_for_tags (&plist, get_tags_setting());
 
-		for (i = 0; i < plist.num; i++)
-			if (!plist_deleted(&plist, i))
-				iface_add_to_plist (&plist, i);
+		/* The menu refers to the items of the playlist, so add them
+		 * there first. */
+		first = playlist->num;
 		plist_cat (playlist, &plist);
+		for (i = first; i < playlist->num; i++)
+			if (!plist_deleted(playlist, i))
+				iface_add_to_plist (playlist, i);
 	}
 
 	send_int_to_srv (CMD_UNLOCK);
@@ -2021,7 +2345,7 @@ static void toggle_show_time ()
 	else if (!strcasecmp (options_get_symb ("ShowTime"), "no")) {
 		options_set_symb ("ShowTime", "yes");
 		iface_update_show_time ();
-		ask_for_tags (dir_plist, TAGS_TIME);
+		forget_requested_tags ();
 		ask_for_tags (playlist, TAGS_TIME);
 		iface_set_status ("ShowTime: yes");
 
@@ -2058,6 +2382,7 @@ static void cmd_clear_playlist ()
 	if (options_get_bool("SyncPlaylist")) {
 		send_int_to_srv (CMD_LOCK);
 		send_int_to_srv (CMD_CLI_PLIST_CLEAR);
+		send_int_to_srv (-1);
 		change_srv_plist_serial ();
 		send_int_to_srv (CMD_UNLOCK);
 	}
@@ -2357,17 +2682,33 @@ static void entry_key_search (const struct iface_key *k)
 		iface_entry_handle_key (k);
 }
 
-static void save_playlist (const char *file, const int save_serial)
+/* Save the playlist to the file and its snapshot.  Return 1 if both were
+ * saved. */
+static int save_playlist (const char *file, const int save_serial)
 {
+	int saved = 0;
+
 	iface_set_status ("Saving the playlist...");
 	fill_tags (playlist, TAGS_COMMENTS | TAGS_TIME, 0);
 	if (!user_wants_interrupt()) {
-		if (plist_save (playlist, file, save_serial))
+		saved = plist_save (playlist, file, save_serial);
+		if (saved) {
+			char *snapshot_file = snapshot_file_name (file);
+
 			interface_message ("Playlist saved");
+
+			/* It usually exists already. */
+			mkdir (create_file_name (PLAYLIST_SNAPSHOT_DIR), 0700);
+			saved = plist_save_snapshot (playlist, snapshot_file,
+					file);
+			free (snapshot_file);
+		}
 	}
 	else
 		iface_set_status ("Aborted");
 	iface_set_status ("");
+
+	return saved;
 }
 
 static void entry_key_plist_save (const struct iface_key *k)
@@ -2500,7 +2841,7 @@ static void switch_read_tags ()
 	}
 	else {
 		options_set_bool ("ReadTags", true);
-		ask_for_tags (dir_plist, TAGS_COMMENTS);
+		forget_requested_tags ();
 		ask_for_tags (playlist, TAGS_COMMENTS);
 		switch_titles_tags (dir_plist);
 		switch_titles_tags (playlist);
@@ -2554,15 +2895,22 @@ static void go_to_playing_file ()
 		else {
 			char *slash;
 			char *file = xstrdup (curr_file.file);
+			int changed;
 
 			slash = strrchr (file, '/');
 			assert (slash != NULL);
 			*slash = 0;
 
 			if (file[0])
-				go_to_dir (file, 0);
+				changed = go_to_dir (file, 0);
 			else
-				go_to_dir ("/", 0);
+				changed = go_to_dir ("/", 0);
+
+			/* Select it also if it's not read yet. */
+			if (changed && dir_read.reader) {
+				free (dir_read.select_file);
+				dir_read.select_file = xstrdup (curr_file.file);
+			}
 
 			iface_switch_to_dir ();
 			free (file);
@@ -2593,7 +2941,7 @@ static time_t rounded_time ()
 static void seek_silent (const int sec)
 {
 	if (curr_file.state == STATE_PLAY && curr_file.file
-			&& !is_url(curr_file.file)) {
+			&& (!is_url(curr_file.file) || curr_file.total_time > 0)) {
 		if (silent_seek_pos == -1) {
 			silent_seek_pos = curr_file.curr_time + sec;
 		}
@@ -3175,6 +3523,10 @@ static void menu_key (const struct iface_key *k)
 			case KEY_CMD_MENU_LAST:
 				iface_menu_key (cmd);
 				last_menu_move_time = time (NULL);
+				if (dir_read.select_file && iface_in_dir_menu ()) {
+					free (dir_read.select_file);
+					dir_read.select_file = NULL;
+				}
 				break;
 			case KEY_CMD_QUIT:
 				want_quit = QUIT_SERVER;
@@ -3508,6 +3860,7 @@ void init_interface (const int sock, const int logging, lists_t_strs *args)
 		logit ("Could not set locale!");
 
 	srv_sock = sock;
+	sock_buf_open (srv_sock);
 
 	file_info_reset (&curr_file);
 	file_info_block_init (&curr_file);
@@ -3530,10 +3883,12 @@ void init_interface (const int sock, const int logging, lists_t_strs *args)
 	if (!lists_strs_empty (args)) {
 		process_args (args);
 
+		/* Subscribe to the playlist events before getting the
+		 * playlist, so we don't miss any change after it. */
 		if (plist_count(playlist) == 0) {
+			send_int_to_srv (CMD_SEND_PLIST_EVENTS);
 			if (!options_get_bool("SyncPlaylist") || !use_server_playlist())
 				load_playlist ();
-			send_int_to_srv (CMD_SEND_PLIST_EVENTS);
 		}
 		else if (options_get_bool("SyncPlaylist")) {
 			struct plist tmp_plist;
@@ -3543,13 +3898,14 @@ void init_interface (const int sock, const int logging, lists_t_strs *args)
 			/* The playlist should be now clear, but this will give
 			 * us the serial number of the playlist used by other
 			 * clients. */
-			plist_init (&tmp_plist);
-			get_server_playlist (&tmp_plist);
-
 			send_int_to_srv (CMD_SEND_PLIST_EVENTS);
 
+			plist_init (&tmp_plist);
+			get_server_playlist (&tmp_plist, false);
+
 			send_int_to_srv (CMD_LOCK);
 			send_int_to_srv (CMD_CLI_PLIST_CLEAR);
+			send_int_to_srv (-1);
 
 			plist_set_serial (playlist,
 					plist_get_serial(&tmp_plist));
@@ -3579,9 +3935,6 @@ void init_interface (const int sock, const int logging, lists_t_strs *args)
 	/* Ask the server for queue. */
 	use_server_queue ();
 
-	if (options_get_bool("SyncPlaylist"))
-		send_int_to_srv (CMD_CAN_SEND_PLIST);
-
 	update_state ();
 
 	if (options_get_bool("CanStartInPlaylist")
@@ -3597,8 +3950,15 @@ void interface_loop ()
 	while (want_quit == NO_QUIT) {
 		fd_set fds;
 		int ret;
+		int srv_pending;
 		struct timespec timeout = { 1, 0 };
 
+		/* Only poll while there is a directory to read or there are
+		 * events from the server already read into the buffer. */
+		srv_pending = sock_buf_pending (srv_sock) > 0;
+		if ((dir_read.reader && !dir_read.finished) || srv_pending)
+			timeout.tv_sec = 0;
+
 		FD_ZERO (&fds);
 		FD_SET (srv_sock, &fds);
 		FD_SET (STDIN_FILENO, &fds);
@@ -3608,9 +3968,12 @@ void interface_loop ()
 		if (ret == -1 && !want_quit && errno != EINTR)
 			interface_fatal ("pselect() failed: %s", xstrerror (errno));
 
+		/* Send what we have to say in this iteration at once. */
+		sock_buf_batch (srv_sock);
+
 		iface_tick ();
 
-		if (ret == 0)
+		if (ret == 0 && !srv_pending)
 			do_silent_seek ();
 
 #ifdef SIGWINCH
@@ -3618,8 +3981,8 @@ void interface_loop ()
 			do_resize ();
 #endif
 
-		if (ret > 0) {
-			if (FD_ISSET(STDIN_FILENO, &fds)) {
+		if (ret > 0 || srv_pending) {
+			if (ret > 0 && FD_ISSET(STDIN_FILENO, &fds)) {
 				struct iface_key k;
 
 				iface_get_key (&k);
@@ -3629,7 +3992,8 @@ void interface_loop ()
 			}
 
 			if (!want_quit) {
-				if (FD_ISSET(srv_sock, &fds))
+				if ((ret > 0 && FD_ISSET(srv_sock, &fds))
+						|| sock_buf_pending(srv_sock))
 					get_and_handle_event ();
 				do_silent_seek ();
 			}
@@ -3637,8 +4001,16 @@ void interface_loop ()
 		else if (user_wants_interrupt())
 			handle_interrupt ();
 
-		if (!want_quit)
+		if (!want_quit && dir_read.reader)
+			dir_read_continue ();
+
+		if (!want_quit) {
+			request_visible_tags ();
 			update_mixer_value ();
+		}
+
+		if (!sock_buf_flush(srv_sock))
+			fatal ("Can't send data to the server!");
 	}
 
 	log_circular_log ();
@@ -3663,12 +4035,36 @@ static void save_curr_dir ()
  * playlist is empty. */
 static void save_playlist_in_moc ()
 {
-	char *plist_file = create_file_name (PLAYLIST_FILE);
+	char *plist_file = xstrdup (create_file_name (PLAYLIST_FILE));
+	char *snapshot_file = xstrdup (create_file_name (PLAYLIST_SNAPSHOT_FILE));
+	char *sync_file = xstrdup (create_file_name (PLAYLIST_SYNC_FILE));
+	FILE *file;
+
+	if (plist_count(playlist) && options_get_bool("SavePlaylist")
+			&& save_playlist (plist_file, 1)) {
+
+		/* Remember which version of the clients' playlist it is to
+		 * get only the changes the next time. */
+		if (options_get_bool("SyncPlaylist") && plist_sync.id != -1
+				&& (file = fopen (sync_file, "w"))) {
+			fprintf (file, "%d %d\n", plist_sync.id,
+					plist_sync.version);
+			if (fclose (file))
+				unlink (sync_file);
+		}
+		else
+			unlink (sync_file);
+	}
+	else {
+		if (!plist_count(playlist) || !options_get_bool("SavePlaylist"))
+			unlink (plist_file);
+		unlink (snapshot_file);
+		unlink (sync_file);
+	}
 
-	if (plist_count(playlist) && options_get_bool("SavePlaylist"))
-		save_playlist (plist_file, 1);
-	else
-		unlink (plist_file);
+	free (plist_file);
+	free (snapshot_file);
+	free (sync_file);
 }
 
 void interface_end ()
@@ -3679,15 +4075,19 @@ void interface_end ()
 		send_int_to_srv (CMD_QUIT);
 	else
 		send_int_to_srv (CMD_DISCONNECT);
+	sock_buf_close (srv_sock);
 	srv_sock = -1;
 
+	dir_read_stop ();
 	windows_end ();
 	keys_cleanup ();
 
 	plist_free (dir_plist);
+	plist_free (dir_tags_requested);
 	plist_free (playlist);
 	plist_free (queue);
 	free (dir_plist);
+	free (dir_tags_requested);
 	free (playlist);
 	free (queue);
 
@@ -3725,10 +4125,8 @@ void interface_cmdline_clear_plist (int server_sock)
 
 	plist_init (&plist);
 
-	if (options_get_bool("SyncPlaylist"))
-		send_int_to_srv (CMD_CLI_PLIST_CLEAR);
-
-	if (recv_server_plist(&plist) && plist_get_serial(&plist)
+	/* Get the serial before the playlist is cleared. */
+	if (recv_server_plist(&plist, false) && plist_get_serial(&plist)
 			== get_server_plist_serial()) {
 		send_int_to_srv (CMD_LOCK);
 		send_int_to_srv (CMD_GET_SERIAL);
@@ -3739,7 +4137,14 @@ void interface_cmdline_clear_plist (int server_sock)
 		send_int_to_srv (CMD_UNLOCK);
 	}
 
+	if (options_get_bool("SyncPlaylist")) {
+		send_int_to_srv (CMD_CLI_PLIST_CLEAR);
+		send_int_to_srv (-1);
+	}
+
 	unlink (create_file_name (PLAYLIST_FILE));
+	unlink (create_file_name (PLAYLIST_SNAPSHOT_FILE));
+	unlink (create_file_name (PLAYLIST_SYNC_FILE));
 
 	plist_free (&plist);
 }
@@ -3799,7 +4204,7 @@ void interface_cmdline_append (int server_sock, lists_t_strs *args)
 		if (!getcwd(cwd, sizeof(cwd)))
 			fatal ("Can't get CWD: %s", xstrerror (errno));
 
-		if (recv_server_plist(&clients_plist)) {
+		if (recv_server_plist(&clients_plist, false)) {
 			add_recursively (&new, args);
 			plist_sort_fname (&new);
 
@@ -3841,6 +4246,8 @@ void interface_cmdline_append (int server_sock, lists_t_strs *args)
 				fill_tags (&saved_plist, TAGS_COMMENTS
 						| TAGS_TIME, 1);
 				plist_save (&saved_plist, create_file_name (PLAYLIST_FILE), 1);
+				unlink (create_file_name (PLAYLIST_SNAPSHOT_FILE));
+				unlink (create_file_name (PLAYLIST_SYNC_FILE));
 			}
 
 			plist_free (&saved_plist);
@@ -3866,7 +4273,7 @@ void interface_cmdline_play_first (int server_sock)
 	plist_set_serial (&plist, get_data_int());
 
 	/* the second condition will checks if the file exists */
-	if (!recv_server_plist(&plist)
+	if (!recv_server_plist(&plist, false)
 			&& file_type (create_file_name (PLAYLIST_FILE))
 			== F_PLAYLIST)
 		plist_load (&plist, create_file_name (PLAYLIST_FILE), cwd, 1);
@@ -4202,8 +4609,9 @@ CurrentSec  %cs
 Bitrate     %b
 Rate        %r
 */
-void interface_cmdline_formatted_info (const int server_sock,
-		const char *format_str)
+/* Print the information about the file in curr_file formatted as in the
+ * format string. */
+static void print_formatted_info (const char *format_str)
 {
 	typedef struct {
 		char *state;
@@ -4232,14 +4640,6 @@ void interface_cmdline_formatted_info (const int server_sock,
 	char *fmt, *str;
 	info_t str_info;
 
-	srv_sock = server_sock;	/* the interface is not initialized, so set it
-				   here */
-	init_playlists ();
-	file_info_reset (&curr_file);
-	file_info_block_init (&curr_file);
-
-	curr_file.state = get_state ();
-
 	/* extra paranoid about struct data */
 	memset(&str_info, 0, sizeof(str_info));
 	curr_time_str[0] = time_left_str[0] = time_str[0] =
@@ -4264,34 +4664,12 @@ void interface_cmdline_formatted_info (const int server_sock,
 		else if (curr_file.state == STATE_PAUSE)
 			str_info.state = "PAUSE";
 
-		curr_file.file = get_curr_file ();
-
-		if (curr_file.file[0]) {
-
-			/* get tags */
-			if (file_type(curr_file.file) == F_URL) {
-				send_int_to_srv (CMD_GET_TAGS);
-				curr_file.tags = get_data_tags ();
-			}
-			else
-				curr_file.tags = get_tags_no_iface (
-						curr_file.file,
-						TAGS_COMMENTS | TAGS_TIME);
-
-			/* get the title */
-			if (curr_file.tags->title)
-				str_info.title = build_title (curr_file.tags);
-			else
-				str_info.title = xstrdup ("");
-		}
+		/* get the title */
+		if (curr_file.file[0] && curr_file.tags->title)
+			str_info.title = build_title (curr_file.tags);
 		else
 			str_info.title = xstrdup ("");
 
-		curr_file.channels = get_channels ();
-		curr_file.rate = get_rate ();
-		curr_file.bitrate = get_bitrate ();
-		curr_file.curr_time = get_curr_time ();
-
 		if (curr_file.tags->time != -1)
 			sec_to_min (time_str, curr_file.tags->time);
 		else
@@ -4368,6 +4746,42 @@ void interface_cmdline_formatted_info (const int server_sock,
 
 	if (str_info.title)
 		free(str_info.title);
+}
+
+void interface_cmdline_formatted_info (const int server_sock,
+		const char *format_str)
+{
+	srv_sock = server_sock;	/* the interface is not initialized, so set it
+				   here */
+	init_playlists ();
+	file_info_reset (&curr_file);
+	file_info_block_init (&curr_file);
+
+	curr_file.state = get_state ();
+
+	if (curr_file.state != STATE_STOP) {
+		curr_file.file = get_curr_file ();
+
+		if (curr_file.file[0]) {
+
+			/* get tags */
+			if (file_type(curr_file.file) == F_URL) {
+				send_int_to_srv (CMD_GET_TAGS);
+				curr_file.tags = get_data_tags ();
+			}
+			else
+				curr_file.tags = get_tags_no_iface (
+						curr_file.file,
+						TAGS_COMMENTS | TAGS_TIME);
+		}
+
+		curr_file.channels = get_channels ();
+		curr_file.rate = get_rate ();
+		curr_file.bitrate = get_bitrate ();
+		curr_file.curr_time = get_curr_time ();
+	}
+
+	print_formatted_info (format_str);
 
 	if (curr_file.state != STATE_STOP)
 		file_info_cleanup (&curr_file);
@@ -4376,3 +4790,57 @@ void interface_cmdline_formatted_info (const int server_sock,
 	plist_free (playlist);
 	plist_free (queue);
 }
+
+/* Print the formatted information using the status page published by the
+ * server, so we don't need to connect to it.  Return 0 if there is no
+ * usable status page. */
+int interface_cmdline_formatted_info_page (const char *format_str)
+{
+	struct status_page *page;
+	struct status_page st;
+	int ok;
+
+	page = status_page_open (create_file_name(STATUS_PAGE_FILE));
+	if (!page)
+		return 0;
+
+	ok = status_page_read (page, &st);
+	status_page_close (page);
+
+	/* The socket gives us full file names and tags. */
+	if (!ok || (st.flags & STATUS_PAGE_TRUNCATED))
+		return 0;
+
+	file_info_reset (&curr_file);
+	file_info_block_init (&curr_file);
+
+	curr_file.state = st.state;
+
+	if (curr_file.state != STATE_STOP) {
+		struct file_tags *tags = tags_new ();
+
+		if (st.title[0])
+			tags->title = xstrdup (st.title);
+		if (st.artist[0])
+			tags->artist = xstrdup (st.artist);
+		if (st.album[0])
+			tags->album = xstrdup (st.album);
+		tags->track = st.track;
+		tags->time = st.total_time;
+		tags->filled = TAGS_COMMENTS | TAGS_TIME;
+
+		curr_file.file = xstrdup (st.file);
+		curr_file.tags = tags;
+		curr_file.channels = st.channels;
+		curr_file.rate = st.rate;
+		curr_file.bitrate = st.bitrate;
+		curr_file.curr_time = st.curr_time;
+	}
+
+	print_formatted_info (format_str);
+
+	if (curr_file.state != STATE_STOP)
+		file_info_cleanup (&curr_file);
+
+	return 1;
+}
@@ -50,6 +50,7 @@ void interface_cmdline_jump_to (int server_sock, const int pos);
 void interface_cmdline_adj_volume (int server_sock, const char *arg);
 void interface_cmdline_set (int server_sock, char *arg, const int val);
 void interface_cmdline_formatted_info (const int server_sock, const char *format_str);
+int interface_cmdline_formatted_info_page (const char *format_str);
 void interface_cmdline_enqueue (int server_sock, lists_t_strs *args);
 
 #ifdef __cplusplus
@@ -88,8 +88,6 @@ struct side_menu
 	{
 		struct {
 			struct menu *main;    /* visible menu */
-			struct menu *copy;    /* copy of the menu when we display
-			                         matching items while searching */
 		} list;
 		/* struct menu_tree *tree;*/
 	} menu;
@@ -776,7 +774,6 @@ static void side_menu_init (struct side_menu *m, const enum side_menu_type type,
 
 	if (type == MENU_DIR || type == MENU_PLAYLIST) {
 		side_menu_init_menu (m);
-		m->menu.list.copy = NULL;
 
 		menu_set_items_numbering (m->menu.list.main,
 				type == MENU_PLAYLIST
@@ -796,7 +793,6 @@ static void side_menu_init (struct side_menu *m, const enum side_menu_type type,
 	}
 	else if (type == MENU_THEMES) {
 		side_menu_init_menu (m);
-		m->menu.list.copy = NULL;
 	}
 	else
 		abort ();
@@ -812,8 +808,6 @@ static void side_menu_destroy (struct side_menu *m)
 		if (m->type == MENU_DIR || m->type == MENU_PLAYLIST
 				|| m->type == MENU_THEMES) {
 			menu_free (m->menu.list.main);
-			if (m->menu.list.copy)
-				menu_free (m->menu.list.copy);
 		}
 		else
 			abort ();
@@ -1023,50 +1017,48 @@ static char *make_menu_title (const char *plist_title,
 	return title;
 }
 
-/* Add an item from the playlist to the menu.
- * If full_paths has non-zero value, full paths will be displayed instead of
- * just file names.
- * Return a non-zero value if the added item is visible on the screen. */
-static int add_to_menu (struct menu *menu, const struct plist *plist,
-		const int num, const int full_paths)
+/* Fill the menu item with the num-th item of the playlist shown in this
+ * side menu (data).  It's called only for items being drawn. */
+static void fill_menu_item (struct menu_item *mi, const struct plist *plist,
+		const int num, void *data)
 {
-	bool made_from_tags;
-	struct menu_item *added;
+	const struct side_menu *m = (const struct side_menu *)data;
 	const struct plist_item *item = &plist->items[num];
-	char *title;
+	bool made_from_tags, full_path;
 	const char *type_name;
 
+	assert (mi != NULL);
+	assert (m != NULL);
+
+	full_path = m->type == MENU_PLAYLIST
+	            && options_get_bool ("PlaylistFullPaths");
 	made_from_tags = (options_get_bool ("ReadTags") && item->title_tags);
 
 	if (made_from_tags)
-		title = make_menu_title (item->title_tags, 1, 0);
+		mi->title = make_menu_title (item->title_tags, 1, 0);
 	else
-		title = make_menu_title (item->title_file, 0, full_paths);
-	added = menu_add (menu, title, plist_file_type (plist, num), item->file);
-	free (title);
+		mi->title = make_menu_title (item->title_file, 0, full_path);
 
 	if (item->tags && item->tags->time != -1) {
 		char time_str[32];
 
 		sec_to_min (time_str, item->tags->time);
-		menu_item_set_time (added, time_str);
+		menu_item_set_time (mi, time_str);
 	}
 
-	menu_item_set_attr_normal (added, get_color(CLR_MENU_ITEM_FILE));
-	menu_item_set_attr_sel (added, get_color(CLR_MENU_ITEM_FILE_SELECTED));
-	menu_item_set_attr_marked (added, get_color(CLR_MENU_ITEM_FILE_MARKED));
-	menu_item_set_attr_sel_marked (added,
+	menu_item_set_attr_normal (mi, get_color(CLR_MENU_ITEM_FILE));
+	menu_item_set_attr_sel (mi, get_color(CLR_MENU_ITEM_FILE_SELECTED));
+	menu_item_set_attr_marked (mi, get_color(CLR_MENU_ITEM_FILE_MARKED));
+	menu_item_set_attr_sel_marked (mi,
 			get_color(CLR_MENU_ITEM_FILE_MARKED_SELECTED));
 
 	if (!(type_name = file_type_name(item->file)))
 		type_name = "";
-	menu_item_set_format (added, type_name);
-	menu_item_set_queue_pos (added, item->queue_pos);
-
-	if (full_paths && !made_from_tags)
-		menu_item_set_align (added, MENU_ALIGN_RIGHT);
+	menu_item_set_format (mi, type_name);
+	menu_item_set_queue_pos (mi, item->queue_pos);
 
-	return menu_is_visible (menu, added);
+	if (full_path && !made_from_tags)
+		menu_item_set_align (mi, MENU_ALIGN_RIGHT);
 }
 
 static void side_menu_clear (struct side_menu *m)
@@ -1075,7 +1067,6 @@ static void side_menu_clear (struct side_menu *m)
 	assert (m->visible);
 	assert (m->type == MENU_DIR || m->type == MENU_PLAYLIST);
 	assert (m->menu.list.main != NULL);
-	assert (m->menu.list.copy == NULL);
 
 	menu_free (m->menu.list.main);
 	side_menu_init_menu (m);
@@ -1102,7 +1093,6 @@ static void side_menu_make_list_content (struct side_menu *m,
 	assert (m != NULL);
 	assert (m->type == MENU_DIR || m->type == MENU_PLAYLIST);
 	assert (m->menu.list.main != NULL);
-	assert (m->menu.list.copy == NULL);
 
 	side_menu_clear (m);
 
@@ -1166,11 +1156,10 @@ static void side_menu_make_list_content (struct side_menu *m,
 		}
 
 	/* playlist items */
+	menu_set_plist (m->menu.list.main, files, fill_menu_item, m);
 	for (i = 0; i < files->num; i++) {
 		if (!plist_deleted(files, i))
-			add_to_menu (m->menu.list.main, files, i,
-					m->type == MENU_PLAYLIST
-					&& options_get_bool("PlaylistFullPaths"));
+			menu_add_plist_item (m->menu.list.main, i);
 	}
 
 	m->total_time = plist_total_time (files, &m->total_time_for_all);
@@ -1324,36 +1313,22 @@ static void side_menu_cmd (struct side_menu *m, const enum key_cmd cmd)
 
 static enum file_type side_menu_curritem_get_type (const struct side_menu *m)
 {
-	struct menu_item *mi;
-
 	assert (m != NULL);
 	assert (m->visible);
 	assert (m->type == MENU_DIR || m->type == MENU_PLAYLIST
 			|| m->type == MENU_THEMES);
 
-	mi = menu_curritem (m->menu.list.main);
-
-	if (mi)
-		return menu_item_get_type (mi);
-
-	return F_OTHER;
+	return menu_get_curr_type (m->menu.list.main);
 }
 
 static char *side_menu_get_curr_file (const struct side_menu *m)
 {
-	struct menu_item *mi;
-
 	assert (m != NULL);
 	assert (m->visible);
 	assert (m->type == MENU_DIR || m->type == MENU_PLAYLIST
 			|| m->type == MENU_THEMES);
 
-	mi = menu_curritem (m->menu.list.main);
-
-	if (mi)
-		return menu_item_get_file (mi);
-
-	return NULL;
+	return menu_get_curr_file (m->menu.list.main);
 }
 
 static struct side_menu *find_side_menu (struct main_win *w,
@@ -1373,95 +1348,22 @@ static struct side_menu *find_side_menu (struct main_win *w,
 	abort (); /* menu not found - BUG */
 }
 
-static void side_menu_set_curr_item_title (struct side_menu *m,
-		const char *title)
-{
-	assert (m != NULL);
-	assert (m->visible);
-	assert (title != NULL);
-
-	menu_setcurritem_title (m->menu.list.main, title);
-}
-
-/* Update menu item using the playlist item. */
-static void update_menu_item (struct menu_item *mi,
-		const struct plist *plist,
-		const int n, const int full_path)
-{
-	bool made_from_tags;
-	char *title;
-	const struct plist_item *item;
-
-	assert (mi != NULL);
-	assert (plist != NULL);
-	assert (n >= 0);
-
-	item = &plist->items[n];
-
-	if (item->tags && item->tags->time != -1) {
-		char time_str[32];
-
-		sec_to_min (time_str, item->tags->time);
-		menu_item_set_time (mi, time_str);
-	}
-	else
-		menu_item_set_time (mi, "");
-
-	made_from_tags = (options_get_bool ("ReadTags") && item->title_tags);
-
-	if (made_from_tags)
-		title = make_menu_title (item->title_tags, 1, 0);
-	else
-		title = make_menu_title (item->title_file, 0, full_path);
-
-	menu_item_set_title (mi, title);
-
-	if (full_path && !made_from_tags)
-		menu_item_set_align (mi, MENU_ALIGN_RIGHT);
-	else
-		menu_item_set_align (mi, MENU_ALIGN_LEFT);
-
-	menu_item_set_queue_pos (mi, item->queue_pos);
-
-	free (title);
-
-}
-
-/* Update item title and time for this item if it's present on this menu.
- * Return a non-zero value if the item is visible. */
+/* Update the search index and the total time of the files after the item
+ * has changed.  Return a non-zero value if the item is visible in the
+ * menu. */
 static int side_menu_update_item (struct side_menu *m,
 		const struct plist *plist, const int n)
 {
-	struct menu_item *mi;
-	int visible = 0;
-	char *file;
-
 	assert (m != NULL);
 	assert (m->visible);
 	assert (m->type == MENU_DIR || m->type == MENU_PLAYLIST);
 	assert (plist != NULL);
 	assert (LIMIT(n, plist->num));
 
-	file = plist_get_file (plist, n);
-	assert (file != NULL);
-
-	if ((mi = menu_find(m->menu.list.main, file))) {
-		update_menu_item (mi, plist, n, m->type == MENU_PLAYLIST
-				&& options_get_bool("PlaylistFullpaths"));
-		visible = menu_is_visible (m->menu.list.main, mi);
-	}
-	if (m->menu.list.copy
-			&& (mi = menu_find(m->menu.list.copy, file))) {
-		update_menu_item (mi, plist, n, m->type == MENU_PLAYLIST
-				&& options_get_bool("PlaylistFullpaths"));
-		visible = visible || menu_is_visible (m->menu.list.main, mi);
-	}
-
-	free (file);
-
+	menu_update_search (m->menu.list.main, plist->items[n].file);
 	m->total_time = plist_total_time (plist, &m->total_time_for_all);
 
-	return visible;
+	return menu_is_visible (m->menu.list.main, plist->items[n].file);
 }
 
 static void side_menu_unmark_file (struct side_menu *m)
@@ -1471,8 +1373,6 @@ static void side_menu_unmark_file (struct side_menu *m)
 	assert (m->type == MENU_DIR || m->type == MENU_PLAYLIST);
 
 	menu_unmark_item (m->menu.list.main);
-	if (m->menu.list.copy)
-		menu_unmark_item (m->menu.list.copy);
 }
 
 static void side_menu_mark_file (struct side_menu *m, const char *file)
@@ -1482,8 +1382,6 @@ static void side_menu_mark_file (struct side_menu *m, const char *file)
 	assert (m->type == MENU_DIR || m->type == MENU_PLAYLIST);
 
 	menu_mark_item (m->menu.list.main, file);
-	if (m->menu.list.copy)
-		menu_mark_item (m->menu.list.copy, file);
 }
 
 static void side_menu_add_file (struct side_menu *m, const char *file,
@@ -1503,21 +1401,19 @@ static void side_menu_add_file (struct side_menu *m, const char *file,
 static int side_menu_add_plist_item (struct side_menu *m,
 		const struct plist *plist, const int num)
 {
-	int visible;
-
 	assert (m != NULL);
 	assert (plist != NULL);
 	assert (m->visible);
 	assert (m->type == MENU_DIR || m->type == MENU_PLAYLIST);
 
-	visible = add_to_menu (m->menu.list.copy ? m->menu.list.copy
-			: m->menu.list.main,
-			plist, num,
-			m->type == MENU_PLAYLIST
-			&& options_get_bool("PlaylistFullPaths"));
+	if (!m->menu.list.main->plist)
+		menu_set_plist (m->menu.list.main, plist, fill_menu_item, m);
+	assert (m->menu.list.main->plist == plist);
+
+	menu_add_plist_item (m->menu.list.main, num);
 	m->total_time = plist_total_time (plist, &m->total_time_for_all);
 
-	return visible;
+	return menu_is_visible (m->menu.list.main, plist->items[num].file);
 }
 
 static int side_menu_is_time_for_all (const struct side_menu *m)
@@ -1583,8 +1479,7 @@ static void side_menu_del_item (struct side_menu *m, const char *file)
 	assert (m->visible);
 	assert (m->type == MENU_DIR || m->type == MENU_PLAYLIST);
 
-	menu_del_item (m->menu.list.copy ? m->menu.list.copy : m->menu.list.main,
-			file);
+	menu_del_item (m->menu.list.main, file);
 }
 
 static void side_menu_set_plist_time (struct side_menu *m, const int time,
@@ -1598,33 +1493,16 @@ static void side_menu_set_plist_time (struct side_menu *m, const int time,
 	m->total_time_for_all = time_for_all;
 }
 
-/* Replace the menu with one having only those items which contain 'pattern'.
+/* Show only those items of the menu which contain 'pattern'.
  * If no items match, don't do anything.
  * Return the number of matching items. */
 static int side_menu_filter (struct side_menu *m, const char *pattern)
 {
-	struct menu *filtered_menu;
-
 	assert (m != NULL);
 	assert (pattern != NULL);
 	assert (m->menu.list.main != NULL);
 
-	filtered_menu = menu_filter_pattern (m->menu.list.copy
-			? m->menu.list.copy : m->menu.list.main, pattern);
-
-	if (menu_nitems(filtered_menu) == 0) {
-		menu_free (filtered_menu);
-		return 0;
-	}
-
-	if (m->menu.list.copy)
-		menu_free (m->menu.list.main);
-	else
-		m->menu.list.copy = m->menu.list.main;
-
-	m->menu.list.main = filtered_menu;
-
-	return menu_nitems (filtered_menu);
+	return menu_filter_pattern (m->menu.list.main, pattern);
 }
 
 static void side_menu_use_main (struct side_menu *m)
@@ -1632,11 +1510,7 @@ static void side_menu_use_main (struct side_menu *m)
 	assert (m != NULL);
 	assert (m->menu.list.main != NULL);
 
-	if (m->menu.list.copy) {
-		menu_free (m->menu.list.main);
-		m->menu.list.main = m->menu.list.copy;
-		m->menu.list.copy = NULL;
-	}
+	menu_clear_filter (m->menu.list.main);
 }
 
 static void side_menu_make_visible (struct side_menu *m, const char *file)
@@ -1646,7 +1520,7 @@ static void side_menu_make_visible (struct side_menu *m, const char *file)
 	assert (m->type == MENU_PLAYLIST || m->type == MENU_DIR);
 	assert (file != NULL);
 
-	if (!m->menu.list.copy)
+	if (!menu_is_filtered (m->menu.list.main))
 		menu_make_visible (m->menu.list.main, file);
 }
 
@@ -1659,7 +1533,7 @@ static void side_menu_swap_items (struct side_menu *m, const char *file1,
 	assert (file1 != NULL);
 	assert (file2 != NULL);
 	assert (m->menu.list.main != NULL);
-	assert (m->menu.list.copy == NULL);
+	assert (!menu_is_filtered (m->menu.list.main));
 
 	menu_swap_items (m->menu.list.main, file1, file2);
 }
@@ -1689,10 +1563,6 @@ static void side_menu_resize (struct side_menu *m,
 			|| m->type == MENU_THEMES) {
 		menu_update_size (m->menu.list.main, m->posx + 1, m->posy + 1,
 				m->width - 2, side_menu_get_menu_height(m));
-		if (m->menu.list.copy)
-			menu_update_size (m->menu.list.copy, m->posx + 1,
-					m->posy + 1, m->width - 2,
-					side_menu_get_menu_height(m));
 	}
 	else
 		abort ();
@@ -1837,6 +1707,20 @@ static void main_win_set_dir_content (struct main_win *w,
 	main_win_draw (w);
 }
 
+static void main_win_get_visible_files (struct main_win *w,
+		const enum iface_menu iface_menu, lists_t_strs *files,
+		const int margin)
+{
+	struct side_menu *m;
+
+	assert (w != NULL);
+
+	m = find_side_menu (w, iface_to_side_menu(iface_menu));
+
+	if (m->visible)
+		menu_get_visible_files (m->menu.list.main, files, margin);
+}
+
 static void main_win_set_title (struct main_win *w,
 		const enum side_menu_type type,
 		const char *title)
@@ -1857,15 +1741,24 @@ static void main_win_update_dir_content (struct main_win *w,
 {
 	struct side_menu *m;
 	struct side_menu_state ms;
+	char *selected;
 
 	assert (w != NULL);
 
 	m = find_side_menu (w, iface_menu == IFACE_MENU_DIR ? MENU_DIR
 			: MENU_PLAYLIST);
 
+	selected = side_menu_get_curr_file (m);
 	side_menu_get_state (m, &ms);
 	side_menu_make_list_content (m, files, dirs, playlists, 1);
 	side_menu_set_state (m, &ms);
+
+	/* Keep the same file selected if it's still there. */
+	if (selected) {
+		side_menu_select_file (m, selected);
+		free (selected);
+	}
+
 	if (w->curr_file)
 		side_menu_mark_file (m, w->curr_file);
 	main_win_draw (w);
@@ -1980,15 +1873,6 @@ static int main_win_in_theme_menu (const struct main_win *w)
 	return w->menus[w->selected_menu].type == MENU_THEMES;
 }
 
-static void main_win_set_curr_item_title (struct main_win *w, const char *title)
-{
-	assert (w != NULL);
-	assert (title != NULL);
-
-	side_menu_set_curr_item_title (&w->menus[w->selected_menu], title);
-	main_win_draw (w);
-}
-
 /* Update item title and time on all menus where it's present. */
 static void main_win_update_item (struct main_win *w,
 		const enum iface_menu iface_menu, const struct plist *plist,
@@ -3780,9 +3664,9 @@ void iface_update_attrs ()
 			menu_set_info_attr_marked (menu, get_color (CLR_MENU_ITEM_INFO_MARKED));
 			menu_set_info_attr_sel_marked (menu, get_color (CLR_MENU_ITEM_INFO_MARKED_SELECTED));
 
-			for (mi = menu->items, item_num = 0;
-			     mi && item_num < menu->nitems;
-			     mi = mi->next, item_num += 1) {
+			for (item_num = 0; item_num < menu->nitems;
+			     item_num += 1) {
+				mi = menu->items[item_num];
 				if (mi->type == F_DIR) {
 					menu_item_set_attr_normal (mi, get_color (CLR_MENU_ITEM_DIR));
 					menu_item_set_attr_sel (mi, get_color (CLR_MENU_ITEM_DIR_SELECTED));
@@ -3801,9 +3685,9 @@ void iface_update_attrs ()
 			menu_set_info_attr_normal (menu, get_color (CLR_MENU_ITEM_FILE));
 			menu_set_info_attr_sel (menu, get_color (CLR_MENU_ITEM_FILE_SELECTED));
 
-			for (mi = menu->items, item_num = 0;
-			     mi && item_num < menu->nitems;
-			     mi = mi->next, item_num += 1) {
+			for (item_num = 0; item_num < menu->nitems;
+			     item_num += 1) {
+				mi = menu->items[item_num];
 				menu_item_set_attr_normal (mi, get_color (CLR_MENU_ITEM_FILE));
 				menu_item_set_attr_sel (mi, get_color (CLR_MENU_ITEM_FILE_SELECTED));
 			}
@@ -3814,7 +3698,7 @@ void iface_update_attrs ()
 void iface_update_theme_selection (const char *file)
 {
     /* menus[2] is theme menu. */
-    assert (main_win.menus[2].menu.list.main->selected);
+    assert (main_win.menus[2].menu.list.main->selected != -1);
 
     menu_setcurritem_file (main_win.menus[2].menu.list.main, file);
 }
@@ -3852,13 +3736,14 @@ void iface_update_item (const enum iface_menu menu,
 	iface_refresh_screen ();
 }
 
-/* Change the current item in the directory menu to this item. */
-void iface_set_curr_item_title (const char *title)
+/* Append to the list files shown in the menu and files of up to 'margin'
+ * items around them. */
+void iface_get_visible_files (const enum iface_menu menu, lists_t_strs *files,
+		const int margin)
 {
-	assert (title != NULL);
+	assert (files != NULL);
 
-	main_win_set_curr_item_title (&main_win, title);
-	iface_refresh_screen ();
+	main_win_get_visible_files (&main_win, menu, files, margin);
 }
 
 /* Set the title for the directory menu. */
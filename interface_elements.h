@@ -73,7 +73,6 @@ void iface_update_dir_content (const enum iface_menu iface_menu,
 		const struct plist *files,
 		const lists_t_strs *dirs,
 		const lists_t_strs *playlists);
-void iface_set_curr_item_title (const char *title);
 void iface_get_key (struct iface_key *k);
 int iface_key_is_resize (const struct iface_key *k);
 void iface_menu_key (const enum key_cmd cmd);
@@ -84,6 +83,8 @@ int iface_in_theme_menu ();
 char *iface_get_curr_file ();
 void iface_update_item (const enum iface_menu menu, const struct plist *plist,
 		const int n);
+void iface_get_visible_files (const enum iface_menu menu, lists_t_strs *files,
+		const int margin);
 void iface_set_curr_time (const int time);
 void iface_set_total_time (const int time);
 void iface_set_block (const int start_time, const int end_time);
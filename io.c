@@ -43,6 +43,9 @@
 #ifdef HAVE_CURL
 # include "io_curl.h"
 #endif
+#ifdef HAVE_LIBURING
+# include "io_ring.h"
+#endif
 
 #ifdef HAVE_CURL
 # define CURL_ONLY
@@ -50,6 +53,13 @@
 # define CURL_ONLY ATTR_UNUSED
 #endif
 
+/* Limits of the size of a read done by the read thread. */
+#define READ_CHUNK_MIN	(8 * 1024)
+#define READ_CHUNK_MAX	(256 * 1024)
+
+/* How much of a file is prefetched before it's played. */
+#define PREFETCH_SIZE	(16 * 1024 * 1024)
+
 #ifdef HAVE_MMAP
 static void *io_mmap_file (const struct io_stream *s)
 {
@@ -71,6 +81,11 @@ static void *io_mmap_file (const struct io_stream *s)
 		}
 
 		logit ("mmap()ed %zu bytes", sz);
+
+#ifdef POSIX_MADV_SEQUENTIAL
+		/* Decoders read files from the start to the end. */
+		posix_madvise (result, sz, POSIX_MADV_SEQUENTIAL);
+#endif
 	} while (0);
 
 	return result;
@@ -162,6 +177,11 @@ static ssize_t io_internal_read (struct io_stream *s, const int dont_move,
 			fatal ("You can't peek data directly from CURL!");
 		res = io_curl_read (s, buf, count);
 		break;
+#endif
+#ifdef HAVE_LIBURING
+	case IO_SOURCE_URING:
+		res = io_ring_read (s, dont_move, buf, count);
+		break;
 #endif
 	default:
 		fatal ("Unknown io_stream->source: %d", s->source);
@@ -186,8 +206,6 @@ static off_t io_seek_buffered (struct io_stream *s, const off_t where)
 {
 	off_t res = -1;
 
-	assert (s->source != IO_SOURCE_CURL);
-
 	logit ("Seeking...");
 
 	switch (s->source) {
@@ -198,6 +216,16 @@ static off_t io_seek_buffered (struct io_stream *s, const off_t where)
 	case IO_SOURCE_MMAP:
 		res = io_seek_mmap (s, where);
 		break;
+#endif
+#ifdef HAVE_LIBURING
+	case IO_SOURCE_URING:
+		res = io_ring_seek (s, where);
+		break;
+#endif
+#ifdef HAVE_CURL
+	case IO_SOURCE_CURL:
+		res = io_curl_seek (s, where);
+		break;
 #endif
 	default:
 		fatal ("Unknown io_stream->source: %d", s->source);
@@ -217,8 +245,6 @@ static off_t io_seek_unbuffered (struct io_stream *s, const off_t where)
 {
 	off_t res = -1;
 
-	assert (s->source != IO_SOURCE_CURL);
-
 	switch (s->source) {
 #ifdef HAVE_MMAP
 	case IO_SOURCE_MMAP:
@@ -228,10 +254,24 @@ static off_t io_seek_unbuffered (struct io_stream *s, const off_t where)
 	case IO_SOURCE_FD:
 		res = io_seek_fd (s, where);
 		break;
+#ifdef HAVE_LIBURING
+	case IO_SOURCE_URING:
+		res = io_ring_seek (s, where);
+		break;
+#endif
+#ifdef HAVE_CURL
+	case IO_SOURCE_CURL:
+		res = io_curl_seek (s, where);
+		break;
+#endif
 	default:
 		fatal ("Unknown io_stream->source: %d", s->source);
 	}
 
+	/* Decoders may seek back after reaching the end. */
+	if (res != -1)
+		s->eof = 0;
+
 	return res;
 }
 
@@ -242,9 +282,21 @@ off_t io_seek (struct io_stream *s, off_t offset, int whence)
 	assert (s != NULL);
 	assert (s->opened);
 
-	if (s->source == IO_SOURCE_CURL || !io_ok(s))
+	if (!io_seekable(s) || !io_ok(s))
 		return -1;
 
+#ifdef HAVE_CURL
+	/* The read thread can be waiting for data at the old position
+	 * holding io_mtx.  The flag must be set before the wake up, the
+	 * thread checks it after pselect() returns. */
+	if (s->source == IO_SOURCE_CURL && s->buffered) {
+		LOCK (s->buf_mtx);
+		s->curl.seek_pending = 1;
+		UNLOCK (s->buf_mtx);
+		io_curl_wake_up (s);
+	}
+#endif
+
 	LOCK (s->io_mtx);
 	switch (whence) {
 	case SEEK_SET:
@@ -334,6 +386,12 @@ void io_close (struct io_stream *s)
 			close (s->fd);
 			break;
 #endif
+#ifdef HAVE_LIBURING
+		case IO_SOURCE_URING:
+			io_ring_close (s);
+			close (s->fd);
+			break;
+#endif
 #ifdef HAVE_CURL
 		case IO_SOURCE_CURL:
 			io_curl_close (s);
@@ -379,14 +437,29 @@ void io_close (struct io_stream *s)
 	logit ("done");
 }
 
+/* Size of a read done by the read thread: a part of the buffer, so a slow
+ * device gets a few large reads rather than many small ones.  A network
+ * read waits until the whole chunk arrives, which for a radio stream is
+ * the time it takes to play it, so streams are read in small chunks. */
+static size_t read_chunk_size (const struct io_stream *s)
+{
+	size_t size = options_get_int ("InputBuffer") * 1024 / 8;
+
+	if (s->source == IO_SOURCE_CURL)
+		return READ_CHUNK_MIN;
+
+	return CLAMP(READ_CHUNK_MIN, size, READ_CHUNK_MAX);
+}
+
 static void *io_read_thread (void *data)
 {
 	struct io_stream *s = (struct io_stream *)data;
+	size_t read_buf_size = read_chunk_size (s);
+	char *read_buf = (char *)xmalloc (read_buf_size);
 
 	logit ("IO read thread created");
 
 	while (!s->stop_read_thread) {
-		char read_buf[8096];
 		int read_buf_fill = 0;
 		int read_buf_pos = 0;
 
@@ -397,7 +470,7 @@ static void *io_read_thread (void *data)
 		s->after_seek = 0;
 		UNLOCK (s->buf_mtx);
 
-		read_buf_fill = io_internal_read (s, 0, read_buf, sizeof(read_buf));
+		read_buf_fill = io_internal_read (s, 0, read_buf, read_buf_size);
 		UNLOCK (s->io_mtx);
 		if (read_buf_fill > 0)
 			debug ("Read %d bytes", read_buf_fill);
@@ -409,6 +482,13 @@ static void *io_read_thread (void *data)
 			break;
 		}
 
+		/* The data are from before a seek, it's not the end of the
+		 * stream even if nothing was read. */
+		if (s->after_seek) {
+			UNLOCK (s->buf_mtx);
+			continue;
+		}
+
 		if (read_buf_fill < 0) {
 			s->errno_val = errno;
 			s->read_error = 1;
@@ -468,6 +548,7 @@ static void *io_read_thread (void *data)
 	if (s->stop_read_thread)
 		logit ("Stop request");
 
+	free (read_buf);
 	logit ("Exiting IO read thread");
 
 	return NULL;
@@ -495,6 +576,22 @@ static void io_open_file (struct io_stream *s, const char *file)
 		s->size = file_stat.st_size;
 		s->opened = 1;
 
+#ifdef HAVE_POSIX_FADVISE
+		/* Let the system read ahead more. */
+		posix_fadvise (s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+#ifdef HAVE_LIBURING
+		if (options_get_bool ("UseIOUring")) {
+			if (io_ring_open (s)) {
+				s->source = IO_SOURCE_URING;
+				break;
+			}
+			logit ("Can't use io_uring for %s, falling back to the "
+			       "usual reading", file);
+		}
+#endif
+
 #ifdef HAVE_MMAP
 		if (!options_get_bool ("UseMMap")) {
 			logit ("Not using mmap()");
@@ -512,6 +609,34 @@ static void io_open_file (struct io_stream *s, const char *file)
 	} while (0);
 }
 
+/* Tell the system that the start of the file is going to be read soon,
+ * so the first reads don't wait for the disk or network.  This doesn't
+ * block. */
+void io_prefetch (const char *file)
+{
+#ifdef HAVE_POSIX_FADVISE
+	int fd;
+#endif
+
+	assert (file != NULL);
+
+	if (is_url (file)) {
+#ifdef HAVE_CURL
+		io_curl_prefetch (file);
+#endif
+		return;
+	}
+
+#ifdef HAVE_POSIX_FADVISE
+	fd = open (file, O_RDONLY);
+	if (fd == -1)
+		return;
+
+	posix_fadvise (fd, 0, PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+	close (fd);
+#endif
+}
+
 /* Open the file. */
 struct io_stream *io_open (const char *file, const int buffered)
 {
@@ -614,6 +739,9 @@ static ssize_t io_peek_internal (struct io_stream *s, void *buf, size_t count)
  * occurs which prevents prebuffering. */
 void io_prebuffer (struct io_stream *s, const size_t to_fill)
 {
+	if (!s->buffered)
+		return;
+
 	logit ("prebuffering to %zu bytes...", to_fill);
 
 	LOCK (s->buf_mtx);
@@ -868,5 +996,10 @@ void io_set_buf_fill_callback (struct io_stream *s,
 /* Return a non-zero value if the stream is seekable. */
 int io_seekable (const struct io_stream *s)
 {
-	return s->source == IO_SOURCE_FD || s->source == IO_SOURCE_MMAP;
+#ifdef HAVE_CURL
+	if (s->source == IO_SOURCE_CURL)
+		return io_curl_seekable (s);
+#endif
+
+	return 1;
 }
@@ -4,6 +4,7 @@
 #include <sys/types.h>
 #include <pthread.h>
 #ifdef HAVE_CURL
+# include <stdio.h>
 # include <sys/socket.h>     /* curl sometimes needs this */
 # include <curl/curl.h>
 #endif
@@ -18,7 +19,8 @@ enum io_source
 {
 	IO_SOURCE_FD,
 	IO_SOURCE_MMAP,
-	IO_SOURCE_CURL
+	IO_SOURCE_CURL,
+	IO_SOURCE_URING
 };
 
 #ifdef HAVE_CURL
@@ -45,6 +47,19 @@ struct io_stream_curl
 				   0 - disabled, in bytes */
 	size_t icy_meta_count;	/* how many bytes was read from the last
 				   metadata packet */
+	int http_status;	/* status code of the current response */
+	int accept_ranges;	/* did the server send Accept-Ranges: bytes? */
+	off_t content_length;	/* of the current response, -1 if unknown */
+	int got_response;	/* were the headers of the file received? */
+	int seekable;		/* can we seek using range requests? */
+	int seek_pending;	/* io_seek() waits for the read to stop,
+				   protected by buf_mtx */
+	off_t pos;		/* position of the reader (seekable streams) */
+	off_t transfer_pos;	/* position of the next byte from curl */
+	off_t restart_pos;	/* where the last range request started */
+	FILE *cache;		/* sparse copy of the downloaded ranges */
+	struct io_curl_range *ranges;	/* ranges in the cache, sorted */
+	int ranges_num;
 };
 #endif
 
@@ -78,6 +93,10 @@ struct io_stream
 	struct io_stream_curl curl;
 #endif
 
+#ifdef HAVE_LIBURING
+	struct io_ring_stream *ring;
+#endif
+
 	struct fifo_buf *buf;
 	pthread_mutex_t buf_mtx;
 	pthread_cond_t buf_free_cond; /* some space became available in the
@@ -99,6 +118,7 @@ struct io_stream
 };
 
 struct io_stream *io_open (const char *file, const int buffered);
+void io_prefetch (const char *file);
 ssize_t io_read (struct io_stream *s, void *buf, size_t count);
 ssize_t io_peek (struct io_stream *s, void *buf, size_t count);
 off_t io_seek (struct io_stream *s, off_t offset, int whence);
@@ -23,6 +23,8 @@
 #include <errno.h>
 #include <assert.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
 
 #define DEBUG
 
@@ -33,11 +35,106 @@
 #include "options.h"
 #include "lists.h"
 
+/* A part of the file present in the cache. */
+struct io_curl_range
+{
+	off_t start;
+	off_t end;	/* the first byte after the range */
+};
+
+/* How long may connecting to the next URL take (seconds). */
+#define PREFETCH_TIMEOUT	10
+
 static char user_agent[] = PACKAGE_NAME"/"PACKAGE_VERSION;
 
+/* DNS cache and TLS sessions shared by all handles, so consecutive
+ * streams from a server don't resolve the host and negotiate TLS again. */
+static CURLSH *share = NULL;
+static pthread_mutex_t share_mtx[CURL_LOCK_DATA_LAST];
+
+/* Keep the connection open after the transfer, we use HTTP/1.0. */
+static struct curl_slist *prefetch_headers = NULL;
+
+/* Handles of the URL connected to by io_curl_prefetch().  The connection
+ * stays in the cache of the multi handle, io_curl_open() of the same URL
+ * takes both handles and reuses it.  They belong to the prefetch thread
+ * until prefetch_done is set. */
+static char *prefetch_url = NULL;
+static CURLM *prefetch_multi = NULL;
+static CURL *prefetch_handle = NULL;
+
+static pthread_mutex_t prefetch_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t prefetch_tid;
+static int prefetch_running = 0;	/* was the thread not joined? */
+static int prefetch_done = 0;		/* has the thread finished? */
+
+static void share_lock (CURL *unused1 ATTR_UNUSED, curl_lock_data data,
+		curl_lock_access unused2 ATTR_UNUSED, void *unused3 ATTR_UNUSED)
+{
+	LOCK (share_mtx[data]);
+}
+
+static void share_unlock (CURL *unused1 ATTR_UNUSED, curl_lock_data data,
+		void *unused2 ATTR_UNUSED)
+{
+	UNLOCK (share_mtx[data]);
+}
+
+/* Free the handles of the prefetched URL if no stream took them.  The
+ * prefetch thread must not be running. */
+static void free_prefetched ()
+{
+	if (prefetch_multi) {
+		curl_multi_cleanup (prefetch_multi);
+		prefetch_multi = NULL;
+	}
+	if (prefetch_handle) {
+		curl_easy_cleanup (prefetch_handle);
+		prefetch_handle = NULL;
+	}
+	if (prefetch_url) {
+		free (prefetch_url);
+		prefetch_url = NULL;
+	}
+}
+
+/* If the URL was prefetched, give its handles to the stream.  Return 0 if
+ * the stream must create its own. */
+static int take_prefetched (struct io_stream *s, const char *url)
+{
+	int taken = 0;
+
+	LOCK (prefetch_mtx);
+
+	if (prefetch_running && prefetch_done) {
+		pthread_join (prefetch_tid, NULL);
+		prefetch_running = 0;
+	}
+
+	if (!prefetch_running && prefetch_url && !strcmp (prefetch_url, url)) {
+		debug ("Using the connection made in advance");
+		s->curl.multi_handle = prefetch_multi;
+		s->curl.handle = prefetch_handle;
+		prefetch_multi = NULL;
+		prefetch_handle = NULL;
+		free (prefetch_url);
+		prefetch_url = NULL;
+
+		/* Drop the options of the HEAD request, live connections
+		 * are kept. */
+		curl_easy_reset (s->curl.handle);
+		taken = 1;
+	}
+
+	UNLOCK (prefetch_mtx);
+
+	return taken;
+}
+
 void io_curl_init ()
 {
 	char *ptr;
+	int ix;
 
 	for (ptr = user_agent; *ptr; ptr += 1) {
 		if (*ptr == ' ')
@@ -45,13 +142,101 @@ void io_curl_init ()
 	}
 
 	curl_global_init (CURL_GLOBAL_NOTHING);
+
+	if (!(share = curl_share_init())) {
+		logit ("curl_share_init() returned NULL");
+		return;
+	}
+
+	for (ix = 0; ix < CURL_LOCK_DATA_LAST; ix += 1)
+		pthread_mutex_init (&share_mtx[ix], NULL);
+
+	curl_share_setopt (share, CURLSHOPT_LOCKFUNC, share_lock);
+	curl_share_setopt (share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+	curl_share_setopt (share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt (share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+	prefetch_headers = curl_slist_append (NULL, "Connection: Keep-Alive");
 }
 
 void io_curl_cleanup ()
 {
+	int ix, running;
+
+	LOCK (prefetch_mtx);
+	running = prefetch_running;
+	prefetch_running = 0;
+	UNLOCK (prefetch_mtx);
+
+	if (running)
+		pthread_join (prefetch_tid, NULL);
+	free_prefetched ();
+
+	if (share) {
+		curl_share_cleanup (share);
+		share = NULL;
+		for (ix = 0; ix < CURL_LOCK_DATA_LAST; ix += 1)
+			pthread_mutex_destroy (&share_mtx[ix]);
+	}
+
+	if (prefetch_headers) {
+		curl_slist_free_all (prefetch_headers);
+		prefetch_headers = NULL;
+	}
+
 	curl_global_cleanup ();
 }
 
+/* Note that the bytes from start to end are in the cache, merging the
+ * ranges which overlap or touch. */
+static void add_range (struct io_stream *s, const off_t start,
+		const off_t end)
+{
+	struct io_curl_range *r = s->curl.ranges;
+	int first, last;
+
+	for (first = 0; first < s->curl.ranges_num && r[first].end < start;
+			first += 1)
+		;
+	for (last = first; last < s->curl.ranges_num && r[last].start <= end;
+			last += 1)
+		;
+
+	if (first == last) {
+		r = (struct io_curl_range *)xrealloc (r,
+				sizeof (struct io_curl_range)
+				* (s->curl.ranges_num + 1));
+		memmove (r + first + 1, r + first, sizeof (struct io_curl_range)
+				* (s->curl.ranges_num - first));
+		r[first].start = start;
+		r[first].end = end;
+		s->curl.ranges = r;
+		s->curl.ranges_num += 1;
+		return;
+	}
+
+	r[first].start = MIN(r[first].start, start);
+	r[first].end = MAX(r[last - 1].end, end);
+	memmove (r + first + 1, r + last, sizeof (struct io_curl_range)
+			* (s->curl.ranges_num - last));
+	s->curl.ranges_num -= last - first - 1;
+}
+
+/* Return the number of bytes in the cache starting at pos. */
+static off_t cached_bytes (const struct io_stream *s, const off_t pos)
+{
+	int ix;
+
+	for (ix = 0; ix < s->curl.ranges_num; ix += 1) {
+		if (s->curl.ranges[ix].start > pos)
+			break;
+		if (s->curl.ranges[ix].end > pos)
+			return s->curl.ranges[ix].end - pos;
+	}
+
+	return 0;
+}
+
 static size_t write_cb (void *data, size_t size, size_t nmemb,
 		void *stream)
 {
@@ -59,14 +244,65 @@ static size_t write_cb (void *data, size_t size, size_t nmemb,
 	size_t buf_start = s->curl.buf_fill;
 	size_t data_size = size * nmemb;
 
-	s->curl.buf_fill += data_size;
 	debug ("Got %zu bytes", data_size);
-	s->curl.buf = (char *)xrealloc (s->curl.buf, s->curl.buf_fill);
-	memcpy (s->curl.buf + buf_start, data, data_size);
+
+	if (s->curl.seekable) {
+		if (pwrite (fileno (s->curl.cache), data, data_size,
+					s->curl.transfer_pos)
+				!= (ssize_t)data_size) {
+			log_errno ("Can't write to the stream cache", errno);
+			return 0;
+		}
+		add_range (s, s->curl.transfer_pos,
+				s->curl.transfer_pos + data_size);
+	}
+	else {
+		s->curl.buf_fill += data_size;
+		s->curl.buf = (char *)xrealloc (s->curl.buf, s->curl.buf_fill);
+		memcpy (s->curl.buf + buf_start, data, data_size);
+	}
+
+	s->curl.transfer_pos += data_size;
 
 	return data_size;
 }
 
+/* Called at the end of the headers of a response.  Return 0 if the
+ * transfer should be aborted. */
+static int headers_end (struct io_stream *s)
+{
+	/* Headers of a redirection, the next response follows. */
+	if (s->curl.http_status / 100 != 2)
+		return 1;
+
+	if (s->curl.got_response) {
+		/* Requesting from byte 0 sends no range. */
+		if (s->curl.http_status != 206 && s->curl.transfer_pos != 0) {
+			logit ("The server ignored the range request");
+			return 0;
+		}
+		return 1;
+	}
+
+	s->curl.got_response = 1;
+
+	/* Seeking would break the icy metadata interval. */
+	if (!s->curl.accept_ranges || s->curl.content_length <= 0
+			|| s->curl.icy_meta_int)
+		return 1;
+
+	if (!(s->curl.cache = tmpfile ())) {
+		log_errno ("Can't create the stream cache", errno);
+		return 1;
+	}
+
+	s->curl.seekable = 1;
+	s->size = s->curl.content_length;
+	debug ("Seekable stream of %"PRId64" bytes", s->size);
+
+	return 1;
+}
+
 static size_t header_cb (void *data, size_t size, size_t nmemb,
 		void *stream)
 {
@@ -77,7 +313,7 @@ static size_t header_cb (void *data, size_t size, size_t nmemb,
 	assert (s != NULL);
 
 	if (size * nmemb <= 2)
-		return size * nmemb;
+		return headers_end (s) ? size * nmemb : 0;
 
 	/* we dont need '\r\n', so cut it. */
 	header_size = sizeof(char) * (size * nmemb + 1 - 2);
@@ -87,9 +323,39 @@ static size_t header_cb (void *data, size_t size, size_t nmemb,
 	memcpy (header, data, size * nmemb - 2);
 	header[header_size-1] = 0;
 
-	if (!strncasecmp(header, "Location:", sizeof("Location:")-1)) {
+	if (!strncasecmp(header, "HTTP/", sizeof("HTTP/")-1)
+			|| !strncasecmp(header, "ICY ", sizeof("ICY ")-1)) {
+		char *value = strchr (header, ' ');
+
+		s->curl.http_status = value ? atoi (value) : 0;
+		s->curl.accept_ranges = 0;
+		s->curl.content_length = -1;
+	}
+	else if (!strncasecmp(header, "Location:", sizeof("Location:")-1)) {
 		s->curl.got_locn = 1;
 	}
+	else if (!strncasecmp(header, "Accept-Ranges:",
+				sizeof("Accept-Ranges:")-1)) {
+		char *value = header + sizeof("Accept-Ranges:") - 1;
+
+		while (isblank(value[0]))
+			value++;
+
+		s->curl.accept_ranges = !strncasecmp(value, "bytes",
+				sizeof("bytes")-1);
+	}
+	else if (!strncasecmp(header, "Content-Length:",
+				sizeof("Content-Length:")-1)) {
+		char *end;
+		char *value = header + sizeof("Content-Length:") - 1;
+
+		s->curl.content_length = strtoll (value, &end, 10);
+		if (end == value || *end)
+			s->curl.content_length = -1;
+	}
+	else if (s->curl.got_response) {
+		/* Headers of a range request, the rest is known. */
+	}
 	else if (!strncasecmp(header, "Content-Type:", sizeof("Content-Type:")-1)) {
 		/* If we got redirected then use the last MIME type. */
 		if (s->curl.got_locn && s->curl.mime_type) {
@@ -199,7 +465,11 @@ static int check_curl_stream (struct io_stream *s)
 			s->curl.status = msg->data.result;
 			if (s->curl.status != CURLE_OK) {
 				debug ("Read error");
-				res = 0;
+
+				/* The rest of a seekable stream is requested
+				 * again when it's needed. */
+				if (!s->curl.seekable)
+					res = 0;
 			}
 			curl_multi_remove_handle (s->curl.multi_handle, s->curl.handle);
 			curl_easy_cleanup (s->curl.handle);
@@ -212,6 +482,35 @@ static int check_curl_stream (struct io_stream *s)
 	return res;
 }
 
+/* Set the options of a new easy handle. */
+static void setup_handle (struct io_stream *s)
+{
+	curl_easy_setopt (s->curl.handle, CURLOPT_NOPROGRESS, 1);
+	curl_easy_setopt (s->curl.handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_0);
+	curl_easy_setopt (s->curl.handle, CURLOPT_WRITEFUNCTION, write_cb);
+	curl_easy_setopt (s->curl.handle, CURLOPT_WRITEDATA, s);
+	curl_easy_setopt (s->curl.handle, CURLOPT_HEADERFUNCTION, header_cb);
+	curl_easy_setopt (s->curl.handle, CURLOPT_WRITEHEADER, s);
+	curl_easy_setopt (s->curl.handle, CURLOPT_USERAGENT, user_agent);
+	curl_easy_setopt (s->curl.handle, CURLOPT_URL, s->curl.url);
+	curl_easy_setopt (s->curl.handle, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt (s->curl.handle, CURLOPT_FAILONERROR, 1);
+	curl_easy_setopt (s->curl.handle, CURLOPT_MAXREDIRS, 15);
+	curl_easy_setopt (s->curl.handle, CURLOPT_HTTP200ALIASES,
+			s->curl.http200_aliases);
+	curl_easy_setopt (s->curl.handle, CURLOPT_HTTPHEADER,
+			s->curl.http_headers);
+	if (share)
+		curl_easy_setopt (s->curl.handle, CURLOPT_SHARE, share);
+	if (options_get_str("HTTPProxy"))
+		curl_easy_setopt (s->curl.handle, CURLOPT_PROXY,
+				options_get_str("HTTPProxy"));
+#if !defined(NDEBUG) && defined(DEBUG)
+	curl_easy_setopt (s->curl.handle, CURLOPT_VERBOSE, 1);
+	curl_easy_setopt (s->curl.handle, CURLOPT_DEBUGFUNCTION, debug_cb);
+#endif
+}
+
 void io_curl_open (struct io_stream *s, const char *url)
 {
 	s->source = IO_SOURCE_CURL;
@@ -221,20 +520,34 @@ void io_curl_open (struct io_stream *s, const char *url)
 	s->curl.buf_fill = 0;
 	s->curl.need_perform_loop = 1;
 	s->curl.got_locn = 0;
+	s->curl.http_status = 0;
+	s->curl.accept_ranges = 0;
+	s->curl.content_length = -1;
+	s->curl.got_response = 0;
+	s->curl.seekable = 0;
+	s->curl.seek_pending = 0;
+	s->curl.pos = 0;
+	s->curl.transfer_pos = 0;
+	s->curl.restart_pos = -1;
+	s->curl.cache = NULL;
+	s->curl.ranges = NULL;
+	s->curl.ranges_num = 0;
 
 	s->curl.wake_up_pipe[0] = -1;
 	s->curl.wake_up_pipe[1] = -1;
 
-	if (!(s->curl.multi_handle = curl_multi_init())) {
-		logit ("curl_multi_init() returned NULL");
-		s->errno_val = EINVAL;
-		return;
-	}
+	if (!take_prefetched (s, url)) {
+		if (!(s->curl.multi_handle = curl_multi_init())) {
+			logit ("curl_multi_init() returned NULL");
+			s->errno_val = EINVAL;
+			return;
+		}
 
-	if (!(s->curl.handle = curl_easy_init())) {
-		logit ("curl_easy_init() returned NULL");
-		s->errno_val = EINVAL;
-		return;
+		if (!(s->curl.handle = curl_easy_init())) {
+			logit ("curl_easy_init() returned NULL");
+			s->errno_val = EINVAL;
+			return;
+		}
 	}
 
 	s->curl.multi_status = CURLM_OK;
@@ -246,29 +559,10 @@ void io_curl_open (struct io_stream *s, const char *url)
 
 	s->curl.http200_aliases = curl_slist_append (NULL, "ICY");
 	s->curl.http_headers = curl_slist_append (NULL, "Icy-MetaData: 1");
+	s->curl.http_headers = curl_slist_append (s->curl.http_headers,
+			"Connection: Keep-Alive");
 
-	curl_easy_setopt (s->curl.handle, CURLOPT_NOPROGRESS, 1);
-	curl_easy_setopt (s->curl.handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_0);
-	curl_easy_setopt (s->curl.handle, CURLOPT_WRITEFUNCTION, write_cb);
-	curl_easy_setopt (s->curl.handle, CURLOPT_WRITEDATA, s);
-	curl_easy_setopt (s->curl.handle, CURLOPT_HEADERFUNCTION, header_cb);
-	curl_easy_setopt (s->curl.handle, CURLOPT_WRITEHEADER, s);
-	curl_easy_setopt (s->curl.handle, CURLOPT_USERAGENT, user_agent);
-	curl_easy_setopt (s->curl.handle, CURLOPT_URL, s->curl.url);
-	curl_easy_setopt (s->curl.handle, CURLOPT_FOLLOWLOCATION, 1);
-	curl_easy_setopt (s->curl.handle, CURLOPT_FAILONERROR, 1);
-	curl_easy_setopt (s->curl.handle, CURLOPT_MAXREDIRS, 15);
-	curl_easy_setopt (s->curl.handle, CURLOPT_HTTP200ALIASES,
-			s->curl.http200_aliases);
-	curl_easy_setopt (s->curl.handle, CURLOPT_HTTPHEADER,
-			s->curl.http_headers);
-	if (options_get_str("HTTPProxy"))
-		curl_easy_setopt (s->curl.handle, CURLOPT_PROXY,
-				options_get_str("HTTPProxy"));
-#if !defined(NDEBUG) && defined(DEBUG)
-	curl_easy_setopt (s->curl.handle, CURLOPT_VERBOSE, 1);
-	curl_easy_setopt (s->curl.handle, CURLOPT_DEBUGFUNCTION, debug_cb);
-#endif
+	setup_handle (s);
 
 	if ((s->curl.multi_status = curl_multi_add_handle(s->curl.multi_handle,
 					s->curl.handle)) != CURLM_OK) {
@@ -314,6 +608,43 @@ void io_curl_close (struct io_stream *s)
 
 	if (s->curl.http200_aliases)
 		curl_slist_free_all (s->curl.http200_aliases);
+
+	if (s->curl.cache)
+		fclose (s->curl.cache);
+	if (s->curl.ranges)
+		free (s->curl.ranges);
+}
+
+/* Start a new transfer of the file at the given position.  Return 0 on
+ * error. */
+static int curl_restart (struct io_stream *s, const off_t pos)
+{
+	debug ("Requesting the file from byte %"PRId64, pos);
+
+	if (s->curl.handle)
+		curl_multi_remove_handle (s->curl.multi_handle, s->curl.handle);
+	else if ((s->curl.handle = curl_easy_init()))
+		setup_handle (s);
+	else {
+		logit ("curl_easy_init() returned NULL");
+		return 0;
+	}
+
+	curl_easy_setopt (s->curl.handle, CURLOPT_RESUME_FROM_LARGE,
+			(curl_off_t)pos);
+
+	if ((s->curl.multi_status = curl_multi_add_handle(s->curl.multi_handle,
+					s->curl.handle)) != CURLM_OK) {
+		logit ("curl_multi_add_handle() failed");
+		return 0;
+	}
+
+	s->curl.status = CURLE_OK;
+	s->curl.transfer_pos = pos;
+	s->curl.restart_pos = pos;
+	s->curl.need_perform_loop = 1;
+
+	return 1;
 }
 
 /* Get data using curl and put them into the internal buffer.
@@ -322,7 +653,7 @@ void io_curl_close (struct io_stream *s)
 static int curl_read_internal (struct io_stream *s)
 {
 	int running = 1;
-	long buf_fill_before = s->curl.buf_fill;
+	off_t transfer_pos_before = s->curl.transfer_pos;
 
 	if (s->curl.need_perform_loop) {
 		debug ("Starting curl...");
@@ -338,7 +669,8 @@ static int curl_read_internal (struct io_stream *s)
 		s->curl.need_perform_loop = 0;
 	}
 
-	while (s->opened && running && buf_fill_before == s->curl.buf_fill
+	while (s->opened && running
+			&& transfer_pos_before == s->curl.transfer_pos
 			&& s->curl.handle
 			&& (s->curl.multi_status == CURLM_CALL_MULTI_PERFORM
 				|| s->curl.multi_status == CURLM_OK)) {
@@ -389,7 +721,12 @@ static int curl_read_internal (struct io_stream *s)
 				return 1;
 
 			if (FD_ISSET(s->curl.wake_up_pipe[0], &read_fds)) {
+				int w;
+
 				logit ("Got wake up - exiting");
+				if (read(s->curl.wake_up_pipe[0], &w, sizeof(w)) < 0)
+					log_errno ("read() on the wake up pipe failed",
+							errno);
 				return 1;
 			}
 
@@ -562,6 +899,75 @@ static int read_icy_metadata (struct io_stream *s)
 	return 1;
 }
 
+/* Return a non-zero value if io_seek() waits for the read to stop. */
+static int seek_pending (struct io_stream *s)
+{
+	int pending;
+
+	if (!s->buffered)
+		return 0;
+
+	LOCK (s->buf_mtx);
+	pending = s->curl.seek_pending;
+	UNLOCK (s->buf_mtx);
+
+	return pending;
+}
+
+/* Read from a seekable stream.  The data are taken from the cache if they
+ * were already downloaded, otherwise the transfer is restarted at the
+ * position if it's somewhere else. */
+static ssize_t read_seekable (struct io_stream *s, char *buf, size_t count)
+{
+	size_t nread = 0;
+
+	while (nread < count && s->curl.pos < s->size
+			&& !s->stop_read_thread && !seek_pending(s)) {
+		off_t avail = cached_bytes (s, s->curl.pos);
+
+		if (avail > 0) {
+			ssize_t res;
+
+			res = pread (fileno (s->curl.cache), buf + nread,
+					MIN((off_t)(count - nread), avail),
+					s->curl.pos);
+			if (res <= 0) {
+				if (res == 0)
+					errno = EIO;
+				log_errno ("Can't read the stream cache", errno);
+				return -1;
+			}
+
+			nread += res;
+			s->curl.pos += res;
+			continue;
+		}
+
+		/* The server may drop a transfer which was idle while we
+		 * were reading from the cache, request the rest again unless
+		 * that's what has just ended. */
+		if (!s->curl.handle && s->curl.transfer_pos == s->curl.pos) {
+			if (s->curl.restart_pos == s->curl.pos) {
+				if (s->curl.status != CURLE_OK)
+					return -1;
+				logit ("The server sent less data than announced");
+				break;
+			}
+			logit ("The transfer stopped at byte %"PRId64
+					", requesting the rest", s->curl.pos);
+		}
+
+		if ((!s->curl.handle || s->curl.transfer_pos != s->curl.pos)
+				&& !curl_restart(s, s->curl.pos))
+			return -1;
+
+		if (!curl_read_internal(s))
+			return -1;
+	}
+
+	return nread;
+}
+
 ssize_t io_curl_read (struct io_stream *s, char *buf, size_t count)
 {
 	size_t nread = 0;
@@ -574,6 +980,14 @@ ssize_t io_curl_read (struct io_stream *s, char *buf, size_t count)
 		size_t to_read;
 		size_t res;
 
+		/* It's known after the headers of the first response. */
+		if (s->curl.seekable) {
+			ssize_t cached = read_seekable (s, buf + nread,
+					count - nread);
+
+			return cached == -1 ? -1 : (ssize_t)(nread + cached);
+		}
+
 		if (s->curl.icy_meta_int && s->curl.icy_meta_count
 				== s->curl.icy_meta_int) {
 			s->curl.icy_meta_count = 0;
@@ -596,7 +1010,8 @@ ssize_t io_curl_read (struct io_stream *s, char *buf, size_t count)
 		if (nread < count && !curl_read_internal(s))
 			return -1;
 	} while (nread < count && !s->stop_read_thread
-			&& s->curl.handle); /* s->curl.handle == NULL on EOF */
+			&& (s->curl.handle || s->curl.seekable));
+			/* s->curl.handle == NULL on EOF */
 
 	return nread;
 }
@@ -624,3 +1039,173 @@ void io_curl_wake_up (struct io_stream *s)
 	if (write(s->curl.wake_up_pipe[1], &w, sizeof(w)) < 0)
 		log_errno ("Can't wake up curl thread: write() failed", errno);
 }
+
+int io_curl_seekable (const struct io_stream *s)
+{
+	assert (s != NULL);
+	assert (s->source == IO_SOURCE_CURL);
+
+	return s->curl.seekable;
+}
+
+/* Set the position of a seekable stream, the data are requested when
+ * they are read. */
+off_t io_curl_seek (struct io_stream *s, const off_t where)
+{
+	assert (s != NULL);
+	assert (s->source == IO_SOURCE_CURL);
+	assert (s->curl.seekable);
+
+	s->curl.pos = where;
+
+	if (s->buffered) {
+		LOCK (s->buf_mtx);
+		s->curl.seek_pending = 0;
+		UNLOCK (s->buf_mtx);
+	}
+
+	return where;
+}
+
+static void *prefetch_thread (void *unused ATTR_UNUSED)
+{
+	CURLMsg *msg;
+	CURLcode rc = CURLE_FAILED_INIT;
+	int running, msg_queue_num;
+
+	while (curl_multi_perform (prefetch_multi, &running) == CURLM_OK
+			&& running) {
+		fd_set read_fds, write_fds, exc_fds;
+		int max_fd = -1;
+		long milliseconds;
+		struct timeval timeout;
+
+		FD_ZERO (&read_fds);
+		FD_ZERO (&write_fds);
+		FD_ZERO (&exc_fds);
+
+		if (curl_multi_fdset (prefetch_multi, &read_fds, &write_fds,
+					&exc_fds, &max_fd) != CURLM_OK)
+			break;
+
+		curl_multi_timeout (prefetch_multi, &milliseconds);
+		if (milliseconds < 0 || milliseconds > 1000)
+			milliseconds = 1000;
+		timeout.tv_sec = milliseconds / 1000;
+		timeout.tv_usec = (milliseconds % 1000L) * 1000L;
+
+		if (select (max_fd + 1, &read_fds, &write_fds, &exc_fds,
+					&timeout) < 0 && errno != EINTR) {
+			log_errno ("select() failed", errno);
+			break;
+		}
+	}
+
+	while ((msg = curl_multi_info_read (prefetch_multi, &msg_queue_num))) {
+		if (msg->msg == CURLMSG_DONE)
+			rc = msg->data.result;
+	}
+
+	/* The connection stays in the cache of the multi handle. */
+	curl_multi_remove_handle (prefetch_multi, prefetch_handle);
+
+	LOCK (prefetch_mtx);
+
+	if (rc != CURLE_OK) {
+		logit ("Connecting to the next URL failed: %s",
+				curl_easy_strerror (rc));
+		free_prefetched ();
+	}
+	else
+		debug ("Connected to the next URL");
+
+	prefetch_done = 1;
+	UNLOCK (prefetch_mtx);
+
+	return NULL;
+}
+
+/* Resolve the host and connect to the server of the URL in the
+ * background with a HEAD request.  Opening the URL later takes the
+ * handles and reuses the connection. */
+void io_curl_prefetch (const char *url)
+{
+	int rc;
+
+	assert (url != NULL);
+
+	LOCK (prefetch_mtx);
+
+	if (prefetch_running && !prefetch_done) {
+		UNLOCK (prefetch_mtx);
+		debug ("Still connecting to the previous URL");
+		return;
+	}
+
+	if (prefetch_running) {
+		pthread_join (prefetch_tid, NULL);
+		prefetch_running = 0;
+	}
+
+	if (prefetch_url && !strcmp (prefetch_url, url)) {
+		UNLOCK (prefetch_mtx);
+		debug ("Already connected to %s", url);
+		return;
+	}
+
+	free_prefetched ();
+
+	if (!(prefetch_multi = curl_multi_init())) {
+		UNLOCK (prefetch_mtx);
+		logit ("curl_multi_init() returned NULL");
+		return;
+	}
+
+	if (!(prefetch_handle = curl_easy_init())) {
+		free_prefetched ();
+		UNLOCK (prefetch_mtx);
+		logit ("curl_easy_init() returned NULL");
+		return;
+	}
+
+	prefetch_url = xstrdup (url);
+
+	curl_easy_setopt (prefetch_handle, CURLOPT_NOPROGRESS, 1);
+	curl_easy_setopt (prefetch_handle, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt (prefetch_handle, CURLOPT_NOBODY, 1);
+	curl_easy_setopt (prefetch_handle, CURLOPT_TIMEOUT, PREFETCH_TIMEOUT);
+	curl_easy_setopt (prefetch_handle, CURLOPT_HTTP_VERSION,
+			CURL_HTTP_VERSION_1_0);
+	curl_easy_setopt (prefetch_handle, CURLOPT_USERAGENT, user_agent);
+	curl_easy_setopt (prefetch_handle, CURLOPT_URL, url);
+	curl_easy_setopt (prefetch_handle, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt (prefetch_handle, CURLOPT_MAXREDIRS, 15);
+	curl_easy_setopt (prefetch_handle, CURLOPT_HTTPHEADER, prefetch_headers);
+	if (share)
+		curl_easy_setopt (prefetch_handle, CURLOPT_SHARE, share);
+	if (options_get_str("HTTPProxy"))
+		curl_easy_setopt (prefetch_handle, CURLOPT_PROXY,
+				options_get_str("HTTPProxy"));
+
+	if (curl_multi_add_handle (prefetch_multi, prefetch_handle)
+			!= CURLM_OK) {
+		free_prefetched ();
+		UNLOCK (prefetch_mtx);
+		logit ("curl_multi_add_handle() failed");
+		return;
+	}
+
+	debug ("Connecting to %s", url);
+
+	prefetch_done = 0;
+	rc = pthread_create (&prefetch_tid, NULL, prefetch_thread, NULL);
+	if (rc != 0) {
+		log_errno ("Can't create the prefetch thread", rc);
+		curl_multi_remove_handle (prefetch_multi, prefetch_handle);
+		free_prefetched ();
+	}
+	else
+		prefetch_running = 1;
+
+	UNLOCK (prefetch_mtx);
+}
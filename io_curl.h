@@ -14,6 +14,9 @@ void io_curl_close (struct io_stream *s);
 ssize_t io_curl_read (struct io_stream *s, char *buf, size_t count);
 void io_curl_strerror (struct io_stream *s);
 void io_curl_wake_up (struct io_stream *s);
+int io_curl_seekable (const struct io_stream *s);
+off_t io_curl_seek (struct io_stream *s, const off_t where);
+void io_curl_prefetch (const char *url);
 
 #ifdef __cplusplus
 }
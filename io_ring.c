@@ -0,0 +1,354 @@
+/*
+ * MOC - music on console
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/* Reading files with io_uring.
+ *
+ * There is one ring for the whole process and a pool of buffers registered
+ * with it.  A stream takes two buffers: while the caller reads from one,
+ * the next part of the file is being read into the other.  Buffered streams
+ * still have their read thread and input buffer on top of it.  The thread
+ * which waits for a read collects the completions of all streams, other
+ * waiting threads sleep on a condition until it's done. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <liburing.h>
+
+#include "common.h"
+#include "log.h"
+#include "io.h"
+#include "io_ring.h"
+
+#define RING_ENTRIES	64
+#define RING_BUFFERS	64
+#define RING_BUF_SIZE	(64 * 1024)
+
+enum buf_state
+{
+	BUF_IDLE,
+	BUF_PENDING,
+	BUF_DONE
+};
+
+struct ring_buf
+{
+	int index;		/* of the registered buffer */
+	char *data;
+	off_t offset;		/* in the file */
+	enum buf_state state;
+	int res;		/* bytes read or -errno */
+};
+
+struct io_ring_stream
+{
+	struct ring_buf *bufs[2];
+	int cur;		/* the buffer being read by the caller */
+	size_t cur_pos;		/* position in it */
+};
+
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static int ring_ok = 0;
+static int ring_fixed = 0;	/* are the buffers registered? */
+static struct io_uring ring;
+
+/* Protects the submission side and the buffers. */
+static pthread_mutex_t ring_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;
+static int reaping = 0;		/* is a thread collecting completions? */
+
+static char *pool = NULL;
+static struct ring_buf bufs[RING_BUFFERS];
+static struct ring_buf *free_bufs[RING_BUFFERS];
+static int free_count = 0;
+
+static void ring_init ()
+{
+	struct iovec iov[RING_BUFFERS];
+	int rc, ix;
+
+	rc = io_uring_queue_init (RING_ENTRIES, &ring, 0);
+	if (rc < 0) {
+		log_errno ("io_uring is not available", -rc);
+		return;
+	}
+
+	if (posix_memalign ((void **)&pool, 4096,
+				(size_t)RING_BUFFERS * RING_BUF_SIZE))
+		fatal ("Can't allocate io_uring buffers");
+
+	for (ix = 0; ix < RING_BUFFERS; ix += 1) {
+		bufs[ix].index = ix;
+		bufs[ix].data = pool + (size_t)ix * RING_BUF_SIZE;
+		bufs[ix].state = BUF_IDLE;
+		free_bufs[ix] = &bufs[ix];
+		iov[ix].iov_base = bufs[ix].data;
+		iov[ix].iov_len = RING_BUF_SIZE;
+	}
+	free_count = RING_BUFFERS;
+
+	/* Registering can fail because of RLIMIT_MEMLOCK, the buffers
+	 * still work unregistered. */
+	rc = io_uring_register_buffers (&ring, iov, RING_BUFFERS);
+	if (rc < 0)
+		log_errno ("Can't register io_uring buffers", -rc);
+	else
+		ring_fixed = 1;
+
+	ring_ok = 1;
+	logit ("Using io_uring to read files");
+}
+
+/* Queue a read of the next part of the file into the buffer.  Must be
+ * called with ring_mtx locked, io_uring_submit() submits the reads. */
+static void queue_read (struct ring_buf *rb, const int fd, const off_t offset)
+{
+	struct io_uring_sqe *sqe;
+
+	assert (rb->state != BUF_PENDING);
+
+	rb->offset = offset;
+	sqe = io_uring_get_sqe (&ring);
+	if (!sqe) {
+		rb->state = BUF_DONE;
+		rb->res = -EBUSY;
+		return;
+	}
+
+	if (ring_fixed)
+		io_uring_prep_read_fixed (sqe, fd, rb->data, RING_BUF_SIZE,
+				offset, rb->index);
+	else
+		io_uring_prep_read (sqe, fd, rb->data, RING_BUF_SIZE, offset);
+	io_uring_sqe_set_data (sqe, rb);
+	rb->state = BUF_PENDING;
+}
+
+static void submit ()
+{
+	int rc = io_uring_submit (&ring);
+
+	if (rc < 0)
+		fatal ("io_uring_submit() failed: %s", xstrerror (-rc));
+}
+
+/* Wait for a completion and mark the buffers of all completed reads.
+ * Called with ring_mtx locked, it's unlocked while waiting. */
+static void reap ()
+{
+	struct io_uring_cqe *cqe;
+	unsigned head, count = 0;
+	int rc;
+
+	reaping = 1;
+	UNLOCK (ring_mtx);
+	rc = io_uring_wait_cqe (&ring, &cqe);
+	LOCK (ring_mtx);
+	reaping = 0;
+
+	if (rc < 0 && rc != -EINTR && rc != -EAGAIN)
+		fatal ("io_uring_wait_cqe() failed: %s", xstrerror (-rc));
+
+	io_uring_for_each_cqe (&ring, head, cqe) {
+		struct ring_buf *rb = (struct ring_buf *)io_uring_cqe_get_data (cqe);
+
+		rb->res = cqe->res;
+		rb->state = BUF_DONE;
+		count += 1;
+	}
+	io_uring_cq_advance (&ring, count);
+
+	pthread_cond_broadcast (&ring_cond);
+}
+
+/* Wait until the read into the buffer is finished. */
+static void wait_done (struct ring_buf *rb)
+{
+	LOCK (ring_mtx);
+	while (rb->state == BUF_PENDING) {
+		if (reaping)
+			pthread_cond_wait (&ring_cond, &ring_mtx);
+		else
+			reap ();
+	}
+	UNLOCK (ring_mtx);
+}
+
+/* Start reading the file at the given offset into both buffers. */
+static void start_reads (struct io_stream *s, const off_t offset)
+{
+	struct io_ring_stream *r = s->ring;
+
+	LOCK (ring_mtx);
+	queue_read (r->bufs[0], s->fd, offset);
+	queue_read (r->bufs[1], s->fd, offset + RING_BUF_SIZE);
+	submit ();
+	UNLOCK (ring_mtx);
+
+	r->cur = 0;
+	r->cur_pos = 0;
+}
+
+/* Set up reading the opened file (s->fd) with io_uring.  Return 0 if
+ * io_uring can't be used. */
+int io_ring_open (struct io_stream *s)
+{
+	struct io_ring_stream *r;
+
+	assert (s != NULL);
+	assert (s->fd != -1);
+
+	pthread_once (&ring_once, ring_init);
+	if (!ring_ok)
+		return 0;
+
+	r = (struct io_ring_stream *)xmalloc (sizeof (struct io_ring_stream));
+
+	LOCK (ring_mtx);
+	if (free_count < 2) {
+		UNLOCK (ring_mtx);
+		logit ("No free io_uring buffers");
+		free (r);
+		return 0;
+	}
+	r->bufs[0] = free_bufs[--free_count];
+	r->bufs[1] = free_bufs[--free_count];
+	UNLOCK (ring_mtx);
+
+	s->ring = r;
+	start_reads (s, 0);
+
+	return 1;
+}
+
+/* Read from the stream.  If dont_move is set the position is unchanged,
+ * then no more than two buffers of data can be returned. */
+ssize_t io_ring_read (struct io_stream *s, const int dont_move, char *buf,
+		size_t count)
+{
+	struct io_ring_stream *r = s->ring;
+	int cur;
+	size_t pos;
+	size_t copied = 0;
+
+	assert (r != NULL);
+
+	cur = r->cur;
+	pos = r->cur_pos;
+
+	while (copied < count) {
+		struct ring_buf *rb = r->bufs[cur];
+		struct ring_buf *next = r->bufs[!cur];
+		off_t next_offset;
+
+		wait_done (rb);
+
+		if (rb->res < 0) {
+			if (copied)
+				break;
+			errno = -rb->res;
+			return -1;
+		}
+
+		if (pos < (size_t)rb->res) {
+			size_t len = MIN(count - copied, rb->res - pos);
+
+			memcpy (buf + copied, rb->data + pos, len);
+			copied += len;
+			pos += len;
+			continue;
+		}
+
+		if (rb->res == 0)
+			break;	/* EOF */
+
+		if (dont_move && cur != r->cur)
+			break;
+
+		/* The other buffer was read assuming this one would be
+		 * full, read it again after a short read. */
+		next_offset = rb->offset + rb->res;
+		wait_done (next);
+		if (next->offset != next_offset) {
+			LOCK (ring_mtx);
+			queue_read (next, s->fd, next_offset);
+			if (!dont_move)
+				queue_read (rb, s->fd, next_offset + RING_BUF_SIZE);
+			submit ();
+			UNLOCK (ring_mtx);
+		}
+		else if (!dont_move) {
+			LOCK (ring_mtx);
+			queue_read (rb, s->fd, next_offset + RING_BUF_SIZE);
+			submit ();
+			UNLOCK (ring_mtx);
+		}
+
+		cur = !cur;
+		pos = 0;
+	}
+
+	if (!dont_move) {
+		r->cur = cur;
+		r->cur_pos = pos;
+	}
+
+	return copied;
+}
+
+off_t io_ring_seek (struct io_stream *s, const off_t where)
+{
+	struct io_ring_stream *r = s->ring;
+	struct ring_buf *rb = r->bufs[r->cur];
+
+	assert (where >= 0);
+
+	/* Keep the data if the position is in the current buffer. */
+	wait_done (rb);
+	if (rb->res >= 0 && where >= rb->offset
+			&& where <= rb->offset + rb->res) {
+		r->cur_pos = where - rb->offset;
+		return where;
+	}
+
+	wait_done (r->bufs[0]);
+	wait_done (r->bufs[1]);
+	start_reads (s, where);
+
+	return where;
+}
+
+/* Wait for the reads and give back the buffers.  The file is not closed. */
+void io_ring_close (struct io_stream *s)
+{
+	struct io_ring_stream *r = s->ring;
+
+	assert (r != NULL);
+
+	wait_done (r->bufs[0]);
+	wait_done (r->bufs[1]);
+
+	LOCK (ring_mtx);
+	r->bufs[0]->state = BUF_IDLE;
+	r->bufs[1]->state = BUF_IDLE;
+	free_bufs[free_count++] = r->bufs[0];
+	free_bufs[free_count++] = r->bufs[1];
+	UNLOCK (ring_mtx);
+
+	free (r);
+	s->ring = NULL;
+}
@@ -0,0 +1,21 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <sys/types.h>
+#include "io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int io_ring_open (struct io_stream *s);
+ssize_t io_ring_read (struct io_stream *s, const int dont_move, char *buf,
+		size_t count);
+off_t io_ring_seek (struct io_stream *s, const off_t where);
+void io_ring_close (struct io_stream *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
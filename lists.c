@@ -107,6 +107,46 @@ void lists_strs_sort (lists_t_strs *list, lists_t_compare *compare)
 	qsort (list->strs, list->size, sizeof (char *), compare);
 }
 
+/* Sort a list of which the first 'sorted' entries are already in order.
+ * Only the remaining entries are sorted and then merged into the head. */
+void lists_strs_sort_tail (lists_t_strs *list, int sorted,
+                           lists_t_compare *compare)
+{
+	char **merged;
+	int ix, iy, iz;
+
+	assert (list);
+	assert (compare);
+	assert (RANGE(0, sorted, list->size));
+
+	if (sorted == list->size)
+		return;
+
+	qsort (list->strs + sorted, list->size - sorted, sizeof (char *), compare);
+
+	if (sorted == 0)
+		return;
+
+	merged = (char **) xmalloc (sizeof (char *) * list->size);
+
+	ix = 0;
+	iy = sorted;
+	iz = 0;
+	while (ix < sorted && iy < list->size) {
+		if (compare (&list->strs[iy], &list->strs[ix]) < 0)
+			merged[iz++] = list->strs[iy++];
+		else
+			merged[iz++] = list->strs[ix++];
+	}
+	while (ix < sorted)
+		merged[iz++] = list->strs[ix++];
+	while (iy < list->size)
+		merged[iz++] = list->strs[iy++];
+
+	memcpy (list->strs, merged, sizeof (char *) * list->size);
+	free (merged);
+}
+
 /* Reverse the order of entries in a list. */
 void lists_strs_reverse (lists_t_strs *list)
 {
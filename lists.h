@@ -23,6 +23,8 @@ char *lists_strs_at (const lists_t_strs *list, int index);
 
 /* List mutating functions. */
 void lists_strs_sort (lists_t_strs *list, lists_t_compare *compare);
+void lists_strs_sort_tail (lists_t_strs *list, int sorted,
+                           lists_t_compare *compare);
 void lists_strs_reverse (lists_t_strs *list);
 
 /* Ownership transferring functions. */
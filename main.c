@@ -226,46 +226,74 @@ static void start_moc (const struct parameters *params, lists_t_strs *args)
 	close (server_sock);
 }
 
-/* Send commands requested in params to the server. */
-static void server_command (struct parameters *params, lists_t_strs *args)
+/* Connect to the server for server_command() if not connected yet and
+ * return the socket. */
+static int command_sock (int *sock)
 {
-	int sock;
+	if (*sock != -1)
+		return *sock;
 
-	if ((sock = server_connect()) == -1)
+	if ((*sock = server_connect()) == -1)
 		fatal ("The server is not running!");
 
 	xsignal (SIGPIPE, SIG_IGN);
-	if (!ping_server (sock))
+
+	/* We only need responses to our requests. */
+	send_int (*sock, CMD_SUBSCRIBE);
+	send_int (*sock, 0);
+
+	if (!ping_server (*sock))
 		fatal ("Can't connect to the server!");
 
+	return *sock;
+}
+
+/* Send commands requested in params to the server. */
+static void server_command (struct parameters *params, lists_t_strs *args)
+{
+	int sock = -1;
+
 	if (params->playit)
-		interface_cmdline_playit (sock, args);
+		interface_cmdline_playit (command_sock (&sock), args);
 	if (params->clear)
-		interface_cmdline_clear_plist (sock);
+		interface_cmdline_clear_plist (command_sock (&sock));
 	if (params->append)
-		interface_cmdline_append (sock, args);
+		interface_cmdline_append (command_sock (&sock), args);
 	if (params->enqueue)
-		interface_cmdline_enqueue (sock, args);
+		interface_cmdline_enqueue (command_sock (&sock), args);
 	if (params->play)
-		interface_cmdline_play_first (sock);
+		interface_cmdline_play_first (command_sock (&sock));
 	if (params->get_file_info)
-		interface_cmdline_file_info (sock);
+		interface_cmdline_file_info (command_sock (&sock));
 	if (params->seek_by)
-		interface_cmdline_seek_by (sock, params->seek_by);
+		interface_cmdline_seek_by (command_sock (&sock), params->seek_by);
 	if (params->jump_type=='%')
-		interface_cmdline_jump_to_percent (sock,params->jump_to);
+		interface_cmdline_jump_to_percent (command_sock (&sock),
+				params->jump_to);
 	if (params->jump_type=='s')
-		interface_cmdline_jump_to (sock,params->jump_to);
-	if (params->get_formatted_info)
-		interface_cmdline_formatted_info (sock, params->formatted_info_param);
+		interface_cmdline_jump_to (command_sock (&sock),
+				params->jump_to);
+	/* Unless we have changed something, the status page is enough. */
+	if (params->get_formatted_info && (sock != -1
+				|| !interface_cmdline_formatted_info_page (
+					params->formatted_info_param)))
+		interface_cmdline_formatted_info (command_sock (&sock),
+				params->formatted_info_param);
 	if (params->adj_volume)
-		interface_cmdline_adj_volume (sock, params->adj_volume);
+		interface_cmdline_adj_volume (command_sock (&sock),
+				params->adj_volume);
 	if (params->toggle)
-		interface_cmdline_set (sock, params->toggle, 2);
+		interface_cmdline_set (command_sock (&sock), params->toggle, 2);
 	if (params->on)
-		interface_cmdline_set (sock, params->on, 1);
+		interface_cmdline_set (command_sock (&sock), params->on, 1);
 	if (params->off)
-		interface_cmdline_set (sock, params->off, 0);
+		interface_cmdline_set (command_sock (&sock), params->off, 0);
+
+	if (params->exit || params->stop || params->pause || params->next
+			|| params->previous || params->unpause
+			|| params->toggle_pause)
+		sock = command_sock (&sock);
+
 	if (params->exit) {
 		if (!send_int(sock, CMD_QUIT))
 			fatal ("Can't send command!");
@@ -309,7 +337,8 @@ static void server_command (struct parameters *params, lists_t_strs *args)
 			fatal ("Can't send commands!");
 	}
 
-	close (sock);
+	if (sock != -1)
+		close (sock);
 }
 
 static void show_version ()
@@ -354,6 +383,9 @@ static void show_version ()
 #ifdef HAVE_CURL
 	printf (" Network streams");
 #endif
+#ifdef HAVE_LIBURING
+	printf (" io_uring");
+#endif
 #ifdef HAVE_SAMPLERATE
 	printf (" resample");
 #endif
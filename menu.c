@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 
 #include "common.h"
@@ -25,15 +26,269 @@
 #include "rbtree.h"
 #include "utf8.h"
 
+/* Number of items in the (filtered) view of the menu. */
+static int view_size (const struct menu *menu)
+{
+	if (menu->filter)
+		return menu->nfilter;
+
+	return menu->nitems + menu->nplist_items;
+}
+
+/* Return the position in the menu of the item at this position in the
+ * view. */
+static int view_to_pos (const struct menu *menu, const int v)
+{
+	assert (LIMIT(v, view_size(menu)));
+
+	return menu->filter ? menu->filter[v] : v;
+}
+
+/* Return the position in the view of the item at this position in the
+ * menu or -1 if the item is filtered out. */
+static int pos_to_view (const struct menu *menu, const int pos)
+{
+	int lo, hi;
+
+	if (!menu->filter)
+		return pos;
+
+	lo = 0;
+	hi = menu->nfilter - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+
+		if (menu->filter[mid] == pos)
+			return mid;
+		if (menu->filter[mid] < pos)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return -1;
+}
+
+static void menu_item_init (struct menu_item *mi)
+{
+	assert (mi != NULL);
+
+	mi->title = NULL;
+	mi->file = NULL;
+	mi->type = F_OTHER;
+
+	mi->attr_normal = A_NORMAL;
+	mi->attr_sel = A_NORMAL;
+	mi->attr_marked = A_NORMAL;
+	mi->attr_sel_marked = A_NORMAL;
+	mi->align = MENU_ALIGN_LEFT;
+
+	mi->time[0] = 0;
+	mi->format[0] = 0;
+	mi->queue_pos = 0;
+}
+
+/* Playlist items are kept in slots in the order they were added.  Deleting
+ * an item leaves its slot empty, so the positions of the following items
+ * are not renumbered, but counted in a Fenwick tree when needed. */
+
+/* Return the number of shown items in the slots before this one. */
+static int shown_before (const struct menu *menu, int slot)
+{
+	int count = 0;
+
+	for (; slot > 0; slot -= slot & -slot)
+		count += menu->plist_shown[slot - 1];
+
+	return count;
+}
+
+/* Return the slot of the n-th shown playlist item. */
+static int nth_shown_slot (const struct menu *menu, int n)
+{
+	int slot = 0, step;
+
+	assert (LIMIT(n, menu->nplist_items));
+
+	for (step = 1; step * 2 <= menu->nplist_slots; step *= 2)
+		;
+
+	for (; step; step /= 2) {
+		if (slot + step <= menu->nplist_slots
+				&& menu->plist_shown[slot + step - 1] <= n) {
+			slot += step;
+			n -= menu->plist_shown[slot - 1];
+		}
+	}
+
+	return slot;
+}
+
+/* Return the playlist index of the playlist item at this position in the
+ * menu. */
+static int plist_num_at (const struct menu *menu, const int pos)
+{
+	return menu->plist_items[nth_shown_slot (menu, pos - menu->nitems)];
+}
+
+/* Put the playlist item into a new slot. */
+static void add_slot (struct menu *menu, const int num)
+{
+	int slot = menu->nplist_slots++;
+	int node = slot + 1;
+
+	menu->plist_items[slot] = num;
+	menu->plist_shown[slot] = 1 + shown_before (menu, slot)
+		- shown_before (menu, node - (node & -node));
+	menu->plist_pos[num] = slot;
+	menu->nplist_items++;
+}
+
+/* Empty the slot of a deleted playlist item. */
+static void empty_slot (struct menu *menu, const int slot)
+{
+	int node;
+
+	menu->plist_pos[menu->plist_items[slot]] = -1;
+	menu->plist_items[slot] = -1;
+	menu->nplist_items--;
+
+	for (node = slot + 1; node <= menu->nplist_slots; node += node & -node)
+		menu->plist_shown[node - 1]--;
+}
+
+/* Drop the empty slots. */
+static void compact_slots (struct menu *menu)
+{
+	int i, n = 0;
+
+	for (i = 0; i < menu->nplist_slots; i++) {
+		if (menu->plist_items[i] == -1)
+			continue;
+		menu->plist_items[n] = menu->plist_items[i];
+		menu->plist_pos[menu->plist_items[n]] = n;
+		menu->plist_shown[n] = 1;
+		n++;
+	}
+
+	menu->nplist_slots = n;
+
+	for (i = 1; i <= n; i++) {
+		int parent = i + (i & -i);
+
+		if (parent <= n)
+			menu->plist_shown[parent - 1] += menu->plist_shown[i - 1];
+	}
+}
+
+/* Return the item at this position in the menu.  Items of the playlist
+ * are made in 'tmp', which must be released with release_item(). */
+static const struct menu_item *get_item (const struct menu *menu,
+		const int pos, struct menu_item *tmp)
+{
+	int num;
+
+	assert (LIMIT(pos, menu->nitems + menu->nplist_items));
+
+	if (pos < menu->nitems)
+		return menu->items[pos];
+
+	num = plist_num_at (menu, pos);
+	assert (LIMIT(num, menu->plist->num));
+	assert (!plist_deleted(menu->plist, num));
+
+	menu_item_init (tmp);
+	tmp->file = menu->plist->items[num].file;
+	tmp->type = plist_file_type (menu->plist, num);
+	menu->fill_item (tmp, menu->plist, num, menu->fill_item_data);
+	assert (tmp->title != NULL);
+
+	return tmp;
+}
+
+static void release_item (const struct menu_item *mi,
+		struct menu_item *tmp)
+{
+	if (mi == tmp)
+		free (tmp->title);
+}
+
+/* Return the file of the item at this position in the menu. */
+static const char *get_item_file (const struct menu *menu, const int pos)
+{
+	assert (LIMIT(pos, menu->nitems + menu->nplist_items));
+
+	if (pos < menu->nitems)
+		return menu->items[pos]->file;
+
+	return menu->plist->items[plist_num_at (menu, pos)].file;
+}
+
+static bool is_marked (const struct menu *menu, const struct menu_item *mi)
+{
+	return menu->marked && mi->file && !strcmp (mi->file, menu->marked);
+}
+
+static void menu_title_cache_free (struct menu *menu)
+{
+	int i;
+
+	for (i = 0; i < menu->title_cache_size; i++) {
+		free (menu->title_cache[i].title);
+		free (menu->title_cache[i].screen);
+	}
+
+	free (menu->title_cache);
+	menu->title_cache = NULL;
+	menu->title_cache_size = 0;
+}
+
+/* Return the title of the item at this position in the view converted
+ * for the screen and cut to 'space' columns.  Converted titles of recently
+ * drawn items are cached, so they are not converted on every redraw. */
+static const char *screen_title (struct menu *menu, const int v,
+		const struct menu_item *mi, const int space)
+{
+	struct menu_title_cache *c;
+
+	if (menu->title_cache_size != 2 * menu->height) {
+		menu_title_cache_free (menu);
+		menu->title_cache_size = 2 * menu->height;
+		menu->title_cache = (struct menu_title_cache *)xcalloc (
+				menu->title_cache_size,
+				sizeof(struct menu_title_cache));
+	}
+
+	c = &menu->title_cache[v % menu->title_cache_size];
+	if (c->title && c->space == space && c->align == mi->align
+			&& !strcmp (c->title, mi->title))
+		return c->screen;
+
+	free (c->title);
+	free (c->screen);
+	c->title = xstrdup (mi->title);
+	c->space = space;
+	c->align = mi->align;
+
+	if (mi->align == MENU_ALIGN_LEFT
+			|| (int)strwidth (mi->title) <= space)
+		c->screen = make_screen_str (mi->title, space, false);
+	else
+		c->screen = make_screen_str (mi->title, space, true);
+
+	return c->screen;
+}
+
 /* Draw menu item on a given position from the top of the menu. */
-static void draw_item (const struct menu *menu, const struct menu_item *mi,
+static void draw_item (struct menu *menu, const struct menu_item *mi,
 		const int pos, const int item_info_pos, int title_space,
-		const int number_space, const int draw_selected)
+		const int number, const int number_space, const bool selected)
 {
-	int title_width, queue_pos_len = 0;
+	int queue_pos_len = 0;
 	int ix, x;
 	int y ATTR_UNUSED;		/* OpenBSD flags this as unused. */
 	char buf[32];
+	bool marked;
 
 	assert (menu != NULL);
 	assert (mi != NULL);
@@ -43,26 +298,28 @@ static void draw_item (const struct menu *menu, const struct menu_item *mi,
 	assert (title_space > 0);
 	assert (number_space == 0 || number_space >= 2);
 
+	marked = is_marked (menu, mi);
+
 	wmove (menu->win, pos, menu->posx);
 
 	if (number_space) {
-		if (draw_selected && mi == menu->selected && mi == menu->marked)
+		if (selected && marked)
 			wattrset (menu->win, menu->info_attr_sel_marked);
-		else if (draw_selected && mi == menu->selected)
+		else if (selected)
 			wattrset (menu->win, menu->info_attr_sel);
-		else if (mi == menu->marked)
+		else if (marked)
 			wattrset (menu->win, menu->info_attr_marked);
 		else
 			wattrset (menu->win, menu->info_attr_normal);
-		xwprintw (menu->win, "%*d ", number_space - 1, mi->num + 1);
+		xwprintw (menu->win, "%*d ", number_space - 1, number + 1);
 	}
 
 	/* Set attributes */
-	if (draw_selected && mi == menu->selected && mi == menu->marked)
+	if (selected && marked)
 		wattrset (menu->win, mi->attr_sel_marked);
-	else if (draw_selected && mi == menu->selected)
+	else if (selected)
 		wattrset (menu->win, mi->attr_sel);
-	else if (mi == menu->marked)
+	else if (marked)
 		wattrset (menu->win, mi->attr_marked);
 	else
 		wattrset (menu->win, mi->attr_normal);
@@ -74,21 +331,11 @@ static void draw_item (const struct menu *menu, const struct menu_item *mi,
 		title_space -= queue_pos_len;
 	}
 
-	title_width = strwidth (mi->title);
-
 	getyx (menu->win, y, x);
-	if (title_width <= title_space || mi->align == MENU_ALIGN_LEFT)
-		xwaddnstr (menu->win, mi->title, title_space);
-	else {
-		char *ptr;
-
-		ptr = xstrtail (mi->title, title_space);
-		xwaddstr (menu->win, ptr);
-		free (ptr);
-	}
+	waddstr (menu->win, screen_title (menu, number, mi, title_space));
 
 	/* Fill the remainder of the title field with spaces. */
-	if (mi == menu->selected) {
+	if (selected) {
 		getyx (menu->win, y, ix);
 		while (ix < x + title_space) {
 			waddch (menu->win, ' ');
@@ -97,11 +344,11 @@ static void draw_item (const struct menu *menu, const struct menu_item *mi,
 	}
 
 	/* Description. */
-	if (draw_selected && mi == menu->selected && mi == menu->marked)
+	if (selected && marked)
 		wattrset (menu->win, menu->info_attr_sel_marked);
-	else if (draw_selected && mi == menu->selected)
+	else if (selected)
 		wattrset (menu->win, menu->info_attr_sel);
-	else if (mi == menu->marked)
+	else if (marked)
 		wattrset (menu->win, menu->info_attr_marked);
 	else
 		wattrset (menu->win, menu->info_attr_normal);
@@ -123,17 +370,19 @@ static void draw_item (const struct menu *menu, const struct menu_item *mi,
 		xwprintw (menu->win, "[%3s]", mi->format);
 }
 
-void menu_draw (const struct menu *menu, const int active)
+/* Draw the visible items.  Only they are made from the playlist, so the
+ * time doesn't depend on the number of items in the menu. */
+void menu_draw (struct menu *menu, const int active)
 {
-	struct menu_item *mi;
 	int title_width;
 	int info_pos;
 	int number_space = 0;
+	int v;
 
 	assert (menu != NULL);
 
 	if (menu->number_items) {
-		int count = menu->nitems / 10;
+		int count = view_size (menu) / 10;
 
 		number_space = 2; /* begin from 1 digit and a space char */
 		while (count) {
@@ -161,11 +410,17 @@ void menu_draw (const struct menu *menu, const int active)
 
 	title_width -= number_space;
 
-	for (mi = menu->top; mi && mi->num - menu->top->num < menu->height;
-			mi = mi->next)
-		draw_item (menu, mi, mi->num - menu->top->num + menu->posy,
-				menu->posx + info_pos, title_width,
-				number_space, active);
+	for (v = menu->top; v < view_size(menu) && v - menu->top < menu->height;
+			v++) {
+		struct menu_item tmp;
+		const struct menu_item *mi;
+
+		mi = get_item (menu, view_to_pos(menu, v), &tmp);
+		draw_item (menu, mi, v - menu->top + menu->posy,
+				menu->posx + info_pos, title_width, v,
+				number_space, active && v == menu->selected);
+		release_item (mi, &tmp);
+	}
 }
 
 /* Move the cursor to the selected file. */
@@ -173,8 +428,33 @@ void menu_set_cursor (const struct menu *m)
 {
 	assert (m != NULL);
 
-	if (m->selected)
-		wmove (m->win, m->selected->num - m->top->num + m->posy, m->posx);
+	if (m->selected != -1)
+		wmove (m->win, m->selected - m->top + m->posy, m->posx);
+}
+
+/* Append to the list files of the visible items followed by files of up
+ * to 'margin' items below and above the visible part of the menu. */
+void menu_get_visible_files (const struct menu *menu, lists_t_strs *files,
+		const int margin)
+{
+	int v;
+	const char *file;
+
+	assert (menu != NULL);
+	assert (files != NULL);
+	assert (margin >= 0);
+
+	for (v = menu->top;
+	     v < view_size(menu) && v - menu->top < menu->height + margin;
+	     v++) {
+		if ((file = get_item_file (menu, view_to_pos(menu, v))))
+			lists_strs_append (files, file);
+	}
+
+	for (v = menu->top - 1; v >= 0 && menu->top - v <= margin; v--) {
+		if ((file = get_item_file (menu, view_to_pos(menu, v))))
+			lists_strs_append (files, file);
+	}
 }
 
 static int rb_compare (const void *a, const void *b,
@@ -195,7 +475,6 @@ static int rb_fname_compare (const void *key, const void *data,
 	return strcmp (fname, mi->file);
 }
 
-/* menu_items must be malloc()ed memory! */
 struct menu *menu_new (WINDOW *win, const int posx, const int posy,
 		const int width, const int height)
 {
@@ -212,9 +491,29 @@ struct menu *menu_new (WINDOW *win, const int posx, const int posy,
 	menu->win = win;
 	menu->items = NULL;
 	menu->nitems = 0;
-	menu->top = NULL;
-	menu->last = NULL;
-	menu->selected = NULL;
+	menu->items_allocated = 0;
+	menu->plist = NULL;
+	menu->plist_items = NULL;
+	menu->nplist_slots = 0;
+	menu->nplist_items = 0;
+	menu->plist_items_allocated = 0;
+	menu->plist_shown = NULL;
+	menu->plist_pos = NULL;
+	menu->plist_pos_allocated = 0;
+	menu->fill_item = NULL;
+	menu->fill_item_data = NULL;
+	menu->filter = NULL;
+	menu->nfilter = 0;
+	menu->filter_pattern = NULL;
+	menu->filter_fuzzy = false;
+	menu->search_titles = NULL;
+	menu->search_sigs = NULL;
+	menu->search_chars = NULL;
+	menu->nsearch = 0;
+	menu->title_cache = NULL;
+	menu->title_cache_size = 0;
+	menu->top = 0;
+	menu->selected = -1;
 	menu->posx = posx;
 	menu->posy = posy;
 	menu->width = width;
@@ -233,6 +532,8 @@ struct menu *menu_new (WINDOW *win, const int posx, const int posy,
 	return menu;
 }
 
+/* Add an item owned by the menu.  Owned items are shown before the items
+ * of the playlist. */
 struct menu_item *menu_add (struct menu *menu, const char *title,
 		const enum file_type type, const char *file)
 {
@@ -240,90 +541,120 @@ struct menu_item *menu_add (struct menu *menu, const char *title,
 
 	assert (menu != NULL);
 	assert (title != NULL);
+	assert (menu->nplist_items == 0);
+	assert (menu->filter == NULL);
 
 	mi = (struct menu_item *)xmalloc (sizeof(struct menu_item));
 
+	menu_item_init (mi);
 	mi->title = xstrdup (title);
 	mi->type = type;
-	mi->file = xstrdup (file);
-	mi->num = menu->nitems;
-
-	mi->attr_normal = A_NORMAL;
-	mi->attr_sel = A_NORMAL;
-	mi->attr_marked = A_NORMAL;
-	mi->attr_sel_marked = A_NORMAL;
-	mi->align = MENU_ALIGN_LEFT;
+	mi->file = file ? xstrdup (file) : NULL;
 
-	mi->time[0] = 0;
-	mi->format[0] = 0;
-	mi->queue_pos = 0;
-
-	mi->next = NULL;
-	mi->prev = menu->last;
-	if (menu->last)
-		menu->last->next = mi;
+	if (menu->nitems == menu->items_allocated) {
+		menu->items_allocated = menu->items_allocated
+			? menu->items_allocated * 2 : 64;
+		menu->items = (struct menu_item **)xrealloc (menu->items,
+				menu->items_allocated * sizeof(struct menu_item *));
+	}
+	menu->items[menu->nitems++] = mi;
 
-	if (!menu->items)
-		menu->items = mi;
-	if (!menu->top)
-		menu->top = menu->items;
-	if (!menu->selected)
-		menu->selected = menu->items;
+	if (menu->selected == -1)
+		menu->selected = 0;
 
 	if (file)
 		rb_insert (menu->search_tree, (void *)mi);
 
-	menu->last = mi;
-	menu->nitems++;
-
 	return mi;
 }
 
-static struct menu_item *menu_add_from_item (struct menu *menu,
-		const struct menu_item *mi)
+/* Show items of this playlist in the menu.  They are made by fill_item()
+ * only when they need to be drawn. */
+void menu_set_plist (struct menu *menu, const struct plist *plist,
+		menu_fill_item_fn *fill_item, void *data)
 {
-	struct menu_item *new;
+	assert (menu != NULL);
+	assert (plist != NULL);
+	assert (fill_item != NULL);
+	assert (menu->nplist_items == 0);
+
+	menu->plist = plist;
+	menu->fill_item = fill_item;
+	menu->fill_item_data = data;
+}
 
+/* Add the num-th item of the menu's playlist to the end of the menu. */
+void menu_add_plist_item (struct menu *menu, const int num)
+{
 	assert (menu != NULL);
-	assert (mi != NULL);
+	assert (menu->plist != NULL);
+	assert (LIMIT(num, menu->plist->num));
+
+	if (menu->nplist_slots == menu->plist_items_allocated) {
+		menu->plist_items_allocated = menu->plist_items_allocated
+			? menu->plist_items_allocated * 2 : 64;
+		menu->plist_items = (int *)xrealloc (menu->plist_items,
+				menu->plist_items_allocated * sizeof(int));
+		menu->plist_shown = (int *)xrealloc (menu->plist_shown,
+				menu->plist_items_allocated * sizeof(int));
+	}
+
+	if (num >= menu->plist_pos_allocated) {
+		int i, old = menu->plist_pos_allocated;
 
-	new = menu_add (menu, mi->title, mi->type, mi->file);
+		menu->plist_pos_allocated = MAX(num + 1, old * 2);
+		menu->plist_pos = (int *)xrealloc (menu->plist_pos,
+				menu->plist_pos_allocated * sizeof(int));
+		for (i = old; i < menu->plist_pos_allocated; i++)
+			menu->plist_pos[i] = -1;
+	}
 
-	new->attr_normal = mi->attr_normal;
-	new->attr_sel = mi->attr_sel;
-	new->attr_marked = mi->attr_marked;
-	new->attr_sel_marked = mi->attr_sel_marked;
+	assert (menu->plist_pos[num] == -1);
 
-	strncpy(new->time, mi->time, FILE_TIME_STR_SZ);
-	strncpy(new->format, mi->format, FILE_FORMAT_SZ);
+	add_slot (menu, num);
 
-	return new;
+	if (menu->selected == -1)
+		menu->selected = 0;
 }
 
-static struct menu_item *get_item_relative (struct menu_item *mi,
-		int to_move)
+/* Find the position of the item with this file in the menu.  Return -1
+ * if there is no such item. */
+static int menu_find_pos (const struct menu *menu, const char *fname)
 {
-	assert (mi != NULL);
+	struct rb_node *x;
 
-	while (to_move) {
-		struct menu_item *prev = mi;
+	assert (menu != NULL);
+	assert (fname != NULL);
 
-		if (to_move > 0) {
-			mi = mi->next;
-			to_move--;
-		}
-		else {
-			mi = mi->prev;
-			to_move++;
-		}
+	x = rb_search (menu->search_tree, fname);
+	if (!rb_is_null(x)) {
+		const struct menu_item *mi = rb_get_data (x);
+		int i;
 
-		if (!mi) {
-			mi = prev;
-			break;
-		}
+		for (i = 0; i < menu->nitems; i++)
+			if (menu->items[i] == mi)
+				return i;
 	}
 
-	return mi;
+	if (menu->plist) {
+		int num = plist_find_fname (menu->plist, fname);
+
+		if (num != -1 && num < menu->plist_pos_allocated
+				&& menu->plist_pos[num] != -1)
+			return menu->nitems
+				+ shown_before (menu, menu->plist_pos[num]);
+	}
+
+	return -1;
+}
+
+/* Make sure that the top item is a valid position which keeps the view
+ * filled if possible. */
+static void fix_top (struct menu *menu)
+{
+	int max_top = MAX(view_size(menu) - menu->height, 0);
+
+	menu->top = CLAMP(0, menu->top, max_top);
 }
 
 void menu_update_size (struct menu *menu, const int posx, const int posy,
@@ -340,10 +671,8 @@ void menu_update_size (struct menu *menu, const int posx, const int posy,
 	menu->width = width;
 	menu->height = height;
 
-	if (menu->selected && menu->top
-			&& menu->selected->num >= menu->top->num + menu->height)
-		menu->selected = get_item_relative (menu->top,
-				menu->height - 1);
+	if (menu->selected >= menu->top + menu->height)
+		menu->selected = menu->top + menu->height - 1;
 }
 
 static void menu_item_free (struct menu_item *mi)
@@ -358,19 +687,184 @@ static void menu_item_free (struct menu_item *mi)
 	free (mi);
 }
 
-void menu_free (struct menu *menu)
+/* Return a lowercased copy of the string. */
+static char *lowercase_dup (const char *str)
 {
-	struct menu_item *mi;
+	char *lower = xstrdup (str);
+	char *c;
+
+	for (c = lower; *c; c++)
+		*c = tolower ((unsigned char)*c);
+
+	return lower;
+}
+
+/* Return the bit of the signature for the value (multiply-shift hash). */
+static inline uint64_t sig_bit (const uint32_t value)
+{
+	return (uint64_t)1 << ((value * UINT64_C(0x9E3779B97F4A7C15)) >> 58);
+}
+
+/* Return the signature of the string: a bit is set for each trigram it
+ * contains.  A string can contain a pattern only if all bits set in the
+ * pattern's signature are set in its signature. */
+static uint64_t trigram_sig (const char *str)
+{
+	uint64_t sig = 0;
+	const unsigned char *c = (const unsigned char *)str;
+
+	for (; c[0] && c[1] && c[2]; c++)
+		sig |= sig_bit (c[0] | c[1] << 8 | (uint32_t)c[2] << 16);
+
+	return sig;
+}
+
+/* Return the signature of the characters of the string, used the same way
+ * for fuzzy matching. */
+static uint64_t chars_sig (const char *str)
+{
+	uint64_t sig = 0;
+	const unsigned char *c;
+
+	for (c = (const unsigned char *)str; *c; c++)
+		sig |= sig_bit (*c);
+
+	return sig;
+}
+
+/* Return true if the characters of the pattern are in the string in the
+ * same order. */
+static bool fuzzy_match (const char *str, const char *pattern)
+{
+	for (; *pattern; pattern++) {
+		if (!(str = strchr (str, *pattern)))
+			return false;
+		str++;
+	}
+
+	return true;
+}
+
+/* Return the indexed path of the item, which follows its title. */
+static const char *search_path (const struct menu *menu, const int pos)
+{
+	return menu->search_titles[pos] + strlen (menu->search_titles[pos]) + 1;
+}
+
+/* Index the lowercased title and path of the item at this position. */
+static void search_index_item (struct menu *menu, const int pos)
+{
+	struct menu_item tmp;
+	const struct menu_item *mi;
+	char *title, *path;
+	size_t title_len;
+
+	mi = get_item (menu, pos, &tmp);
+	title = lowercase_dup (mi->title);
+	path = lowercase_dup (mi->file ? mi->file : "");
+	release_item (mi, &tmp);
+
+	title_len = strlen (title);
+	menu->search_titles[pos] = (char *)xrealloc (title,
+			title_len + strlen (path) + 2);
+	strcpy (menu->search_titles[pos] + title_len + 1, path);
+
+	menu->search_sigs[pos] = trigram_sig (menu->search_titles[pos])
+		| trigram_sig (path);
+	menu->search_chars[pos] = chars_sig (menu->search_titles[pos])
+		| chars_sig (path);
+	free (path);
+}
+
+/* Return true if the title or the path of the item at this position
+ * matches the lowercased pattern with this signature. */
+static bool search_match (const struct menu *menu, const int pos,
+		const char *pattern, const uint64_t sig, const bool fuzzy)
+{
+	if (fuzzy)
+		return (menu->search_chars[pos] & sig) == sig
+			&& (fuzzy_match (menu->search_titles[pos], pattern)
+			    || fuzzy_match (search_path (menu, pos), pattern));
+
+	return (menu->search_sigs[pos] & sig) == sig
+		&& (strstr (menu->search_titles[pos], pattern)
+		    || strstr (search_path (menu, pos), pattern));
+}
+
+/* Add items which are not in the search index yet. */
+static void search_index_update (struct menu *menu)
+{
+	int nitems = menu->nitems + menu->nplist_items;
+	int pos;
+
+	if (menu->search_titles && menu->nsearch == nitems)
+		return;
+
+	menu->search_titles = (char **)xrealloc (menu->search_titles,
+			MAX(nitems, 1) * sizeof(char *));
+	menu->search_sigs = (uint64_t *)xrealloc (menu->search_sigs,
+			MAX(nitems, 1) * sizeof(uint64_t));
+	menu->search_chars = (uint64_t *)xrealloc (menu->search_chars,
+			MAX(nitems, 1) * sizeof(uint64_t));
+
+	for (pos = menu->nsearch; pos < nitems; pos++)
+		search_index_item (menu, pos);
+	menu->nsearch = nitems;
+}
+
+static void search_index_free (struct menu *menu)
+{
+	int pos;
+
+	for (pos = 0; pos < menu->nsearch; pos++)
+		free (menu->search_titles[pos]);
+	free (menu->search_titles);
+	free (menu->search_sigs);
+	free (menu->search_chars);
+
+	menu->search_titles = NULL;
+	menu->search_sigs = NULL;
+	menu->search_chars = NULL;
+	menu->nsearch = 0;
+}
+
+/* Update the search index after the title of the item with this file has
+ * changed.  Items added to the menu are indexed by the next search. */
+void menu_update_search (struct menu *menu, const char *file)
+{
+	int pos;
 
 	assert (menu != NULL);
+	assert (file != NULL);
 
-	mi = menu->items;
-	while (mi) {
-		struct menu_item *next = mi->next;
+	if (!menu->search_titles)
+		return;
 
-		menu_item_free (mi);
-		mi = next;
+	pos = menu_find_pos (menu, file);
+	if (pos != -1 && pos < menu->nsearch) {
+		free (menu->search_titles[pos]);
+		search_index_item (menu, pos);
 	}
+}
+
+void menu_free (struct menu *menu)
+{
+	int i;
+
+	assert (menu != NULL);
+
+	for (i = 0; i < menu->nitems; i++)
+		menu_item_free (menu->items[i]);
+
+	free (menu->items);
+	free (menu->plist_items);
+	free (menu->plist_shown);
+	free (menu->plist_pos);
+	free (menu->filter);
+	free (menu->filter_pattern);
+	free (menu->marked);
+	search_index_free (menu);
+	menu_title_cache_free (menu);
 
 	rb_tree_free (menu->search_tree);
 
@@ -379,141 +873,146 @@ void menu_free (struct menu *menu)
 
 void menu_driver (struct menu *menu, const enum menu_request req)
 {
+	int nitems, last;
+
 	assert (menu != NULL);
 
-	if (menu->nitems == 0)
+	nitems = view_size (menu);
+	if (nitems == 0)
 		return;
 
-	if (req == REQ_DOWN && menu->selected->next) {
-		menu->selected = menu->selected->next;
-		if (menu->selected->num >= menu->top->num + menu->height) {
-			menu->top = get_item_relative (menu->selected,
-					-menu->height / 2);
-			if (menu->top->num > menu->nitems - menu->height)
-				menu->top = get_item_relative (menu->last,
-						-menu->height + 1);
+	last = nitems - 1;
+
+	if (req == REQ_DOWN && menu->selected < last) {
+		menu->selected++;
+		if (menu->selected >= menu->top + menu->height) {
+			menu->top = menu->selected - menu->height / 2;
+			if (menu->top > nitems - menu->height)
+				menu->top = last - menu->height + 1;
 		}
 	}
-	else if (req == REQ_UP && menu->selected->prev) {
-		menu->selected = menu->selected->prev;
-		if (menu->top->num > menu->selected->num)
-			menu->top = get_item_relative (menu->selected,
-					-menu->height / 2);
-	}
-	else if (req == REQ_PGDOWN && menu->selected->num < menu->nitems - 1) {
-		if (menu->selected->num + menu->height - 1 < menu->nitems - 1) {
-			menu->selected = get_item_relative (menu->selected,
-					menu->height - 1);
-			menu->top = get_item_relative (menu->top,
-					menu->height - 1);
-			if (menu->top->num > menu->nitems - menu->height)
-				menu->top = get_item_relative (menu->last,
-						-menu->height + 1);
+	else if (req == REQ_UP && menu->selected > 0) {
+		menu->selected--;
+		if (menu->top > menu->selected)
+			menu->top = menu->selected - menu->height / 2;
+	}
+	else if (req == REQ_PGDOWN && menu->selected < last) {
+		if (menu->selected + menu->height - 1 < last) {
+			menu->selected += menu->height - 1;
+			menu->top += menu->height - 1;
+			if (menu->top > nitems - menu->height)
+				menu->top = last - menu->height + 1;
 		}
 		else {
-			menu->selected = menu->last;
-			menu->top = get_item_relative (menu->last,
-					-menu->height + 1);
+			menu->selected = last;
+			menu->top = last - menu->height + 1;
 		}
 	}
-	else if (req == REQ_PGUP && menu->selected->prev) {
-		if (menu->selected->num - menu->height + 1 > 0) {
-			menu->selected = get_item_relative (menu->selected,
-					-menu->height + 1);
-			menu->top = get_item_relative (menu->top,
-					-menu->height + 1);
+	else if (req == REQ_PGUP && menu->selected > 0) {
+		if (menu->selected - menu->height + 1 > 0) {
+			menu->selected -= menu->height - 1;
+			menu->top -= menu->height - 1;
 		}
 		else {
-			menu->selected = menu->items;
-			menu->top = menu->items;
+			menu->selected = 0;
+			menu->top = 0;
 		}
 	}
 	else if (req == REQ_TOP) {
-		menu->selected = menu->items;
-		menu->top = menu->items;
+		menu->selected = 0;
+		menu->top = 0;
 	}
 	else if (req == REQ_BOTTOM) {
-		menu->selected = menu->last;
-		menu->top = get_item_relative (menu->selected,
-				-menu->height + 1);
+		menu->selected = last;
+		menu->top = menu->selected - menu->height + 1;
 	}
-}
-
-/* Return the index of the currently selected item. */
-struct menu_item *menu_curritem (struct menu *menu)
-{
-	assert (menu != NULL);
 
-	return menu->selected;
+	if (menu->top < 0)
+		menu->top = 0;
 }
 
-static void make_item_visible (struct menu *menu, struct menu_item *mi)
+/* Return the type of the selected item or F_OTHER if the menu is empty. */
+enum file_type menu_get_curr_type (const struct menu *menu)
 {
+	int pos;
+
 	assert (menu != NULL);
-	assert (mi != NULL);
 
-	if (mi->num < menu->top->num || mi->num >= menu->top->num + menu->height) {
-		menu->top = get_item_relative(mi, -menu->height/2);
+	if (menu->selected == -1)
+		return F_OTHER;
 
-		if (menu->top->num > menu->nitems - menu->height)
-			menu->top = get_item_relative (menu->last,
-					-menu->height + 1);
-	}
+	pos = view_to_pos (menu, menu->selected);
+	if (pos < menu->nitems)
+		return menu->items[pos]->type;
 
-	if (menu->selected) {
-		if (menu->selected->num < menu->top->num ||
-				menu->selected->num >= menu->top->num + menu->height)
-			menu->selected = mi;
-	}
+	return plist_file_type (menu->plist, plist_num_at (menu, pos));
 }
 
-/* Make this item selected */
-static void menu_setcurritem (struct menu *menu, struct menu_item *mi)
+/* Return the file of the selected item (malloc()ed) or NULL if the menu
+ * is empty. */
+char *menu_get_curr_file (const struct menu *menu)
 {
+	const char *file;
+
 	assert (menu != NULL);
-	assert (mi != NULL);
 
-	menu->selected = mi;
-	make_item_visible (menu, mi);
+	if (menu->selected == -1)
+		return NULL;
+
+	file = get_item_file (menu, view_to_pos (menu, menu->selected));
+
+	return file ? xstrdup (file) : NULL;
 }
 
-/* Make the item with this title selected. */
-void menu_setcurritem_title (struct menu *menu, const char *title)
+/* Make the item at this position in the view visible. */
+static void make_item_visible (struct menu *menu, const int v)
 {
-	struct menu_item *mi;
+	assert (menu != NULL);
+	assert (LIMIT(v, view_size(menu)));
 
-	/* Find it */
-	for (mi = menu->top; mi; mi = mi->next)
-		if (!strcmp(mi->title, title))
-			break;
+	if (v < menu->top || v >= menu->top + menu->height) {
+		menu->top = v - menu->height / 2;
+		fix_top (menu);
+	}
 
-	if (mi)
-		menu_setcurritem (menu, mi);
+	if (menu->selected != -1) {
+		if (menu->selected < menu->top ||
+				menu->selected >= menu->top + menu->height)
+			menu->selected = v;
+	}
 }
 
-static struct menu_item *menu_find_by_position (struct menu *menu,
-		const int num)
+/* Make the item at this position in the view selected. */
+static void menu_setcurritem (struct menu *menu, const int v)
 {
-	struct menu_item *mi;
-
 	assert (menu != NULL);
+	assert (LIMIT(v, view_size(menu)));
 
-	mi = menu->top;
-	while (mi && mi->num != num)
-		mi = mi->next;
-
-	return mi;
+	menu->selected = v;
+	make_item_visible (menu, v);
 }
 
 void menu_set_state (struct menu *menu, const struct menu_state *st)
 {
+	int nitems;
+
 	assert (menu != NULL);
 
-	if (!(menu->selected = menu_find_by_position(menu, st->selected_item)))
-		menu->selected = menu->last;
+	nitems = view_size (menu);
 
-	if (!(menu->top = menu_find_by_position(menu, st->top_item)))
-		menu->top = get_item_relative (menu->last, menu->height + 1);
+	if (nitems == 0) {
+		menu->selected = -1;
+		menu->top = 0;
+		return;
+	}
+
+	menu->selected = CLAMP(0, st->selected_item, nitems - 1);
+
+	if (LIMIT(st->top_item, nitems))
+		menu->top = st->top_item;
+	else
+		menu->top = nitems - menu->height - 1;
+	fix_top (menu);
 }
 
 void menu_set_items_numbering (struct menu *menu, const int number)
@@ -527,42 +1026,101 @@ void menu_get_state (const struct menu *menu, struct menu_state *st)
 {
 	assert (menu != NULL);
 
-	st->top_item = menu->top ? menu->top->num : -1;
-	st->selected_item = menu->selected ? menu->selected->num : -1;
+	st->top_item = view_size (menu) ? menu->top : -1;
+	st->selected_item = menu->selected;
 }
 
 void menu_unmark_item (struct menu *menu)
 {
 	assert (menu != NULL);
+
+	free (menu->marked);
 	menu->marked = NULL;
 }
 
-/* Make a new menu from elements matching pattern. */
-struct menu *menu_filter_pattern (const struct menu *menu, const char *pattern)
+/* Show only the items whose title or path contains the pattern (ignoring
+ * case), or with FuzzySearch, the characters of the pattern in the same
+ * order.
+ * If no items match, don't do anything.  Return the number of matching
+ * items.  If every title matching the pattern also matches the pattern of
+ * the current filter, only the items already shown are searched. */
+int menu_filter_pattern (struct menu *menu, const char *pattern)
 {
-	struct menu *new;
-	const struct menu_item *mi;
+	int *filter;
+	int nfilter, ncandidates, i;
+	char *lower;
+	uint64_t sig;
+	bool narrow, fuzzy;
 
 	assert (menu != NULL);
 	assert (pattern != NULL);
 
-	new = menu_new (menu->win, menu->posx, menu->posy, menu->width,
-			menu->height);
-	menu_set_show_time (new, menu->show_time);
-	menu_set_show_format (new, menu->show_format);
-	menu_set_info_attr_normal (new, menu->info_attr_normal);
-	menu_set_info_attr_sel (new, menu->info_attr_sel);
-	menu_set_info_attr_marked (new, menu->info_attr_marked);
-	menu_set_info_attr_sel_marked (new, menu->info_attr_sel_marked);
+	search_index_update (menu);
+
+	fuzzy = options_get_bool ("FuzzySearch");
+	lower = lowercase_dup (pattern);
+	sig = fuzzy ? chars_sig (lower) : trigram_sig (lower);
+
+	narrow = menu->filter && menu->filter_fuzzy == fuzzy;
+	if (narrow && fuzzy)
+		narrow = fuzzy_match (lower, menu->filter_pattern);
+	else if (narrow)
+		narrow = strstr (lower, menu->filter_pattern) != NULL;
+	ncandidates = narrow ? menu->nfilter : menu->nsearch;
+
+	filter = (int *)xmalloc (MAX(ncandidates, 1) * sizeof(int));
+	nfilter = 0;
 
-	for (mi = menu->items; mi; mi = mi->next)
-		if (strcasestr(mi->title, pattern))
-			menu_add_from_item (new, mi);
+	for (i = 0; i < ncandidates; i++) {
+		int pos = narrow ? menu->filter[i] : i;
 
-	if (menu->marked)
-		menu_mark_item (new, menu->marked->file);
+		if (search_match (menu, pos, lower, sig, fuzzy))
+			filter[nfilter++] = pos;
+	}
+
+	if (nfilter == 0) {
+		free (filter);
+		free (lower);
+		return 0;
+	}
+
+	if (menu->filter) {
+		free (menu->filter);
+		free (menu->filter_pattern);
+	}
+	else
+		menu_get_state (menu, &menu->unfiltered);
 
-	return new;
+	menu->filter = filter;
+	menu->nfilter = nfilter;
+	menu->filter_pattern = lower;
+	menu->filter_fuzzy = fuzzy;
+	menu->top = 0;
+	menu->selected = 0;
+
+	return nfilter;
+}
+
+/* Show all items again after menu_filter_pattern(). */
+void menu_clear_filter (struct menu *menu)
+{
+	assert (menu != NULL);
+
+	if (menu->filter) {
+		free (menu->filter);
+		free (menu->filter_pattern);
+		menu->filter = NULL;
+		menu->nfilter = 0;
+		menu->filter_pattern = NULL;
+		menu_set_state (menu, &menu->unfiltered);
+	}
+}
+
+bool menu_is_filtered (const struct menu *menu)
+{
+	assert (menu != NULL);
+
+	return menu->filter != NULL;
 }
 
 void menu_item_set_attr_normal (struct menu_item *mi, const int attr)
@@ -663,20 +1221,6 @@ void menu_set_info_attr_sel_marked (struct menu *menu, const int attr)
 	menu->info_attr_sel_marked = attr;
 }
 
-enum file_type menu_item_get_type (const struct menu_item *mi)
-{
-	assert (mi != NULL);
-
-	return mi->type;
-}
-
-char *menu_item_get_file (const struct menu_item *mi)
-{
-	assert (mi != NULL);
-
-	return xstrdup (mi->file);
-}
-
 void menu_item_set_title (struct menu_item *mi, const char *title)
 {
 	assert (mi != NULL);
@@ -686,94 +1230,107 @@ void menu_item_set_title (struct menu_item *mi, const char *title)
 	mi->title = xstrdup (title);
 }
 
+/* Return the number of items in the (filtered) view of the menu. */
 int menu_nitems (const struct menu *menu)
 {
 	assert (menu != NULL);
 
-	return menu->nitems;
+	return view_size (menu);
 }
 
-struct menu_item *menu_find (struct menu *menu, const char *fname)
+void menu_mark_item (struct menu *menu, const char *file)
 {
-	struct rb_node *x;
-
 	assert (menu != NULL);
-	assert (fname != NULL);
-
-	x = rb_search (menu->search_tree, fname);
-	if (rb_is_null(x))
-		return NULL;
+	assert (file != NULL);
 
-	return (struct menu_item *)rb_get_data (x);
+	if (menu_find_pos (menu, file) != -1) {
+		free (menu->marked);
+		menu->marked = xstrdup (file);
+	}
 }
 
-void menu_mark_item (struct menu *menu, const char *file)
+/* Remove the position from the filter and shift positions of the items
+ * after it. */
+static void filter_delete (struct menu *menu, const int pos)
 {
-	struct menu_item *item;
+	int i, j;
 
-	assert (menu != NULL);
-	assert (file != NULL);
+	for (i = 0, j = 0; i < menu->nfilter; i++) {
+		if (menu->filter[i] == pos)
+			continue;
+		menu->filter[j++] = menu->filter[i] > pos ? menu->filter[i] - 1
+		                                          : menu->filter[i];
+	}
 
-	item = menu_find (menu, file);
-	if (item)
-		menu->marked = item;
+	menu->nfilter = j;
 }
 
-static void menu_renumber_items (struct menu *menu)
+static void menu_delete (struct menu *menu, const int pos)
 {
-	int i = 0;
-	struct menu_item *mi;
+	int v;
 
 	assert (menu != NULL);
+	assert (LIMIT(pos, menu->nitems + menu->nplist_items));
 
-	for (mi = menu->items; mi; mi = mi->next)
-		mi->num = i++;
-
-	assert (i == menu->nitems);
-}
+	v = pos_to_view (menu, pos);
 
-static void menu_delete (struct menu *menu, struct menu_item *mi)
-{
-	assert (menu != NULL);
-	assert (mi != NULL);
+	if (pos < menu->nitems) {
+		struct menu_item *mi = menu->items[pos];
 
-	if (mi->prev)
-		mi->prev->next = mi->next;
-	if (mi->next)
-		mi->next->prev = mi->prev;
+		if (mi->file)
+			rb_delete (menu->search_tree, mi->file);
+		menu_item_free (mi);
 
-	if (menu->items == mi)
-		menu->items = mi->next;
-	if (menu->last == mi)
-		menu->last = mi->prev;
+		memmove (menu->items + pos, menu->items + pos + 1,
+				(menu->nitems - pos - 1) * sizeof(struct menu_item *));
+		menu->nitems--;
+	}
+	else {
+		empty_slot (menu, nth_shown_slot (menu, pos - menu->nitems));
 
-	if (menu->marked == mi)
-		menu->marked = NULL;
-	if (menu->selected == mi)
-		menu->selected = mi->next ? mi->next : mi->prev;
-	if (menu->top == mi)
-		menu->top = mi->next ? mi->next : mi->prev;
+		if (menu->nplist_slots - menu->nplist_items
+				> MAX(menu->nplist_items, 64))
+			compact_slots (menu);
+	}
 
-	if (mi->file)
-		rb_delete (menu->search_tree, mi->file);
+	if (menu->filter)
+		filter_delete (menu, pos);
+
+	if (pos < menu->nsearch) {
+		free (menu->search_titles[pos]);
+		memmove (menu->search_titles + pos, menu->search_titles + pos + 1,
+				(menu->nsearch - pos - 1) * sizeof(char *));
+		memmove (menu->search_sigs + pos, menu->search_sigs + pos + 1,
+				(menu->nsearch - pos - 1) * sizeof(uint64_t));
+		memmove (menu->search_chars + pos, menu->search_chars + pos + 1,
+				(menu->nsearch - pos - 1) * sizeof(uint64_t));
+		menu->nsearch--;
+	}
 
-	menu->nitems--;
-	menu_renumber_items (menu);
+	if (v != -1) {
+		if (menu->selected > v || menu->selected == view_size(menu))
+			menu->selected--;
+		if (menu->top > v)
+			menu->top--;
+	}
 
-	menu_item_free (mi);
+	fix_top (menu);
 }
 
 void menu_del_item (struct menu *menu, const char *fname)
 {
-	struct menu_item *mi;
+	int pos;
 
 	assert (menu != NULL);
 	assert (fname != NULL);
 
-	mi = menu_find (menu, fname);
-	assert (mi != NULL);
+	pos = menu_find_pos (menu, fname);
+	assert (pos != -1);
 
-	menu_delete (menu, mi);
+	if (menu->marked && !strcmp (menu->marked, fname))
+		menu_unmark_item (menu);
+
+	menu_delete (menu, pos);
 }
 
 void menu_item_set_align (struct menu_item *mi, const enum menu_align align)
@@ -785,105 +1342,78 @@ void menu_item_set_align (struct menu_item *mi, const enum menu_align align)
 
 void menu_setcurritem_file (struct menu *menu, const char *file)
 {
-	struct menu_item *mi;
+	int pos, v;
 
 	assert (menu != NULL);
 	assert (file != NULL);
 
-	mi = menu_find (menu, file);
-	if (mi)
-		menu_setcurritem (menu, mi);
+	pos = menu_find_pos (menu, file);
+	if (pos != -1 && (v = pos_to_view (menu, pos)) != -1)
+		menu_setcurritem (menu, v);
 }
-/* Return non-zero value if the item in in the visible part of the menu. */
-int menu_is_visible (const struct menu *menu, const struct menu_item *mi)
+
+/* Return non-zero value if the item with this file is in the visible part
+ * of the menu. */
+int menu_is_visible (const struct menu *menu, const char *file)
 {
+	int pos, v;
+
 	assert (menu != NULL);
-	assert (mi != NULL);
+	assert (file != NULL);
 
-	if (mi->num >= menu->top->num
-			&& mi->num < menu->top->num + menu->height)
-		return 1;
+	pos = menu_find_pos (menu, file);
+	if (pos == -1 || (v = pos_to_view (menu, pos)) == -1)
+		return 0;
 
-	return 0;
+	return v >= menu->top && v < menu->top + menu->height;
 }
 
-static void menu_items_swap (struct menu *menu, struct menu_item *mi1,
-		struct menu_item *mi2)
+/* Swap two items of the menu.  Items of the playlist are swapped on the
+ * playlist itself, so only the selection needs to follow them here. */
+void menu_swap_items (struct menu *menu, const char *file1, const char *file2)
 {
-	int t;
+	int pos1, pos2, v1, v2;
 
 	assert (menu != NULL);
-	assert (mi1 != NULL);
-	assert (mi2 != NULL);
-	assert (mi1 != mi2);
+	assert (file1 != NULL);
+	assert (file2 != NULL);
 
-	/* if they are next to each other, change the pointers so that mi2
-	 * is the second one */
-	if (mi2->next == mi1) {
-		struct menu_item *i = mi1;
+	pos1 = menu_find_pos (menu, file1);
+	pos2 = menu_find_pos (menu, file2);
 
-		mi1 = mi2;
-		mi2 = i;
-	}
+	if (pos1 == -1 || pos2 == -1 || pos1 == pos2)
+		return;
 
-	if (mi1->next == mi2) {
-		if (mi2->next)
-			mi2->next->prev = mi1;
-		if (mi1->prev)
-			mi1->prev->next = mi2;
+	if (pos1 < menu->nitems && pos2 < menu->nitems) {
+		struct menu_item *t = menu->items[pos1];
 
-		mi1->next = mi2->next;
-		mi2->prev = mi1->prev;
-		mi1->prev = mi2;
-		mi2->next = mi1;
+		menu->items[pos1] = menu->items[pos2];
+		menu->items[pos2] = t;
 	}
-	else {
-		if (mi2->next)
-			mi2->next->prev = mi1;
-		if (mi2->prev)
-			mi2->prev->next = mi1;
-		mi2->next = mi1->next;
-		mi2->prev = mi1->prev;
+	else if (pos1 < menu->nitems || pos2 < menu->nitems)
+		return;
 
-		if (mi1->next)
-			mi1->next->prev = mi2;
-		if (mi1->prev)
-			mi1->prev->next = mi2;
-		mi1->next = mi2->next;
-		mi1->prev = mi2->prev;
+	if (pos1 < menu->nsearch && pos2 < menu->nsearch) {
+		char *title = menu->search_titles[pos1];
+		uint64_t sig = menu->search_sigs[pos1];
+		uint64_t chars = menu->search_chars[pos1];
+
+		menu->search_titles[pos1] = menu->search_titles[pos2];
+		menu->search_sigs[pos1] = menu->search_sigs[pos2];
+		menu->search_chars[pos1] = menu->search_chars[pos2];
+		menu->search_titles[pos2] = title;
+		menu->search_sigs[pos2] = sig;
+		menu->search_chars[pos2] = chars;
 	}
 
-	t = mi1->num;
-	mi1->num = mi2->num;
-	mi2->num = t;
-
-	if (menu->top == mi1)
-		menu->top = mi2;
-	else if (menu->top == mi2)
-		menu->top = mi1;
-
-	if (menu->last == mi1)
-		menu->last = mi2;
-	else if (menu->last == mi2)
-		menu->last = mi1;
+	v1 = pos_to_view (menu, pos1);
+	v2 = pos_to_view (menu, pos2);
 
-	if (menu->items == mi1)
-		menu->items = mi2;
-	else if (menu->items == mi2)
-		menu->items = mi1;
-}
-
-void menu_swap_items (struct menu *menu, const char *file1, const char *file2)
-{
-	struct menu_item *mi1, *mi2;
-
-	assert (menu != NULL);
-	assert (file1 != NULL);
-	assert (file2 != NULL);
-
-	if ((mi1 = menu_find(menu, file1)) && (mi2 = menu_find(menu, file2))
-			&& mi1 != mi2) {
-		menu_items_swap (menu, mi1, mi2);
+	if (v1 != -1 && v2 != -1) {
+		if (menu->selected == v1)
+			menu->selected = v2;
+		else if (menu->selected == v2)
+			menu->selected = v1;
 
 		/* make sure that the selected item is visible */
 		menu_setcurritem (menu, menu->selected);
@@ -893,11 +1423,12 @@ void menu_swap_items (struct menu *menu, const char *file1, const char *file2)
 /* Make sure that this file is visible in the menu. */
 void menu_make_visible (struct menu *menu, const char *file)
 {
-	struct menu_item *mi;
+	int pos, v;
 
 	assert (menu != NULL);
 	assert (file != NULL);
 
-	if ((mi = menu_find(menu, file)))
-		make_item_visible (menu, mi);
+	pos = menu_find_pos (menu, file);
+	if (pos != -1 && (v = pos_to_view (menu, pos)) != -1)
+		make_item_visible (menu, v);
 }
@@ -13,6 +13,8 @@
 # include <curses.h>
 #endif
 
+#include <stdint.h>
+
 #include "files.h"
 #include "rbtree.h"
 
@@ -43,7 +45,6 @@ struct menu_item
 {
 	char *title;		/* Title of the item */
 	enum menu_align align;	/* Align of the title */
-	int num;		/* Position of the item starting from 0. */
 
 	/* Curses attributes in different states: */
 	int attr_normal;
@@ -59,18 +60,70 @@ struct menu_item
 	char time[FILE_TIME_STR_SZ];		/* File time string */
 	char format[FILE_FORMAT_SZ];		/* File format */
 	int queue_pos;				/* Position in the queue */
+};
+
+/* Fill the menu item with the title, attributes and information about the
+ * num-th item of the playlist. */
+typedef void menu_fill_item_fn (struct menu_item *mi,
+		const struct plist *plist, const int num, void *data);
+
+/* Title of an item converted for the screen. */
+struct menu_title_cache
+{
+	char *title;		/* title of the item */
+	int space;		/* number of columns it was cut to */
+	enum menu_align align;
+	char *screen;		/* the string to show */
+};
 
-	struct menu_item *next;
-	struct menu_item *prev;
+/* Menu state: positions of the top and selected items. */
+struct menu_state
+{
+	int top_item;
+	int selected_item;
 };
 
 struct menu
 {
 	WINDOW *win;
-	struct menu_item *items;
-	int nitems;		/* number of present items */
-	struct menu_item *top;	/* first visible item */
-	struct menu_item *last;	/* last item in the menu */
+
+	/* Items owned by the menu, they are shown first. */
+	struct menu_item **items;
+	int nitems;		/* number of owned items */
+	int items_allocated;
+
+	/* Items of the playlist shown after the owned items.  They are not
+	 * stored in the menu, but made by fill_item() when they are drawn. */
+	const struct plist *plist;
+	int *plist_items;	/* indexes of the shown playlist items by slot,
+				   -1 in slots of deleted items */
+	int nplist_slots;	/* used slots */
+	int nplist_items;	/* number of shown items */
+	int plist_items_allocated;
+	int *plist_shown;	/* Fenwick tree of the numbers of shown items
+				   in the slots */
+	int *plist_pos;		/* slot of each playlist item or -1 if it's
+				   not shown */
+	int plist_pos_allocated;
+	menu_fill_item_fn *fill_item;
+	void *fill_item_data;
+
+	/* Positions of items matching the search pattern or NULL if the
+	 * menu is not filtered. */
+	int *filter;
+	int nfilter;
+	struct menu_state unfiltered;	/* state to restore after the search */
+	char *filter_pattern;		/* lowercased pattern of the filter */
+	bool filter_fuzzy;		/* was it a fuzzy search? */
+
+	/* Search index made by the first search and kept up to date after
+	 * that: lowercased titles of items, each followed by the lowercased
+	 * path after its '\0', and signatures of trigrams and characters
+	 * they contain, by position in the menu. */
+	char **search_titles;
+	uint64_t *search_sigs;
+	uint64_t *search_chars;
+	int nsearch;		/* number of indexed items */
 
 	/* position and size */
 	int posx;
@@ -78,8 +131,16 @@ struct menu
 	int width;
 	int height;
 
-	struct menu_item *selected;	/* selected item */
-	struct menu_item *marked;	/* index of the marked item or -1 */
+	/* Positions in the (filtered) view of the menu. */
+	int top;		/* first visible item */
+	int selected;		/* selected item or -1 if the menu is empty */
+
+	char *marked;		/* file of the marked item or NULL */
+
+	/* Converted titles of the recently drawn items by their position
+	 * in the view modulo title_cache_size. */
+	struct menu_title_cache *title_cache;
+	int title_cache_size;
 
 	/* Flags for displaying information about the file. */
 	int show_time;
@@ -91,21 +152,17 @@ struct menu
 	int info_attr_sel_marked;
 	int number_items; /* display item number (position) */
 
-	struct rb_tree *search_tree; /* RB tree for searching by file name */
-};
-
-/* Menu state: relative (to the first item) positions of the top and selected
- * items. */
-struct menu_state
-{
-	int top_item;
-	int selected_item;
+	struct rb_tree *search_tree; /* RB tree for searching owned items by
+					file name */
 };
 
 struct menu *menu_new (WINDOW *win, const int posx, const int posy,
 		const int width, const int height);
 struct menu_item *menu_add (struct menu *menu, const char *title,
 		const enum file_type type, const char *file);
+void menu_set_plist (struct menu *menu, const struct plist *plist,
+		menu_fill_item_fn *fill_item, void *data);
+void menu_add_plist_item (struct menu *menu, const int num);
 
 void menu_item_set_attr_normal (struct menu_item *mi, const int attr);
 void menu_item_set_attr_sel (struct menu_item *mi, const int attr);
@@ -118,16 +175,18 @@ void menu_item_set_queue_pos (struct menu_item *mi, const int pos);
 
 void menu_free (struct menu *menu);
 void menu_driver (struct menu *menu, const enum menu_request req);
-void menu_setcurritem_title (struct menu *menu, const char *title);
 void menu_setcurritem_file (struct menu *menu, const char *file);
-void menu_draw (const struct menu *menu, const int active);
+void menu_draw (struct menu *menu, const int active);
 void menu_mark_item (struct menu *menu, const char *file);
 void menu_set_state (struct menu *menu, const struct menu_state *st);
 void menu_get_state (const struct menu *menu, struct menu_state *st);
 void menu_update_size (struct menu *menu, const int posx, const int posy,
 		const int width, const int height);
 void menu_unmark_item (struct menu *menu);
-struct menu *menu_filter_pattern (const struct menu *menu, const char *pattern);
+int menu_filter_pattern (struct menu *menu, const char *pattern);
+void menu_clear_filter (struct menu *menu);
+bool menu_is_filtered (const struct menu *menu);
+void menu_update_search (struct menu *menu, const char *file);
 void menu_set_show_time (struct menu *menu, const int t);
 void menu_set_show_format (struct menu *menu, const bool t);
 void menu_set_info_attr_normal (struct menu *menu, const int attr);
@@ -135,18 +194,18 @@ void menu_set_info_attr_sel (struct menu *menu, const int attr);
 void menu_set_info_attr_marked (struct menu *menu, const int attr);
 void menu_set_info_attr_sel_marked (struct menu *menu, const int attr);
 void menu_set_items_numbering (struct menu *menu, const int number);
-enum file_type menu_item_get_type (const struct menu_item *mi);
-char *menu_item_get_file (const struct menu_item *mi);
-struct menu_item *menu_curritem (struct menu *menu);
+enum file_type menu_get_curr_type (const struct menu *menu);
+char *menu_get_curr_file (const struct menu *menu);
 void menu_item_set_title (struct menu_item *mi, const char *title);
 int menu_nitems (const struct menu *menu);
-struct menu_item *menu_find (struct menu *menu, const char *fname);
 void menu_del_item (struct menu *menu, const char *fname);
 void menu_item_set_align (struct menu_item *mi, const enum menu_align align);
-int menu_is_visible (const struct menu *menu, const struct menu_item *mi);
+int menu_is_visible (const struct menu *menu, const char *file);
 void menu_swap_items (struct menu *menu, const char *file1, const char *file2);
 void menu_make_visible (struct menu *menu, const char *file);
 void menu_set_cursor (const struct menu *m);
+void menu_get_visible_files (const struct menu *menu, lists_t_strs *files,
+		const int margin);
 
 #ifdef __cplusplus
 }
@@ -623,6 +623,7 @@ void options_init ()
 	add_bool ("AutoLoadLyrics", true);
 	add_str  ("MOCDir", "~/.moc", CHECK_NONE);
 	add_bool ("UseMMap", false);
+	add_bool ("UseIOUring", false);
 	add_bool ("UseMimeMagic", false);
 	add_str  ("ID3v1TagsEncoding", "WINDOWS-1250", CHECK_NONE);
 	add_bool ("UseRCC", true);
@@ -666,12 +667,17 @@ void options_init ()
 	                 CHECK_FUNCTION);
 
 	add_symb ("ResampleMethod", "Linear",
-	                 CHECK_SYMBOL(5), "SincBestQuality", "SincMediumQuality",
-	                                  "SincFastest", "ZeroOrderHold", "Linear");
+	                 CHECK_SYMBOL(8), "SincBestQuality", "SincMediumQuality",
+	                                  "SincFastest", "ZeroOrderHold", "Linear",
+	                                  "PolyphaseBest", "PolyphaseMedium",
+	                                  "PolyphaseFast");
 	add_int  ("ForceSampleRate", 0, CHECK_RANGE(1), 0, 500000);
+	add_bool ("FixedOutput", false);
 	add_bool ("Allow24bitOutput", false);
 	add_bool ("UseRealtimePriority", false);
 	add_int  ("TagsCacheSize", 256, CHECK_RANGE(1), 0, INT_MAX);
+	add_bool ("PCMCache", false);
+	add_int  ("PCMCacheSize", 1024, CHECK_RANGE(1), 1, INT_MAX);
 	add_bool ("PlaylistNumbering", true);
 
 	add_list ("Layout1", "directory(0,0,50%,100%):playlist(50%,0,FILL,100%)",
@@ -697,6 +703,7 @@ void options_init ()
 	add_bool ("SetXtermTitle", true);
 	add_bool ("SetScreenTitle", true);
 	add_bool ("PlaylistFullPaths", true);
+	add_bool ("FuzzySearch", false);
 
 	add_str  ("BlockDecorators", "`\"'", CHECK_LENGTH(1), 3, 3);
 	add_int  ("MessageLingerTime", 3, CHECK_RANGE(1), 0, INT_MAX);
@@ -0,0 +1,602 @@
+/*
+ * MOC - music on console
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/* Cache of decoded sound.
+ *
+ * When a file is played the decoded sound is written to an entry in the
+ * cache directory; the next time the file is played the entry is mapped
+ * into memory and the pseudo-decoder returned by pcm_cache_decoder() just
+ * copies the sound from it.  An entry is keyed by the decoder, the
+ * modification time, the size and the path of the file, it's a header
+ * followed by raw PCM.  The modification time of the entry is the time it
+ * was last used; the least recently used entries are removed when the
+ * cache grows over its size. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "common.h"
+#include "log.h"
+#include "pcm_cache.h"
+
+#define HEADER_MAGIC	"MPCM"
+#define HEADER_VERSION	1
+#define HEADER_SIZE	4096
+#define KEY_MAX		(HEADER_SIZE - 40)
+
+#define ENTRY_EXT	".pcm"
+#define PART_EXT	".part"
+
+/* More channels than this mean a broken entry. */
+#define MAX_CHANNELS	64
+
+struct header
+{
+	char magic[4];
+	uint32_t version;
+	int64_t frames;
+	int64_t fmt;
+	int32_t rate;
+	int32_t channels;
+	int32_t bitrate;	/* of the original file, kbps */
+	int32_t unused;
+	char key[KEY_MAX];
+};
+
+struct pcm_cache_writer
+{
+	int fd;
+	char *path;
+	char *part_path;
+	char *key;
+	off_t file_size;	/* of the original file */
+	struct sound_params sound_params;
+	int64_t bytes;		/* of sound written */
+};
+
+struct pcm_cache_data
+{
+	char *map;
+	size_t map_size;
+	struct sound_params sound_params;
+	int bitrate;
+	int bpf;		/* bytes per frame */
+	int64_t frames;
+	int64_t pos;		/* frame to decode next */
+	struct decoder_error error;
+};
+
+struct entry
+{
+	char *path;
+	struct timespec mtime;
+	off_t size;
+};
+
+/* NULL if the cache is disabled. */
+static char *cache_dir = NULL;
+static int64_t cache_size = 0;
+
+/* Make the key of the file decoded by the decoder.  Return NULL if the
+ * file can't be cached. */
+static char *make_key (const char *file, const struct decoder *f,
+		off_t *file_size)
+{
+	struct stat st;
+	char *key;
+
+	if (stat (file, &st) == -1 || !S_ISREG (st.st_mode))
+		return NULL;
+
+	key = format_msg ("%s\n%lld\n%lld\n%s", get_decoder_name (f),
+	                  (long long)st.st_mtime, (long long)st.st_size, file);
+	if (strlen (key) >= KEY_MAX) {
+		free (key);
+		return NULL;
+	}
+
+	if (file_size)
+		*file_size = st.st_size;
+
+	return key;
+}
+
+/* 64-bit FNV-1a hash. */
+static uint64_t hash_key (const char *key)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (*key) {
+		hash ^= (unsigned char)*key++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static char *entry_path (const char *key, const char *ext)
+{
+	return format_msg ("%s/%016llx%s", cache_dir,
+	                   (unsigned long long)hash_key (key), ext);
+}
+
+static int has_ext (const char *name, const char *ext)
+{
+	size_t len = strlen (name), ext_len = strlen (ext);
+
+	return len > ext_len && !strcmp (name + len - ext_len, ext);
+}
+
+static int cmp_entries (const void *a, const void *b)
+{
+	const struct entry *ea = (const struct entry *)a;
+	const struct entry *eb = (const struct entry *)b;
+
+	if (ea->mtime.tv_sec != eb->mtime.tv_sec)
+		return ea->mtime.tv_sec < eb->mtime.tv_sec ? -1 : 1;
+	if (ea->mtime.tv_nsec != eb->mtime.tv_nsec)
+		return ea->mtime.tv_nsec < eb->mtime.tv_nsec ? -1 : 1;
+	return 0;
+}
+
+/* Remove the least recently used entries until the cache fits in its size,
+ * but not the entry keep.  Remove also unfinished entries if parts is
+ * set. */
+static void evict (const char *keep, const int parts)
+{
+	DIR *dir;
+	struct dirent *d;
+	struct entry *entries = NULL;
+	int count = 0, allocated = 0, ix;
+	int64_t total = 0;
+
+	dir = opendir (cache_dir);
+	if (!dir) {
+		log_errno ("Can't open the PCM cache directory", errno);
+		return;
+	}
+
+	while ((d = readdir (dir))) {
+		struct stat st;
+		char *path;
+
+		if (has_ext (d->d_name, PART_EXT) && parts) {
+			path = format_msg ("%s/%s", cache_dir, d->d_name);
+			unlink (path);
+			free (path);
+			continue;
+		}
+
+		if (!has_ext (d->d_name, ENTRY_EXT))
+			continue;
+
+		path = format_msg ("%s/%s", cache_dir, d->d_name);
+		if (stat (path, &st) == -1) {
+			free (path);
+			continue;
+		}
+
+		if (count == allocated) {
+			allocated = allocated ? allocated * 2 : 64;
+			entries = (struct entry *)xrealloc (entries,
+					allocated * sizeof (struct entry));
+		}
+		entries[count].path = path;
+		entries[count].mtime = st.st_mtim;
+		entries[count].size = st.st_size;
+		total += st.st_size;
+		count += 1;
+	}
+	closedir (dir);
+
+	if (count)
+		qsort (entries, count, sizeof (struct entry), cmp_entries);
+
+	for (ix = 0; ix < count; ix += 1) {
+		if (total > cache_size
+				&& (!keep || strcmp (entries[ix].path, keep))) {
+			logit ("Removing %s from the PCM cache", entries[ix].path);
+			if (unlink (entries[ix].path) == 0)
+				total -= entries[ix].size;
+		}
+		free (entries[ix].path);
+	}
+	free (entries);
+}
+
+/* Enable the cache in the directory which is created if necessary. */
+void pcm_cache_init (const char *dir, const int size_mb)
+{
+	assert (dir != NULL);
+	assert (size_mb > 0);
+
+	if (mkdir (dir, 0700) == -1 && errno != EEXIST) {
+		error_errno ("Failed to create directory for PCM cache", errno);
+		return;
+	}
+
+	cache_dir = xstrdup (dir);
+	cache_size = (int64_t)size_mb * 1024 * 1024;
+	evict (NULL, 1);
+}
+
+void pcm_cache_exit ()
+{
+	free (cache_dir);
+	cache_dir = NULL;
+}
+
+/* Is the sound the decoder makes from the file in the cache? */
+int pcm_cache_has (const char *file, const struct decoder *f)
+{
+	char *key, *path;
+	int res;
+
+	assert (file != NULL);
+	assert (f != NULL);
+
+	if (!cache_dir || f == pcm_cache_decoder ())
+		return 0;
+
+	key = make_key (file, f, NULL);
+	if (!key)
+		return 0;
+
+	path = entry_path (key, ENTRY_EXT);
+	res = access (path, R_OK) == 0;
+	free (path);
+	free (key);
+
+	return res;
+}
+
+/* Start caching the sound the decoder makes from the file.  Return NULL
+ * if the cache is disabled or the file can't be cached. */
+struct pcm_cache_writer *pcm_cache_writer_new (const char *file,
+		const struct decoder *f)
+{
+	struct pcm_cache_writer *w;
+	off_t file_size;
+	char *key;
+
+	assert (file != NULL);
+	assert (f != NULL);
+
+	if (!cache_dir || f == pcm_cache_decoder ())
+		return NULL;
+
+	key = make_key (file, f, &file_size);
+	if (!key)
+		return NULL;
+
+	w = (struct pcm_cache_writer *)xmalloc (sizeof (struct pcm_cache_writer));
+	w->key = key;
+	w->path = entry_path (key, ENTRY_EXT);
+	w->part_path = entry_path (key, PART_EXT);
+	w->file_size = file_size;
+	w->bytes = 0;
+
+	w->fd = open (w->part_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (w->fd == -1 || lseek (w->fd, HEADER_SIZE, SEEK_SET) == -1) {
+		log_errno ("Can't create PCM cache entry", errno);
+		pcm_cache_abort (w);
+	}
+
+	return w;
+}
+
+/* Append decoded sound to the entry. */
+void pcm_cache_write (struct pcm_cache_writer *w, const char *buf,
+		const size_t size, const struct sound_params *sound_params)
+{
+	size_t written = 0;
+
+	assert (buf != NULL);
+	assert (sound_params != NULL);
+
+	if (!w || w->fd == -1)
+		return;
+
+	if (w->bytes == 0)
+		w->sound_params = *sound_params;
+	else if (!sound_params_eq (w->sound_params, *sound_params)) {
+		logit ("Sound parameters have changed, not caching");
+		pcm_cache_abort (w);
+		return;
+	}
+
+	if (HEADER_SIZE + w->bytes + (int64_t)size > cache_size) {
+		logit ("The sound doesn't fit in the PCM cache");
+		pcm_cache_abort (w);
+		return;
+	}
+
+	while (written < size) {
+		ssize_t res = write (w->fd, buf + written, size - written);
+
+		if (res == -1 && errno == EINTR)
+			continue;
+		if (res == -1) {
+			log_errno ("Can't write PCM cache entry", errno);
+			pcm_cache_abort (w);
+			return;
+		}
+		written += res;
+	}
+
+	w->bytes += size;
+}
+
+/* Give up caching the sound, for example after a seek. */
+void pcm_cache_abort (struct pcm_cache_writer *w)
+{
+	if (w && w->fd != -1) {
+		close (w->fd);
+		w->fd = -1;
+		unlink (w->part_path);
+	}
+}
+
+/* Add the entry to the cache if the whole sound was written, then free
+ * the writer. */
+void pcm_cache_writer_finish (struct pcm_cache_writer *w, const int complete)
+{
+	struct header hdr;
+	int bpf;
+
+	if (!w)
+		return;
+
+	if (w->fd != -1 && (!complete || w->bytes == 0))
+		pcm_cache_abort (w);
+
+	if (w->fd != -1) {
+		bpf = sfmt_Bps (w->sound_params.fmt) * w->sound_params.channels;
+
+		memset (&hdr, 0, sizeof (hdr));
+		memcpy (hdr.magic, HEADER_MAGIC, sizeof (hdr.magic));
+		hdr.version = HEADER_VERSION;
+		hdr.frames = w->bytes / bpf;
+		hdr.fmt = w->sound_params.fmt;
+		hdr.rate = w->sound_params.rate;
+		hdr.channels = w->sound_params.channels;
+		hdr.bitrate = w->file_size * 8 * w->sound_params.rate
+		              / MAX(hdr.frames, 1) / 1000;
+		strcpy (hdr.key, w->key);
+
+		if (pwrite (w->fd, &hdr, sizeof (hdr), 0) != ssizeof (hdr)
+				|| close (w->fd) == -1) {
+			log_errno ("Can't write PCM cache entry", errno);
+			unlink (w->part_path);
+		}
+		else if (rename (w->part_path, w->path) == -1) {
+			log_errno ("Can't add PCM cache entry", errno);
+			unlink (w->part_path);
+		}
+		else {
+			logit ("Added %s to the PCM cache", w->path);
+			evict (w->path, 0);
+		}
+	}
+
+	free (w->key);
+	free (w->path);
+	free (w->part_path);
+	free (w);
+}
+
+static void *pcm_cache_open (const char *file)
+{
+	struct pcm_cache_data *data;
+	const struct header *hdr;
+	struct stat st;
+	char *key = NULL, *path;
+	const struct decoder *f;
+	int fd;
+
+	data = (struct pcm_cache_data *)xmalloc (sizeof (struct pcm_cache_data));
+	data->map = NULL;
+	data->pos = 0;
+	decoder_error_init (&data->error);
+
+	f = get_decoder (file);
+	if (f && cache_dir)
+		key = make_key (file, f, NULL);
+	if (!key) {
+		decoder_error (&data->error, ERROR_FATAL, 0,
+		               "The file is not in the PCM cache");
+		return data;
+	}
+
+	path = entry_path (key, ENTRY_EXT);
+	fd = open (path, O_RDONLY);
+	free (path);
+	if (fd == -1 || fstat (fd, &st) == -1) {
+		decoder_error (&data->error, ERROR_FATAL, errno,
+		               "Can't open PCM cache entry: ");
+		if (fd != -1)
+			close (fd);
+		free (key);
+		return data;
+	}
+
+	/* Mark the entry as recently used. */
+	futimens (fd, NULL);
+
+	if (st.st_size >= HEADER_SIZE) {
+		data->map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data->map == MAP_FAILED)
+			data->map = NULL;
+	}
+	close (fd);
+
+	if (!data->map) {
+		decoder_error (&data->error, ERROR_FATAL, 0,
+		               "Can't map PCM cache entry");
+		free (key);
+		return data;
+	}
+	data->map_size = st.st_size;
+
+#ifdef MADV_SEQUENTIAL
+	madvise (data->map, data->map_size, MADV_SEQUENTIAL);
+#endif
+
+	hdr = (const struct header *)data->map;
+	data->sound_params.fmt = hdr->fmt;
+	data->sound_params.rate = hdr->rate;
+	data->sound_params.channels = hdr->channels;
+	data->bitrate = hdr->bitrate;
+	data->frames = hdr->frames;
+
+	if (memcmp (hdr->magic, HEADER_MAGIC, sizeof (hdr->magic))
+			|| hdr->version != HEADER_VERSION
+			|| strncmp (hdr->key, key, KEY_MAX)
+			|| !sound_format_ok (data->sound_params.fmt)
+			|| data->sound_params.rate <= 0
+			|| data->sound_params.channels <= 0
+			|| data->sound_params.channels > MAX_CHANNELS) {
+		decoder_error (&data->error, ERROR_FATAL, 0,
+		               "Broken PCM cache entry");
+		free (key);
+		return data;
+	}
+	free (key);
+
+	data->bpf = sfmt_Bps (data->sound_params.fmt)
+	            * data->sound_params.channels;
+	if (HEADER_SIZE + data->frames * data->bpf != (int64_t)data->map_size)
+		decoder_error (&data->error, ERROR_FATAL, 0,
+		               "Broken PCM cache entry");
+
+	return data;
+}
+
+static void pcm_cache_close (void *prv_data)
+{
+	struct pcm_cache_data *data = (struct pcm_cache_data *)prv_data;
+
+	if (data->map)
+		munmap (data->map, data->map_size);
+	decoder_error_clear (&data->error);
+	free (data);
+}
+
+static int pcm_cache_seek (void *prv_data, int sec)
+{
+	struct pcm_cache_data *data = (struct pcm_cache_data *)prv_data;
+	int64_t frame;
+
+	assert (sec >= 0);
+
+	frame = (int64_t)sec * data->sound_params.rate;
+	if (frame >= data->frames)
+		return -1;
+
+	data->pos = frame;
+
+	return sec;
+}
+
+static int pcm_cache_get_bitrate (void *prv_data)
+{
+	struct pcm_cache_data *data = (struct pcm_cache_data *)prv_data;
+
+	return data->bitrate;
+}
+
+static int pcm_cache_get_duration (void *prv_data)
+{
+	struct pcm_cache_data *data = (struct pcm_cache_data *)prv_data;
+
+	return (data->frames + data->sound_params.rate / 2)
+	       / data->sound_params.rate;
+}
+
+static void pcm_cache_get_error (void *prv_data, struct decoder_error *error)
+{
+	struct pcm_cache_data *data = (struct pcm_cache_data *)prv_data;
+
+	decoder_error_copy (error, &data->error);
+}
+
+static long pcm_cache_set_format (void *prv_data,
+		const long formats ATTR_UNUSED)
+{
+	struct pcm_cache_data *data = (struct pcm_cache_data *)prv_data;
+
+	return data->sound_params.fmt;
+}
+
+static int pcm_cache_decode_frames (void *prv_data, struct decoder_buf *buf,
+		struct sound_params *sound_params, int64_t *pos)
+{
+	struct pcm_cache_data *data = (struct pcm_cache_data *)prv_data;
+	int64_t frames;
+
+	*sound_params = data->sound_params;
+	*pos = data->pos;
+
+	frames = MIN(data->frames - data->pos, (int64_t)buf->frames);
+	frames = MIN(frames, (int64_t)(buf->size / data->bpf));
+	if (frames <= 0)
+		return 0;
+
+	memcpy (buf->data, data->map + HEADER_SIZE + data->pos * data->bpf,
+	        frames * data->bpf);
+	data->pos += frames;
+
+	return frames;
+}
+
+static struct decoder pcm_cache_decoder_funcs = {
+	DECODER_API_VERSION,
+	NULL,
+	NULL,
+	pcm_cache_open,
+	NULL,
+	NULL,
+	pcm_cache_close,
+	NULL,
+	pcm_cache_seek,
+	NULL,
+	pcm_cache_get_bitrate,
+	pcm_cache_get_duration,
+	pcm_cache_get_error,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	pcm_cache_get_bitrate,
+	NULL,
+	NULL,
+	pcm_cache_set_format,
+	pcm_cache_decode_frames
+};
+
+/* Return the pseudo-decoder which plays files from the cache. */
+struct decoder *pcm_cache_decoder ()
+{
+	return &pcm_cache_decoder_funcs;
+}
@@ -0,0 +1,29 @@
+#ifndef PCM_CACHE_H
+#define PCM_CACHE_H
+
+#include "audio.h"
+#include "decoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pcm_cache_writer;
+
+void pcm_cache_init (const char *dir, const int size_mb);
+void pcm_cache_exit ();
+struct decoder *pcm_cache_decoder ();
+int pcm_cache_has (const char *file, const struct decoder *f);
+
+struct pcm_cache_writer *pcm_cache_writer_new (const char *file,
+		const struct decoder *f);
+void pcm_cache_write (struct pcm_cache_writer *w, const char *buf,
+		const size_t size, const struct sound_params *sound_params);
+void pcm_cache_abort (struct pcm_cache_writer *w);
+void pcm_cache_writer_finish (struct pcm_cache_writer *w, const int complete);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
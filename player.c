@@ -33,6 +33,7 @@
 #include "files.h"
 #include "playlist.h"
 #include "md5.h"
+#include "pcm_cache.h"
 
 #define PCM_BUF_SIZE		(36 * 1024)
 #define PREBUFFER_THRESHOLD	(18 * 1024)
@@ -76,7 +77,7 @@ struct precache
 	int buf_fill;
 	int ok; /* 1 if precache succeed */
 	struct sound_params sound_params; /* of the sound in the buffer */
-	struct decoder *f; /* decoder functions for precached file */
+	const struct decoder *f; /* decoder functions for precached file */
 	void *decoder_data;
 	int running; /* if the precache thread is running */
 	pthread_t tid; /* tid of the precache thread */
@@ -233,10 +234,48 @@ static void update_time ()
 	}
 }
 
+/* Return the decoder for the file: the PCM cache if the file is there. */
+static struct decoder *file_decoder (const char *file)
+{
+	struct decoder *f = get_decoder (file);
+
+	if (f && pcm_cache_has (file, f))
+		return pcm_cache_decoder ();
+
+	return f;
+}
+
+/* Open the file with the decoder and fill err.  If the decoder is the PCM
+ * cache and the entry was evicted since file_decoder(), open the file with
+ * its own decoder and change *f to it. */
+static void *open_file (const struct decoder **f, const char *file,
+		struct decoder_error *err)
+{
+	void *decoder_data;
+
+	decoder_data = (*f)->open (file);
+	(*f)->get_error (decoder_data, err);
+
+	if (err->type != ERROR_OK && *f == pcm_cache_decoder ()) {
+		logit ("Not using the PCM cache: %s", err->err);
+		decoder_error_clear (err);
+		(*f)->close (decoder_data);
+
+		*f = get_decoder (file);
+		assert (*f != NULL);
+
+		decoder_data = (*f)->open (file);
+		(*f)->get_error (decoder_data, err);
+	}
+
+	return decoder_data;
+}
+
 static void *precache_thread (void *data)
 {
 	struct precache *precache = (struct precache *)data;
 	int decoded;
+	int64_t pos;
 	struct sound_params new_sound_params;
 	struct decoder_error err;
 
@@ -244,11 +283,14 @@ static void *precache_thread (void *data)
 	precache->sound_params.channels = 0; /* mark that sound_params were not
 						yet filled. */
 	precache->decoded_time = 0.0;
-	precache->f = get_decoder (precache->file);
+	precache->f = file_decoder (precache->file);
 	assert (precache->f != NULL);
 
-	precache->decoder_data = precache->f->open(precache->file);
-	precache->f->get_error(precache->decoder_data, &err);
+	if (precache->f != pcm_cache_decoder ())
+		io_prefetch (precache->file);
+
+	precache->decoder_data = open_file (&precache->f, precache->file,
+			&err);
 	if (err.type != ERROR_OK) {
 		logit ("Failed to open the file for precache: %s", err.err);
 		decoder_error_clear (&err);
@@ -256,15 +298,16 @@ static void *precache_thread (void *data)
 		return NULL;
 	}
 
+	decoder_set_format (precache->f, precache->decoder_data);
 	audio_plist_set_time (precache->file,
 			precache->f->get_duration(precache->decoder_data));
 
 	/* Stop at PCM_BUF_SIZE, because when we decode too much, there is no
 	 * place where we can put the data that doesn't fit into the buffer. */
 	while (precache->buf_fill < PCM_BUF_SIZE) {
-		decoded = precache->f->decode (precache->decoder_data,
+		decoded = decoder_decode (precache->f, precache->decoder_data,
 				precache->buf + precache->buf_fill,
-				PCM_BUF_SIZE, &new_sound_params);
+				PCM_BUF_SIZE, &new_sound_params, &pos);
 
 		if (!decoded) {
 
@@ -440,14 +483,17 @@ static void buf_free_cb ()
 static void decode_loop (const struct decoder *f, void *decoder_data,
 		const char *next_file, struct out_buf *out_buf,
 		struct sound_params *sound_params, struct md5_data *md5,
-		const float already_decoded_sec)
+		struct pcm_cache_writer *cache, const float already_decoded_sec)
 {
 	bool eof = false;
 	bool stopped = false;
+	bool next_prefetched = false;
 	char buf[PCM_BUF_SIZE];
 	int decoded = 0;
+	int64_t pos;
 	struct sound_params new_sound_params;
 	bool sound_params_change = false;
+	bool fixed_output = options_get_bool ("FixedOutput");
 	float decode_time = already_decoded_sec; /* the position of the decoder
 	                                            (in seconds) */
 
@@ -486,9 +532,12 @@ static void decode_loop (const struct decoder *f, void *decoder_data,
 				status_msg ("Playing...");
 			}
 
-			decoded = f->decode (decoder_data, buf, sizeof(buf),
-					&new_sound_params);
+			decoded = decoder_decode (f, decoder_data, buf,
+					sizeof(buf), &new_sound_params, &pos);
 
+			/* Use the exact position if the decoder knows it. */
+			if (decoded && pos >= 0)
+				decode_time = pos / (float)new_sound_params.rate;
 			if (decoded)
 				decode_time += decoded / (float)(sfmt_Bps(
 							new_sound_params.fmt) *
@@ -498,6 +547,7 @@ static void decode_loop (const struct decoder *f, void *decoder_data,
 			f->get_error (decoder_data, &err);
 			if (err.type != ERROR_OK) {
 				md5->okay = false;
+				pcm_cache_abort (cache);
 				if (err.type != ERROR_STREAM ||
 				    options_get_bool ("ShowStreamErrors"))
 					error ("%s", err.err);
@@ -507,9 +557,13 @@ static void decode_loop (const struct decoder *f, void *decoder_data,
 			if (!decoded) {
 				eof = true;
 				logit ("EOF from decoder");
+				pcm_cache_writer_finish (cache, 1);
+				cache = NULL;
 			}
 			else {
 				debug ("decoded %d bytes", decoded);
+				pcm_cache_write (cache, buf, decoded,
+						&new_sound_params);
 				if (!sound_params_eq(new_sound_params, *sound_params))
 					sound_params_change = true;
 
@@ -529,6 +583,13 @@ static void decode_loop (const struct decoder *f, void *decoder_data,
 					&& options_get_bool("Precache")
 					&& options_get_bool("AutoNext"))
 				start_precache (&precache, next_file);
+			else if (eof && !next_prefetched && next_file
+					&& file_type(next_file) == F_URL
+					&& options_get_bool("Precache")
+					&& options_get_bool("AutoNext")) {
+				io_prefetch (next_file);
+				next_prefetched = true;
+			}
 			pthread_cond_wait (&request_cond, &request_cond_mtx);
 			UNLOCK (request_cond_mtx);
 		}
@@ -556,6 +617,7 @@ static void decode_loop (const struct decoder *f, void *decoder_data,
 
 			logit ("seeking");
 			md5->okay = false;
+			pcm_cache_abort (cache);
 			req_seek = MAX(0, req_seek);
 			if ((decoder_seek = f->seek(decoder_data, req_seek)) == -1)
 				logit ("error when seeking");
@@ -588,13 +650,18 @@ static void decode_loop (const struct decoder *f, void *decoder_data,
 			decoded = 0;
 		}
 		else if (!eof && sound_params_change
-				&& out_buf_get_fill(out_buf) == 0) {
+				&& (fixed_output || out_buf_get_fill(out_buf) == 0)) {
 			logit ("Sound parameters have changed.");
 			*sound_params = new_sound_params;
 			sound_params_change = false;
 			set_info_channels (sound_params->channels);
 			set_info_rate (sound_params->rate / 1000);
-			out_buf_wait (out_buf);
+
+			/* With fixed output the buffer holds the sound already
+			 * converted for the device, it must be played only if
+			 * the device is reopened. */
+			if (!audio_open_reuses_device (sound_params))
+				out_buf_wait (out_buf);
 			if (!audio_open(sound_params)) {
 				md5->okay = false;
 				break;
@@ -608,6 +675,8 @@ static void decode_loop (const struct decoder *f, void *decoder_data,
 
 	status_msg ("");
 
+	pcm_cache_writer_finish (cache, 0);
+
 	LOCK (decoder_stream_mtx);
 	decoder_stream = NULL;
 	f->close (decoder_data);
@@ -675,7 +744,8 @@ static void log_md5_sum (const char *file, struct sound_params sound_params,
 	fn = strrchr (file, '/');
 	fn = fn ? fn + 1 : file;
 	debug ("MD5(%s) = %s %ld %s %c%u%s %d %d",
-	        fn, md5sum, md5_len, get_decoder_name (f),
+	        fn, md5sum, md5_len,
+	        f == pcm_cache_decoder () ? "pcm_cache" : get_decoder_name (f),
 	        format, bps, endian,
 	        sound_params.channels, sound_params.rate);
 }
@@ -689,6 +759,7 @@ static void play_file (const char *file, const struct decoder *f,
 	struct sound_params sound_params = { 0, 0, 0 };
 	float already_decoded_time;
 	struct md5_data md5;
+	struct pcm_cache_writer *cache;
 
 #if !defined(NDEBUG) && defined(DEBUG)
 	md5.okay = true;
@@ -700,7 +771,9 @@ static void play_file (const char *file, const struct decoder *f,
 
 	precache_wait (&precache);
 
-	if (precache.ok && strcmp(precache.file, file)) {
+	/* The decoder differs if the file was added to the PCM cache after
+	 * precaching. */
+	if (precache.ok && (strcmp(precache.file, file) || precache.f != f)) {
 		logit ("The precached file is not the file we want.");
 		precache.f->close (precache.decoder_data);
 		precache_reset (&precache);
@@ -711,8 +784,6 @@ static void play_file (const char *file, const struct decoder *f,
 
 		logit ("Using precached file");
 
-		assert (f == precache.f);
-
 		sound_params = precache.sound_params;
 		decoder_data = precache.decoder_data;
 		set_info_channels (sound_params.channels);
@@ -732,9 +803,14 @@ static void play_file (const char *file, const struct decoder *f,
 
 		audio_send_buf (precache.buf, precache.buf_fill);
 
+		cache = pcm_cache_writer_new (file, f);
+		pcm_cache_write (cache, precache.buf, precache.buf_fill,
+				&sound_params);
+
 		precache.f->get_error (precache.decoder_data, &err);
 		if (err.type != ERROR_OK) {
 			md5.okay = false;
+			pcm_cache_abort (cache);
 			if (err.type != ERROR_STREAM ||
 			    options_get_bool ("ShowStreamErrors"))
 				error ("%s", err.err);
@@ -760,8 +836,7 @@ static void play_file (const char *file, const struct decoder *f,
 		struct decoder_error err;
 
 		status_msg ("Opening...");
-		decoder_data = f->open(file);
-		f->get_error (decoder_data, &err);
+		decoder_data = open_file (&f, file, &err);
 		if (err.type != ERROR_OK) {
 			f->close (decoder_data);
 			status_msg ("");
@@ -771,6 +846,8 @@ static void play_file (const char *file, const struct decoder *f,
 			return;
 		}
 
+		decoder_set_format (f, decoder_data);
+		cache = pcm_cache_writer_new (file, f);
 		already_decoded_time = 0.0;
 		if (f->get_avg_bitrate)
 			set_info_avg_bitrate (f->get_avg_bitrate(decoder_data));
@@ -782,7 +859,7 @@ static void play_file (const char *file, const struct decoder *f,
 	precache_reset (&precache);
 
 	decode_loop (f, decoder_data, next_file, out_buf, &sound_params,
-			&md5, already_decoded_time);
+			&md5, cache, already_decoded_time);
 
 #if !defined(NDEBUG) && defined(DEBUG)
 	if (md5.okay) {
@@ -794,8 +871,10 @@ static void play_file (const char *file, const struct decoder *f,
 #endif
 }
 
-/* Play the stream (global decoder_stream) using the given decoder. */
-static void play_stream (const struct decoder *f, struct out_buf *out_buf)
+/* Play the stream (global decoder_stream) using the given decoder.
+ * next_file is precached. */
+static void play_stream (const struct decoder *f, const char *next_file,
+		struct out_buf *out_buf)
 {
 	void *decoder_data;
 	struct sound_params sound_params = { 0, 0, 0 };
@@ -821,10 +900,11 @@ static void play_stream (const struct decoder *f, struct out_buf *out_buf)
 		logit ("Can't open file");
 	}
 	else {
+		decoder_set_format (f, decoder_data);
 		audio_state_started_playing ();
 		bitrate_list_init (&bitrate_list);
-		decode_loop (f, decoder_data, NULL, out_buf, &sound_params,
-				&null_md5, 0.0);
+		decode_loop (f, decoder_data, next_file, out_buf, &sound_params,
+				&null_md5, NULL, 0.0);
 	}
 }
 
@@ -881,11 +961,11 @@ void player (const char *file, const char *next_file, struct out_buf *out_buf)
 
 		status_msg ("Playing...");
 		ev_audio_start ();
-		play_stream (f, out_buf);
+		play_stream (f, next_file, out_buf);
 		ev_audio_stop ();
 	}
 	else {
-		f = get_decoder (file);
+		f = file_decoder (file);
 		LOCK (decoder_stream_mtx);
 		decoder_stream = NULL;
 		UNLOCK (decoder_stream_mtx);
@@ -178,6 +178,20 @@ struct plist_item *plist_new_item ()
 
 /* Add a file to the list. Return the index of the item. */
 int plist_add (struct plist *plist, const char *file_name)
+{
+	enum file_type type = F_OTHER;
+	time_t mtime = (time_t)-1;
+
+	if (file_name)
+		type = file_type_mtime (file_name, &mtime);
+
+	return plist_add_typed (plist, file_name, type, mtime);
+}
+
+/* Add a file of which the type and modification time are already known
+ * to the list.  Return the index of the item. */
+int plist_add_typed (struct plist *plist, const char *file_name,
+		const enum file_type type, const time_t mtime)
 {
 	assert (plist != NULL);
 	assert (plist->items != NULL);
@@ -189,14 +203,12 @@ int plist_add (struct plist *plist, const char *file_name)
 	}
 
 	plist->items[plist->num].file = xstrdup (file_name);
-	plist->items[plist->num].type = file_name ? file_type (file_name)
-		: F_OTHER;
+	plist->items[plist->num].type = type;
 	plist->items[plist->num].deleted = 0;
 	plist->items[plist->num].title_file = NULL;
 	plist->items[plist->num].title_tags = NULL;
 	plist->items[plist->num].tags = NULL;
-	plist->items[plist->num].mtime = (file_name ? get_mtime(file_name)
-			: (time_t)-1);
+	plist->items[plist->num].mtime = mtime;
 	plist->items[plist->num].queue_pos = 0;
 
 	if (file_name) {
@@ -371,7 +383,7 @@ void plist_sort_fname (struct plist *plist)
 }
 
 /* Find an item in the list.  Return the index or -1 if not found. */
-int plist_find_fname (struct plist *plist, const char *file)
+int plist_find_fname (const struct plist *plist, const char *file)
 {
 	struct rb_node *x;
 
@@ -433,30 +445,38 @@ const char *plist_get_next_dead_entry (const struct plist *plist,
 	return NULL;
 }
 
-#define if_not_empty(str)	(tags && (str) && (*str) ? (str) : NULL)
-
-static char *title_expn_subs(char fmt, const struct file_tags *tags)
+/* Operations of a compiled title format. */
+enum title_op_type
 {
-	static char track[16];
+	TITLE_OP_TEXT,	/* literal text */
+	TITLE_OP_FIELD,	/* value of a tag */
+	TITLE_OP_COND	/* %(x:true:false) */
+};
 
-	switch (fmt) {
-		case 'n':
-			if (!tags || tags->track == -1)
-				break;
-			snprintf (track, sizeof(track), "%d", tags->track);
-			return track;
-		case 'a':
-			return if_not_empty (tags->artist);
-		case 'A':
-			return if_not_empty (tags->album);
-		case 't':
-			return if_not_empty (tags->title);
-		default:
-			fatal ("Error parsing format string!");
-	}
+struct title_op
+{
+	enum title_op_type type;
+	char field;		/* FIELD, COND: the tag (n, a, A or t) */
+	int text;		/* TEXT: offset of the text in text[] */
+	int len;		/* TEXT: its length */
+	int true_ops;		/* COND: number of following operations of
+				   the true part, the false part follows */
+	int false_ops;
+};
+
+/* Title format compiled by title_format_compile(). */
+struct title_format
+{
+	char *fmt;		/* source of the format */
+	char *text;		/* unescaped literal text of all operations */
+	int text_len;
+	struct title_op *ops;
+	int nops;
+	int ops_allocated;
+};
 
-	return NULL;
-}
+/* Compiled FormatString option. */
+static struct title_format *default_title_format = NULL;
 
 static inline void check_zero (const char *x)
 {
@@ -464,133 +484,305 @@ static inline void check_zero (const char *x)
 		fatal ("Unexpected end of title expression!");
 }
 
-/* Generate a title from fmt. */
-static void do_title_expn (char *dest, int size, const char *fmt,
-		const struct file_tags *tags)
+static void check_field (const char field)
+{
+	if (!strchr ("naAt", field))
+		fatal ("Error parsing format string!");
+}
+
+static int title_format_add_op (struct title_format *tf,
+		const enum title_op_type type)
+{
+	if (tf->nops == tf->ops_allocated) {
+		tf->ops_allocated = tf->ops_allocated ? tf->ops_allocated * 2 : 16;
+		tf->ops = (struct title_op *)xrealloc (tf->ops,
+				tf->ops_allocated * sizeof(struct title_op));
+	}
+
+	memset (&tf->ops[tf->nops], 0, sizeof(struct title_op));
+	tf->ops[tf->nops].type = type;
+
+	return tf->nops++;
+}
+
+/* Skip the text up to the first unescaped 'end' character. */
+static const char *skip_expn (const char *fmt, const char end)
 {
-	const char *h;
-	int free = --size;
 	short escape = 0;
 
-	dest[0] = 0;
+	while (escape || *fmt != end) {
+		if (escape)
+			escape = 0;
+		else if (*fmt == '\\')
+			escape = 1;
+		check_zero (++fmt);
+	}
+
+	return fmt;
+}
+
+static void compile_title_expn (struct title_format *tf, const char *fmt);
+
+/* Compile 'len' characters of the format as a separate expression. */
+static void compile_title_part (struct title_format *tf, const char *fmt,
+		const size_t len)
+{
+	char *part = (char *)xmalloc (len + 1);
+
+	memcpy (part, fmt, len);
+	part[len] = 0;
+	compile_title_expn (tf, part);
+	free (part);
+}
+
+/* Compile the format adding operations to 'tf'.  The text is unescaped
+ * into tf->text which must be big enough. */
+static void compile_title_expn (struct title_format *tf, const char *fmt)
+{
+	short escape = 0;
+	int text_op = -1;
 
-	while (free > 0 && *fmt) {
+	while (*fmt) {
 		if (*fmt == '%' && !escape) {
-			check_zero(++fmt);
+			check_zero (++fmt);
+			text_op = -1;
 
-			/* do ternary expansion
+			/* ternary expansion
 			 * format: %(x:true:false)
 			 */
 			if (*fmt == '(') {
-				char separator, expr[256];
-				int expr_pos = 0;
+				const char *true_part, *false_part;
+				char separator;
+				int op;
 
-				check_zero(++fmt);
-				h = title_expn_subs(*fmt, tags);
+				check_zero (++fmt);
+				op = title_format_add_op (tf, TITLE_OP_COND);
+				tf->ops[op].field = *fmt;
+				check_field (*fmt);
 
-				check_zero(++fmt);
+				check_zero (++fmt);
 				separator = *fmt;
 
-				check_zero(++fmt);
-
-				if(h) { /* true */
-
-					/* copy the expression */
-					while (escape || *fmt != separator) {
-						if (expr_pos == sizeof(expr)-2)
-							fatal ("Nested ternary expression too long!");
-						expr[expr_pos++] = *fmt;
-						if (*fmt == '\\')
-							escape = 1;
-						else
-							escape = 0;
-						check_zero(++fmt);
-					}
-					expr[expr_pos] = '\0';
-
-					/* eat the rest */
-					while (escape || *fmt != ')') {
-						if (escape)
-							escape = 0;
-						else if (*fmt == '\\')
-							escape = 1;
-						check_zero(++fmt);
-					}
-				}
-				else { /* false */
-
-					/* eat the truth :-) */
-					while (escape || *fmt != separator) {
-						if (escape)
-							escape = 0;
-						else if (*fmt == '\\')
-							escape = 1;
-						check_zero(++fmt);
-					}
-
-					check_zero(++fmt);
-
-					/* copy the expression */
-					while (escape || *fmt != ')') {
-						if (expr_pos == sizeof(expr)-2)
-							fatal ("Ternary expression too long!");
-						expr[expr_pos++] = *fmt;
-						if (*fmt == '\\')
-							escape = 1;
-						else
-							escape = 0;
-						check_zero(++fmt);
-					}
-					expr[expr_pos] = '\0';
-				}
+				check_zero (++fmt);
+				true_part = fmt;
+				fmt = skip_expn (fmt, separator);
+
+				check_zero (++fmt);
+				false_part = fmt;
+				fmt = skip_expn (fmt, ')');
 
-				do_title_expn((dest + size - free),
-					      free, expr, tags);
-				free -= strlen(dest + size - free);
+				compile_title_part (tf, true_part,
+						false_part - true_part - 1);
+				tf->ops[op].true_ops = tf->nops - op - 1;
+
+				compile_title_part (tf, false_part,
+						fmt - false_part);
+				tf->ops[op].false_ops = tf->nops - op - 1
+					- tf->ops[op].true_ops;
 			}
 			else {
-				h = title_expn_subs(*fmt, tags);
+				int op = title_format_add_op (tf, TITLE_OP_FIELD);
 
-				if (h) {
-					strncat(dest, h, free-1);
-					free -= strlen (h);
-				}
+				check_field (*fmt);
+				tf->ops[op].field = *fmt;
 			}
 		}
 		else if (*fmt == '\\' && !escape)
 			escape = 1;
 		else {
-			dest[size - free] = *fmt;
-			dest[size - free + 1] = 0;
-			--free;
+			if (text_op == -1) {
+				text_op = title_format_add_op (tf, TITLE_OP_TEXT);
+				tf->ops[text_op].text = tf->text_len;
+			}
+			tf->text[tf->text_len++] = *fmt;
+			tf->ops[text_op].len++;
 			escape = 0;
 		}
 		fmt++;
 	}
+}
+
+/* Compile the title format, so titles can be made without parsing it. */
+struct title_format *title_format_compile (const char *fmt)
+{
+	struct title_format *tf;
+
+	assert (fmt != NULL);
 
-	free = MAX(free, 0); /* Possible integer overflow? */
-	dest[size - free] = '\0';
+	tf = (struct title_format *)xmalloc (sizeof(struct title_format));
+	tf->fmt = xstrdup (fmt);
+	tf->text = (char *)xmalloc (strlen(fmt) + 1);
+	tf->text_len = 0;
+	tf->ops = NULL;
+	tf->nops = 0;
+	tf->ops_allocated = 0;
+
+	compile_title_expn (tf, fmt);
+
+	return tf;
+}
+
+void title_format_free (struct title_format *tf)
+{
+	assert (tf != NULL);
+
+	free (tf->fmt);
+	free (tf->text);
+	free (tf->ops);
+	free (tf);
+}
+
+/* Format the number at the end of the buffer, return the pointer to it. */
+static const char *format_track (int track, char *buf, const size_t size)
+{
+	char *p = buf + size - 1;
+	bool negative = track < 0;
+
+	*p = 0;
+	do {
+		*--p = '0' + abs (track % 10);
+		track /= 10;
+	} while (track);
+
+	if (negative)
+		*--p = '-';
+
+	return p;
+}
+
+/* Return the value of the tag or NULL if it's not present.  The track
+ * number is formatted in 'track'. */
+static const char *title_field (const char field,
+		const struct file_tags *tags, char *track, const size_t track_size)
+{
+	const char *value = NULL;
+
+	if (!tags)
+		return NULL;
+
+	switch (field) {
+		case 'n':
+			if (tags->track == -1)
+				return NULL;
+			return format_track (tags->track, track, track_size);
+		case 'a':
+			value = tags->artist;
+			break;
+		case 'A':
+			value = tags->album;
+			break;
+		case 't':
+			value = tags->title;
+			break;
+	}
+
+	return value && *value ? value : NULL;
+}
+
+/* Render 'nops' operations into buf at position pos.  Return the new
+ * position. */
+static int render_title_ops (const struct title_format *tf,
+		const struct title_op *ops, const int nops,
+		const struct file_tags *tags, char *buf, int pos,
+		const int size)
+{
+	char track[16];
+	const char *value;
+	int i = 0, len;
+
+	while (i < nops && pos < size - 1) {
+		const struct title_op *op = &ops[i];
+
+		switch (op->type) {
+			case TITLE_OP_TEXT:
+				len = MIN(op->len, size - 1 - pos);
+				memcpy (buf + pos, tf->text + op->text, len);
+				pos += len;
+				i++;
+				break;
+			case TITLE_OP_FIELD:
+				value = title_field (op->field, tags, track,
+						sizeof(track));
+				if (value) {
+					len = MIN((int)strlen(value),
+							size - 1 - pos);
+					memcpy (buf + pos, value, len);
+					pos += len;
+				}
+				i++;
+				break;
+			case TITLE_OP_COND:
+				if (title_field (op->field, tags, track,
+							sizeof(track)))
+					pos = render_title_ops (tf, op + 1,
+							op->true_ops, tags,
+							buf, pos, size);
+				else
+					pos = render_title_ops (tf,
+							op + 1 + op->true_ops,
+							op->false_ops, tags,
+							buf, pos, size);
+				i += 1 + op->true_ops + op->false_ops;
+				break;
+		}
+	}
+
+	return pos;
+}
+
+/* Make the title from tags using the compiled format in buf which has
+ * 'size' bytes, truncating it if needed.  Return the length of the title. */
+int title_format_render (const struct title_format *tf,
+		const struct file_tags *tags, char *buf, const int size)
+{
+	int len;
+
+	assert (tf != NULL);
+	assert (buf != NULL);
+	assert (size > 0);
+
+	len = render_title_ops (tf, tf->ops, tf->nops, tags, buf, 0, size);
+	buf[len] = 0;
+
+	return len;
 }
 
 /* Build file title from struct file_tags. Returned memory is malloc()ed. */
 char *build_title_with_format (const struct file_tags *tags, const char *fmt)
 {
+	struct title_format *tf;
 	char title[512];
 
-	do_title_expn (title, sizeof(title), fmt, tags);
+	tf = title_format_compile (fmt);
+	title_format_render (tf, tags, title, sizeof(title));
+	title_format_free (tf);
+
 	return xstrdup (title);
 }
 
-/* Build file title from struct file_tags. Returned memory is malloc()ed. */
+/* Build file title from struct file_tags using the FormatString option.
+ * Returned memory is malloc()ed. */
 char *build_title (const struct file_tags *tags)
 {
-	return build_title_with_format (tags, options_get_str ("FormatString"));
+	const char *fmt = options_get_str ("FormatString");
+	char title[512];
+
+	if (default_title_format && strcmp (default_title_format->fmt, fmt)) {
+		title_format_free (default_title_format);
+		default_title_format = NULL;
+	}
+	if (!default_title_format)
+		default_title_format = title_format_compile (fmt);
+
+	title_format_render (default_title_format, tags, title, sizeof(title));
+
+	return xstrdup (title);
 }
 
 /* Copy the item to the playlist. Return the index of the added item. */
 int plist_add_from_item (struct plist *plist, const struct plist_item *item)
 {
-	int pos = plist_add (plist, item->file);
+	int pos = plist_add_typed (plist, item->file, item->type, item->mtime);
 
 	plist_item_copy (&plist->items[pos], item);
 
@@ -631,6 +823,30 @@ void plist_delete (struct plist *plist, const int num)
 	}
 }
 
+/* Free the deleted items and move the others down keeping their order.
+ * Indexes of the items change. */
+void plist_compact (struct plist *plist)
+{
+	int i, num = 0;
+
+	assert (plist != NULL);
+
+	rb_tree_clear (plist->search_tree);
+
+	for (i = 0; i < plist->num; i++) {
+		if (plist->items[i].deleted) {
+			plist_free_item_fields (&plist->items[i]);
+			continue;
+		}
+
+		plist->items[num] = plist->items[i];
+		rb_insert (plist->search_tree, (void *)(intptr_t)num);
+		num++;
+	}
+
+	plist->num = num;
+}
+
 /* Count non-deleted items. */
 int plist_count (const struct plist *plist)
 {
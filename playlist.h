@@ -36,6 +36,8 @@ enum file_type
 	F_OTHER
 };
 
+struct title_format;
+
 struct plist_item
 {
 	char *file;
@@ -63,20 +65,27 @@ struct plist
 
 void plist_init (struct plist *plist);
 int plist_add (struct plist *plist, const char *file_name);
+int plist_add_typed (struct plist *plist, const char *file_name,
+		const enum file_type type, const time_t mtime);
 int plist_add_from_item (struct plist *plist, const struct plist_item *item);
 char *plist_get_file (const struct plist *plist, int i);
 int plist_next (struct plist *plist, int num);
 int plist_prev (struct plist *plist, int num);
 void plist_clear (struct plist *plist);
 void plist_delete (struct plist *plist, const int num);
+void plist_compact (struct plist *plist);
 void plist_free (struct plist *plist);
 void plist_sort_fname (struct plist *plist);
-int plist_find_fname (struct plist *plist, const char *file);
+int plist_find_fname (const struct plist *plist, const char *file);
 struct file_tags *tags_new ();
 void tags_clear (struct file_tags *tags);
 void tags_copy (struct file_tags *dst, const struct file_tags *src);
 struct file_tags *tags_dup (const struct file_tags *tags);
 void tags_free (struct file_tags *tags);
+struct title_format *title_format_compile (const char *fmt);
+void title_format_free (struct title_format *tf);
+int title_format_render (const struct title_format *tf,
+		const struct file_tags *tags, char *buf, const int size);
 char *build_title_with_format (const struct file_tags *tags, const char *fmt);
 char *build_title (const struct file_tags *tags);
 int plist_count (const struct plist *plist);
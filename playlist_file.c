@@ -21,6 +21,10 @@
 #include <strings.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <assert.h>
 
 #define DEBUG
@@ -46,7 +50,7 @@ int is_plist_file (const char *name)
 
 static void make_path (char *buf, size_t buf_size, const char *cwd, char *path)
 {
-	if (file_type(path) == F_URL) {
+	if (is_url (path)) {
 		strncpy (buf, path, buf_size);
 		buf[buf_size-1] = 0;
 		return;
@@ -76,15 +80,179 @@ static void strip_string (char *str)
 		*(last_non_white + 1) = 0;
 }
 
+/* An entry read from a playlist file. */
+struct plist_entry
+{
+	char *path;
+	char *title;		/* title given in the playlist file or NULL */
+	int time;		/* time given in the playlist file */
+	bool has_time;
+	struct file_tags *tags;	/* tags from a snapshot or NULL */
+	time_t tags_mtime;	/* modification time of the file when the tags
+				   were read */
+	enum file_type type;
+	time_t mtime;
+};
+
+/* Entries of a playlist file, which are added to the playlist only after
+ * they all have been read. */
+struct plist_entries
+{
+	struct plist_entry *items;
+	int num;
+	int allocated;
+};
+
+/* Do not start a thread for stat()ing less files than this. */
+#define STAT_MIN_FILES	256
+#define STAT_THREADS	8
+
+static void entries_init (struct plist_entries *entries)
+{
+	entries->items = NULL;
+	entries->num = 0;
+	entries->allocated = 0;
+}
+
+static void entries_free (struct plist_entries *entries)
+{
+	int i;
+
+	for (i = 0; i < entries->num; i++) {
+		free (entries->items[i].path);
+		free (entries->items[i].title);
+		if (entries->items[i].tags)
+			tags_free (entries->items[i].tags);
+	}
+
+	free (entries->items);
+}
+
+/* Add an entry for this path and return it. */
+static struct plist_entry *entries_add (struct plist_entries *entries,
+		const char *path)
+{
+	struct plist_entry *entry;
+
+	if (entries->num == entries->allocated) {
+		entries->allocated = entries->allocated
+			? entries->allocated * 2 : 64;
+		entries->items = (struct plist_entry *)xrealloc (entries->items,
+				entries->allocated * sizeof(struct plist_entry));
+	}
+
+	entry = &entries->items[entries->num++];
+	entry->path = xstrdup (path);
+	entry->title = NULL;
+	entry->time = -1;
+	entry->has_time = false;
+	entry->tags = NULL;
+	entry->tags_mtime = (time_t)-1;
+	entry->type = F_OTHER;
+	entry->mtime = (time_t)-1;
+
+	return entry;
+}
+
+struct stat_job
+{
+	struct plist_entry *entries;
+	int num;
+};
+
+static void *stat_thread (void *arg)
+{
+	struct stat_job *job = (struct stat_job *)arg;
+	int i;
+
+	for (i = 0; i < job->num; i++)
+		job->entries[i].type = file_type_mtime (job->entries[i].path,
+				&job->entries[i].mtime);
+
+	return NULL;
+}
+
+/* Get the type and modification time of the entries' files.  On big
+ * playlists it's done by a few threads, because stat() of each file can
+ * take long on slow file systems. */
+static void stat_entries (struct plist_entries *entries)
+{
+	struct stat_job jobs[STAT_THREADS];
+	pthread_t threads[STAT_THREADS];
+	bool started[STAT_THREADS];
+	int i, nthreads, first = 0;
+
+	nthreads = CLAMP(1, entries->num / STAT_MIN_FILES, STAT_THREADS);
+
+	for (i = 0; i < nthreads; i++) {
+		int last = (long)entries->num * (i + 1) / nthreads;
+
+		jobs[i].entries = entries->items + first;
+		jobs[i].num = last - first;
+		first = last;
+
+		started[i] = i > 0 && !pthread_create (&threads[i], NULL,
+				stat_thread, &jobs[i]);
+	}
+
+	/* The first part and parts we failed to start a thread for. */
+	for (i = 0; i < nthreads; i++)
+		if (!started[i])
+			stat_thread (&jobs[i]);
+
+	for (i = 0; i < nthreads; i++)
+		if (started[i])
+			pthread_join (threads[i], NULL);
+}
+
+/* Add the entries to the playlist skipping files which are already there.
+ * Return the number of added items. */
+static int add_entries (struct plist *plist, struct plist_entries *entries)
+{
+	int i, added = 0;
+
+	stat_entries (entries);
+
+	for (i = 0; i < entries->num; i++) {
+		struct plist_entry *entry = &entries->items[i];
+		int num;
+
+		if (plist_find_fname (plist, entry->path) != -1)
+			continue;
+
+		num = plist_add_typed (plist, entry->path, entry->type,
+				entry->mtime);
+
+		if (entry->title)
+			plist_set_title_tags (plist, num, entry->title);
+
+		/* Tags from a snapshot are valid only if the file hasn't
+		 * changed since. */
+		if (entry->tags && entry->mtime != (time_t)-1
+				&& entry->mtime == entry->tags_mtime) {
+			plist_set_tags (plist, num, entry->tags);
+		}
+		else if (entry->has_time)
+			plist_set_item_time (plist, num, entry->time);
+
+		added += 1;
+	}
+
+	return added;
+}
+
 /* Load M3U file into plist.  Return the number of items read. */
 static int plist_load_m3u (struct plist *plist, const char *fname,
 		const char *cwd, const int load_serial)
 {
 	FILE *file;
 	char *line = NULL;
-	int last_added = -1;
+	char *title = NULL;
+	int time = -1;
+	bool has_time = false;
 	int after_extinf = 0;
-	int added = 0;
+	int added;
+	struct plist_entries entries;
 	struct flock read_lock = {.l_type = F_RDLCK, .l_whence = SEEK_SET};
 
 	file = fopen (fname, "r");
@@ -97,6 +265,8 @@ static int plist_load_m3u (struct plist *plist, const char *fname,
 	if (fcntl (fileno (file), F_SETLKW, &read_lock) == -1)
 		log_errno ("Can't lock the playlist file", errno);
 
+	entries_init (&entries);
+
 	while ((line = read_line (file))) {
 		if (!strncmp (line, "#EXTINF:", sizeof("#EXTINF:") - 1)) {
 			char *comma, *num_err;
@@ -105,7 +275,6 @@ static int plist_load_m3u (struct plist *plist, const char *fname,
 
 			if (after_extinf) {
 				error ("Broken M3U file: double #EXTINF!");
-				plist_delete (plist, last_added);
 				goto err;
 			}
 
@@ -134,32 +303,30 @@ static int plist_load_m3u (struct plist *plist, const char *fname,
 			}
 
 			after_extinf = 1;
-			last_added = plist_add (plist, NULL);
-			plist_set_title_tags (plist, last_added, comma + 1);
-
-			if (*time_text)
-				plist_set_item_time (plist, last_added, time_sec);
+			title = xstrdup (comma + 1);
+			time = time_sec;
+			has_time = *time_text != 0;
 		}
 		else if (line[0] != '#') {
 			char path[2 * PATH_MAX];
 
 			strip_string (line);
 			if (strlen (line) <= PATH_MAX) {
+				struct plist_entry *entry;
+
 				make_path (path, sizeof(path), cwd, line);
 
-				if (plist_find_fname (plist, path) == -1) {
-					if (after_extinf)
-						plist_set_file (plist, last_added, path);
-					else
-						plist_add (plist, path);
-					added += 1;
+				entry = entries_add (&entries, path);
+				if (after_extinf) {
+					entry->title = title;
+					entry->time = time;
+					entry->has_time = has_time;
+					title = NULL;
 				}
-				else if (after_extinf)
-					plist_delete (plist, last_added);
 			}
-			else if (after_extinf)
-				plist_delete (plist, last_added);
 
+			free (title);
+			title = NULL;
 			after_extinf = 0;
 		}
 		else if (load_serial &&
@@ -182,10 +349,14 @@ static int plist_load_m3u (struct plist *plist, const char *fname,
 
 err:
 	free (line);
+	free (title);
 	fclose (file);
+
+	added = add_entries (plist, &entries);
+	entries_free (&entries);
+
 	return added;
 }
-
 /* Return 1 if the line contains only blank characters, 0 otherwise. */
 static int is_blank_line (const char *l)
 {
@@ -197,104 +368,91 @@ static int is_blank_line (const char *l)
 	return 1;
 }
 
-/* Read a value from the given section from .INI file.  File should be opened
- * and seeking will be performed on it.  Return the malloc()ed value or NULL
- * if not present or error occurred. */
-static char *read_ini_value (FILE *file, const char *section, const char *key)
+/* Parse a "key = value" line of an .INI file.  Terminate the key and return
+ * the value (with quotes stripped) or NULL on parse error. */
+static char *parse_ini_line (char *line)
 {
-	char *line = NULL;
-	int in_section = 0;
-	char *value = NULL;
-	int key_len;
+	char *t, *t2, *value;
 
-	if (fseek(file, 0, SEEK_SET)) {
-		error_errno ("File fseek() error", errno);
+	t2 = t = strchr (line, '=');
+	if (!t)
 		return NULL;
-	}
-
-	key_len = strlen (key);
-
-	while ((line = read_line(file))) {
-		if (line[0] == '[') {
-			if (in_section) {
-
-				/* we are outside of the interesting section */
-				free (line);
-				break;
-			}
-			else {
-				char *close = strchr (line, ']');
 
-				if (!close) {
-					error ("Parse error in the INI file");
-					free (line);
-					break;
-				}
-
-				if (!strncasecmp(line + 1, section,
-							close - line - 1))
-					in_section = 1;
-			}
-		}
-		else if (in_section && line[0] != '#' && !is_blank_line(line)) {
-			char *t, *t2;
-
-			t2 = t = strchr (line, '=');
+	/* go back to the last char in the name */
+	while (t2 >= line && (isblank(*t2) || *t2 == '='))
+		t2--;
+	if (t2 < line)
+		return NULL;
+	t2[1] = 0;
 
-			if (!t) {
-				error ("Parse error in the INI file");
-				free (line);
-				break;
-			}
+	value = t + 1;
+	while (isblank(value[0]))
+		value++;
 
-			/* go back to the last char in the name */
-			while (t2 >= t && (isblank(*t2) || *t2 == '='))
-				t2--;
+	if (value[0] == '"') {
+		char *q = strchr (value + 1, '"');
 
-			if (t2 == t) {
-				error ("Parse error in the INI file");
-				free (line);
-				break;
-			}
+		if (!q)
+			return NULL;
+		*q = 0;
+	}
 
-			if (!strncasecmp(line, key,
-						MAX(t2 - line + 1, key_len))) {
-				value = t + 1;
+	return value;
+}
 
-				while (isblank(value[0]))
-					value++;
+/* If the key is prefix followed by a number, return the number, otherwise
+ * return 0. */
+static long pls_key_index (const char *key, const char *prefix)
+{
+	size_t len = strlen (prefix);
+	char *e;
+	long i;
 
-				if (value[0] == '"') {
-					char *q = strchr (value + 1, '"');
+	if (strncasecmp (key, prefix, len) || !isdigit (key[len]))
+		return 0;
 
-					if (!q) {
-						error ("Parse error in the INI file");
-						free (line);
-						break;
-					}
+	i = strtol (key + len, &e, 10);
+	if (*e)
+		return 0;
 
-					*q = 0;
-				}
+	return i;
+}
 
-				value = xstrdup (value);
-				free (line);
-				break;
-			}
-		}
+/* Make room for the PLS entry number i. */
+static void pls_grow (struct plist_entries *entries, char ***files,
+		char ***titles, char ***lengths, long i)
+{
+	long n = entries->allocated;
 
-		free (line);
-	}
+	if (i <= n)
+		return;
 
-	return value;
+	entries->allocated = MAX(i, n ? n * 2 : 64);
+	*files = (char **)xrealloc (*files,
+			entries->allocated * sizeof(char *));
+	*titles = (char **)xrealloc (*titles,
+			entries->allocated * sizeof(char *));
+	*lengths = (char **)xrealloc (*lengths,
+			entries->allocated * sizeof(char *));
+	memset (*files + n, 0, (entries->allocated - n) * sizeof(char *));
+	memset (*titles + n, 0, (entries->allocated - n) * sizeof(char *));
+	memset (*lengths + n, 0, (entries->allocated - n) * sizeof(char *));
 }
 
-/* Load PLS file into plist. Return the number of items read. */
+/* Load PLS file into plist. Return the number of items read.  The
+ * [playlist] section is read in one pass; File<n>, Title<n> and Length<n>
+ * keys are collected by their number. */
 static int plist_load_pls (struct plist *plist, const char *fname,
 		const char *cwd)
 {
 	FILE *file;
-	char *e, *line = NULL;
-	long i, nitems, added = 0;
+	char *line;
+	char *nitems_str = NULL;
+	char **files = NULL, **titles = NULL, **lengths = NULL;
+	struct plist_entries slots, entries;
+	int in_section = 0;
+	long i, nitems, keys = 0;
+	int added = 0;
 
 	file = fopen (fname, "r");
 	if (!file) {
@@ -302,74 +460,115 @@ static int plist_load_pls (struct plist *plist, const char *fname,
 		return 0;
 	}
 
-	line = read_ini_value (file, "playlist", "NumberOfEntries");
-	if (!line) {
+	entries_init (&slots);
+	entries_init (&entries);
+
+	while ((line = read_line (file))) {
+		if (line[0] == '[') {
+			char *close = strchr (line, ']');
+
+			if (in_section || !close) {
+				if (!close)
+					error ("Parse error in the INI file");
+				free (line);
+				break;
+			}
+
+			if (!strncasecmp (line + 1, "playlist", close - line - 1))
+				in_section = 1;
+		}
+		else if (in_section && line[0] != '#' && !is_blank_line (line)) {
+			char *value = parse_ini_line (line);
+			char ***slot = NULL;
+
+			if (!value) {
+				error ("Parse error in the INI file");
+				free (line);
+				break;
+			}
+
+			if (!strcasecmp (line, "NumberOfEntries")) {
+				if (!nitems_str)
+					nitems_str = xstrdup (value);
+			}
+			else if ((i = pls_key_index (line, "File")))
+				slot = &files;
+			else if ((i = pls_key_index (line, "Title")))
+				slot = &titles;
+			else if ((i = pls_key_index (line, "Length")))
+				slot = &lengths;
+
+			/* The first value of a key counts. */
+			if (slot && i > 0 && i <= INT_MAX / 2) {
+				pls_grow (&slots, &files, &titles, &lengths, i);
+				if (!(*slot)[i - 1])
+					(*slot)[i - 1] = xstrdup (value);
+				keys++;
+			}
+		}
+
+		free (line);
+	}
+
+	fclose (file);
+
+	if (!nitems_str) {
 
 		/* Assume that it is a pls file version 1 - plist_load_m3u()
 		 * should handle it like an m3u file without the m3u extensions. */
-		fclose (file);
-		return plist_load_m3u (plist, fname, cwd, 0);
+		added = plist_load_m3u (plist, fname, cwd, 0);
+		goto end;
 	}
 
-	nitems = strtol (line, &e, 10);
-	if (*e) {
+	nitems = strtol (nitems_str, &line, 10);
+	if (*line) {
 		error ("Broken PLS file");
-		goto err;
+		goto end;
 	}
 
 	for (i = 1; i <= nitems; i++) {
-		int time, last_added;
-		char *pls_file, *pls_title, *pls_length;
-		char key[32], path[2 * PATH_MAX];
+		struct plist_entry *entry;
+		char *e, path[2 * PATH_MAX];
+		int time = -1;
 
-		sprintf (key, "File%ld", i);
-		pls_file = read_ini_value (file, "playlist", key);
-		if (!pls_file) {
+		if (i > keys || i > slots.allocated || !files[i - 1]) {
 			error ("Broken PLS file");
-			goto err;
+			break;
 		}
 
-		sprintf (key, "Title%ld", i);
-		pls_title = read_ini_value (file, "playlist", key);
-
-		sprintf (key, "Length%ld", i);
-		pls_length = read_ini_value (file, "playlist", key);
-
-		if (pls_length) {
-			time = strtol (pls_length, &e, 10);
+		if (lengths[i - 1]) {
+			time = strtol (lengths[i - 1], &e, 10);
 			if (*e)
 				time = -1;
 		}
-		else
-			time = -1;
-
-		if (strlen (pls_file) <= PATH_MAX) {
-			make_path (path, sizeof(path), cwd, pls_file);
-			if (plist_find_fname (plist, path) == -1) {
-				last_added = plist_add (plist, path);
 
-				if (pls_title && pls_title[0])
-					plist_set_title_tags (plist, last_added, pls_title);
+		if (strlen (files[i - 1]) <= PATH_MAX) {
+			make_path (path, sizeof(path), cwd, files[i - 1]);
 
-				if (time > 0) {
-					plist->items[last_added].tags = tags_new ();
-					plist->items[last_added].tags->time = time;
-					plist->items[last_added].tags->filled |= TAGS_TIME;
-				}
+			entry = entries_add (&entries, path);
+			if (titles[i - 1] && titles[i - 1][0])
+				entry->title = xstrdup (titles[i - 1]);
+			if (time > 0) {
+				entry->time = time;
+				entry->has_time = true;
 			}
 		}
+	}
 
-		free (pls_file);
-		if (pls_title)
-			free (pls_title);
-		if (pls_length)
-			free (pls_length);
-		added += 1;
+	added = add_entries (plist, &entries);
+
+end:
+	for (i = 0; i < slots.allocated; i++) {
+		free (files[i]);
+		free (titles[i]);
+		free (lengths[i]);
 	}
+	free (files);
+	free (titles);
+	free (lengths);
+	free (nitems_str);
+	entries_free (&entries);
 
-err:
-	free (line);
-	fclose (file);
 	return added;
 }
 
@@ -465,3 +664,289 @@ err:
 		fclose (file);
 	return result;
 }
+
+/* Snapshot of a playlist: the items with their tags in a binary form which
+ * can be loaded without parsing the playlist file and reading the tags
+ * again.  It's valid only for the path and the version of the playlist
+ * file it was made from. */
+#define SNAPSHOT_MAGIC		"MOCPLSNP"
+#define SNAPSHOT_VERSION	2
+#define SNAPSHOT_BYTE_ORDER	0x01020304
+
+static int snap_write (FILE *file, const void *data, const size_t size)
+{
+	return fwrite (data, size, 1, file) == 1;
+}
+
+static int snap_write_int (FILE *file, const int32_t val)
+{
+	return snap_write (file, &val, sizeof(val));
+}
+
+static int snap_write_time (FILE *file, const time_t t)
+{
+	int64_t val = t;
+
+	return snap_write (file, &val, sizeof(val));
+}
+
+static int snap_write_str (FILE *file, const char *str)
+{
+	int32_t len = str ? (int32_t)strlen (str) : -1;
+
+	return snap_write_int (file, len)
+		&& (len <= 0 || snap_write (file, str, len));
+}
+
+static int snap_read (FILE *file, void *data, const size_t size)
+{
+	return fread (data, size, 1, file) == 1;
+}
+
+static int snap_read_int (FILE *file, int *val)
+{
+	int32_t v;
+
+	if (!snap_read (file, &v, sizeof(v)))
+		return 0;
+	*val = v;
+	return 1;
+}
+
+static int snap_read_time (FILE *file, time_t *t)
+{
+	int64_t val;
+
+	if (!snap_read (file, &val, sizeof(val)))
+		return 0;
+	*t = (time_t)val;
+	return 1;
+}
+
+/* Read a string, NULL is a valid value. */
+static int snap_read_str (FILE *file, char **str)
+{
+	int len;
+
+	*str = NULL;
+	if (!snap_read_int (file, &len) || len < -1 || len > 4 * PATH_MAX)
+		return 0;
+	if (len == -1)
+		return 1;
+
+	*str = (char *)xmalloc (len + 1);
+	if (len && !snap_read (file, *str, len)) {
+		free (*str);
+		*str = NULL;
+		return 0;
+	}
+	(*str)[len] = 0;
+
+	return 1;
+}
+
+/* Get the modification time and size of the playlist file the snapshot is
+ * made from. */
+static int snap_plist_stat (const char *plist_fname, time_t *mtime,
+		int64_t *size)
+{
+	struct stat st;
+
+	if (stat (plist_fname, &st) == -1)
+		return 0;
+
+	*mtime = st.st_mtime;
+	*size = st.st_size;
+
+	return 1;
+}
+
+/* Save the snapshot of the playlist made after saving it to plist_fname.
+ * Return 1 if OK. */
+int plist_save_snapshot (const struct plist *plist, const char *fname,
+		const char *plist_fname)
+{
+	FILE *file;
+	int i, ok;
+	time_t plist_mtime;
+	int64_t plist_size;
+
+	assert (plist != NULL);
+	assert (fname != NULL);
+	assert (plist_fname != NULL);
+
+	if (!snap_plist_stat (plist_fname, &plist_mtime, &plist_size)) {
+		log_errno ("Can't stat the playlist file", errno);
+		return 0;
+	}
+
+	file = fopen (fname, "wb");
+	if (!file) {
+		error_errno ("Can't save playlist snapshot", errno);
+		return 0;
+	}
+
+	ok = snap_write (file, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC) - 1)
+		&& snap_write_int (file, SNAPSHOT_VERSION)
+		&& snap_write_int (file, SNAPSHOT_BYTE_ORDER)
+		&& snap_write_time (file, plist_mtime)
+		&& snap_write (file, &plist_size, sizeof(plist_size))
+		&& snap_write_str (file, plist_fname)
+		&& snap_write_int (file, plist_get_serial (plist))
+		&& snap_write_int (file, plist_count (plist));
+
+	for (i = 0; ok && i < plist->num; i++) {
+		const struct plist_item *item = &plist->items[i];
+
+		if (plist_deleted (plist, i))
+			continue;
+
+		ok = snap_write_str (file, item->file)
+			&& snap_write_str (file, item->title_tags)
+			&& snap_write_time (file, item->mtime)
+			&& snap_write_int (file, item->tags != NULL);
+
+		if (ok && item->tags)
+			ok = snap_write_str (file, item->tags->title)
+				&& snap_write_str (file, item->tags->artist)
+				&& snap_write_str (file, item->tags->album)
+				&& snap_write_int (file, item->tags->track)
+				&& snap_write_int (file, item->tags->time)
+				&& snap_write_int (file, item->tags->filled);
+	}
+
+	if (fclose (file))
+		ok = 0;
+
+	if (!ok) {
+		error_errno ("Error writing playlist snapshot", errno);
+		unlink (fname);
+	}
+
+	return ok;
+}
+
+/* Read the snapshot items into entries.  Return 1 if OK. */
+static int snap_read_entries (FILE *file, struct plist_entries *entries,
+		const int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		struct plist_entry *entry;
+		char *path, *title;
+		time_t mtime;
+		int has_tags;
+
+		if (!snap_read_str (file, &path))
+			return 0;
+		if (!path)
+			return 0;
+
+		entry = entries_add (entries, path);
+		free (path);
+
+		if (!snap_read_str (file, &title)
+				|| !snap_read_time (file, &mtime)
+				|| !snap_read_int (file, &has_tags))
+			return 0;
+
+		entry->title = title;
+		entry->tags_mtime = mtime;
+
+		if (has_tags) {
+			struct file_tags *tags = tags_new ();
+
+			entry->tags = tags;
+			if (!snap_read_str (file, &tags->title)
+					|| !snap_read_str (file, &tags->artist)
+					|| !snap_read_str (file, &tags->album)
+					|| !snap_read_int (file, &tags->track)
+					|| !snap_read_int (file, &tags->time)
+					|| !snap_read_int (file, &tags->filled))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Load the playlist from the snapshot made for plist_fname.  Return the
+ * number of items read or -1 if there is no valid snapshot for the current
+ * version of the playlist file. */
+int plist_load_snapshot (struct plist *plist, const char *fname,
+		const char *plist_fname, const int load_serial)
+{
+	FILE *file;
+	char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+	int version, byte_order, serial, count, num = -1;
+	time_t plist_mtime, snap_mtime;
+	int64_t plist_size, snap_size;
+	char *snap_fname = NULL;
+	struct plist_entries entries;
+
+	assert (plist != NULL);
+	assert (fname != NULL);
+	assert (plist_fname != NULL);
+
+	if (!snap_plist_stat (plist_fname, &plist_mtime, &plist_size))
+		return -1;
+
+	file = fopen (fname, "rb");
+	if (!file)
+		return -1;
+
+	if (!snap_read (file, magic, sizeof(magic))
+			|| memcmp (magic, SNAPSHOT_MAGIC, sizeof(magic))
+			|| !snap_read_int (file, &version)
+			|| version != SNAPSHOT_VERSION
+			|| !snap_read_int (file, &byte_order)
+			|| byte_order != SNAPSHOT_BYTE_ORDER
+			|| !snap_read_time (file, &snap_mtime)
+			|| !snap_read (file, &snap_size, sizeof(snap_size))
+			|| !snap_read_str (file, &snap_fname)
+			|| !snap_fname
+			|| !snap_read_int (file, &serial)
+			|| !snap_read_int (file, &count)
+			|| count < 0) {
+		logit ("Playlist snapshot is broken or in a different format");
+		free (snap_fname);
+		fclose (file);
+		return -1;
+	}
+
+	if (strcmp (snap_fname, plist_fname)) {
+		logit ("Playlist snapshot is made for another playlist");
+		free (snap_fname);
+		fclose (file);
+		return -1;
+	}
+	free (snap_fname);
+
+	if (snap_mtime != plist_mtime || snap_size != plist_size) {
+		logit ("Playlist snapshot is out of date");
+		fclose (file);
+		return -1;
+	}
+
+	entries_init (&entries);
+
+	if (snap_read_entries (file, &entries, count)) {
+		if (load_serial)
+			plist_set_serial (plist, serial);
+
+		num = add_entries (plist, &entries);
+
+		if (options_get_bool ("ReadTags"))
+			switch_titles_tags (plist);
+		else
+			switch_titles_file (plist);
+	}
+	else
+		logit ("Playlist snapshot is truncated");
+
+	entries_free (&entries);
+	fclose (file);
+
+	return num;
+}
@@ -9,6 +9,10 @@ int plist_load (struct plist *plist, const char *fname, const char *cwd,
 		const int load_serial);
 int plist_save (struct plist *plist, const char *file, const int save_serial);
 int is_plist_file (const char *name);
+int plist_save_snapshot (const struct plist *plist, const char *fname,
+		const char *plist_fname);
+int plist_load_snapshot (struct plist *plist, const char *fname,
+		const char *plist_fname, const int load_serial);
 
 #ifdef __cplusplus
 }
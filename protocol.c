@@ -18,10 +18,12 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <time.h>
 #include <assert.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "log.h"
@@ -31,7 +33,7 @@
 
 /* Maximal socket name. */
 #define UNIX_PATH_MAX	108
-#define SOCKET_NAME	"socket2"
+#define SOCKET_NAME	"socket3"
 
 #define nonblocking(fn, result, sock, buf, len) \
 	do { \
@@ -59,6 +61,197 @@ struct packet_buf
 	size_t len;
 };
 
+/* Size of the input and output buffers of a socket. */
+#define SOCK_BUF_SIZE	(64 * 1024)
+
+/* Buffers of a socket.  Protocol values are small, so reading or writing
+ * them one by one would cost a system call each.  Input is read in bigger
+ * chunks; output is collected while batching (see sock_buf_batch()). */
+struct sock_buf
+{
+	char in[SOCK_BUF_SIZE];
+	size_t in_pos;		/* position of unread data */
+	size_t in_len;		/* end of data read from the socket */
+	char out[SOCK_BUF_SIZE];
+	size_t out_len;
+	int batch;		/* are we batching the output? */
+};
+
+/* Buffers of sockets indexed by the descriptor, NULL if not buffered. */
+static struct sock_buf *sock_bufs[FD_SETSIZE];
+
+static struct sock_buf *get_sock_buf (const int sock)
+{
+	if (sock < 0 || sock >= FD_SETSIZE)
+		return NULL;
+	return sock_bufs[sock];
+}
+
+/* Send data to the socket. Return 0 on error. */
+static int send_all (int sock, const char *buf, const size_t size)
+{
+	ssize_t sent;
+	size_t send_pos = 0;
+
+	while (send_pos < size) {
+		sent = send (sock, buf + send_pos, size - send_pos, 0);
+		if (sent < 0) {
+			log_errno ("Error while sending data", errno);
+			return 0;
+		}
+		send_pos += sent;
+	}
+
+	return 1;
+}
+
+/* Send the output collected in the buffer.  Return 0 on error. */
+static int sock_buf_send (int sock, struct sock_buf *b)
+{
+	int res = 1;
+
+	if (b->out_len)
+		res = send_all (sock, b->out, b->out_len);
+	b->out_len = 0;
+
+	return res;
+}
+
+/* Write data to the socket or to its buffer if we are batching.  Return 0
+ * on error. */
+static int sock_write (int sock, const void *data, const size_t len)
+{
+	struct sock_buf *b = get_sock_buf (sock);
+
+	if (!b || !b->batch)
+		return send_all (sock, data, len);
+
+	if (b->out_len + len > sizeof(b->out)) {
+		if (!sock_buf_send(sock, b))
+			return 0;
+		if (len > sizeof(b->out))
+			return send_all (sock, data, len);
+	}
+
+	memcpy (b->out + b->out_len, data, len);
+	b->out_len += len;
+
+	return 1;
+}
+
+/* Read exactly len bytes from the socket.  Return 0 on error or EOF. */
+static int sock_read (int sock, void *data, size_t len)
+{
+	struct sock_buf *b = get_sock_buf (sock);
+	char *dst = (char *)data;
+
+	/* The peer may be waiting for what we have to send before it
+	 * responds. */
+	if (b && !sock_buf_send(sock, b))
+		return 0;
+
+	while (len) {
+		ssize_t res;
+
+		if (b && b->in_pos < b->in_len) {
+			size_t n = MIN(len, b->in_len - b->in_pos);
+
+			memcpy (dst, b->in + b->in_pos, n);
+			b->in_pos += n;
+			dst += n;
+			len -= n;
+			continue;
+		}
+
+		if (b && len < sizeof(b->in)) {
+			res = recv (sock, b->in, sizeof(b->in), 0);
+			if (res > 0) {
+				b->in_pos = 0;
+				b->in_len = res;
+			}
+		}
+		else {
+			res = recv (sock, dst, len, 0);
+			if (res > 0) {
+				dst += res;
+				len -= res;
+			}
+		}
+
+		if (res == -1) {
+			log_errno ("recv() failed", errno);
+			return 0;
+		}
+		if (res == 0) {
+			logit ("Unexpected EOF");
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Enable buffered I/O on the socket. */
+void sock_buf_open (int sock)
+{
+	assert (LIMIT(sock, FD_SETSIZE));
+	assert (sock_bufs[sock] == NULL);
+
+	sock_bufs[sock] = (struct sock_buf *)xmalloc (sizeof(struct sock_buf));
+	sock_bufs[sock]->in_pos = 0;
+	sock_bufs[sock]->in_len = 0;
+	sock_bufs[sock]->out_len = 0;
+	sock_bufs[sock]->batch = 0;
+}
+
+/* Disable buffering discarding buffered data.  Must be called before the
+ * socket is closed, so the descriptor can be reused. */
+void sock_buf_close (int sock)
+{
+	struct sock_buf *b = get_sock_buf (sock);
+
+	if (b) {
+		free (b);
+		sock_bufs[sock] = NULL;
+	}
+}
+
+/* Return the number of bytes read from the socket but not consumed yet.
+ * select() doesn't see them, so the caller must check it. */
+size_t sock_buf_pending (int sock)
+{
+	struct sock_buf *b = get_sock_buf (sock);
+
+	return b ? b->in_len - b->in_pos : 0;
+}
+
+/* Start collecting the output to the socket to send it at once by
+ * sock_buf_flush().  Reading from the socket flushes the output. */
+void sock_buf_batch (int sock)
+{
+	struct sock_buf *b = get_sock_buf (sock);
+
+	if (b)
+		b->batch++;
+}
+
+/* End batching started by sock_buf_batch() and send the output.  Return 0
+ * on error. */
+int sock_buf_flush (int sock)
+{
+	struct sock_buf *b = get_sock_buf (sock);
+
+	if (!b)
+		return 1;
+
+	assert (b->batch > 0);
+
+	if (--b->batch)
+		return 1;
+
+	return sock_buf_send (sock, b);
+}
+
 /* Create a socket name, return NULL if the name could not be created. */
 char *socket_name ()
 {
@@ -73,13 +266,7 @@ char *socket_name ()
 /* Get an integer value from the socket, return == 0 on error. */
 int get_int (int sock, int *i)
 {
-	ssize_t res;
-
-	res = recv (sock, i, sizeof(int), 0);
-	if (res == -1)
-		log_errno ("recv() failed when getting int", errno);
-
-	return res == ssizeof(int) ? 1 : 0;
+	return sock_read (sock, i, sizeof(int));
 }
 
 /* Get an integer value from the socket without blocking. */
@@ -87,11 +274,40 @@ enum noblock_io_status get_int_noblock (int sock, int *i)
 {
 	ssize_t res;
 	char *err;
+	struct sock_buf *b = get_sock_buf (sock);
+
+	if (!b) {
+		nonblocking (recv, res, sock, i, sizeof (int));
+		if (res == ssizeof (int))
+			return NB_IO_OK;
+	}
+	else {
+		if (!sock_buf_send(sock, b))
+			return NB_IO_ERR;
+
+		/* Keep a partially received value at the beginning. */
+		res = 1;
+		if (b->in_len - b->in_pos < sizeof(int)) {
+			memmove (b->in, b->in + b->in_pos,
+					b->in_len - b->in_pos);
+			b->in_len -= b->in_pos;
+			b->in_pos = 0;
+
+			nonblocking (recv, res, sock, b->in + b->in_len,
+					sizeof(b->in) - b->in_len);
+			if (res > 0)
+				b->in_len += res;
+		}
 
-	nonblocking (recv, res, sock, i, sizeof (int));
+		if (b->in_len - b->in_pos >= sizeof(int)) {
+			memcpy (i, b->in + b->in_pos, sizeof(int));
+			b->in_pos += sizeof(int);
+			return NB_IO_OK;
+		}
+		if (res > 0)
+			return NB_IO_BLOCK;
+	}
 
-	if (res == ssizeof (int))
-		return NB_IO_OK;
 	if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
 		return NB_IO_BLOCK;
 
@@ -105,13 +321,7 @@ enum noblock_io_status get_int_noblock (int sock, int *i)
 /* Send an integer value to the socket, return == 0 on error */
 int send_int (int sock, int i)
 {
-	ssize_t res;
-
-	res = send (sock, &i, sizeof(int), 0);
-	if (res == -1)
-		log_errno ("send() failed", errno);
-
-	return res == ssizeof(int) ? 1 : 0;
+	return sock_write (sock, &i, sizeof(int));
 }
 
 #if 0
@@ -145,7 +355,7 @@ static int send_long (int sock, long i)
 /* Get the string from socket, return NULL on error. The memory is malloced. */
 char *get_str (int sock)
 {
-	int len, nread = 0;
+	int len;
 	char *str;
 
 	if (!get_int(sock, &len))
@@ -157,21 +367,10 @@ char *get_str (int sock)
 	}
 
 	str = (char *)xmalloc (sizeof(char) * (len + 1));
-	while (nread < len) {
-		ssize_t res;
-
-		res = recv (sock, str + nread, len - nread, 0);
-		if (res == -1) {
-			log_errno ("recv() failed when getting string", errno);
-			free (str);
-			return NULL;
-		}
-		if (res == 0) {
-			logit ("Unexpected EOF when getting string");
-			free (str);
-			return NULL;
-		}
-		nread += res;
+	if (!sock_read(sock, str, len)) {
+		logit ("Error when getting string");
+		free (str);
+		return NULL;
 	}
 	str[len] = 0;
 
@@ -186,34 +385,19 @@ int send_str (int sock, const char *str)
 	if (!send_int (sock, len))
 		return 0;
 
-	if (send (sock, str, len, 0) != len)
-		return 0;
-
-	return 1;
+	return sock_write (sock, str, len);
 }
 
 /* Get a time_t value from the socket, return == 0 on error. */
 int get_time (int sock, time_t *i)
 {
-	ssize_t res;
-
-	res = recv (sock, i, sizeof(time_t), 0);
-	if (res == -1)
-		log_errno ("recv() failed when getting time_t", errno);
-
-	return res == ssizeof(time_t) ? 1 : 0;
+	return sock_read (sock, i, sizeof(time_t));
 }
 
 /* Send a time_t value to the socket, return == 0 on error */
 int send_time (int sock, time_t i)
 {
-	ssize_t res;
-
-	res = send (sock, &i, sizeof(time_t), 0);
-	if (res == -1)
-		log_errno ("send() failed", errno);
-
-	return res == ssizeof(time_t) ? 1 : 0;
+	return sock_write (sock, &i, sizeof(time_t));
 }
 
 static struct packet_buf *packet_buf_new ()
@@ -317,24 +501,6 @@ void packet_buf_add_item (struct packet_buf *b, const struct plist_item *item)
 	packet_buf_add_time (b, item->mtime);
 }
 
-/* Send data to the socket. Return 0 on error. */
-static int send_all (int sock, const char *buf, const size_t size)
-{
-	ssize_t sent;
-	size_t send_pos = 0;
-
-	while (send_pos < size) {
-		sent = send (sock, buf + send_pos, size - send_pos, 0);
-		if (sent < 0) {
-			log_errno ("Error while sending data", errno);
-			return 0;
-		}
-		send_pos += sent;
-	}
-
-	return 1;
-}
-
 /* Send a playlist item to the socket. If item == NULL, send empty item mark
  * (end of playlist). Return 0 on error. */
 int send_item (int sock, const struct plist_item *item)
@@ -352,7 +518,7 @@ int send_item (int sock, const struct plist_item *item)
 
 	b = packet_buf_new ();
 	packet_buf_add_item (b, item);
-	if (!send_all(sock, b->buf, b->len)) {
+	if (!sock_write(sock, b->buf, b->len)) {
 		logit ("Error when sending item");
 		res = 0;
 	}
@@ -427,7 +593,7 @@ int send_tags (int sock, const struct file_tags *tags)
 	b = packet_buf_new ();
 	packet_buf_add_tags (b, tags);
 
-	if (!send_all(sock, b->buf, b->len))
+	if (!sock_write(sock, b->buf, b->len))
 		res = 0;
 
 	packet_buf_free (b);
@@ -486,6 +652,227 @@ struct plist_item *recv_item (int sock)
 	return item;
 }
 
+/* Add tags to the buffer in the compact form used for whole playlists:
+ * nothing but a flag if there are no tags. */
+static void packet_buf_add_opt_tags (struct packet_buf *b,
+		const struct file_tags *tags)
+{
+	packet_buf_add_int (b, tags ? 1 : 0);
+	if (tags)
+		packet_buf_add_tags (b, tags);
+}
+
+/* Return the length of the common prefix of the strings. */
+static int common_prefix (const char *a, const char *b)
+{
+	int len = 0;
+
+	while (a[len] && a[len] == b[len])
+		len++;
+
+	return len;
+}
+
+/* Send the whole playlist in one packet: its length, the number of items
+ * and the items.  Consecutive items usually share a long directory part,
+ * so a file name is sent as the length of its common prefix with the
+ * previous one and the rest of it.  Return 0 on error. */
+int send_plist (int sock, const struct plist *plist)
+{
+	struct packet_buf *b;
+	const char *prev = "";
+	int i, len, res = 1;
+
+	assert (plist != NULL);
+
+	b = packet_buf_new ();
+	packet_buf_add_int (b, 0); /* the length, filled below */
+	packet_buf_add_int (b, plist_count (plist));
+
+	for (i = 0; i < plist->num; i++) {
+		const struct plist_item *item = &plist->items[i];
+		int prefix;
+
+		if (plist_deleted (plist, i))
+			continue;
+
+		prefix = common_prefix (prev, item->file);
+		packet_buf_add_int (b, prefix);
+		packet_buf_add_str (b, item->file + prefix);
+		packet_buf_add_int (b, item->type);
+		packet_buf_add_str (b, item->title_tags ? item->title_tags : "");
+		packet_buf_add_opt_tags (b, item->tags);
+		packet_buf_add_time (b, item->mtime);
+
+		prev = item->file;
+	}
+
+	len = b->len - sizeof(int);
+	memcpy (b->buf, &len, sizeof(len));
+
+	if (!sock_write(sock, b->buf, b->len)) {
+		logit ("Error when sending the playlist");
+		res = 0;
+	}
+
+	packet_buf_free (b);
+	return res;
+}
+
+/* Reader of a packet received as a whole. */
+struct packet_reader
+{
+	const char *buf;
+	size_t len;
+	size_t pos;
+	int error;
+};
+
+static void packet_read (struct packet_reader *r, void *data,
+		const size_t len)
+{
+	if (r->error || r->len - r->pos < len) {
+		r->error = 1;
+		memset (data, 0, len);
+		return;
+	}
+
+	memcpy (data, r->buf + r->pos, len);
+	r->pos += len;
+}
+
+static int packet_read_int (struct packet_reader *r)
+{
+	int n;
+
+	packet_read (r, &n, sizeof(n));
+	return n;
+}
+
+/* Read a string appending it to the first prefix_len characters of prefix.
+ * Return the malloc()ed string or NULL on error. */
+static char *packet_read_str (struct packet_reader *r, const char *prefix,
+		const int prefix_len)
+{
+	int len = packet_read_int (r);
+	char *str;
+
+	if (r->error || !RANGE(0, len, MAX_SEND_STRING)
+			|| r->len - r->pos < (size_t)len) {
+		r->error = 1;
+		return NULL;
+	}
+
+	str = (char *)xmalloc (prefix_len + len + 1);
+	memcpy (str, prefix, prefix_len);
+	memcpy (str + prefix_len, r->buf + r->pos, len);
+	str[prefix_len + len] = 0;
+	r->pos += len;
+
+	return str;
+}
+
+/* Read a tag string, empty strings are NULL. */
+static char *packet_read_tag (struct packet_reader *r)
+{
+	char *str = packet_read_str (r, "", 0);
+
+	if (str && !str[0]) {
+		free (str);
+		str = NULL;
+	}
+
+	return str;
+}
+
+static struct file_tags *packet_read_opt_tags (struct packet_reader *r)
+{
+	struct file_tags *tags;
+
+	if (!packet_read_int (r))
+		return NULL;
+
+	tags = tags_new ();
+	tags->title = packet_read_tag (r);
+	tags->artist = packet_read_tag (r);
+	tags->album = packet_read_tag (r);
+	tags->track = packet_read_int (r);
+	tags->time = packet_read_int (r);
+	tags->filled = packet_read_int (r);
+
+	return tags;
+}
+
+/* Receive the playlist sent by send_plist() and add its items to plist.
+ * Return 0 on error. */
+int recv_plist (int sock, struct plist *plist)
+{
+	struct packet_reader r;
+	char *buf, *prev = NULL;
+	int len, count, i;
+
+	assert (plist != NULL);
+
+	if (!get_int(sock, &len) || len < (int)sizeof(int)) {
+		logit ("Error while receiving the playlist length");
+		return 0;
+	}
+
+	buf = (char *)xmalloc (len);
+	if (!sock_read(sock, buf, len)) {
+		logit ("Error while receiving the playlist");
+		free (buf);
+		return 0;
+	}
+
+	r.buf = buf;
+	r.len = len;
+	r.pos = 0;
+	r.error = 0;
+
+	count = packet_read_int (&r);
+	for (i = 0; i < count && !r.error; i++) {
+		int prefix, type, num;
+		char *file, *title;
+		struct file_tags *tags;
+		time_t mtime;
+
+		prefix = packet_read_int (&r);
+		if (!RANGE(0, prefix, prev ? (int)strlen (prev) : 0)) {
+			r.error = 1;
+			break;
+		}
+
+		file = packet_read_str (&r, prev ? prev : "", prefix);
+		type = packet_read_int (&r);
+		title = packet_read_tag (&r);
+		tags = packet_read_opt_tags (&r);
+		packet_read (&r, &mtime, sizeof(mtime));
+
+		if (!r.error && file[0]) {
+			num = plist_add_typed (plist, file, type, mtime);
+			if (title)
+				plist_set_title_tags (plist, num, title);
+			if (tags)
+				plist_set_tags (plist, num, tags);
+		}
+
+		free (prev);
+		prev = file;
+		free (title);
+		if (tags)
+			tags_free (tags);
+	}
+
+	free (prev);
+	free (buf);
+
+	if (r.error)
+		logit ("Broken playlist received");
+
+	return !r.error;
+}
+
 struct move_ev_data *recv_move_ev_data (int sock)
 {
 	struct move_ev_data *d;
@@ -508,32 +895,112 @@ struct move_ev_data *recv_move_ev_data (int sock)
 	return d;
 }
 
-/* Push an event on the queue if it's not already there. */
-void event_push (struct event_queue *q, const int event, void *data)
+/* Data of an event queued for many clients.  It's copied once and freed
+ * when the last queue drops it. */
+struct event_shared
 {
+	int type;
+	void *data;
+	int refs;
+};
+
+/* Queues of different clients are locked separately, so the reference
+ * counts need their own lock. */
+static pthread_mutex_t event_shared_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static void event_append (struct event_queue *q, const int event, void *data,
+		struct event_shared *shared)
+{
+	struct event *e;
+
 	assert (q != NULL);
 
+	e = (struct event *)xmalloc (sizeof(struct event));
+	e->next = NULL;
+	e->type = event;
+	e->data = data;
+	e->shared = shared;
+
 	if (!q->head) {
-		q->head = (struct event *)xmalloc (sizeof(struct event));
-		q->head->next = NULL;
-		q->head->type = event;
-		q->head->data = data;
-		q->tail = q->head;
+		q->head = e;
+		q->tail = e;
 	}
 	else {
-		assert (q->head != NULL);
 		assert (q->tail != NULL);
 		assert (q->tail->next == NULL);
 
-		q->tail->next = (struct event *)xmalloc (
-				sizeof(struct event));
-		q->tail = q->tail->next;
-		q->tail->next = NULL;
-		q->tail->type = event;
-		q->tail->data = data;
+		q->tail->next = e;
+		q->tail = e;
 	}
 }
 
+/* Push an event on the queue. */
+void event_push (struct event_queue *q, const int event, void *data)
+{
+	event_append (q, event, data, NULL);
+}
+
+/* Wrap the data of an event to be pushed on many queues by
+ * event_push_shared().  The caller owns one reference. */
+struct event_shared *event_shared_new (const int event, void *data)
+{
+	struct event_shared *s;
+
+	assert (data != NULL);
+
+	s = (struct event_shared *)xmalloc (sizeof(struct event_shared));
+	s->type = event;
+	s->data = data;
+	s->refs = 1;
+
+	return s;
+}
+
+/* Drop a reference to the shared data freeing them if it was the last. */
+void event_shared_unref (struct event_shared *s)
+{
+	int refs;
+
+	assert (s != NULL);
+
+	LOCK (event_shared_mtx);
+	refs = --s->refs;
+	UNLOCK (event_shared_mtx);
+
+	if (refs == 0) {
+		free_event_data (s->type, s->data);
+		free (s);
+	}
+}
+
+/* Push an event with shared data (or without data if s is NULL) on the
+ * queue. */
+void event_push_shared (struct event_queue *q, const int event,
+		struct event_shared *s)
+{
+	if (!s) {
+		event_append (q, event, NULL, NULL);
+		return;
+	}
+
+	assert (s->type == event);
+
+	LOCK (event_shared_mtx);
+	s->refs++;
+	UNLOCK (event_shared_mtx);
+
+	event_append (q, event, s->data, s);
+}
+
+/* Free the data of the event or drop its reference to shared data. */
+static void event_free_data (struct event *e)
+{
+	if (e->shared)
+		event_shared_unref (e->shared);
+	else
+		free_event_data (e->type, e->data);
+}
+
 /* Remove the first event from the queue (don't free the data field). */
 void event_pop (struct event_queue *q)
 {
@@ -621,7 +1088,7 @@ void event_queue_free (struct event_queue *q)
 	assert (q != NULL);
 
 	while ((e = event_get_first(q))) {
-		free_event_data (e->type, e->data);
+		event_free_data (e);
 		event_pop (q);
 	}
 }
@@ -634,7 +1101,6 @@ void event_queue_init (struct event_queue *q)
 	q->tail = NULL;
 }
 
-#if 0
 /* Search for an event of this type and return pointer to it or NULL if there
  * was no such event. */
 struct event *event_search (struct event_queue *q, const int event)
@@ -643,15 +1109,81 @@ struct event *event_search (struct event_queue *q, const int event)
 
 	assert (q != NULL);
 
-	while ((e = q->head)) {
+	for (e = q->head; e; e = e->next)
 		if (e->type == event)
 			return e;
-		e = e->next;
-	}
 
 	return NULL;
 }
-#endif
+
+/* Return the class of the event (EV_CLASS_*) or 0 if the event is always
+ * sent to the client. */
+int event_class (const int event)
+{
+	switch (event) {
+	case EV_STATE:
+	case EV_CTIME:
+	case EV_BITRATE:
+	case EV_RATE:
+	case EV_CHANNELS:
+	case EV_AVG_BITRATE:
+	case EV_TAGS:
+	case EV_MIXER_CHANGE:
+	case EV_AUDIO_START:
+	case EV_AUDIO_STOP:
+		return EV_CLASS_STATE;
+	case EV_PLIST_ADD:
+	case EV_PLIST_DEL:
+	case EV_PLIST_MOVE:
+	case EV_PLIST_CLEAR:
+		return EV_CLASS_PLIST;
+	case EV_QUEUE_ADD:
+	case EV_QUEUE_DEL:
+	case EV_QUEUE_MOVE:
+	case EV_QUEUE_CLEAR:
+		return EV_CLASS_QUEUE;
+	case EV_OPTIONS:
+	case EV_SRV_ERROR:
+	case EV_STATUS_MSG:
+		return EV_CLASS_MSG;
+	}
+
+	return 0;
+}
+
+/* Return true iff 'event' is a playlist event. */
+bool is_plist_event (const int event)
+{
+	return event_class (event) == EV_CLASS_PLIST;
+}
+
+/* Remove events of the given classes from the queue. */
+void event_queue_drop (struct event_queue *q, const int classes)
+{
+	struct event *e, *prev = NULL;
+
+	assert (q != NULL);
+
+	e = q->head;
+	while (e) {
+		struct event *next = e->next;
+
+		if (event_class (e->type) & classes) {
+			event_free_data (e);
+			if (prev)
+				prev->next = next;
+			else
+				q->head = next;
+			if (q->tail == e)
+				q->tail = prev;
+			free (e);
+		}
+		else
+			prev = e;
+
+		e = next;
+	}
+}
 
 /* Return != 0 if the queue is empty. */
 int event_queue_empty (const struct event_queue *q)
@@ -715,11 +1247,17 @@ enum noblock_io_status event_send_noblock (int sock, struct event_queue *q)
 	ssize_t res;
 	char *err;
 	struct packet_buf *b;
+	struct sock_buf *sb;
 	enum noblock_io_status result;
 
 	assert (q != NULL);
 	assert (!event_queue_empty(q));
 
+	/* Events must not overtake the batched output. */
+	sb = get_sock_buf (sock);
+	if (sb && sb->out_len && !sock_buf_send(sock, sb))
+		return NB_IO_ERR;
+
 	b = make_event_packet (event_get_first(q));
 
 	/* We must do it in one send() call to be able to handle blocking. */
@@ -729,7 +1267,7 @@ enum noblock_io_status event_send_noblock (int sock, struct event_queue *q)
 		struct event *e;
 
 		e = event_get_first (q);
-		free_event_data (e->type, e->data);
+		event_free_data (e);
 		event_pop (q);
 
 		result = NB_IO_OK;
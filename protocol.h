@@ -1,16 +1,22 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <stdbool.h>
+
 #include "playlist.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct event_shared;
+
 struct event
 {
 	int type;	/* type of the event (one of EV_*) */
 	void *data;	/* optional data associated with the event */
+	struct event_shared *shared; /* not NULL if the data are shared
+					with other queues */
 	struct event *next;
 };
 
@@ -55,7 +61,6 @@ enum noblock_io_status
 #define EV_EXIT		0x0a /* the server is about to exit */
 #define EV_PONG		0x0b /* response for CMD_PING */
 #define EV_OPTIONS	0x0c /* the options has changed */
-#define EV_SEND_PLIST	0x0d /* request for sending the playlist */
 #define EV_TAGS		0x0e /* tags for the current file have changed */
 #define EV_STATUS_MSG	0x0f /* followed by a status message */
 #define EV_MIXER_CHANGE	0x10 /* the mixer channel was changed */
@@ -78,6 +83,20 @@ enum noblock_io_status
 #define EV_QUEUE_MOVE	0x56
 #define EV_QUEUE_CLEAR	0x57
 
+/* Classes of events a client can subscribe to.  Responses to requests,
+ * EV_BUSY and EV_EXIT are always sent. */
+#define EV_CLASS_STATE	0x01 /* state, time, bitrate, tags, mixer, etc. */
+#define EV_CLASS_PLIST	0x02 /* changes to the clients' playlist */
+#define EV_CLASS_QUEUE	0x04 /* changes to the queue */
+#define EV_CLASS_MSG	0x08 /* options, error and status messages */
+#define EV_CLASS_ALL	(EV_CLASS_STATE | EV_CLASS_PLIST | EV_CLASS_QUEUE \
+			| EV_CLASS_MSG)
+
+/* Responses to CMD_GET_PLIST. */
+#define PLIST_SYNC_NONE		0x00 /* there is no playlist */
+#define PLIST_SYNC_DELTA	0x01 /* followed by changes since the version */
+#define PLIST_SYNC_FULL		0x02 /* followed by the whole playlist */
+
 /* State of the server. */
 #define STATE_PLAY	0x01
 #define STATE_STOP	0x02
@@ -108,14 +127,14 @@ enum noblock_io_status
 #define CMD_DELETE	0x1c /* delete an item from the playlist */
 #define CMD_SEND_PLIST_EVENTS 0x1d /* request for playlist events */
 #define CMD_PREV	0x20 /* start playing previous song if available */
-#define CMD_SEND_PLIST	0x21 /* send the playlist to the requesting client */
-#define CMD_GET_PLIST	0x22 /* get the playlist from one of the clients */
-#define CMD_CAN_SEND_PLIST	0x23 /* mark the client as able to send
-					playlist */
+#define CMD_GET_PLIST	0x22 /* get the clients' playlist or changes to it
+				   since the given version */
 #define CMD_CLI_PLIST_ADD	0x24 /* add an item to the client's playlist */
 #define CMD_CLI_PLIST_DEL	0x25 /* delete an item from the client's
 					playlist */
-#define CMD_CLI_PLIST_CLEAR	0x26 /* clear the client's playlist */
+#define CMD_CLI_PLIST_CLEAR	0x26 /* clear the client's playlist, followed
+					by the serial of the new playlist or
+					-1 */
 #define CMD_GET_SERIAL	0x27 /* get an unique serial number */
 #define CMD_PLIST_SET_SERIAL	0x28 /* assign a serial number to the server's
 					playlist */
@@ -146,8 +165,15 @@ enum noblock_io_status
 #define CMD_QUEUE_MOVE	0x3d /* move an item in the queue */
 #define CMD_QUEUE_CLEAR	0x3e /* clear the queue */
 #define CMD_GET_QUEUE	0x3f /* request the queue from the server */
+#define CMD_SUBSCRIBE	0x40 /* set the classes of events to receive,
+				followed by EV_CLASS_* flags */
 
 char *socket_name ();
+void sock_buf_open (int sock);
+void sock_buf_close (int sock);
+size_t sock_buf_pending (int sock);
+void sock_buf_batch (int sock);
+int sock_buf_flush (int sock);
 int get_int (int sock, int *i);
 enum noblock_io_status get_int_noblock (int sock, int *i);
 int send_int (int sock, int i);
@@ -159,6 +185,8 @@ int send_item (int sock, const struct plist_item *item);
 struct plist_item *recv_item (int sock);
 struct file_tags *recv_tags (int sock);
 int send_tags (int sock, const struct file_tags *tags);
+int send_plist (int sock, const struct plist *plist);
+int recv_plist (int sock, struct plist *plist);
 
 void event_queue_init (struct event_queue *q);
 void event_queue_free (struct event_queue *q);
@@ -166,7 +194,15 @@ void free_event_data (const int type, void *data);
 struct event *event_get_first (struct event_queue *q);
 void event_pop (struct event_queue *q);
 void event_push (struct event_queue *q, const int event, void *data);
+struct event_shared *event_shared_new (const int event, void *data);
+void event_shared_unref (struct event_shared *s);
+void event_push_shared (struct event_queue *q, const int event,
+		struct event_shared *s);
+struct event *event_search (struct event_queue *q, const int event);
 int event_queue_empty (const struct event_queue *q);
+int event_class (const int event);
+bool is_plist_event (const int event);
+void event_queue_drop (struct event_queue *q, const int classes);
 enum noblock_io_status event_send_noblock (int sock, struct event_queue *q);
 void free_tag_ev_data (struct tag_ev_response *d);
 void free_move_ev_data (struct move_ev_data *m);
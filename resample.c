@@ -0,0 +1,316 @@
+/*
+ * MOC - music on console
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/* Built-in polyphase FIR resampler.
+ *
+ * The ratio of the rates is reduced to L/M: the sound is (conceptually)
+ * upsampled by L, low-pass filtered and every M-th sample is taken.  The
+ * filter, a Kaiser windowed sinc, is split into L phases, so an output
+ * sample is the dot product of one phase with the last 'taps' input
+ * samples of the channel.  All memory is allocated in resampler_new(). */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+#endif
+
+#include "common.h"
+#include "resample.h"
+
+/* Limit of L, enough for 44.1<->48, 88.2<->96 and 22.05->48kHz. */
+#define MAX_PHASES	1024
+
+/* Input frames taken into the history at once. */
+#define CHUNK_FRAMES	1024
+
+struct resampler
+{
+	int channels;
+	int taps;		/* coefficients of a phase, multiple of 8 */
+	int phases;		/* L */
+	int step;		/* M */
+	float *bank;		/* phases * taps coefficients */
+	int *next_phase;	/* phase of the next output for each phase */
+	int *advance;		/* frames to advance for each phase */
+
+	float *hist;		/* history buffer of each channel */
+	int hist_len;		/* size of a history buffer in frames */
+	int avail;		/* frames in the history buffers */
+	int index;		/* start of the window of the next output */
+	int phase;		/* phase of the next output */
+};
+
+static const struct
+{
+	int taps;
+	double cutoff;		/* part of the lower Nyquist frequency */
+	double beta;		/* of the Kaiser window */
+} tiers[] = {
+	{ 16, 0.85, 6.0 },	/* RESAMPLE_FAST */
+	{ 32, 0.91, 8.0 },	/* RESAMPLE_MEDIUM */
+	{ 64, 0.95, 10.0 }	/* RESAMPLE_BEST */
+};
+
+static int gcd (int a, int b)
+{
+	while (b) {
+		int t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/* Modified Bessel function of the first kind of order 0. */
+static double bessel_i0 (const double x)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+
+	for (k = 1; k < 100 && term > sum * 1e-12; k += 1) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+
+	return sum;
+}
+
+/* Compute the filter and split it into phases.  Coefficients of a phase
+ * are stored in reverse order, so they are applied to the history in the
+ * order of time. */
+static void make_bank (struct resampler *r, const double cutoff,
+		const double beta)
+{
+	int len = r->phases * r->taps;
+	double fc = cutoff * 0.5 / MAX(r->phases, r->step);
+	double center = (len - 1) / 2.0;
+	double i0_beta = bessel_i0 (beta);
+	int j, p, k;
+
+	for (j = 0; j < len; j += 1) {
+		double x = j - center;
+		double w = x / (center + 1.0);
+		double h;
+
+		if (x == 0.0)
+			h = 2.0 * fc;
+		else
+			h = sin (2.0 * M_PI * fc * x) / (M_PI * x);
+		h *= bessel_i0 (beta * sqrt (1.0 - w * w)) / i0_beta;
+
+		p = j % r->phases;
+		k = j / r->phases;
+		r->bank[p * r->taps + r->taps - 1 - k] = h;
+	}
+
+	/* Unity gain in every phase. */
+	for (p = 0; p < r->phases; p += 1) {
+		float *coef = r->bank + p * r->taps;
+		double sum = 0.0;
+
+		for (k = 0; k < r->taps; k += 1)
+			sum += coef[k];
+		for (k = 0; k < r->taps; k += 1)
+			coef[k] /= sum;
+
+		r->next_phase[p] = (p + r->step) % r->phases;
+		r->advance[p] = (p + r->step) / r->phases;
+	}
+}
+
+/* Return a new resampler or NULL if the ratio of the rates needs too
+ * many phases. */
+struct resampler *resampler_new (const int from_rate, const int to_rate,
+		const int channels, const enum resample_quality quality)
+{
+	struct resampler *r;
+	int g;
+
+	assert (from_rate > 0);
+	assert (to_rate > 0);
+	assert (channels > 0);
+	assert (LIMIT(quality, ARRAY_SIZE(tiers)));
+
+	g = gcd (from_rate, to_rate);
+	if (to_rate / g > MAX_PHASES)
+		return NULL;
+
+	r = (struct resampler *)xmalloc (sizeof (struct resampler));
+	r->channels = channels;
+	r->phases = to_rate / g;
+	r->step = from_rate / g;
+
+	/* Keep the transition band narrow when downsampling. */
+	r->taps = tiers[quality].taps
+	          * ((r->step + r->phases - 1) / r->phases);
+
+	r->bank = (float *)xmalloc (sizeof (float) * r->phases * r->taps);
+	r->next_phase = (int *)xmalloc (sizeof (int) * r->phases);
+	r->advance = (int *)xmalloc (sizeof (int) * r->phases);
+	make_bank (r, tiers[quality].cutoff, tiers[quality].beta);
+
+	r->hist_len = r->taps + CHUNK_FRAMES;
+	r->hist = (float *)xmalloc (sizeof (float) * channels * r->hist_len);
+	resampler_reset (r);
+
+	return r;
+}
+
+/* Forget the history, as at the start of a stream. */
+void resampler_reset (struct resampler *r)
+{
+	assert (r != NULL);
+
+	memset (r->hist, 0, sizeof (float) * r->channels * r->hist_len);
+	r->avail = r->taps - 1;
+	r->index = 0;
+	r->phase = 0;
+}
+
+void resampler_free (struct resampler *r)
+{
+	if (r) {
+		free (r->bank);
+		free (r->next_phase);
+		free (r->advance);
+		free (r->hist);
+		free (r);
+	}
+}
+
+/* Return the maximum number of frames resampler_process() produces from
+ * the given number of frames. */
+size_t resampler_max_output (const struct resampler *r, const size_t frames)
+{
+	assert (r != NULL);
+
+	return (frames + r->taps) * r->phases / r->step + 1;
+}
+
+static inline float dot (const float *x, const float *h, const int n)
+{
+	int i;
+
+#ifdef __SSE2__
+	__m128 acc0 = _mm_setzero_ps ();
+	__m128 acc1 = _mm_setzero_ps ();
+
+	for (i = 0; i < n; i += 8) {
+		acc0 = _mm_add_ps (acc0, _mm_mul_ps (_mm_loadu_ps (x + i),
+		                                     _mm_loadu_ps (h + i)));
+		acc1 = _mm_add_ps (acc1, _mm_mul_ps (_mm_loadu_ps (x + i + 4),
+		                                     _mm_loadu_ps (h + i + 4)));
+	}
+	acc0 = _mm_add_ps (acc0, acc1);
+	acc0 = _mm_add_ps (acc0, _mm_movehl_ps (acc0, acc0));
+	acc0 = _mm_add_ss (acc0, _mm_shuffle_ps (acc0, acc0, 1));
+
+	return _mm_cvtss_f32 (acc0);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	float32x4_t acc0 = vdupq_n_f32 (0.0f);
+	float32x4_t acc1 = vdupq_n_f32 (0.0f);
+	float32x2_t sum;
+
+	for (i = 0; i < n; i += 8) {
+		acc0 = vmlaq_f32 (acc0, vld1q_f32 (x + i), vld1q_f32 (h + i));
+		acc1 = vmlaq_f32 (acc1, vld1q_f32 (x + i + 4),
+		                  vld1q_f32 (h + i + 4));
+	}
+	acc0 = vaddq_f32 (acc0, acc1);
+	sum = vadd_f32 (vget_low_f32 (acc0), vget_high_f32 (acc0));
+
+	return vget_lane_f32 (vpadd_f32 (sum, sum), 0);
+#else
+	float sum = 0.0f;
+
+	for (i = 0; i < n; i += 1)
+		sum += x[i] * h[i];
+
+	return sum;
+#endif
+}
+
+/* Move the part of the history still needed to the start of the
+ * buffers.  The window of the next output may start past the end of the
+ * history, then the frames before it are dropped as they come. */
+static void shift_history (struct resampler *r)
+{
+	int shift = MIN(r->index, r->avail);
+	int ch;
+
+	if (shift == 0)
+		return;
+
+	for (ch = 0; ch < r->channels; ch += 1) {
+		float *hist = r->hist + ch * r->hist_len;
+
+		memmove (hist, hist + shift,
+		         sizeof (float) * (r->avail - shift));
+	}
+
+	r->avail -= shift;
+	r->index -= shift;
+}
+
+/* Resample interleaved frames to out, which must have room for
+ * resampler_max_output() frames.  Return the number of frames
+ * written. */
+size_t resampler_process (struct resampler *r, const float *in,
+		const size_t frames, float *out)
+{
+	size_t left = frames, produced = 0;
+	int ch, i;
+
+	assert (r != NULL);
+	assert (in != NULL || frames == 0);
+	assert (out != NULL);
+
+	while (left > 0) {
+		int count;
+
+		shift_history (r);
+
+		count = MIN(left, (size_t)(r->hist_len - r->avail));
+		for (ch = 0; ch < r->channels; ch += 1) {
+			float *hist = r->hist + ch * r->hist_len + r->avail;
+
+			for (i = 0; i < count; i += 1)
+				hist[i] = in[i * r->channels + ch];
+		}
+		r->avail += count;
+		in += count * r->channels;
+		left -= count;
+
+		while (r->index + r->taps <= r->avail) {
+			const float *coef = r->bank + r->phase * r->taps;
+
+			for (ch = 0; ch < r->channels; ch += 1)
+				*out++ = dot (r->hist + ch * r->hist_len + r->index,
+				              coef, r->taps);
+
+			r->index += r->advance[r->phase];
+			r->phase = r->next_phase[r->phase];
+			produced += 1;
+		}
+	}
+
+	return produced;
+}
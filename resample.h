@@ -0,0 +1,32 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Quality of the built-in resampler, the better the more CPU it uses. */
+enum resample_quality
+{
+	RESAMPLE_FAST,
+	RESAMPLE_MEDIUM,
+	RESAMPLE_BEST
+};
+
+struct resampler;
+
+struct resampler *resampler_new (const int from_rate, const int to_rate,
+		const int channels, const enum resample_quality quality);
+size_t resampler_max_output (const struct resampler *r, const size_t frames);
+size_t resampler_process (struct resampler *r, const float *in,
+		const size_t frames, float *out);
+void resampler_reset (struct resampler *r);
+void resampler_free (struct resampler *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -44,9 +44,11 @@
 #include "server.h"
 #include "playlist.h"
 #include "tags_cache.h"
+#include "pcm_cache.h"
 #include "files.h"
 #include "softmixer.h"
 #include "equalizer.h"
+#include "status_page.h"
 
 #define SERVER_LOG	"mocp_server_log"
 #define PID_FILE	"pid"
@@ -54,11 +56,9 @@
 struct client
 {
 	int socket; 		/* -1 if inactive */
-	int wants_plist_events;	/* requested playlist events? */
+	int events_mask;	/* classes of events the client wants */
 	struct event_queue events;
 	pthread_mutex_t events_mtx;
-	int requests_plist;	/* is the client waiting for the playlist? */
-	int can_send_plist;	/* can this client send a playlist? */
 	int lock;		/* is this client locking us? */
 	int serial;		/* used for generating unique serial numbers */
 };
@@ -92,6 +92,47 @@ static struct {
 
 static struct tags_cache *tags_cache;
 
+/* Status published for clients that don't connect to the server.  It's
+ * updated by the server thread when one of the state events occurs.  The
+ * tags come from the tags cache thread. */
+static struct {
+	struct status_page *page;
+	int changed;			/* the page needs an update */
+	int tags_changed;		/* the tags need to be read again */
+	char *file;			/* file the tags are for */
+	struct file_tags *tags;
+} status = { NULL, 0, 0, NULL, NULL };
+
+/* Lock for the fields of status except the page. */
+static pthread_mutex_t status_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* Number of the latest changes of the clients' playlist remembered to send
+ * clients only the changes since the version they know. */
+#define PLIST_LOG_SIZE	1024
+
+/* Deleted items kept in the clients' playlist before it's compacted. */
+#define PLIST_MIN_DELETED	64
+
+/* A change of the clients' playlist. */
+struct plist_change
+{
+	int type;			/* EV_PLIST_* or -1 if unused */
+	struct plist_item *item;	/* item added by EV_PLIST_ADD */
+	char *from;			/* file deleted or moved */
+	char *to;			/* file swapped with 'from' */
+};
+
+/* The playlist shared by clients using SyncPlaylist.  The server keeps it
+ * with the log of recent changes, so a client reconnecting with a known
+ * version gets only the changes since. */
+static struct {
+	struct plist plist;
+	int id;			/* identifies the history of the versions */
+	int version;		/* incremented on each change */
+	int logged;		/* number of the latest changes in the log */
+	struct plist_change log[PLIST_LOG_SIZE];
+} clients_plist;
+
 extern char **environ;
 
 static void write_pid_file ()
@@ -178,15 +219,15 @@ static int add_client (int sock)
 
 	for (i = 0; i < CLIENTS_MAX; i++)
 		if (clients[i].socket == -1) {
-			clients[i].wants_plist_events = 0;
+			clients[i].events_mask = EV_CLASS_ALL
+				& ~EV_CLASS_PLIST;
 			LOCK (clients[i].events_mtx);
 			event_queue_free (&clients[i].events);
 			event_queue_init (&clients[i].events);
 			UNLOCK (clients[i].events_mtx);
 			clients[i].socket = sock;
-			clients[i].requests_plist = 0;
-			clients[i].can_send_plist = 0;
 			clients[i].lock = 0;
+			sock_buf_open (sock);
 			tags_cache_clear_queue (tags_cache, i);
 			return 1;
 		}
@@ -253,6 +294,7 @@ static int client_index (const struct client *cli)
 
 static void del_client (struct client *cli)
 {
+	sock_buf_close (cli->socket);
 	cli->socket = -1;
 	LOCK (cli->events_mtx);
 	event_queue_free (&cli->events);
@@ -352,6 +394,93 @@ static void run_extern_cmd (const char *event)
 }
 
 /* Initialize the server - return fd of the listening socket or -1 on error */
+static void clients_plist_init ()
+{
+	int i;
+
+	plist_init (&clients_plist.plist);
+	clients_plist.id = (int)((time(NULL) ^ (getpid() << 16)) & INT_MAX);
+	clients_plist.version = 0;
+	clients_plist.logged = 0;
+
+	for (i = 0; i < PLIST_LOG_SIZE; i++) {
+		clients_plist.log[i].type = -1;
+		clients_plist.log[i].item = NULL;
+		clients_plist.log[i].from = NULL;
+		clients_plist.log[i].to = NULL;
+	}
+}
+
+static void plist_change_clear (struct plist_change *c)
+{
+	if (c->item) {
+		plist_free_item_fields (c->item);
+		free (c->item);
+	}
+	free (c->from);
+	free (c->to);
+
+	c->type = -1;
+	c->item = NULL;
+	c->from = NULL;
+	c->to = NULL;
+}
+
+static void clients_plist_destroy ()
+{
+	int i;
+
+	for (i = 0; i < PLIST_LOG_SIZE; i++)
+		plist_change_clear (&clients_plist.log[i]);
+	plist_free (&clients_plist.plist);
+}
+
+/* Apply the change to the clients' playlist and add it to the log.  The
+ * data is the same as for the event of this type. */
+static void clients_plist_change (const int type, const void *data)
+{
+	struct plist *plist = &clients_plist.plist;
+	struct plist_change *c;
+	int num;
+
+	clients_plist.version++;
+	clients_plist.logged = MIN(clients_plist.logged + 1, PLIST_LOG_SIZE);
+
+	c = &clients_plist.log[clients_plist.version % PLIST_LOG_SIZE];
+	plist_change_clear (c);
+	c->type = type;
+
+	switch (type) {
+	case EV_PLIST_ADD:
+		c->item = plist_new_item ();
+		plist_item_copy (c->item, data);
+		if (plist_find_fname (plist, c->item->file) == -1)
+			plist_add_from_item (plist, c->item);
+		break;
+	case EV_PLIST_DEL:
+		c->from = xstrdup (data);
+		if ((num = plist_find_fname (plist, c->from)) != -1)
+			plist_delete (plist, num);
+
+		/* Nobody refers to the items by index, so drop the deleted
+		 * ones before they outnumber the rest. */
+		if (plist->num - plist_count (plist)
+				> MAX(plist_count (plist), PLIST_MIN_DELETED))
+			plist_compact (plist);
+		break;
+	case EV_PLIST_MOVE:
+		c->from = xstrdup (((const struct move_ev_data *)data)->from);
+		c->to = xstrdup (((const struct move_ev_data *)data)->to);
+		plist_swap_files (plist, c->from, c->to);
+		break;
+	case EV_PLIST_CLEAR:
+		plist_clear (plist);
+		break;
+	default:
+		abort (); /* BUG */
+	}
+}
+
 void server_init (int debugging, int foreground)
 {
 	struct sockaddr_un sock_name;
@@ -411,9 +540,13 @@ void server_init (int debugging, int foreground)
 	log_pthread_stack_size ();
 
 	clients_init ();
+	clients_plist_init ();
 	audio_initialize ();
 	tags_cache = tags_cache_new (options_get_int("TagsCacheSize"));
 	tags_cache_load (tags_cache, create_file_name("cache"));
+	if (options_get_bool ("PCMCache"))
+		pcm_cache_init (create_file_name("pcm_cache"),
+				options_get_int("PCMCacheSize"));
 
 	server_tid = pthread_self ();
 	xsignal (SIGTERM, sig_exit);
@@ -425,6 +558,15 @@ void server_init (int debugging, int foreground)
 
 	write_pid_file ();
 
+	status.page = status_page_create (create_file_name(STATUS_PAGE_FILE),
+			getpid());
+	if (status.page) {
+		status.changed = 1;
+		status.tags_changed = 1;
+	}
+	else
+		log_errno ("Can't create the status page", errno);
+
 	if (!foreground) {
 		setsid ();
 		redirect_output (stdin);
@@ -600,26 +742,83 @@ static void on_song_change ()
 	last_file = curr_file;
 }
 
-/* Return true iff 'event' is a playlist event. */
-static inline bool is_plist_event (const int event)
+/* Can a newer event of this type replace the queued one?  These events
+ * only tell the client to ask for the current value. */
+static int is_coalesced_event (const int event)
 {
-	bool result = false;
-
 	switch (event) {
-	case EV_PLIST_ADD:
-	case EV_PLIST_DEL:
-	case EV_PLIST_MOVE:
-	case EV_PLIST_CLEAR:
-		result = true;
+	case EV_STATE:
+	case EV_CTIME:
+	case EV_BITRATE:
+	case EV_RATE:
+	case EV_CHANNELS:
+	case EV_AVG_BITRATE:
+	case EV_TAGS:
+	case EV_MIXER_CHANGE:
+	case EV_OPTIONS:
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Add an event with shared data (may be NULL) to the client's queue unless
+ * the client doesn't want it or it's already there.  Return != 0 if the
+ * event was added. */
+static int add_shared_event (struct client *cli, const int event,
+		struct event_shared *data)
+{
+	int added = 0;
+	int class = event_class (event);
+
+	LOCK (cli->events_mtx);
+	if ((!class || (cli->events_mask & class))
+			&& (!is_coalesced_event(event)
+				|| !event_search(&cli->events, event))) {
+		event_push_shared (&cli->events, event, data);
+		added = 1;
 	}
+	UNLOCK (cli->events_mtx);
 
-	return result;
+	return added;
+}
+
+/* Make a copy of the event's data. */
+static void *event_data_dup (const int event, const void *data)
+{
+	if (event == EV_PLIST_ADD || event == EV_QUEUE_ADD) {
+		struct plist_item *item = plist_new_item ();
+
+		plist_item_copy (item, data);
+		return item;
+	}
+
+	if (event == EV_PLIST_DEL || event == EV_QUEUE_DEL
+			|| event == EV_STATUS_MSG || event == EV_SRV_ERROR)
+		return xstrdup (data);
+
+	if (event == EV_PLIST_MOVE || event == EV_QUEUE_MOVE)
+		return move_ev_data_dup ((struct move_ev_data *)data);
+
+	logit ("Unhandled data!");
+	return NULL;
 }
 
 static void add_event_all (const int event, const void *data)
 {
 	int i;
 	int added = 0;
+	bool status_changed = false;
+	struct event_shared *shared = NULL;
+
+	if (event_class (event) == EV_CLASS_STATE && status.page) {
+		LOCK (status_mtx);
+		if (event == EV_STATE || event == EV_TAGS)
+			status.tags_changed = 1;
+		status.changed = 1;
+		UNLOCK (status_mtx);
+		status_changed = true;
+	}
 
 	if (event == EV_STATE) {
 		switch (audio_get_state()) {
@@ -632,41 +831,24 @@ static void add_event_all (const int event, const void *data)
 		}
 	}
 
-	for (i = 0; i < CLIENTS_MAX; i++) {
-		void *data_copy = NULL;
-
-		if (clients[i].socket == -1)
-			continue;
+	/* All clients get the same copy of the data. */
+	if (data) {
+		void *data_copy = event_data_dup (event, data);
 
-		if (!clients[i].wants_plist_events && is_plist_event (event))
-			continue;
+		if (data_copy)
+			shared = event_shared_new (event, data_copy);
+	}
 
-		if (data) {
-			if (event == EV_PLIST_ADD
-					|| event == EV_QUEUE_ADD) {
-				data_copy = plist_new_item ();
-				plist_item_copy (data_copy, data);
-			}
-			else if (event == EV_PLIST_DEL
-					|| event == EV_QUEUE_DEL
-					|| event == EV_STATUS_MSG
-					|| event == EV_SRV_ERROR) {
-				data_copy = xstrdup (data);
-			}
-			else if (event == EV_PLIST_MOVE
-					|| event == EV_QUEUE_MOVE)
-				data_copy = move_ev_data_dup (
-						(struct move_ev_data *)
-						data);
-			else
-				logit ("Unhandled data!");
-		}
+	for (i = 0; i < CLIENTS_MAX; i++)
+		if (clients[i].socket != -1
+				&& add_shared_event (&clients[i], event,
+					shared))
+			added++;
 
-		add_event (&clients[i], event, data_copy);
-		added++;
-	}
+	if (shared)
+		event_shared_unref (shared);
 
-	if (added)
+	if (added || status_changed)
 		wake_up_server ();
 	else
 		debug ("No events have been added because there are no clients");
@@ -710,6 +892,13 @@ static void server_shutdown ()
 	audio_exit ();
 	tags_cache_free (tags_cache);
 	tags_cache = NULL;
+	pcm_cache_exit ();
+	clients_plist_destroy ();
+	status_page_destroy (status.page, create_file_name(STATUS_PAGE_FILE));
+	status.page = NULL;
+	free (status.file);
+	if (status.tags)
+		tags_free (status.tags);
 	logit ("Running OnServerStop");
 	run_extern_cmd ("OnServerStop");
 	unlink (socket_name());
@@ -945,130 +1134,102 @@ static int req_queue_del (const struct client *cli)
 	return 1;
 }
 
-/* Return the index of the first client able to send the playlist or -1 if
- * there isn't any. */
-static int find_sending_plist ()
+/* Send a change of the clients' playlist.  Return 0 on error. */
+static int send_plist_change (int sock, const struct plist_change *c)
 {
-	int i;
+	if (!send_int(sock, c->type))
+		return 0;
 
-	for (i = 0; i < CLIENTS_MAX; i++)
-		if (clients[i].socket != -1 && clients[i].can_send_plist)
-			return i;
-	return -1;
+	switch (c->type) {
+	case EV_PLIST_ADD:
+		return send_item (sock, c->item);
+	case EV_PLIST_DEL:
+		return send_str (sock, c->from);
+	case EV_PLIST_MOVE:
+		return send_str (sock, c->from) && send_str (sock, c->to);
+	}
+
+	return 1;
 }
 
-/* Handle CMD_GET_PLIST. Return 0 on error. */
-static int get_client_plist (struct client *cli)
+/* Handle CMD_SUBSCRIBE.  Return 0 on error. */
+static int req_subscribe (struct client *cli)
 {
-	int first;
-
-	debug ("Client with fd %d requests the playlist", cli->socket);
-
-	/* Find the first connected client, and ask it to send the playlist.
-	 * Here, send 1 if there is a client with the playlist, or 0 if there
-	 * isn't. */
-
-	cli->requests_plist = 1;
-
-	first = find_sending_plist ();
-	if (first == -1) {
-		debug ("No clients with the playlist");
-		cli->requests_plist = 0;
-		if (!send_data_int(cli, 0))
-			return 0;
-		return 1;
-	}
+	int mask;
 
-	if (!send_data_int(cli, 1))
+	if (!get_int(cli->socket, &mask))
 		return 0;
 
-	if (!send_int(clients[first].socket, EV_SEND_PLIST))
-		return 0;
+	debug ("Client with fd %d subscribes to events 0x%x", cli->socket,
+			mask);
+
+	LOCK (cli->events_mtx);
+	cli->events_mask = mask & EV_CLASS_ALL;
+	event_queue_drop (&cli->events, EV_CLASS_ALL & ~cli->events_mask);
+	UNLOCK (cli->events_mtx);
 
 	return 1;
 }
 
-/* Find the client requesting the playlist. */
-static int find_cli_requesting_plist ()
+/* Handle CMD_GET_PLIST.  The client sends the id and version of the
+ * playlist it has (or -1), we send the changes since that version if we
+ * still have them or the whole playlist.  Return 0 on error. */
+static int req_get_plist (struct client *cli)
 {
-	int i;
-
-	for (i = 0; i < CLIENTS_MAX; i++)
-		if (clients[i].requests_plist)
-			return i;
-	return -1;
-}
+	int id, version, changes, mode, i;
 
-/* Handle CMD_SEND_PLIST. Some client requested to get the playlist, so we asked
- * another client to send it (EV_SEND_PLIST). */
-static int req_send_plist (struct client *cli)
-{
-	int requesting = find_cli_requesting_plist ();
-	int send_fd;
-	struct plist_item *item;
-	int serial;
+	if (!get_int(cli->socket, &id) || !get_int(cli->socket, &version)) {
+		logit ("Error while getting the playlist version");
+		return 0;
+	}
 
-	debug ("Client with fd %d wants to send its playlists", cli->socket);
+	debug ("Client with fd %d requests the playlist since version %d:%d",
+			cli->socket, id, version);
 
-	if (requesting == -1) {
-		logit ("No clients are requesting the playlist");
-		send_fd = -1;
-	}
-	else {
-		send_fd = clients[requesting].socket;
-		if (!send_int(send_fd, EV_DATA)) {
-			logit ("Error while sending response; disconnecting the client");
-			close (send_fd);
-			del_client (&clients[requesting]);
-			send_fd = -1;
-		}
-	}
+	/* The response covers all changes made so far, so the events for them
+	 * which are still queued would be applied twice. */
+	LOCK (cli->events_mtx);
+	event_queue_drop (&cli->events, EV_CLASS_PLIST);
+	UNLOCK (cli->events_mtx);
 
-	if (!get_int(cli->socket, &serial)) {
-		logit ("Error while getting serial");
+	if (!send_int(cli->socket, EV_DATA))
 		return 0;
-	}
 
-	if (send_fd != -1 && !send_int(send_fd, serial)) {
-		error ("Error while sending serial; disconnecting the client");
-		close (send_fd);
-		del_client (&clients[requesting]);
-		send_fd = -1;
+	if (!plist_count(&clients_plist.plist)) {
+		debug ("No playlist");
+		return send_int (cli->socket, PLIST_SYNC_NONE);
 	}
 
-	/* Even if no clients are requesting the playlist, we must read it,
-	 * because there is no way to say that we don't need it. */
-	while ((item = recv_item(cli->socket)) && item->file[0]) {
-		if (send_fd != -1 && !send_item(send_fd, item)) {
-			logit ("Error while sending item; disconnecting the client");
-			close (send_fd);
-			del_client (&clients[requesting]);
-			send_fd = -1;
-		}
-		plist_free_item_fields (item);
-		free (item);
-	}
-
-	if (item) {
-		plist_free_item_fields (item);
-		free (item);
-		logit ("Playlist sent");
-	}
+	changes = clients_plist.version - version;
+	if (id == clients_plist.id && RANGE(0, changes, clients_plist.logged)
+			&& changes <= plist_count(&clients_plist.plist))
+		mode = PLIST_SYNC_DELTA;
 	else
-		logit ("Error while receiving item");
+		mode = PLIST_SYNC_FULL;
 
-	if (send_fd != -1 && !send_item (send_fd, NULL)) {
-		logit ("Error while sending end of playlist mark; "
-		       "disconnecting the client");
-		close (send_fd);
-		del_client (&clients[requesting]);
+	if (!send_int(cli->socket, mode)
+			|| !send_int(cli->socket, clients_plist.id)
+			|| !send_int(cli->socket, clients_plist.version)
+			|| !send_int(cli->socket,
+				plist_get_serial(&clients_plist.plist)))
 		return 0;
+
+	if (mode == PLIST_SYNC_FULL) {
+		logit ("Sending the whole playlist");
+		return send_plist (cli->socket, &clients_plist.plist);
 	}
 
-	if (requesting != -1)
-		clients[requesting].requests_plist = 0;
+	logit ("Sending %d playlist changes", changes);
+
+	if (!send_int(cli->socket, changes))
+		return 0;
+
+	for (i = version + 1; i <= clients_plist.version; i++)
+		if (!send_plist_change(cli->socket,
+					&clients_plist.log[i % PLIST_LOG_SIZE]))
+			return 0;
 
-	return item ? 1 : 0;
+	return 1;
 }
 
 /* Client requested we send the queue so we get it from audio.c and
@@ -1129,6 +1290,7 @@ static int plist_sync_cmd (struct client *cli, const int cmd)
 			return 0;
 		}
 
+		clients_plist_change (EV_PLIST_ADD, item);
 		add_event_all (EV_PLIST_ADD, item);
 		plist_free_item_fields (item);
 		free (item);
@@ -1143,6 +1305,7 @@ static int plist_sync_cmd (struct client *cli, const int cmd)
 			return 0;
 		}
 
+		clients_plist_change (EV_PLIST_DEL, file);
 		add_event_all (EV_PLIST_DEL, file);
 		free (file);
 	}
@@ -1155,13 +1318,24 @@ static int plist_sync_cmd (struct client *cli, const int cmd)
 			return 0;
 		}
 
+		clients_plist_change (EV_PLIST_MOVE, &m);
 		add_event_all (EV_PLIST_MOVE, &m);
 
 		free (m.from);
 		free (m.to);
 	}
 	else { /* it can be only CMD_CLI_PLIST_CLEAR */
+		int serial;
+
+		if (!get_int(cli->socket, &serial)) {
+			logit ("Error while receiving serial");
+			return 0;
+		}
+
 		debug ("Sending EV_PLIST_CLEAR");
+		clients_plist_change (EV_PLIST_CLEAR, NULL);
+		if (serial != -1)
+			plist_set_serial (&clients_plist.plist, serial);
 		add_event_all (EV_PLIST_CLEAR, NULL);
 	}
 
@@ -1541,20 +1715,19 @@ static void handle_command (const int client_id)
 				err = 1;
 			break;
 		case CMD_SEND_PLIST_EVENTS:
-			cli->wants_plist_events = 1;
+			LOCK (cli->events_mtx);
+			cli->events_mask |= EV_CLASS_PLIST;
+			UNLOCK (cli->events_mtx);
 			logit ("Request for events");
 			break;
-		case CMD_GET_PLIST:
-			if (!get_client_plist(cli))
+		case CMD_SUBSCRIBE:
+			if (!req_subscribe(cli))
 				err = 1;
 			break;
-		case CMD_SEND_PLIST:
-			if (!req_send_plist(cli))
+		case CMD_GET_PLIST:
+			if (!req_get_plist(cli))
 				err = 1;
 			break;
-		case CMD_CAN_SEND_PLIST:
-			cli->can_send_plist = 1;
-			break;
 		case CMD_CLI_PLIST_ADD:
 		case CMD_CLI_PLIST_DEL:
 		case CMD_CLI_PLIST_CLEAR:
@@ -1687,17 +1860,49 @@ static int max_fd (int max)
 	return max;
 }
 
-/* Handle clients whose fds are ready to read. */
+/* Return != 0 if there is a client that can be handled and has commands
+ * already read into its buffer. */
+static int clients_pending ()
+{
+	int i;
+
+	for (i = 0; i < CLIENTS_MAX; i++)
+		if (clients[i].socket != -1
+				&& sock_buf_pending(clients[i].socket)
+				&& (locking_client() == -1
+					|| is_locking(&clients[i])))
+			return 1;
+	return 0;
+}
+
+/* Handle a command from the client sending all responses at once. */
+static void handle_client (const int client_id)
+{
+	struct client *cli = &clients[client_id];
+	int sock = cli->socket;
+
+	sock_buf_batch (sock);
+	handle_command (client_id);
+
+	if (cli->socket != -1 && !sock_buf_flush(sock)) {
+		logit ("Closing client connection due to error");
+		close (cli->socket);
+		del_client (cli);
+	}
+}
+
+/* Handle clients whose fds are ready to read or have buffered commands. */
 static void handle_clients (fd_set *fds)
 {
 	int i;
 
 	for (i = 0; i < CLIENTS_MAX; i++)
 		if (clients[i].socket != -1
-				&& FD_ISSET(clients[i].socket, fds)) {
+				&& (FD_ISSET(clients[i].socket, fds)
+					|| sock_buf_pending(clients[i].socket))) {
 			if (locking_client() == -1
 					|| is_locking(&clients[i]))
-				handle_command (i);
+				handle_client (i);
 			else
 				debug ("Not getting a command from client with"
 						" fd %d because of lock",
@@ -1718,6 +1923,124 @@ static void close_clients ()
 		}
 }
 
+/* Request the tags of the current file for the status page if the file
+ * has changed or its tags may have.  They are set by status_tags_response()
+ * when the tags cache has read them. */
+static void update_status_tags (const int tags_changed)
+{
+	char *file = audio_get_sname ();
+	bool same_file;
+
+	LOCK (status_mtx);
+	same_file = file == status.file
+		|| (file && status.file && !strcmp(file, status.file));
+	if (!same_file) {
+		free (status.file);
+		status.file = xstrdup (file);
+		if (status.tags) {
+			tags_free (status.tags);
+			status.tags = NULL;
+		}
+	}
+	UNLOCK (status_mtx);
+
+	if (!file || (same_file && !tags_changed)) {
+		free (file);
+		return;
+	}
+
+	if (is_url(file)) {
+		struct file_tags *tags = audio_get_curr_tags ();
+
+		LOCK (status_mtx);
+		if (status.tags)
+			tags_free (status.tags);
+		status.tags = tags;
+		UNLOCK (status_mtx);
+	}
+	else {
+		tags_cache_clear_queue (tags_cache, STATUS_CLIENT_ID);
+		tags_cache_add_request (tags_cache, file,
+				TAGS_COMMENTS | TAGS_TIME, STATUS_CLIENT_ID);
+	}
+
+	free (file);
+}
+
+/* Use the tags read by the tags cache for the status page if they are for
+ * the current file. */
+static void status_tags_response (const char *file,
+		const struct file_tags *tags)
+{
+	bool current;
+
+	LOCK (status_mtx);
+	current = status.file && !strcmp (status.file, file);
+	if (current) {
+		if (status.tags)
+			tags_free (status.tags);
+		status.tags = tags_dup (tags);
+		status.changed = 1;
+	}
+	UNLOCK (status_mtx);
+
+	if (current)
+		wake_up_server ();
+}
+
+/* Publish the current status in the status page if it has changed. */
+static void update_status_page ()
+{
+	struct status_page *page = status.page;
+	const struct file_tags *tags;
+	int changed, tags_changed, state, curr_time, volume;
+
+	LOCK (status_mtx);
+	changed = status.changed;
+	tags_changed = status.tags_changed;
+	status.changed = 0;
+	status.tags_changed = 0;
+	UNLOCK (status_mtx);
+
+	if (!changed)
+		return;
+
+	update_status_tags (tags_changed);
+
+	/* Don't call the audio functions with status_mtx locked: the
+	 * threads which hold their locks may be adding an event. */
+	state = audio_get_state ();
+	curr_time = audio_get_time ();
+	volume = audio_get_mixer ();
+
+	status_page_begin (page);
+
+	page->flags = 0;
+	page->state = state;
+	page->bitrate = sound_info.bitrate;
+	page->avg_bitrate = sound_info.avg_bitrate;
+	page->rate = sound_info.rate;
+	page->channels = sound_info.channels;
+	page->volume = volume;
+
+	LOCK (status_mtx);
+	tags = status.tags;
+	page->curr_time = status.file ? MAX(0, curr_time) : -1;
+	page->track = tags ? tags->track : -1;
+	page->total_time = tags ? tags->time : -1;
+	status_page_set_str (page, page->title, sizeof(page->title),
+			tags ? tags->title : NULL);
+	status_page_set_str (page, page->artist, sizeof(page->artist),
+			tags ? tags->artist : NULL);
+	status_page_set_str (page, page->album, sizeof(page->album),
+			tags ? tags->album : NULL);
+	status_page_set_str (page, page->file, sizeof(page->file),
+			status.file);
+	UNLOCK (status_mtx);
+
+	status_page_end (page);
+}
+
 /* Handle incoming connections */
 void server_loop ()
 {
@@ -1734,6 +2057,9 @@ void server_loop ()
 		int res;
 		fd_set fds_write, fds_read;
 
+		if (status.page)
+			update_status_page ();
+
 		FD_ZERO (&fds_read);
 		FD_ZERO (&fds_write);
 		FD_SET (server_sock, &fds_read);
@@ -1741,9 +2067,14 @@ void server_loop ()
 		add_clients_fds (&fds_read, &fds_write);
 
 		res = 0;
-		if (!server_quit)
+		if (!server_quit) {
+			struct timeval no_wait = { 0, 0 };
+
+			/* Buffered commands don't make the socket readable. */
 			res = select (max_fd(server_sock)+1, &fds_read,
-					&fds_write, NULL, NULL);
+					&fds_write, NULL,
+					clients_pending() ? &no_wait : NULL);
+		}
 
 		if (res == -1 && errno != EINTR && !server_quit)
 			fatal ("select() failed: %s", xstrerror (errno));
@@ -1842,9 +2173,11 @@ void tags_response (const int client_id, const char *file,
 {
 	assert (file != NULL);
 	assert (tags != NULL);
-	assert (LIMIT(client_id, CLIENTS_MAX));
+	assert (LIMIT(client_id, CLIENTS_MAX + 1));
 
-	if (clients[client_id].socket != -1) {
+	if (client_id == STATUS_CLIENT_ID)
+		status_tags_response (file, tags);
+	else if (clients[client_id].socket != -1) {
 		struct tag_ev_response *data
 			= (struct tag_ev_response *)xmalloc (
 					sizeof(struct tag_ev_response));
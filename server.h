@@ -9,6 +9,9 @@ extern "C" {
 
 #define CLIENTS_MAX	10
 
+/* Client ID of the tags requests made for the status page. */
+#define STATUS_CLIENT_ID	CLIENTS_MAX
+
 void server_init (int debug, int foreground);
 void server_loop ();
 void server_error (const char *file, int line, const char *function,
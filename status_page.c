@@ -0,0 +1,196 @@
+/*
+ * MOC - music on console
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/* The page is protected by a sequence lock: the writer makes the sequence
+ * number odd before and even after the update, a reader copies the page
+ * and retries if the number was odd or has changed in the meantime.  There
+ * is one writer (the server thread), readers never block it. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "status_page.h"
+
+/* How many times a reader tries to get a consistent copy. */
+#define READ_TRIES	100
+
+#define seq_of(page)	(*(volatile const uint32_t *)&(page)->seq)
+
+/* Create the page in the file.  It's not readable until the first
+ * status_page_end().  Return NULL on error (errno is set). */
+struct status_page *status_page_create (const char *file, const pid_t pid)
+{
+	struct status_page *page;
+	int fd;
+
+	fd = open (file, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		return NULL;
+
+	if (ftruncate(fd, sizeof(struct status_page)) == -1) {
+		int err = errno;
+
+		close (fd);
+		unlink (file);
+		errno = err;
+		return NULL;
+	}
+
+	page = mmap (NULL, sizeof(struct status_page), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close (fd);
+	if (page == MAP_FAILED) {
+		int err = errno;
+
+		unlink (file);
+		errno = err;
+		return NULL;
+	}
+
+	memset (page, 0, sizeof(struct status_page));
+	page->magic = STATUS_PAGE_MAGIC;
+	page->version = STATUS_PAGE_VERSION;
+	page->seq = 1;
+	page->server_pid = pid;
+	page->curr_time = -1;
+	page->bitrate = -1;
+	page->avg_bitrate = -1;
+	page->rate = -1;
+	page->track = -1;
+	page->total_time = -1;
+
+	return page;
+}
+
+/* Unmap the page and remove the file.  Readers which still have the page
+ * mapped see that the server is gone. */
+void status_page_destroy (struct status_page *page, const char *file)
+{
+	if (page) {
+		status_page_begin (page);
+		page->server_pid = 0;
+		status_page_end (page);
+		munmap (page, sizeof(struct status_page));
+	}
+	unlink (file);
+}
+
+/* Start updating the page. */
+void status_page_begin (struct status_page *page)
+{
+	if (!(page->seq & 1))
+		page->seq++;
+	__sync_synchronize ();
+}
+
+/* End the update making the page readable. */
+void status_page_end (struct status_page *page)
+{
+	__sync_synchronize ();
+	page->seq++;
+}
+
+/* Copy the string into a field of the page marking the page as truncated
+ * if it doesn't fit.  NULL is stored as an empty string.  Return 0 if the
+ * string was truncated. */
+int status_page_set_str (struct status_page *page, char *dst,
+		const size_t size, const char *str)
+{
+	size_t len = str ? strlen (str) : 0;
+
+	if (len >= size) {
+		page->flags |= STATUS_PAGE_TRUNCATED;
+		len = size - 1;
+	}
+
+	memcpy (dst, str ? str : "", len);
+	dst[len] = 0;
+
+	return len == (str ? strlen (str) : 0);
+}
+
+/* Map the page for reading.  Return NULL if there is no valid page (the
+ * server is not running or uses a different version). */
+struct status_page *status_page_open (const char *file)
+{
+	struct status_page *page;
+	struct stat st;
+	int fd;
+
+	fd = open (file, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	if (fstat(fd, &st) == -1
+			|| st.st_size < (off_t)sizeof(struct status_page)) {
+		close (fd);
+		return NULL;
+	}
+
+	page = mmap (NULL, sizeof(struct status_page), PROT_READ, MAP_SHARED,
+			fd, 0);
+	close (fd);
+	if (page == MAP_FAILED)
+		return NULL;
+
+	/* The file is left behind if the server crashes. */
+	if (page->magic != STATUS_PAGE_MAGIC
+			|| page->version != STATUS_PAGE_VERSION
+			|| (kill(page->server_pid, 0) == -1 && errno != EPERM)) {
+		munmap (page, sizeof(struct status_page));
+		return NULL;
+	}
+
+	return page;
+}
+
+/* Get a consistent copy of the page.  Return 0 if the server has exited
+ * or the page is being updated for too long. */
+int status_page_read (const struct status_page *page,
+		struct status_page *copy)
+{
+	int i;
+
+	for (i = 0; i < READ_TRIES; i++) {
+		uint32_t seq = seq_of (page);
+
+		if (seq & 1) {
+			sched_yield ();
+			continue;
+		}
+
+		__sync_synchronize ();
+		memcpy (copy, page, sizeof(struct status_page));
+		__sync_synchronize ();
+
+		if (seq_of(page) == seq)
+			return copy->server_pid != 0;
+	}
+
+	return 0;
+}
+
+void status_page_close (struct status_page *page)
+{
+	if (page)
+		munmap (page, sizeof(struct status_page));
+}
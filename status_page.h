@@ -0,0 +1,75 @@
+#ifndef STATUS_PAGE_H
+#define STATUS_PAGE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The server publishes its status in a file mapped into memory (the
+ * STATUS_PAGE_FILE in the MOC directory), so other programs can read it
+ * without connecting to the server.  This file and status_page.c depend
+ * only on the C library and can be compiled into other programs:
+ *
+ *	struct status_page *page, st;
+ *
+ *	page = status_page_open ("/home/user/.moc/status_page");
+ *	if (page && status_page_read (page, &st))
+ *		printf ("%s %d\n", st.file, st.curr_time);
+ *	status_page_close (page);
+ */
+
+#define STATUS_PAGE_FILE	"status_page"
+#define STATUS_PAGE_MAGIC	0x4d4f4353
+#define STATUS_PAGE_VERSION	1
+
+/* Set in flags if the file name or a tag didn't fit. */
+#define STATUS_PAGE_TRUNCATED	0x01
+
+struct status_page
+{
+	uint32_t magic;		/* STATUS_PAGE_MAGIC */
+	uint32_t version;	/* STATUS_PAGE_VERSION */
+	uint32_t seq;		/* odd while the page is being updated */
+	int32_t server_pid;
+	int32_t flags;
+
+	int32_t state;		/* STATE_PLAY, STATE_STOP or STATE_PAUSE */
+	int32_t curr_time;	/* seconds, -1 if unknown */
+	int32_t bitrate;	/* kbps, -1 if unknown */
+	int32_t avg_bitrate;
+	int32_t rate;		/* kHz, -1 if unknown */
+	int32_t channels;
+	int32_t volume;		/* 0-100 */
+
+	/* Tags of the current file, empty strings and -1 if unknown. */
+	int32_t track;
+	int32_t total_time;
+	char title[512];
+	char artist[512];
+	char album[512];
+
+	char file[4096];	/* empty if stopped */
+};
+
+/* Writing, used by the server. */
+struct status_page *status_page_create (const char *file, const pid_t pid);
+void status_page_destroy (struct status_page *page, const char *file);
+void status_page_begin (struct status_page *page);
+void status_page_end (struct status_page *page);
+int status_page_set_str (struct status_page *page, char *dst,
+		const size_t size, const char *str);
+
+/* Reading. */
+struct status_page *status_page_open (const char *file);
+int status_page_read (const struct status_page *page,
+		struct status_page *copy);
+void status_page_close (struct status_page *page);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -75,6 +75,10 @@ typedef unsigned long int u_long;
  * disables flushing. */
 #define DB_SYNC_COUNT 5
 
+/* The number of requests queues: one for each client and one for the
+ * requests of the server itself for the status page (STATUS_CLIENT_ID). */
+#define QUEUES_MAX (CLIENTS_MAX + 1)
+
 /* Element of a requests queue. */
 struct request_queue_node
 {
@@ -99,8 +103,8 @@ struct tags_cache
 #endif
 
 	int max_items;		/* maximum number of items in the cache. */
-	struct request_queue queues[CLIENTS_MAX]; /* requests queues for each
-						     client */
+	struct request_queue queues[QUEUES_MAX]; /* requests queues for each
+						    client and the status page */
 	int stop_reader_thread; /* request for stopping read thread (if
 				   non-zero) */
 	pthread_cond_t request_cond; /* condition for signalizing new
@@ -702,9 +706,9 @@ static void *reader_thread (void *cache_ptr)
 		 * curr_queue: we want to get one request from each queue,
 		 * and then move to the next non-empty queue. */
 		i = curr_queue;
-		while (i < CLIENTS_MAX && request_queue_empty (&c->queues[i]))
+		while (i < QUEUES_MAX && request_queue_empty (&c->queues[i]))
 			i++;
-		if (i == CLIENTS_MAX) {
+		if (i == QUEUES_MAX) {
 			i = 0;
 			while (i < curr_queue && request_queue_empty (&c->queues[i]))
 				i++;
@@ -724,7 +728,7 @@ static void *reader_thread (void *cache_ptr)
 		free (request_file);
 
 		LOCK (c->mutex);
-		curr_queue = (curr_queue + 1) % CLIENTS_MAX;
+		curr_queue = (curr_queue + 1) % QUEUES_MAX;
 	}
 
 	UNLOCK (c->mutex);
@@ -746,7 +750,7 @@ struct tags_cache *tags_cache_new (size_t max_size)
 	result->db = NULL;
 #endif
 
-	for (i = 0; i < CLIENTS_MAX; i++)
+	for (i = 0; i < QUEUES_MAX; i++)
 		request_queue_init (&result->queues[i]);
 
 #if CACHE_DB_FORMAT_VERSION
@@ -809,7 +813,7 @@ void tags_cache_free (struct tags_cache *c)
 		fatal ("pthread_join() on cache reader thread failed: %s",
 		        xstrerror (rc));
 
-	for (i = 0; i < CLIENTS_MAX; i++)
+	for (i = 0; i < QUEUES_MAX; i++)
 		request_queue_clear (&c->queues[i]);
 
 	rc = pthread_mutex_destroy (&c->mutex);
@@ -867,7 +871,7 @@ void tags_cache_add_request (struct tags_cache *c, const char *file,
 
 	assert (c != NULL);
 	assert (file != NULL);
-	assert (LIMIT(client_id, CLIENTS_MAX));
+	assert (LIMIT(client_id, QUEUES_MAX));
 
 	debug ("Request for tags for '%s' from client %d", file, client_id);
 
@@ -887,7 +891,7 @@ void tags_cache_add_request (struct tags_cache *c, const char *file,
 void tags_cache_clear_queue (struct tags_cache *c, int client_id)
 {
 	assert (c != NULL);
-	assert (LIMIT(client_id, CLIENTS_MAX));
+	assert (LIMIT(client_id, QUEUES_MAX));
 
 	LOCK (c->mutex);
 	request_queue_clear (&c->queues[client_id]);
@@ -901,7 +905,7 @@ void tags_cache_clear_up_to (struct tags_cache *c, const char *file,
                                                       int client_id)
 {
 	assert (c != NULL);
-	assert (LIMIT(client_id, CLIENTS_MAX));
+	assert (LIMIT(client_id, QUEUES_MAX));
 	assert (file != NULL);
 
 	LOCK (c->mutex);
@@ -0,0 +1,278 @@
+/*
+ * MOC - music on console
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/* Time sending a playlist over a socketpair, item by item with
+ * send_item()/recv_item() and at once with send_plist()/recv_plist().
+ *
+ * Usage: bench_protocol [-u] [items]
+ *
+ * With -u the sockets aren't buffered, as before sock_buf_open() was
+ * used. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "playlist.h"
+#include "protocol.h"
+#include "files.h"
+#include "log.h"
+#include "options.h"
+#include "interface.h"
+#include "interface_elements.h"
+#include "server.h"
+
+static struct plist src;
+static int socks[2];
+static bool buffered = true;
+static bool whole_plist;
+
+/* The rest of MOC isn't linked in, only what the protocol needs. */
+char *options_get_str (const char *name ATTR_UNUSED)
+{
+	return "%a - %t";
+}
+
+enum file_type file_type (const char *file ATTR_UNUSED)
+{
+	return F_SOUND;
+}
+
+enum file_type file_type_mtime (const char *file ATTR_UNUSED,
+		time_t *mtime ATTR_UNUSED)
+{
+	return F_SOUND;
+}
+
+time_t get_mtime (const char *file ATTR_UNUSED)
+{
+	return (time_t)-1;
+}
+
+int can_read_file (const char *file ATTR_UNUSED)
+{
+	return 1;
+}
+
+void internal_logit (const char *file ATTR_UNUSED,
+		const int line ATTR_UNUSED, const char *function ATTR_UNUSED,
+		const char *format ATTR_UNUSED, ...)
+{
+}
+
+void log_close ()
+{
+}
+
+void interface_error (const char *msg)
+{
+	fprintf (stderr, "%s\n", msg);
+}
+
+void server_error (const char *file ATTR_UNUSED, int line ATTR_UNUSED,
+                   const char *function ATTR_UNUSED, const char *msg)
+{
+	fprintf (stderr, "%s\n", msg);
+}
+
+void windows_reset ()
+{
+}
+
+static double now_ms ()
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void make_plist (const int count)
+{
+	int i;
+
+	plist_init (&src);
+
+	for (i = 0; i < count; i++) {
+		char file[256];
+		int num;
+
+		snprintf (file, sizeof(file), "/home/user/Music/Artist %d/"
+		          "Album %d/%02d - Track title number %d.flac",
+		          i / 100, i / 10, i % 10, i);
+		num = plist_add_typed (&src, file, F_SOUND, 1000 + i);
+		plist_set_title_tags (&src, num, "Some title");
+
+		/* Every other item has tags. */
+		if (i % 2) {
+			struct file_tags *tags = tags_new ();
+
+			tags->title = xstrdup ("Title");
+			tags->artist = xstrdup ("Artist");
+			tags->time = i;
+			tags->filled = TAGS_COMMENTS | TAGS_TIME;
+			plist_set_tags (&src, num, tags);
+			tags_free (tags);
+		}
+	}
+}
+
+static void *sender_thread (void *unused ATTR_UNUSED)
+{
+	int sock = socks[0];
+
+	if (buffered) {
+		sock_buf_open (sock);
+		sock_buf_batch (sock);
+	}
+
+	if (whole_plist)
+		send_plist (sock, &src);
+	else {
+		int i;
+
+		for (i = 0; i < src.num; i++)
+			send_item (sock, &src.items[i]);
+		send_item (sock, NULL);
+	}
+
+	if (buffered) {
+		sock_buf_flush (sock);
+		sock_buf_close (sock);
+	}
+
+	return NULL;
+}
+
+/* Receive the playlist into dst the way the interface does. */
+static void receive (struct plist *dst)
+{
+	int sock = socks[1];
+
+	if (whole_plist)
+		recv_plist (sock, dst);
+	else {
+		struct plist_item *item;
+
+		while ((item = recv_item (sock)) && item->file[0]) {
+			plist_add_from_item (dst, item);
+			plist_free_item_fields (item);
+			free (item);
+		}
+		if (item) {
+			plist_free_item_fields (item);
+			free (item);
+		}
+	}
+}
+
+/* Check if dst has the same items as src. */
+static bool same_items (const struct plist *dst)
+{
+	int i;
+
+	if (dst->num != src.num)
+		return false;
+
+	for (i = 0; i < src.num; i++) {
+		const struct plist_item *a = &src.items[i];
+		const struct plist_item *b = &dst->items[i];
+
+		if (strcmp (a->file, b->file) || a->mtime != b->mtime
+				|| !b->title_tags
+				|| strcmp (a->title_tags, b->title_tags))
+			return false;
+		if (a->tags && (!b->tags || a->tags->time != b->tags->time
+					|| strcmp (a->tags->artist,
+						b->tags->artist)))
+			return false;
+	}
+
+	return true;
+}
+
+static bool run (const char *name)
+{
+	struct plist dst;
+	pthread_t sender;
+	double start, elapsed;
+	bool ok;
+
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+		perror ("socketpair");
+		return false;
+	}
+
+	plist_init (&dst);
+	if (buffered)
+		sock_buf_open (socks[1]);
+
+	start = now_ms ();
+	if (pthread_create (&sender, NULL, sender_thread, NULL)) {
+		fprintf (stderr, "Can't create the thread\n");
+		return false;
+	}
+	receive (&dst);
+	pthread_join (sender, NULL);
+	elapsed = now_ms () - start;
+
+	ok = same_items (&dst);
+	printf ("%s: %d items in %.1f ms, %.0f items/s%s\n", name, dst.num,
+	        elapsed, dst.num / elapsed * 1000.0, ok ? "" : " (WRONG)");
+
+	if (buffered)
+		sock_buf_close (socks[1]);
+	plist_free (&dst);
+	close (socks[0]);
+	close (socks[1]);
+
+	return ok;
+}
+
+int main (int argc, char *argv[])
+{
+	int count = 50000;
+	int opt;
+	bool ok;
+
+	while ((opt = getopt (argc, argv, "u")) != -1) {
+		switch (opt) {
+			case 'u':
+				buffered = false;
+				break;
+			default:
+				fprintf (stderr, "Usage: %s [-u] [items]\n",
+				         argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc)
+		count = atoi (argv[optind]);
+
+	make_plist (count);
+
+	whole_plist = false;
+	ok = run ("send_item()/recv_item()");
+	whole_plist = true;
+	ok = run ("send_plist()/recv_plist()") && ok;
+
+	plist_free (&src);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,138 @@
+/*
+ * MOC - music on console
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/* Time building titles from tags with build_title().
+ *
+ * Usage: bench_title [-f format] [count]
+ *
+ * Only build_title() is used, so the driver can be built against older
+ * versions of playlist.c to compare them. */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "playlist.h"
+#include "files.h"
+#include "log.h"
+#include "options.h"
+#include "interface.h"
+#include "interface_elements.h"
+#include "server.h"
+
+#define DEFAULT_FORMAT	"%(n:%n :)%(a:%a - :)%(t:%t:)%(A: \\(%A\\):)"
+
+static char *format = DEFAULT_FORMAT;
+
+/* The rest of MOC isn't linked in, only what build_title() needs. */
+char *options_get_str (const char *name ATTR_UNUSED)
+{
+	return format;
+}
+
+enum file_type file_type (const char *file ATTR_UNUSED)
+{
+	return F_OTHER;
+}
+
+enum file_type file_type_mtime (const char *file ATTR_UNUSED,
+		time_t *mtime ATTR_UNUSED)
+{
+	return F_OTHER;
+}
+
+time_t get_mtime (const char *file ATTR_UNUSED)
+{
+	return (time_t)-1;
+}
+
+int can_read_file (const char *file ATTR_UNUSED)
+{
+	return 0;
+}
+
+void internal_logit (const char *file ATTR_UNUSED,
+		const int line ATTR_UNUSED, const char *function ATTR_UNUSED,
+		const char *format ATTR_UNUSED, ...)
+{
+}
+
+void log_close ()
+{
+}
+
+void interface_error (const char *msg)
+{
+	fprintf (stderr, "%s\n", msg);
+}
+
+void server_error (const char *file ATTR_UNUSED, int line ATTR_UNUSED,
+                   const char *function ATTR_UNUSED, const char *msg)
+{
+	fprintf (stderr, "%s\n", msg);
+}
+
+void windows_reset ()
+{
+}
+
+static double now_ms ()
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main (int argc, char *argv[])
+{
+	struct file_tags full = { "Title", "Artist", "Album", 3, 0, 0 };
+	struct file_tags partial = { NULL, "Artist", "", -1, 0, 0 };
+	struct file_tags *tags[2] = { &full, &partial };
+	long count = 1000000, i;
+	size_t len = 0;
+	double start;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "f:")) != -1) {
+		switch (opt) {
+			case 'f':
+				format = optarg;
+				break;
+			default:
+				fprintf (stderr,
+				         "Usage: %s [-f format] [count]\n",
+				         argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc)
+		count = atol (argv[optind]);
+
+	start = now_ms ();
+	for (i = 0; i < count; i++) {
+		char *title = build_title (tags[i & 1]);
+
+		len += strlen (title);
+		free (title);
+	}
+
+	printf ("build_title: %ld titles in %.1f ms (%zu bytes)\n",
+	        count, now_ms () - start, len);
+
+	return EXIT_SUCCESS;
+}
@@ -203,9 +203,13 @@ static size_t xmbstowcs (wchar_t *dest, const char *src, size_t len,
 	return count;
 }
 
-int xwaddnstr (WINDOW *win, const char *str, const int n)
+/* Return a malloc()ed string which can be shown by waddstr(): 'str'
+ * converted to the terminal's charset and cut to the maximum of 'n'
+ * columns.  If 'tail' is true, keep the end of the string instead of the
+ * beginning. */
+char *make_screen_str (const char *str, const int n, const bool tail)
 {
-	int res, width, inv_char;
+	int width, inv_char;
 	wchar_t *ucs;
 	char *mstr, *lstr;
 	size_t size, num_chars;
@@ -213,6 +217,17 @@ int xwaddnstr (WINDOW *win, const char *str, const int n)
 	assert (n > 0);
 	assert (str != NULL);
 
+	if (tail) {
+		char *tail_str = xstrtail (str, n);
+
+		if (using_utf8)
+			return tail_str;
+
+		lstr = iconv_str (iconv_desc, tail_str);
+		free (tail_str);
+		return lstr;
+	}
+
 	mstr = iconv_str (iconv_desc, str);
 
 	size = xmbstowcs (NULL, mstr, -1, NULL) + 1;
@@ -244,11 +259,24 @@ int xwaddnstr (WINDOW *win, const char *str, const int n)
 	else
 		snprintf (lstr, num_chars + 1, "%s", mstr);
 
-	res = waddstr (win, lstr);
-
 	free (ucs);
-	free (lstr);
 	free (mstr);
+
+	return lstr;
+}
+
+int xwaddnstr (WINDOW *win, const char *str, const int n)
+{
+	int res;
+	char *lstr;
+
+	assert (n > 0);
+	assert (str != NULL);
+
+	lstr = make_screen_str (str, n, false);
+	res = waddstr (win, lstr);
+	free (lstr);
+
 	return res;
 }
 